@@ -12,7 +12,7 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
 {
   constexpr size_t buffer_size = 1048576;
 
-  EventLoop eventloop {};
+  EventLoop eventloop { EventLoop::Backend::Epoll, EventLoop::Dispatch::AllReady };
   FileDescriptor input { STDIN_FILENO };
   FileDescriptor output { STDOUT_FILENO };
   ByteStream outbound { buffer_size };
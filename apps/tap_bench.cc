@@ -0,0 +1,236 @@
+#include "eventloop.hh"
+#include "helpers.hh"
+#include "tap_port.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+void show_usage( const char* argv0, const char* msg )
+{
+  cout << "Usage: " << argv0 << " [options] <tx tapdev> <rx tapdev>\n\n"
+       << "Writes frames to <tx tapdev> and reads them back from <rx tapdev>, which must be bridged to it,\n"
+       << "with each way of doing TapPort I/O and each EventLoop backend.\n\n"
+       << "   Option                                                          Default\n"
+       << "   --                                                              --\n\n"
+
+       << "   -n <frames>     Send <frames> frames for each combination       200000\n\n"
+
+       << "   -b <burst>      Write frames in batches of <burst>              32\n\n"
+
+       << "   -s <bytes>      Send frames with <bytes> bytes of payload       1500\n"
+       << "                   (an IPv4 datagram; at most the devices' MTU)\n\n"
+
+       << "   -h              Show this message.\n\n"
+
+       << "Example: ./scripts/tap-pair.sh create 10 11 && " << argv0 << " tap10 tap11\n";
+
+  if ( msg != nullptr ) {
+    cout << msg;
+  }
+  cout << "\n";
+}
+
+struct Config
+{
+  string tx_devname {};
+  string rx_devname {};
+  size_t frames = 200000;
+  size_t burst = 32;
+  size_t payload_size = 1500;
+};
+
+void check_argc( const span<char*>& args, size_t curr, size_t needed, const char* err )
+{
+  if ( curr + needed >= args.size() ) {
+    show_usage( args.front(), err );
+    exit( 1 );
+  }
+}
+
+Config get_config( const span<char*>& args )
+{
+  Config config;
+  size_t curr = 1;
+  vector<string> devnames;
+
+  while ( curr < args.size() ) {
+    if ( strncmp( "-n", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, 1, "ERROR: -n requires one argument." );
+      config.frames = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-b", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, 1, "ERROR: -b requires one argument." );
+      config.burst = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-s", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, 1, "ERROR: -s requires one argument." );
+      config.payload_size = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-h", args[curr], 3 ) == 0 ) {
+      show_usage( args[0], nullptr );
+      exit( 0 );
+
+    } else if ( args[curr][0] == '-' ) {
+      show_usage( args[0], string( "ERROR: unrecognized option " + string( args[curr] ) ).c_str() );
+      exit( 1 );
+
+    } else {
+      devnames.emplace_back( args[curr] );
+      curr += 1;
+    }
+  }
+
+  if ( devnames.size() != 2 ) {
+    show_usage( args[0], "ERROR: two TAP devices are required." );
+    exit( 1 );
+  }
+  if ( config.burst == 0 or config.payload_size < IPv4Header::LENGTH or config.payload_size > 9000 ) {
+    show_usage( args[0], "ERROR: the burst must be positive, and the payload from 20 to 9000 bytes." );
+    exit( 1 );
+  }
+
+  config.tx_devname = devnames[0];
+  config.rx_devname = devnames[1];
+  return config;
+}
+
+const char* mode_name( const TapPort::Mode mode )
+{
+  return mode == TapPort::Mode::IoUring ? "io_uring" : "syscalls";
+}
+
+const char* backend_name( const EventLoop::Backend backend )
+{
+  switch ( backend ) {
+    case EventLoop::Backend::Poll:
+      return "poll";
+    case EventLoop::Backend::Epoll:
+      return "epoll";
+    case EventLoop::Backend::IoUring:
+      return "io_uring";
+  }
+  return "?";
+}
+
+void bench( const Config& config, const TapPort::Mode mode, const EventLoop::Backend backend )
+{
+  // A frame for no one on the bridge, which it floods from the tx device to the rx device
+  // (and which the receiving interface drops, after the port has read it)
+  const EthernetAddress tx_address { 0x02, 0, 0, 0, 0, 0x01 };
+  const EthernetAddress rx_address { 0x02, 0, 0, 0, 0, 0x02 };
+  EthernetFrame frame;
+  frame.header.dst = { 0x02, 0, 0, 0, 0, 0x03 };
+  frame.header.src = tx_address;
+  frame.header.type = EthernetHeader::TYPE_IPv4;
+  InternetDatagram dgram; // (a well-formed one: the bridge may drop anything else)
+  dgram.header.len = config.payload_size;
+  dgram.header.ttl = 64;
+  dgram.header.src = Address { "10.0.0.1" }.ipv4_numeric();
+  dgram.header.dst = Address { "10.0.0.3" }.ipv4_numeric();
+  dgram.header.compute_checksum();
+  dgram.payload.emplace_back( string( config.payload_size - IPv4Header::LENGTH, 'x' ) );
+  frame.payload = serialize( dgram );
+  const vector<EthernetFrame> batch( config.burst, frame );
+
+  auto tx_port = make_shared<TapPort>( config.tx_devname, 1, mode );
+  auto rx_port = make_shared<TapPort>( config.rx_devname, 1, mode );
+  NetworkInterface tx_interface { "tx", tx_port, tx_address, Address { "10.0.0.1" } };
+  NetworkInterface rx_interface { "rx", rx_port, rx_address, Address { "10.0.0.2" } };
+
+  EventLoop loop { backend, EventLoop::Dispatch::AllReady };
+  rx_port->add_to( loop, rx_interface );
+
+  // Send until the bridge passes a frame through (it may still be bringing the devices up)
+  const auto give_up = steady_clock::now() + seconds { 5 };
+  while ( rx_port->stats().frames_received == 0 ) {
+    if ( steady_clock::now() > give_up ) {
+      throw runtime_error( "no frames came through from " + config.tx_devname + " to " + config.rx_devname );
+    }
+    tx_port->transmit( tx_interface, frame );
+    loop.wait_next_event( 10 );
+  }
+
+  const auto tx_before = tx_port->stats();
+  const auto rx_before = rx_port->stats();
+  const auto waits_before = loop.stats().waits;
+  const auto start = steady_clock::now();
+
+  size_t sent = 0;
+  while ( sent < config.frames ) {
+    const size_t n = min( config.burst, config.frames - sent );
+    tx_port->transmit_batch( tx_interface, span { batch }.first( n ) );
+    sent += n;
+
+    // read what came through (the bridge forwards a frame before the write that sent it returns)
+    while ( rx_port->stats().frames_received - rx_before.frames_received < sent ) {
+      if ( loop.wait_next_event( 0 ) != EventLoop::Result::Success ) {
+        break;
+      }
+    }
+  }
+
+  const double elapsed = duration_cast<duration<double>>( steady_clock::now() - start ).count();
+  const auto& tx = tx_port->stats();
+  const auto& rx = rx_port->stats();
+  const auto received = rx.frames_received - rx_before.frames_received;
+  const auto frame_bytes = EthernetHeader::LENGTH + config.payload_size;
+
+  cout << "   " << left << setw( 10 ) << mode_name( mode ) << setw( 10 ) << backend_name( loop.backend() ) << right
+       << fixed << setprecision( 3 ) << setw( 9 ) << static_cast<double>( received ) / elapsed / 1e6 << setw( 9 )
+       << static_cast<double>( received * frame_bytes * 8 ) / elapsed / 1e9 << setw( 10 ) << setprecision( 2 )
+       << static_cast<double>( tx.system_calls - tx_before.system_calls ) / static_cast<double>( sent )
+       << setw( 10 )
+       << static_cast<double>( rx.system_calls - rx_before.system_calls + loop.stats().waits - waits_before )
+            / static_cast<double>( max( received, uint64_t { 1 } ) )
+       << setw( 9 ) << sent - received << "\n";
+}
+
+void run( const Config& config )
+{
+  cout << "tap_bench: " << config.frames << " frames of " << EthernetHeader::LENGTH + config.payload_size
+       << " bytes, from " << config.tx_devname << " to " << config.rx_devname << " in batches of " << config.burst
+       << "\n\n";
+  cout << "   I/O       loop       Mfps     Gbit/s  tx calls  rx calls     lost\n"
+       << "                                          /frame    /frame\n";
+
+  for ( const auto mode : { TapPort::Mode::Syscalls, TapPort::Mode::IoUring } ) {
+    for ( const auto backend :
+          { EventLoop::Backend::Poll, EventLoop::Backend::Epoll, EventLoop::Backend::IoUring } ) {
+      bench( config, mode, backend );
+    }
+  }
+
+  cout << "\n(rx calls count the reads or io_uring_enters of the rx port, plus the event loop's waits)\n";
+}
+} // namespace
+
+int main( int argc, char** argv )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+    run( get_config( args ) );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
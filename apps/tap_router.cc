@@ -0,0 +1,260 @@
+#include "eventloop.hh"
+#include "random.hh"
+#include "router.hh"
+#include "tap_port.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+void show_usage( const char* argv0, const char* msg )
+{
+  cout << "Usage: " << argv0 << " [options] -i <tapdev> <address> [-i ...] [-r <prefix>/<len> <iface> <hop> ...]\n\n"
+       << "   Option                                                          Default\n"
+       << "   --                                                              --\n\n"
+
+       << "   -i <tapdev> <address>   Add an interface on TAP device <tapdev>\n"
+       << "                           with IPv4 address <address>\n\n"
+
+       << "   -r <prefix>/<len> <iface> <hop>\n"
+       << "                           Route <prefix>/<len> out interface number\n"
+       << "                           <iface> (in -i order, from 0), via next hop\n"
+       << "                           <hop> (\"direct\" if attached)\n\n"
+
+       << "   -q <queues>     Open each device with <queues> queues           1\n"
+       << "                   (the devices must be multi_queue)\n\n"
+
+       << "   -t <threads>    Forward with <threads> threads                  1\n\n"
+
+       << "   -b <burst>      Forward datagrams in bursts of <burst>          32\n\n"
+
+       << "   -s <seconds>    Print statistics every <seconds> seconds       (never)\n\n"
+
+       << "   -m <io>         Read and write the devices with \"io_uring\"    io_uring\n"
+       << "                   or plain \"syscalls\"\n\n"
+
+       << "   -h              Show this message.\n\n"
+
+       << "Example: with tap0 and tap1 created (as root) by\n\n"
+       << "   ip tuntap add mode tap user `username` name tap0\n\n"
+       << "   " << argv0 << " -i tap0 10.0.0.1 -i tap1 10.1.0.1 \\\n"
+       << "      -r 10.0.0.0/16 0 direct -r 10.1.0.0/16 1 direct\n\n"
+       << "(scripts/tap-netns.sh sets up network namespaces on the other side of the devices.)\n";
+
+  if ( msg != nullptr ) {
+    cout << msg;
+  }
+  cout << "\n";
+}
+
+struct TapInterface
+{
+  string devname;
+  string address;
+};
+
+struct TapRoute
+{
+  uint32_t prefix {};
+  uint8_t prefix_length {};
+  size_t interface_num {};
+  optional<Address> next_hop {};
+};
+
+struct Config
+{
+  vector<TapInterface> interfaces {};
+  vector<TapRoute> routes {};
+  size_t queues = 1;
+  size_t threads = 1;
+  size_t burst = 32;
+  uint64_t stats_interval = 0;
+  TapPort::Mode mode = TapPort::Mode::IoUring;
+};
+
+void check_argc( const span<char*>& args, size_t curr, size_t needed, const char* err )
+{
+  if ( curr + needed >= args.size() ) {
+    show_usage( args.front(), err );
+    exit( 1 );
+  }
+}
+
+TapRoute parse_route( const span<char*>& args, size_t curr )
+{
+  const string prefix = args[curr + 1];
+  const auto slash = prefix.find( '/' );
+  if ( slash == string::npos ) {
+    show_usage( args.front(), "ERROR: route prefix must look like a.b.c.d/len." );
+    exit( 1 );
+  }
+
+  TapRoute route;
+  route.prefix = Address { prefix.substr( 0, slash ) }.ipv4_numeric();
+  route.prefix_length = static_cast<uint8_t>( strtoul( prefix.substr( slash + 1 ).c_str(), nullptr, 0 ) );
+  route.interface_num = strtoul( args[curr + 2], nullptr, 0 );
+  if ( strcmp( args[curr + 3], "direct" ) != 0 ) {
+    route.next_hop = Address { args[curr + 3] };
+  }
+  return route;
+}
+
+Config get_config( const span<char*>& args )
+{
+  Config config;
+  size_t curr = 1;
+
+  while ( curr < args.size() ) {
+    if ( strncmp( "-i", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, 2, "ERROR: -i requires two arguments." );
+      config.interfaces.push_back( { args[curr + 1], args[curr + 2] } );
+      curr += 3;
+
+    } else if ( strncmp( "-r", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, 3, "ERROR: -r requires three arguments." );
+      config.routes.push_back( parse_route( args, curr ) );
+      curr += 4;
+
+    } else if ( strncmp( "-q", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, 1, "ERROR: -q requires one argument." );
+      config.queues = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-t", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, 1, "ERROR: -t requires one argument." );
+      config.threads = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-b", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, 1, "ERROR: -b requires one argument." );
+      config.burst = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-s", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, 1, "ERROR: -s requires one argument." );
+      config.stats_interval = strtoull( args[curr + 1], nullptr, 0 ) * 1000;
+      curr += 2;
+
+    } else if ( strncmp( "-m", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, 1, "ERROR: -m requires one argument." );
+      if ( strcmp( args[curr + 1], "io_uring" ) == 0 ) {
+        config.mode = TapPort::Mode::IoUring;
+      } else if ( strcmp( args[curr + 1], "syscalls" ) == 0 ) {
+        config.mode = TapPort::Mode::Syscalls;
+      } else {
+        show_usage( args[0], "ERROR: -m takes \"io_uring\" or \"syscalls\"." );
+        exit( 1 );
+      }
+      curr += 2;
+
+    } else if ( strncmp( "-h", args[curr], 3 ) == 0 ) {
+      show_usage( args[0], nullptr );
+      exit( 0 );
+
+    } else {
+      show_usage( args[0], string( "ERROR: unrecognized option " + string( args[curr] ) ).c_str() );
+      exit( 1 );
+    }
+  }
+
+  if ( config.interfaces.empty() ) {
+    show_usage( args[0], "ERROR: at least one interface is required." );
+    exit( 1 );
+  }
+
+  return config;
+}
+
+// A locally administered unicast Ethernet address
+EthernetAddress random_ethernet_address()
+{
+  auto rng = get_random_engine();
+  EthernetAddress addr;
+  for ( auto& byte : addr ) {
+    byte = static_cast<uint8_t>( rng() );
+  }
+  addr.at( 0 ) = ( addr.at( 0 ) | 0x02 ) & 0xfe; // NOLINT(*-signed-bitwise)
+  return addr;
+}
+
+void print_stats( Router& router, const vector<shared_ptr<TapPort>>& ports )
+{
+  for ( size_t i = 0; i < ports.size(); ++i ) {
+    const auto& stats = ports[i]->stats();
+    const auto& drops = router.interface( i )->drop_stats();
+    cerr << "DEBUG: " << router.interface( i )->name() << ": " << stats.frames_received << " frames in ("
+         << stats.receive_calls << " bursts), " << stats.frames_sent << " out, " << stats.send_errors
+         << " send errors, " << drops.tail_drops + drops.red_drops + drops.pending_drops << " drops, "
+         << stats.system_calls << " system calls\n";
+  }
+}
+
+void run( const Config& config )
+{
+  Router router;
+  router.set_burst_size( config.burst );
+  router.set_forwarding_threads( config.threads );
+
+  vector<shared_ptr<TapPort>> ports;
+  EventLoop loop { EventLoop::Backend::Epoll, EventLoop::Dispatch::AllReady };
+  for ( const auto& [devname, address] : config.interfaces ) {
+    ports.push_back( make_shared<TapPort>( devname, config.queues, config.mode ) );
+    auto interface
+      = make_shared<NetworkInterface>( devname, ports.back(), random_ethernet_address(), Address { address } );
+    router.add_interface( interface );
+    ports.back()->add_to( loop, *interface );
+  }
+
+  for ( const auto& route : config.routes ) {
+    router.add_route( route.prefix, route.prefix_length, route.next_hop, route.interface_num );
+  }
+
+  auto last_tick = steady_clock::now();
+  uint64_t ms_since_stats = 0;
+  while ( loop.wait_next_event( 10 ) != EventLoop::Result::Exit ) {
+    router.route();
+
+    const auto now = steady_clock::now();
+    const auto ms = static_cast<uint64_t>( duration_cast<milliseconds>( now - last_tick ).count() );
+    if ( ms > 0 ) {
+      last_tick += milliseconds { ms };
+      router.tick( ms );
+      for ( size_t i = 0; i < ports.size(); ++i ) {
+        router.interface( i )->tick( ms );
+      }
+
+      ms_since_stats += ms;
+      if ( config.stats_interval and ms_since_stats >= config.stats_interval ) {
+        print_stats( router, ports );
+        ms_since_stats = 0;
+      }
+    }
+  }
+}
+} // namespace
+
+int main( int argc, char** argv )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+    run( get_config( args ) );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,287 @@
+#include "loopback_adapter.hh"
+#include "network_emulator.hh"
+#include "tcp_config.hh"
+#include "tcp_minnow_socket.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+void show_usage( const char* argv0, const char* msg )
+{
+  cout << "Usage: " << argv0 << " [options]\n\n"
+       << "Connects two TCPMinnowSockets in this process through a TCPOverIPv4LoopbackAdapter (no TUN device),\n"
+       << "measures round trips of one byte, and then sends bytes one way as fast as they go.\n\n"
+       << "   Option                                                          Default\n"
+       << "   --                                                              --\n\n"
+
+       << "   -m <mode>       Carry the datagrams through in-memory queues    queues\n"
+       << "                   (queues) or a kernel socket pair (socketpair)\n\n"
+
+       << "   -r <trips>      Time <trips> round trips                        1000\n\n"
+
+       << "   -n <bytes>      Then send <bytes> bytes                         10000000\n\n"
+
+       << "   -w <winsz>      Use a window of <winsz> bytes                   " << TCPConfig::DEFAULT_CAPACITY
+       << "\n\n"
+
+       << "   -t <tmout>      Set rt_timeout to tmout                         100\n\n"
+
+       << "   Each way, send the datagrams over an emulated path with:\n\n"
+
+       << "   -d <ms>         a one-way delay of <ms> milliseconds            0\n\n"
+
+       << "   -j <ms>         up to <ms> milliseconds of jitter               0\n\n"
+
+       << "   -b <Mbit/s>     a bottleneck of <Mbit/s>                        none\n\n"
+
+       << "   -q <bytes>      a queue of <bytes> bytes at the bottleneck      65536\n\n"
+
+       << "   -o <prob>       reordering with probability <prob>              0\n\n"
+
+       << "   -u <prob>       duplication with probability <prob>             0\n\n"
+
+       << "   -l <prob>       loss with probability <prob>                    0\n\n"
+
+       << "   -g <p>,<r>      bursts of loss: go bad with probability <p>,    none\n"
+       << "                   and good again with probability <r>\n\n"
+
+       << "   -S <seed>       seeded with <seed> (and <seed> + 1)             0\n\n"
+
+       << "   -h              Show this message.\n\n";
+
+  if ( msg != nullptr ) {
+    cout << msg;
+  }
+  cout << "\n";
+}
+
+struct Config
+{
+  TCPOverIPv4LoopbackAdapter::Mode mode = TCPOverIPv4LoopbackAdapter::Mode::Notified;
+  size_t round_trips = 1000;
+  size_t bytes = 10000000;
+  TCPConfig tcp { .rt_timeout = 100 };
+  NetworkEmulatorConfig path {};
+};
+
+void check_argc( const span<char*>& args, size_t curr, const char* err )
+{
+  if ( curr + 1 >= args.size() ) {
+    show_usage( args.front(), err );
+    exit( 1 );
+  }
+}
+
+Config get_config( const span<char*>& args )
+{
+  Config config;
+  size_t curr = 1;
+
+  while ( curr < args.size() ) {
+    if ( strncmp( "-m", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -m requires one argument." );
+      if ( strcmp( "queues", args[curr + 1] ) == 0 ) {
+        config.mode = TCPOverIPv4LoopbackAdapter::Mode::Notified;
+      } else if ( strcmp( "socketpair", args[curr + 1] ) == 0 ) {
+        config.mode = TCPOverIPv4LoopbackAdapter::Mode::SocketPair;
+      } else {
+        show_usage( args[0], "ERROR: the mode must be queues or socketpair." );
+        exit( 1 );
+      }
+      curr += 2;
+
+    } else if ( strncmp( "-r", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -r requires one argument." );
+      config.round_trips = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-n", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -n requires one argument." );
+      config.bytes = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-w", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -w requires one argument." );
+      config.tcp.recv_capacity = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-t", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -t requires one argument." );
+      config.tcp.rt_timeout = strtol( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-d", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -d requires one argument." );
+      config.path.delay_ms = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-j", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -j requires one argument." );
+      config.path.jitter_ms = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-b", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -b requires one argument." );
+      config.path.rate_bps = static_cast<uint64_t>( strtod( args[curr + 1], nullptr ) * 1e6 );
+      curr += 2;
+
+    } else if ( strncmp( "-q", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -q requires one argument." );
+      config.path.queue_bytes = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-o", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -o requires one argument." );
+      config.path.reorder = strtod( args[curr + 1], nullptr );
+      curr += 2;
+
+    } else if ( strncmp( "-u", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -u requires one argument." );
+      config.path.duplicate = strtod( args[curr + 1], nullptr );
+      curr += 2;
+
+    } else if ( strncmp( "-l", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -l requires one argument." );
+      config.path.loss_good = strtod( args[curr + 1], nullptr );
+      curr += 2;
+
+    } else if ( strncmp( "-g", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -g requires one argument." );
+      char* rest = nullptr;
+      config.path.good_to_bad = strtod( args[curr + 1], &rest );
+      if ( *rest != ',' ) {
+        show_usage( args[0], "ERROR: -g requires two probabilities, separated by a comma." );
+        exit( 1 );
+      }
+      config.path.bad_to_good = strtod( rest + 1, nullptr );
+      curr += 2;
+
+    } else if ( strncmp( "-S", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -S requires one argument." );
+      config.path.seed = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-h", args[curr], 3 ) == 0 ) {
+      show_usage( args[0], nullptr );
+      exit( 0 );
+
+    } else {
+      show_usage( args[0], string( "ERROR: unrecognized option " + string( args[curr] ) ).c_str() );
+      exit( 1 );
+    }
+  }
+
+  return config;
+}
+
+// Read (blocking) until `socket` has given `count` bytes, or reached EOF
+void read_exactly( LocalStreamSocket& socket, size_t count )
+{
+  string buffer;
+  while ( count > 0 and not socket.eof() ) {
+    buffer.resize( min( count, size_t { 65536 } ) );
+    socket.read( buffer );
+    count -= buffer.size();
+  }
+}
+
+// The server's side: echo each of the round trips' bytes, then take in the rest until EOF
+void serve( EmulatedLoopbackTCPMinnowSocket& server, const Config& config )
+{
+  for ( size_t i = 0; i < config.round_trips; ++i ) {
+    read_exactly( server, 1 );
+    server.write( "x" );
+  }
+
+  string buffer;
+  while ( not server.eof() ) {
+    buffer.clear();
+    server.read( buffer );
+  }
+  server.shutdown( SHUT_WR );
+}
+
+void run( const Config& config )
+{
+  auto [client_adapter, server_adapter] = TCPOverIPv4LoopbackAdapter::make_pair( config.mode );
+  NetworkEmulatorConfig server_path = config.path;
+  ++server_path.seed;
+  EmulatedLoopbackTCPMinnowSocket server { { std::move( server_adapter ), server_path } };
+  EmulatedLoopbackTCPMinnowSocket client { { std::move( client_adapter ), config.path } };
+
+  FdAdapterConfig server_address;
+  server_address.source = { "10.0.0.2", "5000" };
+  FdAdapterConfig client_address;
+  client_address.source = { "10.0.0.1", "40000" };
+  client_address.destination = server_address.source;
+
+  thread server_thread { [&] {
+    server.listen_and_accept( config.tcp, server_address );
+    serve( server, config );
+  } };
+  client.connect( config.tcp, client_address );
+
+  // round trips of one byte
+  vector<double> rtts;
+  for ( size_t i = 0; i < config.round_trips; ++i ) {
+    const auto start = steady_clock::now();
+    client.write( "x" );
+    read_exactly( client, 1 );
+    rtts.push_back( duration<double, micro>( steady_clock::now() - start ).count() );
+  }
+  ranges::sort( rtts );
+  const auto percentile = [&rtts]( const double p ) {
+    return rtts.empty() ? 0 : rtts[min( rtts.size() - 1, static_cast<size_t>( p * rtts.size() ) )];
+  };
+
+  // bytes one way, until the server has taken them all in and ended its stream
+  const string chunk( 65536, 'x' );
+  const auto start = steady_clock::now();
+  for ( size_t sent = 0; sent < config.bytes; ) {
+    const string_view piece = string_view { chunk }.substr( 0, config.bytes - sent );
+    client.write_all( piece );
+    sent += piece.size();
+  }
+  client.shutdown( SHUT_WR );
+  read_exactly( client, SIZE_MAX );
+  const double elapsed = duration<double>( steady_clock::now() - start ).count();
+
+  cout << fixed << setprecision( 1 ) << "round trips (us):  p50 " << percentile( 0.5 ) << "   p90 "
+       << percentile( 0.9 ) << "   p99 " << percentile( 0.99 ) << "   max " << percentile( 1 ) << "\n"
+       << setprecision( 3 ) << "throughput:        " << static_cast<double>( config.bytes * 8 ) / elapsed / 1e9
+       << " Gbit/s (" << config.bytes << " bytes in " << elapsed << " s)\n";
+
+  server_thread.join();
+  client.wait_until_closed();
+  server.wait_until_closed();
+}
+} // namespace
+
+int main( int argc, char** argv )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+    run( get_config( args ) );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
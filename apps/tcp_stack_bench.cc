@@ -0,0 +1,424 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "helpers.hh"
+#include "random.hh"
+#include "tcp_stack.hh"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+void show_usage( const char* argv0, const char* msg )
+{
+  cout << "Usage: " << argv0 << " [options]\n\n"
+       << "Connects two TCPStacks, in this process, through a socket pair that carries their datagrams, and\n"
+       << "measures how many connections a second they open and close, and how fast they carry bytes, with\n"
+       << "1, 2, 4, ... shards each.\n\n"
+       << "   Option                                                          Default\n"
+       << "   --                                                              --\n\n"
+
+       << "   -s <shards>     Try up to <shards> shards per stack             " << thread::hardware_concurrency()
+       << "\n\n"
+
+       << "   -c <conns>      Open and close <conns> connections              5000\n\n"
+
+       << "   -p <parallel>   ... with <parallel> of them at a time           64\n\n"
+
+       << "   -f <flows>      Send over <flows> connections at once           16\n\n"
+
+       << "   -n <bytes>      ... <bytes> bytes over each                     4000000\n\n"
+
+       << "   -t <tmout>      Set rt_timeout to tmout                         100\n\n"
+
+       << "   -y <rate>       Also open and close the connections during a    0\n"
+       << "                   flood of <rate> SYNs a second, from spoofed\n"
+       << "                   addresses\n\n"
+
+       << "   -h              Show this message.\n\n";
+
+  if ( msg != nullptr ) {
+    cout << msg;
+  }
+  cout << "\n";
+}
+
+struct Config
+{
+  size_t max_shards = max( thread::hardware_concurrency(), 1U );
+  size_t connections = 5000;
+  size_t parallel = 64;
+  size_t flows = 16;
+  size_t flow_bytes = 4000000;
+  TCPConfig tcp { .rt_timeout = 100 };
+  size_t syn_flood = 0;
+};
+
+void check_argc( const span<char*>& args, size_t curr, const char* err )
+{
+  if ( curr + 1 >= args.size() ) {
+    show_usage( args.front(), err );
+    exit( 1 );
+  }
+}
+
+Config get_config( const span<char*>& args )
+{
+  Config config;
+  size_t curr = 1;
+
+  while ( curr < args.size() ) {
+    if ( strncmp( "-s", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -s requires one argument." );
+      config.max_shards = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-c", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -c requires one argument." );
+      config.connections = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-p", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -p requires one argument." );
+      config.parallel = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-f", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -f requires one argument." );
+      config.flows = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-n", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -n requires one argument." );
+      config.flow_bytes = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-t", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -t requires one argument." );
+      config.tcp.rt_timeout = strtol( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-y", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -y requires one argument." );
+      config.syn_flood = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-h", args[curr], 3 ) == 0 ) {
+      show_usage( args[0], nullptr );
+      exit( 0 );
+
+    } else {
+      show_usage( args[0], string( "ERROR: unrecognized option " + string( args[curr] ) ).c_str() );
+      exit( 1 );
+    }
+  }
+
+  if ( config.max_shards == 0 or config.parallel == 0 or config.flows == 0 ) {
+    show_usage( args[0], "ERROR: the shards, parallel connections and flows must be positive." );
+    exit( 1 );
+  }
+  return config;
+}
+
+const Address CLIENT_ADDRESS { "10.0.0.1" };
+const Address SERVER_ADDRESS { "10.0.0.2" };
+constexpr uint16_t FIRST_SERVER_PORT = 5000;
+
+// A server thread: accepts connections to its port, reads (and discards) all they send, and, at the end of
+// each one's stream, ends its own
+class Server
+{
+public:
+  Server( TCPStack& stack, const uint16_t port )
+    : listener_( stack.listen( Address { SERVER_ADDRESS.ip(), port }, 1024 ) ), thread_( [this] { serve(); } )
+  {}
+
+  ~Server()
+  {
+    stopping_ = true;
+    thread_.join();
+    listener_->close();
+  }
+
+  uint64_t bytes_received() const { return bytes_received_.load(); }
+
+  Server( const Server& ) = delete;
+  Server& operator=( const Server& ) = delete;
+
+private:
+  struct Connection
+  {
+    explicit Connection( LocalStreamSocket&& s ) : socket( std::move( s ) ) { socket.set_blocking( false ); }
+
+    LocalStreamSocket socket;
+    vector<EventLoop::RuleHandle> rules {};
+    bool done {};
+
+    void finish()
+    {
+      for ( auto& rule : rules ) {
+        rule.cancel();
+      }
+      done = true;
+    }
+  };
+
+  shared_ptr<TCPStack::Listener> listener_;
+  atomic<bool> stopping_ {};
+  atomic<uint64_t> bytes_received_ {};
+  thread thread_;
+
+  void serve()
+  {
+    EventLoop loop {
+      EventLoop::Backend::Epoll, EventLoop::Dispatch::AllReady, EventLoop::InterestCheck::WhenChanged };
+    const auto category = loop.add_category( "read from connection" );
+    vector<unique_ptr<Connection>> connections;
+    string buffer;
+
+    loop.add_rule( "accept", listener_->fd(), Direction::In, [&] {
+      auto& conn = *connections.emplace_back( make_unique<Connection>( listener_->accept().socket ) );
+      conn.rules.push_back( loop.add_rule(
+        category,
+        conn.socket,
+        Direction::In,
+        [this, &conn, &buffer] {
+          buffer.clear();
+          conn.socket.read( buffer );
+          bytes_received_ += buffer.size();
+          if ( conn.socket.eof() ) {
+            conn.socket.shutdown( SHUT_WR );
+            conn.finish();
+          }
+        },
+        [] { return true; },
+        [] {},
+        [&conn] { conn.finish(); } ) );
+    } );
+
+    while ( not stopping_ ) {
+      loop.wait_next_event( 100 );
+      erase_if( connections, []( const auto& conn ) { return conn->done; } );
+    }
+  }
+};
+
+// A thread that writes SYNs to the servers' ports, from random (spoofed) addresses outside the network, each
+// millisecond, until destroyed
+class SynFlood
+{
+public:
+  SynFlood( FileDescriptor&& datagrams, const size_t per_second, const size_t servers )
+    : datagrams_( std::move( datagrams ) )
+    , per_ms_( max<size_t>( per_second / 1000, 1 ) )
+    , servers_( servers )
+    , thread_( [this] { flood(); } )
+  {}
+
+  ~SynFlood()
+  {
+    stopping_ = true;
+    thread_.join();
+  }
+
+  SynFlood( const SynFlood& ) = delete;
+  SynFlood& operator=( const SynFlood& ) = delete;
+
+private:
+  FileDescriptor datagrams_;
+  size_t per_ms_;
+  size_t servers_;
+  atomic<bool> stopping_ {};
+  thread thread_;
+
+  void flood()
+  {
+    auto random = get_random_engine();
+    TCPOverIPv4Adapter adapter;
+    datagrams_.set_blocking( false );
+
+    for ( auto next = steady_clock::now(); not stopping_; this_thread::sleep_until( next ) ) {
+      next += milliseconds { 1 };
+      for ( size_t i = 0; i < per_ms_; ++i ) {
+        const uint32_t source = 0x0B000000U | ( random() & 0xFFFFFFU ); // (11.0.0.0/8)
+        adapter.config_mut().source
+          = Address { Address::from_ipv4_numeric( source ).ip(), static_cast<uint16_t>( random() ) };
+        adapter.config_mut().destination
+          = Address { SERVER_ADDRESS.ip(), static_cast<uint16_t>( FIRST_SERVER_PORT + random() % servers_ ) };
+
+        const TCPMessage syn { .sender = TCPSenderMessage { .seqno = Wrap32 { static_cast<uint32_t>( random() ) },
+                                                            .SYN = true },
+                               .receiver = TCPReceiverMessage { .window_size = UINT16_MAX } };
+        try {
+          datagrams_.write( serialize( adapter.wrap_tcp_in_ip( syn ) ) );
+        } catch ( const runtime_error& ) { // (drop what the socket won't take)
+        }
+      }
+    }
+  }
+};
+
+// Read from a socket (blocking) until it reaches EOF
+void wait_for_eof( LocalStreamSocket& socket )
+{
+  string buffer;
+  while ( not socket.eof() ) {
+    buffer.clear();
+    socket.read( buffer );
+  }
+}
+
+LocalStreamSocket connect_to_server( TCPStack& stack, const size_t server )
+{
+  const Address server_address { SERVER_ADDRESS.ip(), static_cast<uint16_t>( FIRST_SERVER_PORT + server ) };
+  return stack.connect( CLIENT_ADDRESS, server_address );
+}
+
+// Open and close `config.connections` connections, from `config.parallel` threads that each open one, end
+// its stream and wait for the server to end its own, and then the next. Returns connections per second.
+double connection_rate( const Config& config, TCPStack& client, const size_t servers )
+{
+  atomic<size_t> next {};
+  const auto start = steady_clock::now();
+
+  vector<thread> threads;
+  for ( size_t i = 0; i < config.parallel; ++i ) {
+    threads.emplace_back( [&] {
+      for ( size_t n = next++; n < config.connections; n = next++ ) {
+        auto socket = connect_to_server( client, n % servers );
+        socket.shutdown( SHUT_WR );
+        wait_for_eof( socket );
+      }
+    } );
+  }
+  for ( auto& t : threads ) {
+    t.join();
+  }
+
+  return static_cast<double>( config.connections ) / duration<double>( steady_clock::now() - start ).count();
+}
+
+// Send `config.flow_bytes` over each of `config.flows` connections at once. Returns Gbit/s (of payload).
+double throughput( const Config& config, TCPStack& client, const size_t servers )
+{
+  const string chunk( 65536, 'x' );
+  const auto start = steady_clock::now();
+
+  vector<thread> threads;
+  for ( size_t i = 0; i < config.flows; ++i ) {
+    threads.emplace_back( [&, i] {
+      auto socket = connect_to_server( client, i % servers );
+      for ( size_t sent = 0; sent < config.flow_bytes; ) {
+        const string_view piece = string_view { chunk }.substr( 0, config.flow_bytes - sent );
+        socket.write_all( piece );
+        sent += piece.size();
+      }
+      socket.shutdown( SHUT_WR );
+      wait_for_eof( socket );
+    } );
+  }
+  for ( auto& t : threads ) {
+    t.join();
+  }
+
+  const double elapsed = duration<double>( steady_clock::now() - start ).count();
+  return static_cast<double>( config.flows * config.flow_bytes * 8 ) / elapsed / 1e9;
+}
+
+void bench( const Config& config, const size_t shards )
+{
+  // (a connected pair of sockets is limited only by its send buffer, however many datagrams it holds)
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds.data() ) );
+  FileDescriptor client_end { fds[0] };
+  FileDescriptor server_end { fds[1] };
+  FileDescriptor flood_end { CheckSystemCall( "dup", ::dup( fds[0] ) ) }; // (SYNs to the server, from outside)
+  for ( auto* fd : { &client_end, &server_end } ) {
+    const int bytes = 16 << 20;
+    CheckSystemCall( "setsockopt",
+                     ::setsockopt( fd->fd_num(), SOL_SOCKET, SO_SNDBUF, &bytes, sizeof( bytes ) ) ); // NOLINT
+  }
+
+  TCPStack client { std::move( client_end ), config.tcp, shards };
+  TCPStack server { std::move( server_end ), config.tcp, shards };
+
+  // one server thread per shard, each listening on its own port
+  vector<unique_ptr<Server>> servers;
+  for ( size_t i = 0; i < shards; ++i ) {
+    servers.push_back( make_unique<Server>( server, FIRST_SERVER_PORT + i ) );
+  }
+
+  const double rate = connection_rate( config, client, shards );
+  const double gbps = throughput( config, client, shards );
+  double flooded_rate = 0;
+  if ( config.syn_flood > 0 ) {
+    const SynFlood flood { std::move( flood_end ), config.syn_flood, shards };
+    flooded_rate = connection_rate( config, client, shards );
+  }
+
+  uint64_t received = 0;
+  for ( const auto& s : servers ) {
+    received += s->bytes_received();
+  }
+
+  const auto client_stats = client.stats();
+  const auto server_stats = server.stats();
+  cout << setw( 9 ) << shards << fixed << setprecision( 0 ) << setw( 12 ) << rate << setw( 10 ) << flooded_rate
+       << setprecision( 3 ) << setw( 10 ) << gbps << setw( 12 )
+       << client_stats.segments_sent + server_stats.segments_sent << setw( 10 )
+       << client_stats.send_errors + server_stats.send_errors << setw( 10 )
+       << client_stats.ring_drops + server_stats.ring_drops << setw( 10 ) << server_stats.syn_cookies_sent
+       << setw( 10 ) << server_stats.syn_cookies_accepted
+       << ( received == config.flows * config.flow_bytes ? "" : "   (bytes lost!)" ) << "\n";
+}
+
+void run( const Config& config )
+{
+  cout << "Opening and closing " << config.connections << " connections (" << config.parallel
+       << " at a time), then sending " << config.flow_bytes << " bytes over each of " << config.flows
+       << " connections at once, on " << thread::hardware_concurrency() << " cores";
+  if ( config.syn_flood > 0 ) {
+    cout << "; then opening and closing them again during a flood of " << config.syn_flood << " SYNs a second";
+  }
+  cout << ":\n\n"
+       << "   shards      conn/s   flooded    Gbit/s    segments  send err ring drop   cookies  accepted\n";
+
+  for ( size_t shards = 1; shards <= config.max_shards; shards *= 2 ) {
+    bench( config, shards );
+    if ( shards < config.max_shards and shards * 2 > config.max_shards ) {
+      bench( config, config.max_shards );
+    }
+  }
+}
+} // namespace
+
+int main( int argc, char** argv )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+    run( get_config( args ) );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
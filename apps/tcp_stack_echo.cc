@@ -0,0 +1,222 @@
+#include "eventloop.hh"
+#include "tcp_stack.hh"
+#include "tun.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+void show_usage( const char* argv0, const char* msg )
+{
+  cout << "Usage: " << argv0 << " [options] <port>\n\n"
+       << "Serves an echo service on <port>, for any number of connections at once, from one TCPStack.\n\n"
+       << "   Option                                                          Default\n"
+       << "   --                                                              --\n\n"
+
+       << "   -d <tundev>     Use tun <tundev>                                tun144\n\n"
+
+       << "   -b <backlog>    Allow <backlog> connections waiting for accept  " << TCPStack::DEFAULT_BACKLOG
+       << "\n\n"
+
+       << "   -q <backlog>    Allow <backlog> connections in their handshakes " << TCPStack::DEFAULT_SYN_BACKLOG
+       << "\n"
+       << "                   (then answer SYNs with SYN cookies)\n\n"
+
+       << "   -t <tmout>      Set rt_timeout to tmout                         " << TCPConfig::TIMEOUT_DFLT << "\n\n"
+
+       << "   -s <shards>     Serve connections from <shards> threads         1\n\n"
+
+       << "   -h              Show this message.\n\n"
+
+       << "Example: " << argv0 << " 7 (then connect to 169.254.144.9 port 7, through tun144)\n";
+
+  if ( msg != nullptr ) {
+    cout << msg;
+  }
+  cout << "\n";
+}
+
+struct Config
+{
+  string tundev = "tun144";
+  size_t backlog = TCPStack::DEFAULT_BACKLOG;
+  size_t syn_backlog = TCPStack::DEFAULT_SYN_BACKLOG;
+  TCPConfig tcp {};
+  size_t shards = 1;
+  uint16_t port {};
+};
+
+void check_argc( const span<char*>& args, size_t curr, const char* err )
+{
+  if ( curr + 1 >= args.size() ) {
+    show_usage( args.front(), err );
+    exit( 1 );
+  }
+}
+
+Config get_config( const span<char*>& args )
+{
+  Config config;
+  size_t curr = 1;
+
+  while ( curr + 1 < args.size() ) {
+    if ( strncmp( "-d", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -d requires one argument." );
+      config.tundev = args[curr + 1];
+      curr += 2;
+
+    } else if ( strncmp( "-b", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -b requires one argument." );
+      config.backlog = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-q", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -q requires one argument." );
+      config.syn_backlog = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-t", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -t requires one argument." );
+      config.tcp.rt_timeout = strtol( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-s", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -s requires one argument." );
+      config.shards = strtoul( args[curr + 1], nullptr, 0 );
+      curr += 2;
+
+    } else if ( strncmp( "-h", args[curr], 3 ) == 0 ) {
+      show_usage( args[0], nullptr );
+      exit( 0 );
+
+    } else {
+      show_usage( args[0], string( "ERROR: unrecognized option " + string( args[curr] ) ).c_str() );
+      exit( 1 );
+    }
+  }
+
+  if ( curr + 1 != args.size() or strtoul( args[curr], nullptr, 0 ) == 0 ) {
+    show_usage( args[0], "ERROR: a (nonzero) port is required." );
+    exit( 1 );
+  }
+  config.port = strtoul( args[curr], nullptr, 0 );
+  return config;
+}
+
+// One accepted connection: what it sent that hasn't been echoed back yet
+struct EchoConnection
+{
+  explicit EchoConnection( LocalStreamSocket&& s ) : socket( std::move( s ) ) { socket.set_blocking( false ); }
+
+  LocalStreamSocket socket;
+  string buffer {};
+  vector<EventLoop::RuleHandle> rules {};
+  bool done {};
+};
+
+void run( const Config& config )
+{
+  TCPStack stack { TunFD { config.tundev }, config.tcp, config.shards };
+  auto listener = stack.listen( Address { "0", config.port }, config.backlog, config.syn_backlog );
+
+  EventLoop loop { // (a connection's two rules mark each other as its buffer fills and drains)
+    EventLoop::Backend::Epoll, EventLoop::Dispatch::AllReady, EventLoop::InterestCheck::WhenChanged };
+  unordered_map<uint64_t, unique_ptr<EchoConnection>> connections;
+  vector<uint64_t> finished;
+  uint64_t next_id = 0;
+  uint64_t bytes_echoed = 0;
+
+  const auto echo_in = loop.add_category( "read from connection" );
+  const auto echo_out = loop.add_category( "echo to connection" );
+
+  loop.add_rule( "accept", listener->fd(), Direction::In, [&] {
+    const uint64_t id = next_id++;
+    auto& conn = *connections.emplace( id, make_unique<EchoConnection>( listener->accept().socket ) ).first->second;
+    const auto finish = [&conn, &finished, id] {
+      if ( not conn.done ) {
+        conn.done = true;
+        for ( auto& rule : conn.rules ) {
+          rule.cancel();
+        }
+        finished.push_back( id );
+      }
+    };
+
+    conn.rules.push_back( loop.add_rule(
+      echo_in,
+      conn.socket,
+      Direction::In,
+      [&conn] {
+        conn.socket.read( conn.buffer );
+        conn.rules.back().interest_changed(); // (there may be something to echo now)
+      },
+      [&conn] { return conn.buffer.empty(); },
+      [&conn, finish] {
+        conn.socket.shutdown( SHUT_WR ); // (once all was echoed, pass the end of stream on)
+        finish();
+      } ) );
+
+    conn.rules.push_back( loop.add_rule(
+      echo_out,
+      conn.socket,
+      Direction::Out,
+      [&conn, &bytes_echoed] {
+        const size_t written = conn.socket.write( conn.buffer );
+        conn.buffer.erase( 0, written );
+        bytes_echoed += written;
+        conn.rules.front().interest_changed(); // (and once it has all gone, something to read)
+      },
+      [&conn] { return not conn.buffer.empty(); },
+      [] {},
+      finish ) );
+  } );
+
+  // report once a second
+  function<void()> report;
+  report = [&] {
+    const auto stats = stack.stats();
+    cerr << "connections: " << stack.connection_count() << " open, " << stats.connections_opened << " opened, "
+         << stats.connections_closed << " closed; segments: " << stats.segments_received << " received, "
+         << stats.segments_sent << " sent, " << stats.segments_unmatched << " unmatched, " << stats.ring_drops
+         << " dropped; SYN cookies: " << stats.syn_cookies_sent << " sent, " << stats.syn_cookies_accepted
+         << " accepted; bytes echoed: " << bytes_echoed << "\n";
+    loop.add_timer( steady_clock::now() + seconds { 1 }, report );
+  };
+  loop.add_timer( steady_clock::now() + seconds { 1 }, report );
+
+  cerr << "tcp_stack_echo: serving port " << config.port << " on " << config.tundev << "\n";
+  while ( loop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {
+    for ( const auto id : finished ) {
+      connections.erase( id );
+    }
+    finished.clear();
+  }
+}
+} // namespace
+
+int main( int argc, char** argv )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+    run( get_config( args ) );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -58,6 +58,12 @@ ttest(net_interface)
 
 ttest(router)
 
+ttest(buffer)
+ttest(network_emulator)
+ttest(loopback_adapter)
+ttest(eventloop)
+ttest(tcp_stack)
+
 ttest(no_skip)
 
 add_custom_target (check0 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --stop-on-failure --timeout 15 -R 'webget|^byte_stream_|^no_skip')
@@ -94,3 +100,6 @@ set_tests_properties(${compile_name_opt} PROPERTIES FIXTURES_SETUP compile_opt)
 
 stest(byte_stream_speed_test)
 stest(reassembler_speed_test)
+stest(net_interface_speed_test)
+stest(router_speed_test)
+stest(tcp_peer_speed_test)
@@ -0,0 +1,68 @@
+#!/bin/bash
+
+# Sets up TAP devices for apps/tap_router, each leading to a host in its own network namespace:
+#
+#   host in netns mnN (10.N.0.2/16) <--> tapN <--> tap_router (10.N.0.1 on interface N)
+#
+# Run "create" before starting the router (which opens the devices), and "attach" after (which moves
+# each device into its namespace, where the router keeps using it). Then, for example:
+#
+#   ./build/apps/tap_router -i tap0 10.0.0.1 -i tap1 10.1.0.1 \
+#       -r 10.0.0.0/16 0 direct -r 10.1.0.0/16 1 direct
+#   ip netns exec mn1 iperf3 -s
+#   ip netns exec mn0 iperf3 -c 10.1.0.2
+
+show_usage () {
+    echo "Usage: $0 <create | attach | destroy> [-q queues] [tapnum ...]"
+    exit 1
+}
+
+create_tap () {
+    local N="$1" TAPDEV="tap$1"
+    ip tuntap add mode tap user "${SUDO_USER}" name "${TAPDEV}" ${MULTI_QUEUE}
+    ip netns add "mn${N}"
+}
+
+attach_tap () {
+    local N="$1" TAPDEV="tap$1" NS="mn$1"
+    ip link set "${TAPDEV}" netns "${NS}"
+    ip -n "${NS}" link set lo up
+    ip -n "${NS}" addr add "10.${N}.0.2/16" dev "${TAPDEV}"
+    ip -n "${NS}" link set "${TAPDEV}" up
+    ip -n "${NS}" route add default via "10.${N}.0.1"
+}
+
+destroy_tap () {
+    local N="$1"
+    ip netns del "mn${N}" 2>/dev/null # (takes an attached device with it)
+    ip tuntap del mode tap name "tap${N}" ${MULTI_QUEUE} 2>/dev/null
+}
+
+# check arguments
+if [ -z "$1" ] || ([ "$1" != "create" ] && [ "$1" != "attach" ] && [ "$1" != "destroy" ]); then
+    show_usage
+fi
+MODE=$1; shift
+
+MULTI_QUEUE=""
+if [ "$1" = "-q" ]; then
+    [ -z "$2" ] && show_usage
+    [ "$2" -gt 1 ] && MULTI_QUEUE="multi_queue"
+    shift 2
+fi
+
+# set default argument
+if [ "$#" = "0" ]; then
+    set -- 0 1
+fi
+
+# sudo if necessary
+if [ -z "$SUDO_USER" ] && [ "$(id -u)" != "0" ]; then
+    exec sudo $0 "$MODE" "$@"
+fi
+SUDO_USER="${SUDO_USER:-root}"
+
+while [ ! -z "$1" ]; do
+    "${MODE}_tap" "$1"
+    shift
+done
@@ -0,0 +1,55 @@
+#!/bin/bash
+
+# Sets up two TAP devices joined by a bridge, so that a frame written to one comes out of the other
+# (a loopback pair, as used by apps/tap_bench):
+#
+#   tap_bench --> tapX --> bridge tapbrX --> tapY --> tap_bench
+#
+# For example:
+#
+#   ./scripts/tap-pair.sh create 10 11
+#   ./build/apps/tap_bench tap10 tap11
+
+show_usage () {
+    echo "Usage: $0 <create | destroy> [tapnum tapnum]"
+    exit 1
+}
+
+create_pair () {
+    local BRIDGE="tapbr$1"
+    ip link add name "${BRIDGE}" type bridge stp_state 0 forward_delay 0
+    for N in "$1" "$2"; do
+        ip tuntap add mode tap user "${SUDO_USER}" name "tap${N}"
+        sysctl -qw "net.ipv6.conf.tap${N}.disable_ipv6=1" # (keep the kernel from sending its own frames)
+        ip link set "tap${N}" master "${BRIDGE}"
+        ip link set "tap${N}" up
+    done
+    sysctl -qw "net.ipv6.conf.${BRIDGE}.disable_ipv6=1"
+    ip link set "${BRIDGE}" up
+}
+
+destroy_pair () {
+    ip link del "tapbr$1" 2>/dev/null
+    ip tuntap del mode tap name "tap$1" 2>/dev/null
+    ip tuntap del mode tap name "tap$2" 2>/dev/null
+}
+
+# check arguments
+if [ -z "$1" ] || ([ "$1" != "create" ] && [ "$1" != "destroy" ]); then
+    show_usage
+fi
+MODE=$1; shift
+
+# set default argument
+if [ "$#" = "0" ]; then
+    set -- 10 11
+fi
+[ "$#" = "2" ] || show_usage
+
+# sudo if necessary
+if [ -z "$SUDO_USER" ] && [ "$(id -u)" != "0" ]; then
+    exec sudo $0 "$MODE" "$@"
+fi
+SUDO_USER="${SUDO_USER:-root}"
+
+"${MODE}_pair" "$1" "$2"
@@ -10,6 +10,11 @@ ByteStream::ByteStream( uint64_t capacity ) : capacity_( capacity )
 
 // Push data to stream, but only as much as available capacity allows.
 void Writer::push( string data )
+{
+  push( string_view { data } );
+}
+
+void Writer::push( string_view data )
 {
   const uint64_t curr_len = buffer_.size();
   const uint64_t add_len = data.size();
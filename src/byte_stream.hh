@@ -41,6 +41,10 @@ public:
   bool is_closed() const;              // Has the stream been closed?
   uint64_t available_capacity() const; // How many bytes can be pushed to the stream right now?
   uint64_t bytes_pushed() const;       // Total number of bytes cumulatively pushed to the stream
+
+  // Push bytes that the caller still owns; only what fits in the buffer gets copied.
+  void push( std::string_view data );
+  void push( const char* data ) { push( std::string_view { data } ); } // `push( "abc" )` picks one overload
 };
 
 class Reader : public ByteStream
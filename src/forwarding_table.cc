@@ -0,0 +1,181 @@
+#include "forwarding_table.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+ForwardingTable::ForwardingTable()
+{
+  clear();
+}
+
+void ForwardingTable::clear()
+{
+  // (the first level's nodes all start out as one empty node, copied as each first changes)
+  root_.fill( make_shared<Node>( 1UL << ( STRIDES.front() - ROOT_BITS ) ) );
+}
+
+// Make a node safe to change: copy it first if another table (or another copy of a node above it) shares it
+ForwardingTable::Node& ForwardingTable::own( shared_ptr<Node>& node )
+{
+  if ( node.use_count() > 1 ) {
+    node = make_shared<Node>( *node );
+  }
+  return *node;
+}
+
+void ForwardingTable::insert( const uint32_t prefix, const uint8_t prefix_length, const uint32_t route )
+{
+  if ( route >= MAX_ROUTES ) {
+    throw runtime_error( "ForwardingTable: too many routes" );
+  }
+  change( prefix, prefix_length, Change::Insert, { .route_plus_1 = route + 1, .length = prefix_length } );
+}
+
+void ForwardingTable::replace( const uint32_t prefix, const uint8_t prefix_length, const uint32_t route )
+{
+  if ( route >= MAX_ROUTES ) {
+    throw runtime_error( "ForwardingTable: too many routes" );
+  }
+  change( prefix, prefix_length, Change::Replace, { .route_plus_1 = route + 1, .length = prefix_length } );
+}
+
+void ForwardingTable::remove( const uint32_t prefix,
+                              const uint8_t prefix_length,
+                              const optional<pair<uint32_t, uint8_t>> shorter )
+{
+  Slot value {};
+  if ( shorter.has_value() ) {
+    if ( shorter->first >= MAX_ROUTES or shorter->second >= prefix_length ) {
+      throw runtime_error( "ForwardingTable: invalid shorter prefix" );
+    }
+    value = { .route_plus_1 = shorter->first + 1, .length = shorter->second };
+  }
+  change( prefix, prefix_length, Change::Remove, value );
+}
+
+void ForwardingTable::change_slot( Slot& slot, const uint8_t prefix_length, const Change change, const Slot& value )
+{
+  const bool empty = slot.route_plus_1 == 0;
+  bool set = false;
+  switch ( change ) {
+    case Change::Insert: // (unless a longer, or equally long and earlier, prefix already owns the slot)
+      set = empty or slot.length < prefix_length;
+      break;
+    case Change::Replace:
+      set = empty or slot.length <= prefix_length;
+      break;
+    case Change::Remove: // (only the slots the prefix owns)
+      set = not empty and slot.length == prefix_length;
+      break;
+  }
+  if ( set ) {
+    slot.route_plus_1 = value.route_plus_1;
+    slot.length = value.length;
+  }
+}
+
+void ForwardingTable::change( const uint32_t prefix,
+                              const uint8_t prefix_length,
+                              const Change change,
+                              const Slot value )
+{
+  if ( prefix_length > 32 ) {
+    throw runtime_error( "ForwardingTable: prefix length must be at most 32" );
+  }
+
+  // only the top `prefix_length` bits of the prefix matter
+  const uint32_t masked = prefix_length ? prefix & ~static_cast<uint32_t>( ( 1ULL << ( 32 - prefix_length ) ) - 1 ) : 0;
+
+  // A prefix that ends in the first level is expanded into a run of its slots, which may take in several of its
+  // nodes
+  const uint8_t root_end = STRIDES.front();
+  const uint32_t root_node_bits = root_end - ROOT_BITS;
+  const uint32_t root_node_mask = ( 1U << root_node_bits ) - 1;
+  if ( prefix_length <= root_end ) {
+    const uint32_t first = masked >> ( 32 - root_end );
+    const uint32_t last = first + ( 1U << ( root_end - prefix_length ) );
+    for ( uint32_t i = first; i < last; ) {
+      Node& node = own( root_[i >> root_node_bits] );
+      for ( const uint32_t node_last = min( last, ( i | root_node_mask ) + 1 ); i < node_last; ++i ) {
+        change_slot( node.slots[i & root_node_mask], prefix_length, change, value );
+      }
+    }
+    return;
+  }
+
+  // Otherwise walk down to the node it ends in, copying the shared nodes on the way (and adding missing ones,
+  // unless the prefix is being removed, in which case it isn't there)
+  array<pair<Node*, uint32_t>, STRIDES.size()> path {}; // the nodes above, and the slot taken in each
+  size_t depth = 0;
+  Node* node = &own( root_[masked >> ( 32 - ROOT_BITS )] );
+  uint32_t index = ( masked >> ( 32 - root_end ) ) & root_node_mask;
+  uint8_t start = root_end;
+  for ( size_t level = 1; level < STRIDES.size(); ++level ) {
+    const uint8_t stride = STRIDES.at( level );
+    if ( node->children.empty() ) {
+      if ( change == Change::Remove ) {
+        return;
+      }
+      node->children.resize( node->slots.size() );
+    }
+    shared_ptr<Node>& child = node->children[index];
+    if ( not child ) {
+      if ( change == Change::Remove ) {
+        return;
+      }
+      child = make_shared<Node>( 1UL << stride );
+    }
+    path.at( depth++ ) = { node, index };
+    node->slots[index].child = &own( child );
+    node = child.get();
+
+    const uint8_t end = start + stride;
+    index = ( masked >> ( 32 - end ) ) & ( ( 1U << stride ) - 1 );
+    if ( prefix_length <= end ) {
+      // the prefix ends in this level: expand it into every slot it covers (a shorter prefix that takes its
+      // place ends in an earlier level, if not in this one, and is found there)
+      const Slot here = value.length > start ? value : Slot {};
+      for ( uint32_t i = index; i < index + ( 1U << ( end - prefix_length ) ); ++i ) {
+        change_slot( node->slots[i], prefix_length, change, here );
+      }
+      break;
+    }
+    start = end;
+  }
+
+  // drop the nodes a removal has left empty
+  while ( change == Change::Remove and depth > 0
+          and ranges::all_of( node->slots, []( const Slot& s ) { return s.route_plus_1 == 0 and not s.child; } ) ) {
+    const auto [parent, parent_index] = path.at( --depth );
+    parent->slots[parent_index].child = nullptr;
+    parent->children[parent_index].reset();
+    node = parent;
+  }
+}
+
+optional<uint32_t> ForwardingTable::lookup( const uint32_t address ) const
+{
+  optional<uint32_t> best;
+
+  // prefixes stored deeper in the trie are always longer, so the last match found is the longest
+  const uint8_t root_end = STRIDES.front();
+  const Slot* slot = &root_[address >> ( 32 - ROOT_BITS )]
+                        ->slots[( address >> ( 32 - root_end ) ) & ( ( 1U << ( root_end - ROOT_BITS ) ) - 1 )];
+  uint8_t start = root_end;
+  for ( size_t level = 1;; ++level ) {
+    if ( slot->route_plus_1 ) {
+      best = slot->route_plus_1 - 1;
+    }
+    if ( not slot->child ) {
+      break;
+    }
+    const uint8_t stride = STRIDES[level];
+    const uint8_t end = start + stride;
+    slot = &slot->child->slots[( address >> ( 32 - end ) ) & ( ( 1U << stride ) - 1 )];
+    start = end;
+  }
+
+  return best;
+}
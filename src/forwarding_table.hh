@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// \brief A longest-prefix-match table from IPv4 prefixes to route numbers.
+//
+// The table is a multibit trie with strides of 16, 4, 4, 4 and 4 bits. Each prefix is expanded
+// into the slots of the level its last bit falls in, so a lookup reads at most five slots (and
+// usually one or two) instead of comparing the address against every route.
+//
+// Copies of a table share their nodes until one of them changes: a change copies only the nodes on
+// the path to its prefix (the first level is split into 256 nodes for this), and leaves the other
+// copies as they were.
+class ForwardingTable
+{
+public:
+  ForwardingTable();
+
+  // Map every address whose top `prefix_length` bits match `prefix` to `route`.
+  // If the same prefix is inserted twice, the first insertion wins.
+  void insert( uint32_t prefix, uint8_t prefix_length, uint32_t route );
+
+  // Map a prefix to `route`, in place of the route it had (if it was in the table)
+  void replace( uint32_t prefix, uint8_t prefix_length, uint32_t route );
+
+  // Take a prefix out of the table. The addresses it covered go back to `shorter`: the route and
+  // length of the longest shorter prefix in the table that covers it (if there is one).
+  void remove( uint32_t prefix, uint8_t prefix_length, std::optional<std::pair<uint32_t, uint8_t>> shorter );
+
+  // The route of the longest prefix that matches `address` (or empty if none does)
+  std::optional<uint32_t> lookup( uint32_t address ) const;
+
+  // Remove every prefix
+  void clear();
+
+  static constexpr uint32_t MAX_ROUTES = ( 1U << 26 ) - 1;
+
+private:
+  static constexpr std::array<uint8_t, 5> STRIDES { 16, 4, 4, 4, 4 };
+  static constexpr uint8_t ROOT_BITS = 8; // the first level's nodes are chosen by the top 8 bits
+
+  struct Node;
+
+  struct Slot
+  {
+    const Node* child {};          // the next level's node (null if none)
+    uint32_t route_plus_1 : 26 {}; // route of the longest prefix covering this slot, plus 1 (0 if none)
+    uint32_t length : 6 {};        // that prefix's length
+  };
+
+  struct Node
+  {
+    explicit Node( size_t num_slots ) : slots( num_slots ) {}
+
+    std::vector<Slot> slots;
+    std::vector<std::shared_ptr<Node>> children {}; // own the slots' children (empty while there are none)
+  };
+
+  std::array<std::shared_ptr<Node>, 1UL << ROOT_BITS> root_ {};
+
+  enum class Change : uint8_t
+  {
+    Insert,
+    Replace,
+    Remove
+  };
+
+  // Change the slots a prefix covers to `value` (the prefix's own route, or for Change::Remove, the shorter one's)
+  void change( uint32_t prefix, uint8_t prefix_length, Change change, Slot value );
+  static void change_slot( Slot& slot, uint8_t prefix_length, Change change, const Slot& value );
+  static Node& own( std::shared_ptr<Node>& node );
+};
@@ -0,0 +1,95 @@
+#include "neighbor_table.hh"
+
+using namespace std;
+
+namespace {
+constexpr size_t INITIAL_CAPACITY = 64;
+} // namespace
+
+NeighborTable::NeighborTable() : entries_( INITIAL_CAPACITY ), mask_( INITIAL_CAPACITY - 1 ) {}
+
+// Fibonacci hashing: addresses on the same subnet differ only in their low bits, so mix them into the high bits
+size_t NeighborTable::bucket( const uint32_t ip ) const
+{
+  return static_cast<size_t>( ( static_cast<uint64_t>( ip ) * 0x9E3779B97F4A7C15ULL ) >> 32 ) & mask_;
+}
+
+const NeighborTable::Entry* NeighborTable::find( const uint32_t ip ) const
+{
+  for ( size_t i = bucket( ip );; i = ( i + 1 ) & mask_ ) {
+    const Entry& entry = entries_[i];
+    if ( not entry.occupied ) {
+      return nullptr;
+    }
+    if ( entry.ip == ip ) {
+      return &entry;
+    }
+  }
+}
+
+void NeighborTable::find_batch( const span<const uint32_t> ips, const span<const Entry*> results ) const
+{
+  for ( const uint32_t ip : ips ) {
+    __builtin_prefetch( &entries_[bucket( ip )] );
+  }
+  for ( size_t i = 0; i < ips.size() and i < results.size(); ++i ) {
+    results[i] = find( ips[i] );
+  }
+}
+
+pair<NeighborTable::Entry*, bool> NeighborTable::try_emplace( const uint32_t ip )
+{
+  // keep the table at most half full, so probe sequences stay short
+  if ( ( size_ + 1 ) * 2 > entries_.size() ) {
+    grow();
+  }
+
+  for ( size_t i = bucket( ip );; i = ( i + 1 ) & mask_ ) {
+    Entry& entry = entries_[i];
+    if ( not entry.occupied ) {
+      entry = { ip, {}, true, 0 };
+      ++size_;
+      return { &entry, true };
+    }
+    if ( entry.ip == ip ) {
+      return { &entry, false };
+    }
+  }
+}
+
+bool NeighborTable::erase( const uint32_t ip )
+{
+  size_t hole = bucket( ip );
+  while ( entries_[hole].occupied and entries_[hole].ip != ip ) {
+    hole = ( hole + 1 ) & mask_;
+  }
+  if ( not entries_[hole].occupied ) {
+    return false;
+  }
+
+  // Move back any later entry of the run that would no longer be found past the hole
+  for ( size_t i = ( hole + 1 ) & mask_; entries_[i].occupied; i = ( i + 1 ) & mask_ ) {
+    const size_t home = bucket( entries_[i].ip );
+    const bool home_after_hole = ( ( i - home ) & mask_ ) < ( ( i - hole ) & mask_ );
+    if ( not home_after_hole ) {
+      entries_[hole] = entries_[i];
+      hole = i;
+    }
+  }
+
+  entries_[hole] = {};
+  --size_;
+  return true;
+}
+
+void NeighborTable::grow()
+{
+  vector<Entry> old = exchange( entries_, vector<Entry>( entries_.size() * 2 ) );
+  mask_ = entries_.size() - 1;
+  size_ = 0;
+  for ( const Entry& entry : old ) {
+    if ( entry.occupied ) {
+      *try_emplace( entry.ip ).first = entry;
+    }
+  }
+}
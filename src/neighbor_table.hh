@@ -0,0 +1,52 @@
+#pragma once
+
+#include "ethernet_header.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+// \brief The IPv4-to-Ethernet mappings a NetworkInterface has learned.
+//
+// The table is a flat array of 32-byte entries (two per cache line) with open addressing and linear
+// probing, so a lookup usually reads one cache line and never chases a pointer. Each entry holds the
+// Ethernet address and the id of the timer that will expire it. Removal shifts later entries of the
+// probe sequence back instead of leaving tombstones, so lookups never slow down as mappings come and go.
+class NeighborTable
+{
+public:
+  struct alignas( 32 ) Entry
+  {
+    uint32_t ip {};
+    EthernetAddress ethernet_address {};
+    bool occupied {};
+    uint64_t expiry {}; // the owner's timer for this mapping
+  };
+
+  NeighborTable();
+
+  // The entry for `ip` (or nullptr if there is none)
+  const Entry* find( uint32_t ip ) const;
+
+  // Look up a burst of addresses at once: results[i] is find( ips[i] ). All the buckets are
+  // prefetched before any is probed, so the cache misses of a burst overlap.
+  void find_batch( std::span<const uint32_t> ips, std::span<const Entry*> results ) const;
+
+  // The entry for `ip`, added if there was none (second is true if it was added)
+  std::pair<Entry*, bool> try_emplace( uint32_t ip );
+
+  // Remove the entry for `ip`, if there is one
+  bool erase( uint32_t ip );
+
+  size_t size() const { return size_; }
+
+private:
+  std::vector<Entry> entries_ {};
+  size_t mask_ {};
+  size_t size_ {};
+
+  size_t bucket( uint32_t ip ) const;
+  void grow();
+};
@@ -1,4 +1,6 @@
+#include <array>
 #include <iostream>
+#include <utility>
 
 #include "debug.hh"
 #include "ethernet_frame.hh"
@@ -34,22 +36,83 @@ void NetworkInterface::send_datagram( InternetDatagram dgram, const Address& nex
   uint32_t dst_ip = next_hop.ipv4_numeric();
 
   // Send datagram if mapping exists.
-  auto it = ip_to_ethernet_.find(dst_ip);
-  if ( it != ip_to_ethernet_.end() ) {
-    send_datagram_frame( dgram, it->second.ethernet_address );
+  const auto* neighbor = ip_to_ethernet_.find( dst_ip );
+  if ( neighbor ) {
+    send_datagram_frame( dgram, neighbor->ethernet_address );
     return;
   }
 
-  // Send ARP
+  wait_for_arp_reply( std::move( dgram ), dst_ip );
+}
+
+//! \param[in] dgrams the IPv4 datagrams to be sent (they are moved from)
+//! \param[in] next_hops the IP address of the next hop of each datagram
+void NetworkInterface::send_datagrams( span<InternetDatagram> dgrams, span<const Address> next_hops )
+{
+  const size_t count = min( dgrams.size(), next_hops.size() );
+  // (taken out of the member while in use, in case the port hands frames back to this interface)
+  vector<EthernetFrame> frames = std::exchange( frame_scratch_, {} );
+  frames.clear();
+
+  // Look up every next hop of the burst at once (copying the results out, since sending an ARP request
+  // could lead to learning a mapping and moving the table's entries)
+  static constexpr size_t BATCH = 32;
+  array<uint32_t, BATCH> dst_ips {};
+  array<const NeighborTable::Entry*, BATCH> neighbors {};
+  array<optional<EthernetAddress>, BATCH> dst_ethernet_addresses {};
+  for ( size_t start = 0; start < count; start += BATCH ) {
+    const size_t n = min( BATCH, count - start );
+    for ( size_t i = 0; i < n; ++i ) {
+      dst_ips[i] = next_hops[start + i].ipv4_numeric();
+    }
+    ip_to_ethernet_.find_batch( span { dst_ips.data(), n }, span { neighbors.data(), n } );
+    for ( size_t i = 0; i < n; ++i ) {
+      dst_ethernet_addresses[i] = neighbors[i] ? optional { neighbors[i]->ethernet_address } : nullopt;
+    }
+
+    // Send the frames in one batch, except that ARP requests go out in order with them
+    for ( size_t i = 0; i < n; ++i ) {
+      if ( dst_ethernet_addresses[i].has_value() ) {
+        frames.push_back( make_datagram_frame( serialize( dgrams[start + i] ), *dst_ethernet_addresses[i] ) );
+      } else {
+        transmit_batch( frames );
+        frames.clear();
+        wait_for_arp_reply( std::move( dgrams[start + i] ), dst_ips[i] );
+      }
+    }
+  }
+  transmit_batch( frames );
+  frames.clear();
+  frame_scratch_ = std::move( frames );
+}
+
+// Hold a datagram until the next hop's Ethernet address is known, asking for it if need be
+void NetworkInterface::wait_for_arp_reply( InternetDatagram dgram, const uint32_t dst_ip )
+{
+  // Drop the datagram rather than let the pending queues grow without bound
   auto it_d = ip_to_dgrams_.find(dst_ip);
-  // Re-send ARP only if the same IP has been sent 5 second ago
-  if ( it_d == ip_to_dgrams_.end() || it_d->second.ts == -1 ) {
+  const size_t hop_count = it_d == ip_to_dgrams_.end() ? 0 : it_d->second.dgrams.size();
+  if ( hop_count >= queue_config_.pending_limit_per_hop || pending_count_ >= queue_config_.pending_limit ) {
+    ++drop_stats_.pending_drops;
+    return;
+  }
+
+  auto& pending = it_d == ip_to_dgrams_.end() ? ip_to_dgrams_[dst_ip] : it_d->second;
+
+  // Send ARP, unless one was sent for the same IP in the last 5 seconds
+  if ( pending.dgrams.empty() || timers_.now() >= pending.arp_resend_time ) {
     auto arp_req = make_arp(ARPMessage::OPCODE_REQUEST, ethernet_address_, ip_address_.ipv4_numeric(), {}, dst_ip);
     send_arp_frame( arp_req );
+    pending.arp_resend_time = timers_.now() + NetworkInterface::ARP_RESEND_TIMEOUT;
   }
 
   // Store the datagram no matter re-send ARP or not.
-  ip_to_dgrams_[dst_ip].dgramq.emplace_back(0, std::move( dgram ));
+  const uint64_t deadline = timers_.now() + NetworkInterface::ARP_RESEND_TIMEOUT;
+  if ( pending.dgrams.empty() ) {
+    pending.expiry = timers_.schedule_at( deadline, { Timer::Kind::PendingDatagrams, dst_ip } );
+  }
+  pending.dgrams.push_back( { deadline, serialize( dgram ) } );
+  ++pending_count_;
 }
 
 //! \param[in] frame the incoming Ethernet frame
@@ -60,20 +123,24 @@ void NetworkInterface::recv_frame( EthernetFrame frame )
   // Receive an IP datagram
   if ( header.type == EthernetHeader::TYPE_IPv4 ) {
     // Drop the datagram if its dst is not current host.
-    if ( header.dst == ethernet_address_ ) {
+    if ( header.dst == ethernet_address_ && admit_received_datagram() ) {
       InternetDatagram dgram;
-      Parser p{ frame.payload };
+      Parser p{ std::move( frame.payload ) };
       dgram.parse( p );
       datagrams_received_.push( std::move(dgram) );
+
+      if ( datagrams_received_.size() == queue_config_.high_watermark && high_watermark_callback_ ) {
+        high_watermark_callback_( *this, datagrams_received_.size() );
+      }
     }
   } else if ( header.type == EthernetHeader::TYPE_ARP ) {
     // Receive an ARP msg.
     ARPMessage arp;
-    Parser p{ frame.payload };
+    Parser p{ std::move( frame.payload ) };
     arp.parse( p );
 
     // Learn mappings from both requests and replies
-    ip_to_ethernet_[arp.sender_ip_address] = { 0, arp.sender_ethernet_address };
+    learn_mapping( arp.sender_ip_address, arp.sender_ethernet_address );
 
     /**
      * Bug: Everytime a host learn a mapping, check to send the pending datagrams. (Even if it's not the target host.)
@@ -81,9 +148,16 @@ void NetworkInterface::recv_frame( EthernetFrame frame )
      */
     auto it = ip_to_dgrams_.find(arp.sender_ip_address);
     if ( it != ip_to_dgrams_.end() ) {
-      for (auto &ts_dgram : it->second.dgramq) {
-        send_datagram_frame( ts_dgram.dgram, arp.sender_ethernet_address );
+      vector<EthernetFrame> frames = std::exchange( frame_scratch_, {} );
+      frames.clear();
+      for (auto &pending : it->second.dgrams) {
+        frames.push_back( make_datagram_frame( std::move( pending.dgram ), arp.sender_ethernet_address ) );
       }
+      transmit_batch( frames );
+      frames.clear();
+      frame_scratch_ = std::move( frames );
+      pending_count_ -= it->second.dgrams.size();
+      timers_.cancel( it->second.expiry );
       ip_to_dgrams_.erase(it);
     }
     
@@ -99,41 +173,84 @@ void NetworkInterface::recv_frame( EthernetFrame frame )
   }
 }
 
+//! \param[in] frames the incoming Ethernet frames
+void NetworkInterface::recv_frames( span<EthernetFrame> frames )
+{
+  for ( auto& frame : frames ) {
+    recv_frame( std::move( frame ) );
+  }
+}
+
 //! \param[in] ms_since_last_tick the number of milliseconds since the last call to this method
 void NetworkInterface::tick( const size_t ms_since_last_tick )
 {
-  // Expire ip - ethernet mappings
-  for ( auto it = ip_to_ethernet_.begin(); it != ip_to_ethernet_.end(); ) {
-    auto& ts_ethernet = it->second;
-    ts_ethernet.ts += ms_since_last_tick;
-    if ( ts_ethernet.ts >= NetworkInterface::MAPPING_CACHE_DURATION ) {
-      it = ip_to_ethernet_.erase(it);
-    } else {
-      it = next(it);
-    }
+  timers_.advance( ms_since_last_tick, [this]( const Timer& timer ) { expire( timer ); } );
+}
+
+// Remember (or refresh) a mapping for 30s
+void NetworkInterface::learn_mapping( const uint32_t ip, const EthernetAddress& ethernet_address )
+{
+  auto [neighbor, inserted] = ip_to_ethernet_.try_emplace( ip );
+  if ( !inserted ) {
+    timers_.cancel( neighbor->expiry );
   }
+  neighbor->ethernet_address = ethernet_address;
+  neighbor->expiry = timers_.schedule_after( NetworkInterface::MAPPING_CACHE_DURATION, { Timer::Kind::Mapping, ip } );
+}
 
-  // Update ARP re-send timeout
-  for ( auto it = ip_to_dgrams_.begin(); it != ip_to_dgrams_.end(); it = next(it) ) {
-    auto& ts_dgramq = it->second;
-    if ( ts_dgramq.ts != -1 ) {
-      ts_dgramq.ts += ms_since_last_tick;
-      if ( ts_dgramq.ts >= NetworkInterface::ARP_RESEND_TIMEOUT ) {
-        ts_dgramq.ts = -1;
-      }
-      /**
-       * Bug: Drop pending datagrams after enqueue for 5s.
-       */
-      auto &dgramq = ts_dgramq.dgramq;
-      for ( size_t i = 0; i < dgramq.size(); ++i ) {
-        dgramq[i].ts += ms_since_last_tick;
-        if ( dgramq[i].ts >= NetworkInterface::ARP_RESEND_TIMEOUT ) {
-          swap(dgramq[i], dgramq.back());
-          dgramq.pop_back();
-        }
+void NetworkInterface::expire( const Timer& timer )
+{
+  if ( timer.kind == Timer::Kind::Mapping ) {
+    ip_to_ethernet_.erase( timer.ip );
+    return;
+  }
+
+  // Drop the pending datagrams that have waited 5s, and wait for the next oldest one
+  auto it = ip_to_dgrams_.find( timer.ip );
+  if ( it == ip_to_dgrams_.end() ) {
+    return;
+  }
+  auto& dgrams = it->second.dgrams;
+  while ( !dgrams.empty() && dgrams.front().deadline <= timers_.now() ) {
+    dgrams.pop_front();
+    --pending_count_;
+  }
+
+  // The newest datagram is never older than the last ARP request, so once every datagram has expired,
+  // another ARP request may be sent too
+  if ( dgrams.empty() ) {
+    ip_to_dgrams_.erase( it );
+  } else {
+    it->second.expiry = timers_.schedule_at( dgrams.front().deadline, timer );
+  }
+}
+
+// Decide whether there is room for one more received datagram, counting the drop if not
+bool NetworkInterface::admit_received_datagram()
+{
+  const size_t queued = datagrams_received_.size();
+  if ( queued >= queue_config_.receive_limit ) {
+    ++drop_stats_.tail_drops;
+    return false;
+  }
+
+  if ( queue_config_.receive_policy == DropPolicy::RED ) {
+    red_average_ += queue_config_.red_weight * ( static_cast<double>( queued ) - red_average_ );
+    if ( red_average_ >= queue_config_.red_max ) {
+      ++drop_stats_.red_drops;
+      return false;
+    }
+    if ( red_average_ >= queue_config_.red_min ) {
+      const double p = queue_config_.red_max_probability * ( red_average_ - queue_config_.red_min )
+                       / ( queue_config_.red_max - queue_config_.red_min );
+      if ( std::bernoulli_distribution { p }( red_random_ ) ) {
+        ++drop_stats_.red_drops;
+        return false;
       }
     }
   }
+
+  return true;
 }
 
 auto NetworkInterface::make_arp(
@@ -152,17 +269,15 @@ auto NetworkInterface::make_arp(
   return arp;
 }
 
-void NetworkInterface::send_datagram_frame( const InternetDatagram& dgram, const EthernetAddress& dst_ethernet_address ) const
+// The serialized IP datagram is the payload of the ethernet frame
+EthernetFrame NetworkInterface::make_datagram_frame( BufferChain dgram, const EthernetAddress& dst_ethernet_address ) const
 {
-  EthernetHeader header{ dst_ethernet_address, ethernet_address_, EthernetHeader::TYPE_IPv4 };
-  
-  // IP datagram is the payload of the ethernet frame
-  Serializer s;
-  dgram.serialize(s);
-  auto payload = s.finish();
+  return { { dst_ethernet_address, ethernet_address_, EthernetHeader::TYPE_IPv4 }, std::move( dgram ) };
+}
 
-  auto frame = EthernetFrame{ header, payload };
-  transmit( frame );
+void NetworkInterface::send_datagram_frame( const InternetDatagram& dgram, const EthernetAddress& dst_ethernet_address ) const
+{
+  transmit( make_datagram_frame( serialize( dgram ), dst_ethernet_address ) );
 }
 
 void NetworkInterface::send_arp_frame( const ARPMessage& arp, const EthernetAddress& dst_ethernet_address ) const
@@ -173,6 +288,6 @@ void NetworkInterface::send_arp_frame( const ARPMessage& arp, const EthernetAddr
   arp.serialize(s);
   auto payload = s.finish();
 
-  auto frame = EthernetFrame{ header, payload };
+  auto frame = EthernetFrame{ header, std::move( payload ) };
   transmit( frame );
 }
@@ -4,10 +4,17 @@
 #include "address.hh"
 #include "ethernet_frame.hh"
 #include "ipv4_datagram.hh"
+#include "neighbor_table.hh"
+#include "timer_queue.hh"
 
+#include <deque>
+#include <functional>
 #include <memory>
 #include <queue>
+#include <random>
+#include <span>
 #include <unordered_map>
+#include <vector>
 
 // A "network interface" that connects IP (the internet layer, or network layer)
 // with Ethernet (the network access layer, or link layer).
@@ -38,9 +45,56 @@ public:
   {
   public:
     virtual void transmit( const NetworkInterface& sender, const EthernetFrame& frame ) = 0;
+
+    // Send many frames at once (ports that can hand a whole batch to the link in one go should override this)
+    virtual void transmit_batch( const NetworkInterface& sender, std::span<const EthernetFrame> frames )
+    {
+      for ( const auto& frame : frames ) {
+        transmit( sender, frame );
+      }
+    }
+
     virtual ~OutputPort() = default;
   };
 
+  // How an incoming datagram is dropped when the receive queue is backed up
+  enum class DropPolicy : uint8_t
+  {
+    TailDrop, // drop only when the queue is full
+    RED,      // Random Early Detection: drop with rising probability as the average queue length grows
+  };
+
+  // Limits on the datagrams the interface will hold on to
+  struct QueueConfig
+  {
+    size_t receive_limit = 1024; // datagrams in datagrams_received() (beyond this, always drop)
+    DropPolicy receive_policy = DropPolicy::TailDrop;
+
+    // RED: below red_min (average queue length) never drop, above red_max always drop, and in between drop
+    // with probability rising linearly up to red_max_probability. red_weight is the weight of each new
+    // sample in the average.
+    double red_min = 256;
+    double red_max = 768;
+    double red_max_probability = 0.1;
+    double red_weight = 0.002;
+
+    size_t pending_limit_per_hop = 64; // datagrams waiting for the ARP reply of one next hop
+    size_t pending_limit = 1024;       // datagrams waiting for any ARP reply
+
+    size_t high_watermark = 768; // the receive queue length that triggers the high-watermark callback
+  };
+
+  // Datagrams dropped because a queue was full (or, for RED, getting full)
+  struct DropStats
+  {
+    uint64_t tail_drops {};    // received datagrams dropped because the receive queue was full
+    uint64_t red_drops {};     // received datagrams dropped early by RED
+    uint64_t pending_drops {}; // datagrams to send dropped because too many were waiting for ARP replies
+  };
+
+  // Called with the receive queue length each time a received datagram fills the queue up to the high watermark
+  using HighWatermarkCallback = std::function<void( NetworkInterface&, size_t )>;
+
   // Construct a network interface with given Ethernet (network-access-layer) and IP (internet-layer)
   // addresses
   NetworkInterface( std::string_view name,
@@ -53,43 +107,77 @@ public:
   // hop. Sending is accomplished by calling `transmit()` (a member variable) on the frame.
   void send_datagram( InternetDatagram dgram, const Address& next_hop );
 
+  // Sends a burst of datagrams, dgrams[i] to next_hops[i], looking up all the next hops' Ethernet
+  // addresses together
+  void send_datagrams( std::span<InternetDatagram> dgrams, std::span<const Address> next_hops );
+
   // Receives an Ethernet frame and responds appropriately.
   // If type is IPv4, pushes the datagram to the datagrams_in queue.
   // If type is ARP request, learn a mapping from the "sender" fields, and send an ARP reply.
   // If type is ARP reply, learn a mapping from the "sender" fields.
   void recv_frame( EthernetFrame frame );
 
+  // Receives a burst of Ethernet frames (they are moved from), as if by calling recv_frame() on each in turn
+  void recv_frames( std::span<EthernetFrame> frames );
+
   // Called periodically when time elapses
   void tick( size_t ms_since_last_tick );
 
+  // Change the queue limits (datagrams already queued are kept even if they are over a new limit)
+  void set_queue_config( const QueueConfig& config ) { queue_config_ = config; }
+  const QueueConfig& queue_config() const { return queue_config_; }
+
+  // Set the function to call when the receive queue reaches the high watermark (e.g. to shed load)
+  void set_high_watermark_callback( HighWatermarkCallback callback ) { high_watermark_callback_ = std::move( callback ); }
+
+  const DropStats& drop_stats() const { return drop_stats_; }
+
   // Accessors
   const std::string& name() const { return name_; }
+  const Address& ip_address() const { return ip_address_; }
   const OutputPort& output() const { return *port_; }
   OutputPort& output() { return *port_; }
   std::queue<InternetDatagram>& datagrams_received() { return datagrams_received_; }
 
 private:
+  bool admit_received_datagram();
+  void wait_for_arp_reply( InternetDatagram dgram, uint32_t dst_ip );
+  EthernetFrame make_datagram_frame( BufferChain dgram, const EthernetAddress& dst_ethernet_address ) const;
   void send_datagram_frame( const InternetDatagram& dgram, const EthernetAddress& dst_ethernet_address ) const;
   void send_arp_frame( const ARPMessage& arp, const EthernetAddress& dst_ethernet_address = ETHERNET_BROADCAST ) const;
   auto make_arp(uint16_t opcode, 
     const EthernetAddress& sender_ethernet_address, const uint32_t sender_ip_address, 
     const EthernetAddress& target_ethernet_address, const uint32_t target_ip_address) const -> ARPMessage;
 
-  struct DatagramWithTimeout {
-    int64_t ts{};
-    InternetDatagram dgram{};
+  // What a timer is for: forgetting a learned mapping, or dropping datagrams that waited too long for an
+  // ARP reply
+  struct Timer
+  {
+    enum class Kind : uint8_t
+    {
+      Mapping,
+      PendingDatagrams,
+    } kind;
+    uint32_t ip;
   };
 
-  struct EthernetAddressWithTimeout {
-    int64_t ts{};
-    EthernetAddress ethernet_address{};
+  struct PendingDatagram
+  {
+    uint64_t deadline {};
+    BufferChain dgram {}; // (serialized when it is queued, so sending it later costs no more work)
   };
 
-  struct DatagramQueueWithTimeout {
-    int64_t ts{};
-    std::vector<DatagramWithTimeout> dgramq{};
+  // Datagrams waiting for the ARP reply of one next hop, oldest first
+  struct PendingQueue
+  {
+    uint64_t arp_resend_time {};          // when another ARP request may be sent
+    TimerQueue<Timer>::TimerId expiry {}; // expires when the oldest datagram does
+    std::deque<PendingDatagram> dgrams {};
   };
 
+  void learn_mapping( uint32_t ip, const EthernetAddress& ethernet_address );
+  void expire( const Timer& timer );
+
   static const uint16_t MAPPING_CACHE_DURATION = 30000;
   static const uint16_t ARP_RESEND_TIMEOUT = 5000;
 
@@ -99,6 +187,12 @@ private:
   // The physical output port (+ a helper function `transmit` that uses it to send an Ethernet frame)
   std::shared_ptr<OutputPort> port_;
   void transmit( const EthernetFrame& frame ) const { port_->transmit( *this, frame ); }
+  void transmit_batch( std::span<const EthernetFrame> frames ) const
+  {
+    if ( not frames.empty() ) {
+      port_->transmit_batch( *this, frames );
+    }
+  }
 
   // Ethernet (known as hardware, network-access-layer, or link-layer) address of the interface
   EthernetAddress ethernet_address_;
@@ -112,11 +206,28 @@ private:
   /**
    * Only cache each mapping for 30s.
    */
-  std::unordered_map<uint32_t, EthernetAddressWithTimeout> ip_to_ethernet_{};
+  NeighborTable ip_to_ethernet_{};
 
   /**
-   * The first timestamp is used to record the timeout (5s) to re-send the APR.
-   * The second timestamp is used to record the timeout (5s) to drop the pending datagram.
+   * Re-send the ARP only after 5s, and drop each pending datagram after 5s.
    */
-  std::unordered_map<uint32_t, DatagramQueueWithTimeout> ip_to_dgrams_{};
+  std::unordered_map<uint32_t, PendingQueue> ip_to_dgrams_{};
+
+  // The deadlines of every mapping and pending queue, so tick() only touches the ones that expire
+  TimerQueue<Timer> timers_ {};
+
+  // Number of datagrams in all of ip_to_dgrams_'s queues
+  size_t pending_count_ {};
+
+  QueueConfig queue_config_ {};
+  DropStats drop_stats_ {};
+  HighWatermarkCallback high_watermark_callback_ {};
+
+  // Frames being gathered for one transmit_batch(), kept between bursts so that sending one doesn't allocate
+  std::vector<EthernetFrame> frame_scratch_ {};
+
+  // RED's running average of the receive queue length, and the source of its drop decisions
+  // (fixed seed, so runs are repeatable)
+  double red_average_ {};
+  std::minstd_rand red_random_ { 1 };
 };
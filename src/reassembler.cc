@@ -7,6 +7,11 @@
  */
 
 void Reassembler::insert( uint64_t first_index, string data, bool is_last_substring )
+{
+  insert( first_index, string_view { data }, is_last_substring );
+}
+
+void Reassembler::insert( uint64_t first_index, string_view data, bool is_last_substring )
 {
   auto &writer = output_.writer();
 
@@ -25,7 +30,13 @@ void Reassembler::insert( uint64_t first_index, string data, bool is_last_substr
   uint64_t r = min( r1, r2 );
   if ( r > l ) {
     auto substring = data.substr( l - first_index, r - l );
-    insert( l, substring );
+    if ( l == first_unassembled_index_ && lst_.empty() ) {
+      // in order, with nothing waiting for it: straight into the stream, without being stored first
+      writer.push( substring );
+      first_unassembled_index_ = r;
+    } else {
+      insert( l, substring );
+    }
   }
 
   // Write to byte stream
@@ -42,11 +53,11 @@ void Reassembler::insert( uint64_t first_index, string data, bool is_last_substr
   }
 }
 
-void Reassembler::insert( const uint64_t first_index, const string data )
+void Reassembler::insert( const uint64_t first_index, const string_view data )
 {
   // Put first node into rbtree and list
   if ( rbtree_.empty() ) {
-    lst_.push_back( { first_index, false, false, data } );
+    lst_.push_back( { first_index, false, false, string { data } } );
     rbtree_[first_index] = lst_.begin();
     return;
   }
@@ -60,10 +71,10 @@ void Reassembler::insert( const uint64_t first_index, const string data )
         it->second->payload = data;
       }
     } else {
-      rbtree_[first_index] = lst_.insert( it->second, { first_index, false, false, data } );
+      rbtree_[first_index] = lst_.insert( it->second, { first_index, false, false, string { data } } );
     }
   } else {
-    rbtree_[first_index] = lst_.insert( lst_.end(), { first_index, false, false, data } );
+    rbtree_[first_index] = lst_.insert( lst_.end(), { first_index, false, false, string { data } } );
   }
 
   // 新加的节点如果不是头节点，就往前走一个节点（因为这个节点可能可以和新插入的节点合并），然后从这个节点开始往后开始做区间合并，直到不能再合并则停止
@@ -91,7 +102,7 @@ void Reassembler::merge( list<Segment>::iterator node )
     if ( r1 + 1 >= l2 ) {
       if ( r1 < next_node->first_index + next_node->payload.size() - 1 ) {
         auto len = r1 - l2 + 1;
-        node->payload += next_node->payload.substr( len , next_node->payload.size() - len );
+        node->payload += string_view { next_node->payload }.substr( len );
       }
       rbtree_.erase( next_node->first_index );
       lst_.erase( next_node );
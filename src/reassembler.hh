@@ -8,6 +8,7 @@
 #include <list>
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 
 using namespace std;
@@ -40,6 +41,14 @@ public:
    */
   void insert( uint64_t first_index, string data, bool is_last_substring );
 
+  // Insert a substring held in the caller's memory (e.g. a segment payload); the
+  // Reassembler copies only the bytes it has to keep until the gaps before them are filled.
+  void insert( uint64_t first_index, string_view data, bool is_last_substring );
+  void insert( uint64_t first_index, const char* data, bool is_last_substring )
+  {
+    insert( first_index, string_view { data }, is_last_substring );
+  }
+
   // How many bytes are stored in the Reassembler itself?
   // This function is for testing only; don't add extra state to support it.
   uint64_t count_bytes_pending() const;
@@ -54,7 +63,7 @@ public:
   uint64_t next_byte() const { return first_unassembled_index_; }
 
 private:
-  void insert( const uint64_t first_index, const string data );
+  void insert( const uint64_t first_index, const string_view data );
   void merge( list<Segment>::iterator node );
 
   ByteStream output_;
@@ -1,7 +1,15 @@
 #include "router.hh"
 #include "debug.hh"
+#include "helpers.hh"
+#include "icmp_message.hh"
 
+#include <algorithm>
+#include <arpa/inet.h>
+#include <bit>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <utility>
 
 using namespace std;
 
@@ -20,52 +28,676 @@ void Router::add_route( const uint32_t route_prefix,
        << static_cast<int>( prefix_length ) << " => " << ( next_hop.has_value() ? next_hop->ip() : "(direct)" )
        << " on interface " << interface_num << "\n";
 
-  route_table_.emplace_back( route_prefix, prefix_length, next_hop, interface_num );
+  update_routes( { { RouteChange::Type::Add, route_prefix, prefix_length, { { next_hop, interface_num } } } } );
+}
+
+void Router::add_route( const uint32_t route_prefix, const uint8_t prefix_length, vector<NextHop> paths )
+{
+  update_routes( { { RouteChange::Type::Add, route_prefix, prefix_length, move( paths ) } } );
+}
+
+bool Router::remove_route( const uint32_t route_prefix, const uint8_t prefix_length )
+{
+  if ( prefix_length > 32 ) {
+    throw runtime_error( "route prefix length must be at most 32" );
+  }
+
+  const lock_guard lock { update_mutex_ };
+  const uint64_t key = route_key( route_prefix, prefix_length );
+  if ( !apply( RouteChange::Type::Remove, key, {} ) ) {
+    return false;
+  }
+  publish( { key } );
+  return true;
+}
+
+void Router::replace_route( const uint32_t route_prefix,
+                            const uint8_t prefix_length,
+                            const optional<Address> next_hop,
+                            const size_t interface_num )
+{
+  update_routes( { { RouteChange::Type::Replace, route_prefix, prefix_length, { { next_hop, interface_num } } } } );
+}
+
+void Router::replace_route( const uint32_t route_prefix, const uint8_t prefix_length, vector<NextHop> paths )
+{
+  update_routes( { { RouteChange::Type::Replace, route_prefix, prefix_length, move( paths ) } } );
+}
+
+void Router::update_routes( const vector<RouteChange>& changes )
+{
+  // Check the whole batch (making its rules) before changing anything
+  vector<optional<Rule>> rules;
+  rules.reserve( changes.size() );
+  for ( const auto& change : changes ) {
+    if ( change.prefix_length > 32 ) {
+      throw runtime_error( "route prefix length must be at most 32" );
+    }
+    if ( change.type == RouteChange::Type::Remove ) {
+      rules.emplace_back();
+    } else {
+      rules.emplace_back( make_rule( change.route_prefix, change.prefix_length, change.paths ) );
+    }
+  }
+
+  const lock_guard lock { update_mutex_ };
+  if ( route_nums_.size() + changes.size() > ForwardingTable::MAX_ROUTES ) {
+    throw runtime_error( "too many routes" );
+  }
+
+  vector<uint64_t> changed;
+  changed.reserve( changes.size() );
+  for ( size_t i = 0; i < changes.size(); ++i ) {
+    const uint64_t key = route_key( changes[i].route_prefix, changes[i].prefix_length );
+    if ( apply( changes[i].type, key, move( rules[i] ) ) ) {
+      changed.push_back( key );
+    }
+  }
+  publish( changed );
+}
+
+namespace {
+// Hash a datagram's flow: its source and destination addresses, protocol, and (for an unfragmented TCP or UDP
+// datagram) its source and destination ports. The fragments of a datagram leave the ports out, since only the
+// first one carries them, so that they all take the same path.
+uint64_t flow_hash( const InternetDatagram& dgram )
+{
+  uint32_t ports = 0;
+  const bool has_ports = dgram.header.proto == IPv4Header::PROTO_TCP || dgram.header.proto == IPv4Header::PROTO_UDP;
+  if ( has_ports && !dgram.header.mf && dgram.header.offset == 0 ) {
+    size_t got = 0;
+    for ( const auto& buf : dgram.payload ) {
+      for ( size_t i = 0; i < buf.size() && got < 4; ++i, ++got ) {
+        ports = ( ports << 8 ) | static_cast<uint8_t>( buf.data()[i] );
+      }
+      if ( got == 4 ) {
+        break;
+      }
+    }
+  }
+
+  // mix the tuple with the finalizer from MurmurHash3
+  uint64_t h = ( static_cast<uint64_t>( dgram.header.src ) << 32 ) | dgram.header.dst;
+  h ^= ( static_cast<uint64_t>( dgram.header.proto ) << 32 | ports ) * 0x9E3779B97F4A7C15ULL;
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+uint32_t parse_ipv4( const string& str, const string& where )
+{
+  in_addr addr {};
+  if ( inet_pton( AF_INET, str.c_str(), &addr ) != 1 ) {
+    throw runtime_error( where + ": invalid IPv4 address \"" + str + "\"" );
+  }
+  return ntohl( addr.s_addr );
+}
+} // namespace
+
+void Router::load_routes( const string& filename )
+{
+  ifstream file { filename };
+  if ( !file ) {
+    throw runtime_error( "could not open route file " + filename );
+  }
+
+  // Parse the whole file before touching the live table
+  map<uint64_t, vector<Rule>> routes;
+  size_t count = 0;
+  string line;
+  for ( size_t line_num = 1; getline( file, line ); ++line_num ) {
+    const string where = filename + ":" + to_string( line_num );
+    istringstream fields { line };
+    string prefix, next_hop;
+    size_t interface_num {};
+    if ( !( fields >> prefix ) || prefix.front() == '#' ) {
+      continue;
+    }
+
+    const auto slash = prefix.find( '/' );
+    vector<NextHop> paths;
+    while ( fields >> next_hop ) {
+      if ( !( fields >> interface_num ) ) {
+        paths.clear();
+        break;
+      }
+      paths.push_back(
+        { next_hop == "direct" ? optional<Address> {} : Address::from_ipv4_numeric( parse_ipv4( next_hop, where ) ),
+          interface_num } );
+    }
+    if ( slash == string::npos || paths.empty() ) {
+      throw runtime_error( where + ": expected \"<prefix>/<length> <next hop> <interface number>...\"" );
+    }
+
+    const string length_str = prefix.substr( slash + 1 );
+    if ( length_str.empty() || length_str.size() > 2
+         || length_str.find_first_not_of( "0123456789" ) != string::npos || stoul( length_str ) > 32 ) {
+      throw runtime_error( where + ": invalid prefix length \"" + length_str + "\"" );
+    }
+
+    const uint32_t route_prefix = parse_ipv4( prefix.substr( 0, slash ), where );
+    const auto prefix_length = static_cast<uint8_t>( stoul( length_str ) );
+    routes[route_key( route_prefix, prefix_length )].push_back(
+      make_rule( route_prefix, prefix_length, move( paths ) ) );
+    ++count;
+  }
+
+  const lock_guard lock { update_mutex_ };
+  routes_ = move( routes );
+  num_rules_ = count;
+  publish_all();
+}
+
+uint64_t Router::route_key( const uint32_t route_prefix, const uint8_t prefix_length )
+{
+  // only the top prefix_length bits of the prefix are significant
+  const uint32_t mask = prefix_length ? ~static_cast<uint32_t>( ( 1ULL << ( 32 - prefix_length ) ) - 1 ) : 0;
+  return ( static_cast<uint64_t>( route_prefix & mask ) << 8 ) | prefix_length;
+}
+
+auto Router::make_rule( const uint32_t route_prefix, const uint8_t prefix_length, vector<NextHop> paths ) -> Rule
+{
+  if ( paths.empty() ) {
+    throw runtime_error( "route needs at least one path" );
+  }
+
+  Rule rule { route_prefix, prefix_length, move( paths ), nullptr };
+  if ( rule.paths.size() > 1 ) {
+    rule.path_counts = make_shared<vector<atomic<uint64_t>>>( rule.paths.size() );
+  }
+  return rule;
+}
+
+// Apply one checked change to routes_ (without publishing it); returns false if it removed nothing
+bool Router::apply( const RouteChange::Type type, const uint64_t key, optional<Rule> rule )
+{
+  switch ( type ) {
+    case RouteChange::Type::Add:
+      routes_[key].push_back( move( *rule ) );
+      ++num_rules_;
+      return true;
+    case RouteChange::Type::Remove: {
+      const auto it = routes_.find( key );
+      if ( it == routes_.end() ) {
+        return false;
+      }
+      num_rules_ -= it->second.size();
+      routes_.erase( it );
+      return true;
+    }
+    case RouteChange::Type::Replace: {
+      auto& rules = routes_[key];
+      num_rules_ -= rules.size();
+      rules = { move( *rule ) };
+      ++num_rules_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Router::RuleArray::set( const uint32_t route_num, shared_ptr<const Rule> rule )
+{
+  if ( route_num / CHUNK_SIZE >= chunks_.size() ) {
+    chunks_.resize( route_num / CHUNK_SIZE + 1 );
+  }
+  auto& chunk = chunks_[route_num / CHUNK_SIZE];
+  if ( !chunk ) {
+    chunk = make_shared<Chunk>();
+  } else if ( chunk.use_count() > 1 ) {
+    chunk = make_shared<Chunk>( *chunk ); // (shared with a published table)
+  }
+  ( *chunk )[route_num % CHUNK_SIZE] = move( rule );
+}
+
+// The route number of a prefix in the tables published from now on (a new one, if it has none yet)
+uint32_t Router::route_num( const uint64_t key )
+{
+  const auto [it, inserted] = route_nums_.try_emplace( key, route_nums_.size() );
+  if ( inserted && !free_route_nums_.empty() ) {
+    it->second = free_route_nums_.back();
+    free_route_nums_.pop_back();
+  }
+  return it->second;
+}
+
+// The route number and length of the longest prefix in routes_ that is shorter than a prefix and covers it
+optional<pair<uint32_t, uint8_t>> Router::shorter_route( const uint64_t key )
+{
+  const auto route_prefix = static_cast<uint32_t>( key >> 8 );
+  for ( auto length = static_cast<int>( key & 0xFF ) - 1; length >= 0; --length ) {
+    const uint64_t shorter = route_key( route_prefix, length );
+    if ( routes_.contains( shorter ) ) {
+      return pair { route_num( shorter ), static_cast<uint8_t>( length ) };
+    }
+  }
+  return {};
+}
+
+// Publish the changes made to some prefixes in routes_: copy the current RouteTable (sharing everything with it),
+// bring just those prefixes up to date in the copy, then swap it in for route() to use
+void Router::publish( const vector<uint64_t>& changed )
+{
+  auto table = make_shared<RouteTable>( *route_table_.load() );
+  ++table->generation;
+  table->num_rules = num_rules_;
+
+  for ( const uint64_t key : changed ) {
+    const auto route_prefix = static_cast<uint32_t>( key >> 8 );
+    const auto prefix_length = static_cast<uint8_t>( key & 0xFF );
+    const auto rules = routes_.find( key );
+    if ( rules != routes_.end() ) {
+      const uint32_t num = route_num( key );
+      table->rules.set( num, make_shared<const Rule>( rules->second.front() ) );
+      table->fib.replace( route_prefix, prefix_length, num );
+      continue;
+    }
+
+    // the prefix is gone (unless it was removed and added again, or was never there)
+    const auto num = route_nums_.find( key );
+    if ( num != route_nums_.end() ) {
+      table->fib.remove( route_prefix, prefix_length, shorter_route( key ) );
+      table->rules.set( num->second, nullptr );
+      free_route_nums_.push_back( num->second );
+      route_nums_.erase( num );
+    }
+  }
+
+  route_table_.store( move( table ) );
+}
+
+// Build a new RouteTable from all of routes_ (off to the side), then swap it in for route() to use
+void Router::publish_all()
+{
+  route_nums_.clear();
+  free_route_nums_.clear();
+
+  auto table = make_shared<RouteTable>();
+  table->generation = route_table_.load()->generation + 1;
+  table->num_rules = num_rules_;
+  for ( const auto& [key, rules] : routes_ ) {
+    const uint32_t num = route_num( key );
+    table->rules.set( num, make_shared<const Rule>( rules.front() ) );
+    table->fib.insert( rules.front().route_prefix, rules.front().prefix_length, num );
+  }
+  route_table_.store( move( table ) );
 }
 
 // Go through all the interfaces, and route every incoming datagram to its proper outgoing interface.
 void Router::route()
 {
-  // Iterate through all interfaces and try to send all their incoming datagrams
-  for ( auto& _interface : interfaces_ ) {
-    auto& queue = _interface->datagrams_received();
+  // Hold on to the current routing table (changes published meanwhile take effect on the next call)
+  const shared_ptr<const RouteTable> table = route_table_.load();
+
+  forwarding_.store( workers_.size(), memory_order_relaxed );
+  finished_.store( 0, memory_order_relaxed );
+  if ( workers_.size() > 1 ) {
+    pass_table_ = table;
+    pass_.fetch_add( 1, memory_order_release );
+    pass_.notify_all();
+  }
+
+  forward_pass( *workers_.front(), *table );
+
+  // Wait for the worker threads to finish
+  for ( size_t finished = finished_.load( memory_order_acquire ); finished < workers_.size() - 1;
+        finished = finished_.load( memory_order_acquire ) ) {
+    finished_.wait( finished, memory_order_acquire );
+  }
+  pass_table_.reset();
+
+  for ( auto& worker : workers_ ) {
+    if ( worker->error ) {
+      rethrow_exception( exchange( worker->error, nullptr ) );
+    }
+  }
+}
+
+// One thread's share of route(): forward the datagrams received by this thread's interfaces, and deliver
+// the datagrams that other threads hand over for them
+void Router::forward_pass( Worker& worker, const RouteTable& table )
+{
+  if ( worker.egress.size() < interfaces_.size() ) {
+    worker.egress.resize( interfaces_.size() );
+  }
+
+  for ( size_t i = worker.index; i < interfaces_.size(); i += workers_.size() ) {
+    auto& queue = interfaces_[i]->datagrams_received();
     while ( !queue.empty() ) {
-      auto dgram = queue.front();
-      queue.pop();
-      uint32_t dst_ip = dgram.header.dst;
-      
-      Rule matched_rule;
-      bool first = true;
-      matched_rule.prefix_length = 0;
-      for ( auto& rule : route_table_ ) {
-        /**
-         * Bug: 0.0.0.0/0 should match with any ip, but its prefix_length = 0 (use first to handle this case)
-         */
-        if ( match( rule, dst_ip ) && ( rule.prefix_length > matched_rule.prefix_length || first ) ) {
-          matched_rule = rule;
-          first = false;
-        }
+      worker.burst.clear();
+      while ( !queue.empty() && worker.burst.size() < burst_size_ ) {
+        worker.burst.push_back( std::move( queue.front() ) );
+        queue.pop();
       }
-      /**
-       * Bug1: 0.0.0.0/0 should match with any ip, but its prefix_length = 0 (use first to handle this case)
-       * Bug2: datagram can be sent only if ttl >= 2
-       */
-      if ( ( matched_rule.prefix_length > 0 || !first ) && dgram.header.ttl > 1 ) {
-        auto next_hop = matched_rule.next_hop.has_value() ? matched_rule.next_hop.value() : Address::from_ipv4_numeric( dst_ip );        
-        auto matched_interface = interface( matched_rule.interface_num );
-        --dgram.header.ttl;
-        matched_interface->send_datagram( dgram, next_hop );
+      try {
+        forward_burst( worker, table, i );
+      } catch ( ... ) {
+        if ( !worker.error ) {
+          worker.error = current_exception();
+        }
       }
     }
   }
+
+  // Other threads may still hand over datagrams until they have all finished forwarding
+  forwarding_.fetch_sub( 1, memory_order_acq_rel );
+  while ( forwarding_.load( memory_order_acquire ) > 0 ) {
+    if ( !drain_inbox( worker ) ) {
+      this_thread::yield();
+    }
+  }
+  drain_inbox( worker );
+}
+
+// Forward a burst of datagrams that arrived on one interface
+void Router::forward_burst( Worker& worker, const RouteTable& table, const size_t ingress )
+{
+  // Start loading every route cache entry the burst needs, so the misses overlap
+  for ( const auto& dgram : worker.burst ) {
+    __builtin_prefetch( &worker.route_cache[route_cache_slot( dgram.header.dst )] );
+  }
+
+  // Route each datagram (sending ICMP errors as needed), collecting them by outgoing interface...
+  for ( auto& dgram : worker.burst ) {
+    forward( worker, table, std::move( dgram ), ingress );
+  }
+
+  // ...and hand each interface its share at once
+  send_egress( worker );
 }
 
-auto Router::match( const Rule& rule, const uint32_t ip ) -> bool 
+void Router::forward( Worker& worker, const RouteTable& table, InternetDatagram dgram, const size_t ingress )
 {
+  const CachedRoute& matched_route = lookup_route( worker, table, dgram.header.dst );
+
+  if ( !matched_route.rule ) {
+    send_icmp_error(
+      worker, table, dgram, ingress, ICMPMessage::TYPE_DESTINATION_UNREACHABLE, ICMPMessage::CODE_NETWORK_UNREACHABLE );
+    return;
+  }
+
   /**
-   * Bug: 0.0.0.0/0 should match with any ip, but its prefix_length = 0
+   * Bug: datagram can be sent only if ttl >= 2
    */
-  if ( rule.prefix_length == 0 ) return true;
-  uint8_t shift = 32 - rule.prefix_length;
-  return (rule.route_prefix >> shift) == (ip >> shift);
-}
\ No newline at end of file
+  if ( dgram.header.ttl <= 1 ) {
+    send_icmp_error( worker, table, dgram, ingress, ICMPMessage::TYPE_TIME_EXCEEDED, ICMPMessage::CODE_TTL_EXCEEDED );
+    return;
+  }
+  dgram.header.decrement_ttl();
+
+  send_on_route( worker, matched_route, std::move( dgram ) );
+}
+
+// Send a datagram on (one of the paths of) its route
+void Router::send_on_route( Worker& worker, const CachedRoute& route, InternetDatagram dgram )
+{
+  // Pick one of the route's paths by flow hash
+  const Rule& rule = *route.rule;
+  size_t path_num = 0;
+  if ( rule.paths.size() > 1 ) {
+    const uint64_t hash = flow_hash( dgram );
+    ++worker.flow_hash_histogram[hash >> ( 64 - bit_width( FLOW_HASH_BUCKETS - 1 ) )];
+    path_num = ( ( hash & UINT32_MAX ) * rule.paths.size() ) >> 32;
+    ( *rule.path_counts )[path_num].fetch_add( 1, memory_order_relaxed );
+  }
+  const NextHop& path = rule.paths[path_num];
+  const Address& next_hop = path.address.has_value() ? *path.address : *route.direct_next_hop;
+
+  const size_t owner = path.interface_num % workers_.size();
+  if ( owner == worker.index ) {
+    // (sent by send_egress() at the end of the burst)
+    auto& batch = worker.egress.at( path.interface_num );
+    batch.dgrams.push_back( std::move( dgram ) );
+    batch.next_hops.push_back( next_hop );
+    return;
+  }
+
+  Handoff handoff { std::move( dgram ), next_hop, path.interface_num };
+  while ( !workers_[owner]->inbox.push( std::move( handoff ) ) ) {
+    // The owner's queue is full: deliver some of our own handoffs while it catches up
+    if ( !drain_inbox( worker ) ) {
+      this_thread::yield();
+    }
+  }
+}
+
+// Tell the sender of a datagram that it could not be forwarded, with an ICMP error message from the interface
+// it arrived on, quoting its header and the first bytes of its payload (RFC 792 and RFC 1812 section 4.3)
+void Router::send_icmp_error( Worker& worker,
+                              const RouteTable& table,
+                              const InternetDatagram& offending,
+                              const size_t ingress,
+                              const uint8_t type,
+                              const uint8_t code )
+{
+  // Never answer a fragment other than the first, a datagram without a unicast source, or another ICMP error
+  const uint32_t src = offending.header.src;
+  if ( offending.header.offset != 0 || src == 0 || src >= 0xE0000000 || ( src >> 24 ) == 127 ) {
+    return;
+  }
+  if ( offending.header.proto == IPv4Header::PROTO_ICMP && !offending.payload.empty()
+       && ICMPMessage::is_error( static_cast<uint8_t>( offending.payload.front().data()[0] ) ) ) {
+    return;
+  }
+
+  if ( !icmp_limiter_.take() ) {
+    ++worker.icmp_stats.rate_limited;
+    return;
+  }
+
+  ICMPMessage icmp;
+  icmp.type = type;
+  icmp.code = code;
+  {
+    // (the header's bytes as they arrived, options and all, unless the datagram was never parsed from bytes)
+    Serializer quote;
+    if ( offending.parsed_header.has_value() ) {
+      quote.buffer( offending.parsed_header->second );
+    } else {
+      offending.header.serialize( quote );
+    }
+    BufferChain payload = offending.payload;
+    payload.truncate( ICMPMessage::QUOTED_PAYLOAD_LENGTH );
+    quote.buffer( payload );
+    icmp.data = quote.finish();
+  }
+  icmp.compute_checksum();
+
+  InternetDatagram dgram;
+  dgram.header.ttl = IPv4Header::DEFAULT_TTL;
+  dgram.header.proto = IPv4Header::PROTO_ICMP;
+  dgram.header.src = interfaces_.at( ingress )->ip_address().ipv4_numeric();
+  dgram.header.dst = src;
+  dgram.payload = serialize( icmp );
+  dgram.header.len = dgram.header.hlen * 4 + dgram.payload.total_size();
+  dgram.header.compute_checksum();
+
+  const CachedRoute& route = lookup_route( worker, table, src );
+  if ( route.rule ) {
+    ++worker.icmp_stats.sent;
+    send_on_route( worker, route, std::move( dgram ) );
+  }
+}
+
+// Send the datagrams of a burst bound for this thread's own interfaces
+void Router::send_egress( Worker& worker )
+{
+  for ( size_t i = worker.index; i < worker.egress.size(); i += workers_.size() ) {
+    auto& batch = worker.egress[i];
+    if ( !batch.dgrams.empty() ) {
+      interfaces_[i]->send_datagrams( batch.dgrams, batch.next_hops );
+      batch.dgrams.clear();
+      batch.next_hops.clear();
+    }
+  }
+}
+
+// Send the datagrams other threads have handed over; returns false if there were none
+bool Router::drain_inbox( Worker& worker )
+{
+  bool any = false;
+  while ( auto handoff = worker.inbox.pop() ) {
+    any = true;
+    try {
+      interfaces_.at( handoff->interface_num )->send_datagram( std::move( handoff->dgram ), handoff->next_hop );
+    } catch ( ... ) {
+      if ( !worker.error ) {
+        worker.error = current_exception();
+      }
+    }
+  }
+  return any;
+}
+
+Router::Router()
+{
+  set_forwarding_threads( 1 );
+}
+
+Router::~Router()
+{
+  stop_workers();
+}
+
+void Router::set_forwarding_threads( const size_t num_threads )
+{
+  if ( num_threads == 0 ) {
+    throw runtime_error( "Router needs at least one forwarding thread" );
+  }
+
+  stop_workers();
+  workers_.clear();
+  for ( size_t i = 0; i < num_threads; ++i ) {
+    workers_.push_back( make_unique<Worker>( i ) );
+  }
+
+  const uint64_t pass = pass_.load();
+  for ( size_t i = 1; i < num_threads; ++i ) {
+    workers_[i]->thread = thread( [this, &worker = *workers_[i], pass] { worker_loop( worker, pass ); } );
+  }
+}
+
+void Router::set_burst_size( const size_t datagrams )
+{
+  if ( datagrams == 0 ) {
+    throw runtime_error( "Router burst size must be at least 1" );
+  }
+  burst_size_ = datagrams;
+}
+
+void Router::worker_loop( Worker& worker, uint64_t pass )
+{
+  while ( true ) {
+    pass_.wait( pass, memory_order_acquire );
+    pass = pass_.load( memory_order_acquire );
+    if ( stopping_.load( memory_order_acquire ) ) {
+      return;
+    }
+
+    forward_pass( worker, *pass_table_ );
+
+    finished_.fetch_add( 1, memory_order_release );
+    finished_.notify_all();
+  }
+}
+
+void Router::stop_workers()
+{
+  stopping_.store( true, memory_order_release );
+  pass_.fetch_add( 1, memory_order_release );
+  pass_.notify_all();
+  for ( auto& worker : workers_ ) {
+    if ( worker->thread.joinable() ) {
+      worker->thread.join();
+    }
+  }
+  stopping_.store( false, memory_order_relaxed );
+}
+
+auto Router::route_for( const uint32_t dst_ip ) const -> optional<MatchedRoute>
+{
+  const auto table = route_table_.load();
+  const auto route_num = table->fib.lookup( dst_ip );
+  if ( !route_num.has_value() ) {
+    return {};
+  }
+  const Rule& rule = table->rules[*route_num];
+  return MatchedRoute { rule.route_prefix, rule.prefix_length, rule.paths };
+}
+
+vector<uint64_t> Router::path_counts( const uint32_t route_prefix, const uint8_t prefix_length ) const
+{
+  const lock_guard lock { update_mutex_ };
+  const auto it = routes_.find( route_key( route_prefix, prefix_length ) );
+  if ( it == routes_.end() || !it->second.front().path_counts ) {
+    return {};
+  }
+
+  vector<uint64_t> ret;
+  for ( const auto& count : *it->second.front().path_counts ) {
+    ret.push_back( count.load( memory_order_relaxed ) );
+  }
+  return ret;
+}
+
+array<uint64_t, Router::FLOW_HASH_BUCKETS> Router::flow_hash_histogram() const
+{
+  array<uint64_t, FLOW_HASH_BUCKETS> ret {};
+  for ( const auto& worker : workers_ ) {
+    for ( size_t i = 0; i < FLOW_HASH_BUCKETS; ++i ) {
+      ret.at( i ) += worker->flow_hash_histogram.at( i );
+    }
+  }
+  return ret;
+}
+
+Router::ICMPStats Router::icmp_stats() const
+{
+  ICMPStats ret;
+  for ( const auto& worker : workers_ ) {
+    ret.sent += worker->icmp_stats.sent;
+    ret.rate_limited += worker->icmp_stats.rate_limited;
+  }
+  return ret;
+}
+
+Router::RouteCacheStats Router::route_cache_stats() const
+{
+  RouteCacheStats ret;
+  for ( const auto& worker : workers_ ) {
+    ret.hits += worker->route_cache_stats.hits;
+    ret.misses += worker->route_cache_stats.misses;
+  }
+  return ret;
+}
+
+// Fibonacci hashing spreads neighbouring addresses across the cache
+size_t Router::route_cache_slot( const uint32_t dst_ip )
+{
+  return ( dst_ip * 0x9E3779B1U ) >> ( 32 - ROUTE_CACHE_BITS );
+}
+
+// Find the route for a destination, consulting the forwarding table only if the destination is not in the cache
+auto Router::lookup_route( Worker& worker, const RouteTable& table, const uint32_t dst_ip ) -> const CachedRoute&
+{
+  CachedRoute& entry = worker.route_cache[route_cache_slot( dst_ip )];
+  if ( entry.generation == table.generation && entry.dst == dst_ip ) {
+    ++worker.route_cache_stats.hits;
+    return entry;
+  }
+
+  ++worker.route_cache_stats.misses;
+  entry.generation = table.generation;
+  entry.dst = dst_ip;
+
+  const auto route_num = table.fib.lookup( dst_ip );
+  entry.rule = route_num.has_value() ? &table.rules[*route_num] : nullptr;
+  entry.direct_next_hop.reset();
+  if ( entry.rule && ranges::any_of( entry.rule->paths, []( const auto& p ) { return !p.address.has_value(); } ) ) {
+    entry.direct_next_hop = Address::from_ipv4_numeric( dst_ip );
+  }
+  return entry;
+}
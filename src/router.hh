@@ -1,15 +1,35 @@
 #pragma once
 
 #include "exception.hh"
+#include "forwarding_table.hh"
+#include "mpsc_queue.hh"
 #include "network_interface.hh"
+#include "token_bucket.hh"
 
+#include <array>
+#include <atomic>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
 
 // \brief A router that has multiple network interfaces and
 // performs longest-prefix-match routing between them.
 class Router
 {
 public:
+  Router();
+  ~Router();
+
+  Router( const Router& other ) = delete;
+  Router( Router&& other ) = delete;
+  Router& operator=( const Router& other ) = delete;
+  Router& operator=( Router&& other ) = delete;
+
   // Add an interface to the router
   // \param[in] interface an already-constructed network interface
   // \returns The index of the interface after it has been added to the router
@@ -28,21 +48,256 @@ public:
                   std::optional<Address> next_hop,
                   size_t interface_num );
 
-  // Route packets between the interfaces
+  // One path of a route: the next hop (empty if directly attached) and the interface to send on
+  struct NextHop
+  {
+    std::optional<Address> address {};
+    size_t interface_num {};
+  };
+
+  // Add an equal-cost multipath route. Each datagram takes one of the paths, chosen by a hash of its
+  // addresses, protocol and (for TCP and UDP) ports, so all the datagrams of a flow take the same path.
+  void add_route( uint32_t route_prefix, uint8_t prefix_length, std::vector<NextHop> paths );
+
+  // Remove every route for a prefix
+  // \returns false if there was no route for the prefix
+  bool remove_route( uint32_t route_prefix, uint8_t prefix_length );
+
+  // Replace every route for a prefix with a new one (or add it, if there was none)
+  void replace_route( uint32_t route_prefix,
+                      uint8_t prefix_length,
+                      std::optional<Address> next_hop,
+                      size_t interface_num );
+
+  void replace_route( uint32_t route_prefix, uint8_t prefix_length, std::vector<NextHop> paths );
+
+  // A change to the routing table
+  struct RouteChange
+  {
+    enum class Type : uint8_t
+    {
+      Add,
+      Remove,
+      Replace
+    };
+
+    Type type {};
+    uint32_t route_prefix {};
+    uint8_t prefix_length {};
+    std::vector<NextHop> paths {}; // ignored by Remove
+  };
+
+  // Apply a batch of changes in order, publishing the resulting table once
+  // (much faster than making many changes one at a time). If any change is invalid, none is made.
+  void update_routes( const std::vector<RouteChange>& changes );
+
+  // Replace the whole routing table with the routes listed in a file, one per line:
+  //   <prefix>/<length> <next hop, or "direct"> <interface number> [<next hop> <interface number>...]
+  // (more than one path makes a multipath route)
+  // Blank lines and lines starting with '#' are ignored.
+  void load_routes( const std::string& filename );
+
+  // Number of routes in the routing table
+  size_t num_routes() const { return route_table_.load()->num_rules; }
+
+  // The route that a datagram to `dst_ip` would take in the published table (empty if none matches)
+  struct MatchedRoute
+  {
+    uint32_t route_prefix {};
+    uint8_t prefix_length {};
+    std::vector<NextHop> paths {};
+  };
+
+  std::optional<MatchedRoute> route_for( uint32_t dst_ip ) const;
+
+  // Route packets between the interfaces. A datagram that cannot be forwarded (because there is no route, or
+  // its TTL has run out) is answered with an ICMP Destination Unreachable or Time Exceeded message.
   void route();
 
+  // Called periodically when time elapses (refills the ICMP rate limiter)
+  void tick( size_t ms_since_last_tick ) { icmp_limiter_.tick( ms_since_last_tick ); }
+
+  // Send at most `per_second` ICMP error messages per second on average, in bursts of up to `burst`
+  // (a burst of 0 turns them off)
+  void set_icmp_rate_limit( uint64_t per_second, uint64_t burst ) { icmp_limiter_.set_rate( per_second, burst ); }
+
+  struct ICMPStats
+  {
+    uint64_t sent {};         // ICMP error messages sent
+    uint64_t rate_limited {}; // ICMP error messages suppressed by the rate limiter
+  };
+
+  // Totals over all forwarding threads
+  ICMPStats icmp_stats() const;
+
+  // Forward with `num_threads` threads: the thread that calls route(), plus num_threads - 1 workers.
+  // Interface N belongs to thread N % num_threads, and only that thread drains the interface's received
+  // datagrams or calls its send_datagram(), so no NetworkInterface (or its OutputPort) is ever used by
+  // two threads at once. A datagram bound for another thread's interface is handed to that thread through
+  // its lock-free queue. route() returns once every thread has finished. Must not be called during route().
+  void set_forwarding_threads( size_t num_threads );
+
+  size_t forwarding_threads() const { return workers_.size(); }
+
+  // Forward the datagrams received on each interface in bursts of up to `datagrams` (vector-packet-processing
+  // style): prefetch the route cache entries of the whole burst, then route and check each datagram, then
+  // hand every outgoing interface its share of the burst with one send_datagrams(). A burst size of 1
+  // forwards one datagram at a time. Must not be called during route().
+  void set_burst_size( size_t datagrams );
+
+  size_t burst_size() const { return burst_size_; }
+
+  struct RouteCacheStats
+  {
+    uint64_t hits {};   // destinations found in the route cache
+    uint64_t misses {}; // destinations that needed a forwarding-table lookup
+  };
+
+  // Totals over all forwarding threads
+  RouteCacheStats route_cache_stats() const;
+
+  // The number of datagrams sent on each path of a multipath route (the first one for this prefix)
+  std::vector<uint64_t> path_counts( uint32_t route_prefix, uint8_t prefix_length ) const;
+
+  // How the flow hashes of datagrams sent on multipath routes are spread: the number of datagrams
+  // whose hash fell in each sixteenth of the hash space (totals over all forwarding threads)
+  static constexpr size_t FLOW_HASH_BUCKETS = 16;
+  std::array<uint64_t, FLOW_HASH_BUCKETS> flow_hash_histogram() const;
+
 private:
   struct Rule {
     uint32_t route_prefix{};
     uint8_t prefix_length{};
-    std::optional<Address> next_hop{};
-    size_t interface_num{};
-  };
+    std::vector<NextHop> paths{};
 
-  auto match( const Rule& rule, const uint32_t ip ) -> bool;
+    // datagrams sent on each path (kept for multipath routes only, and shared by every snapshot of the rule)
+    std::shared_ptr<std::vector<std::atomic<uint64_t>>> path_counts{};
+  };
 
   // The router's collection of network interfaces
   std::vector<std::shared_ptr<NetworkInterface>> interfaces_ {};
 
-  std::vector<Rule> route_table_{};
+  // The rules of a routing table by route number (the first rule for each prefix), in chunks that a copy of the
+  // table shares until it changes them: changing a rule copies only its chunk (and the list of chunks)
+  class RuleArray
+  {
+    static constexpr size_t CHUNK_SIZE = 256;
+    using Chunk = std::array<std::shared_ptr<const Rule>, CHUNK_SIZE>;
+    std::vector<std::shared_ptr<Chunk>> chunks_ {};
+
+  public:
+    const Rule& operator[]( uint32_t route_num ) const
+    {
+      return *( *chunks_[route_num / CHUNK_SIZE] )[route_num % CHUNK_SIZE];
+    }
+    void set( uint32_t route_num, std::shared_ptr<const Rule> rule );
+  };
+
+  // An immutable snapshot of the routing table. Route changes build a new one (the "shadow" table)
+  // and publish it with a single atomic store, so route() never waits for a change to finish or sees
+  // a half-built table. A snapshot is freed when the last reader lets go of it. Each snapshot starts as
+  // a copy of the one before, sharing all but the parts of its rules and forwarding table that change.
+  struct RouteTable
+  {
+    RuleArray rules {};
+    ForwardingTable fib {}; // longest-prefix-match index into rules
+    size_t num_rules {};    // including the rules for a prefix after the first
+    uint64_t generation {}; // identifies this snapshot's entries in the route cache
+  };
+
+  std::atomic<std::shared_ptr<const RouteTable>> route_table_ {
+    std::make_shared<const RouteTable>( RouteTable { .generation = 1 } ) };
+
+  // The authoritative list of routes, keyed by (prefix, length), with the number of rules in it and the route
+  // number of each prefix in the published table; only touched while holding update_mutex_
+  std::map<uint64_t, std::vector<Rule>> routes_ {};
+  size_t num_rules_ {};
+  std::map<uint64_t, uint32_t> route_nums_ {};
+  std::vector<uint32_t> free_route_nums_ {};
+  mutable std::mutex update_mutex_ {};
+
+  static uint64_t route_key( uint32_t route_prefix, uint8_t prefix_length );
+  static Rule make_rule( uint32_t route_prefix, uint8_t prefix_length, std::vector<NextHop> paths );
+  bool apply( RouteChange::Type type, uint64_t key, std::optional<Rule> rule );
+  uint32_t route_num( uint64_t key );
+  std::optional<std::pair<uint32_t, uint8_t>> shorter_route( uint64_t key );
+  void publish( const std::vector<uint64_t>& changed );
+  void publish_all();
+
+  // A direct-mapped cache of recently routed destinations, in front of the forwarding table
+  struct CachedRoute
+  {
+    uint64_t generation {};                    // entry is valid only for the RouteTable of this generation
+    uint32_t dst {};                           // destination IP address
+    const Rule* rule {};                       // matching rule in that RouteTable (null if there is no route)
+    std::optional<Address> direct_next_hop {}; // the destination's Address, if a path is directly attached
+  };
+
+  static constexpr size_t ROUTE_CACHE_BITS = 12;
+  static constexpr size_t INBOX_CAPACITY = 4096;
+  static constexpr size_t DEFAULT_BURST_SIZE = 32;
+
+  size_t burst_size_ = DEFAULT_BURST_SIZE;
+
+  // The datagrams of a burst bound for one outgoing interface
+  struct EgressBatch
+  {
+    std::vector<InternetDatagram> dgrams {};
+    std::vector<Address> next_hops {};
+  };
+
+  // A datagram handed from one forwarding thread to the thread that owns its outgoing interface
+  struct Handoff
+  {
+    InternetDatagram dgram;
+    Address next_hop;
+    size_t interface_num;
+  };
+
+  // The state of one forwarding thread
+  struct Worker
+  {
+    explicit Worker( size_t i ) : index( i ) {}
+
+    size_t index;
+    std::vector<CachedRoute> route_cache = std::vector<CachedRoute>( 1UL << ROUTE_CACHE_BITS );
+    RouteCacheStats route_cache_stats {};
+    ICMPStats icmp_stats {};
+    std::array<uint64_t, FLOW_HASH_BUCKETS> flow_hash_histogram {};
+    MPSCQueue<Handoff> inbox { INBOX_CAPACITY };
+    std::vector<InternetDatagram> burst {}; // the burst being forwarded
+    std::vector<EgressBatch> egress {};     // its datagrams for each of this thread's interfaces
+    std::exception_ptr error {}; // first exception thrown while forwarding (rethrown by route())
+    std::thread thread {};       // (none for worker 0, which is the thread calling route())
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_ {};
+
+  std::atomic<uint64_t> pass_ {};     // advanced by route() to start the worker threads
+  std::atomic<size_t> forwarding_ {}; // threads still forwarding datagrams from their own interfaces
+  std::atomic<size_t> finished_ {};   // worker threads done with the current pass
+  std::atomic<bool> stopping_ {};
+  std::shared_ptr<const RouteTable> pass_table_ {};
+
+  static constexpr uint64_t DEFAULT_ICMP_RATE = 1000; // per second
+  static constexpr uint64_t DEFAULT_ICMP_BURST = 50;
+  TokenBucket icmp_limiter_ { DEFAULT_ICMP_RATE, DEFAULT_ICMP_BURST };
+
+  void worker_loop( Worker& worker, uint64_t pass );
+  void stop_workers();
+  void forward_pass( Worker& worker, const RouteTable& table );
+  void forward_burst( Worker& worker, const RouteTable& table, size_t ingress );
+  void forward( Worker& worker, const RouteTable& table, InternetDatagram dgram, size_t ingress );
+  void send_egress( Worker& worker );
+  void send_on_route( Worker& worker, const CachedRoute& route, InternetDatagram dgram );
+  void send_icmp_error( Worker& worker,
+                        const RouteTable& table,
+                        const InternetDatagram& offending,
+                        size_t ingress,
+                        uint8_t type,
+                        uint8_t code );
+  bool drain_inbox( Worker& worker );
+
+  static size_t route_cache_slot( uint32_t dst_ip );
+  const CachedRoute& lookup_route( Worker& worker, const RouteTable& table, uint32_t dst_ip );
 };
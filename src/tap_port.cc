@@ -0,0 +1,243 @@
+#include "tap_port.hh"
+
+#include "exception.hh"
+#include "helpers.hh"
+#include "packet_pool.hh"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+TapPort::TapPort( const string& devname, const size_t num_queues, const Mode mode )
+{
+  if ( num_queues == 0 ) {
+    throw runtime_error( "TapPort needs at least one queue" );
+  }
+
+  queues_.reserve( num_queues );
+  for ( size_t i = 0; i < num_queues; ++i ) {
+    queues_.emplace_back( devname, num_queues > 1 );
+    queues_.back().set_blocking( false );
+  }
+  burst_.reserve( BURST );
+
+  if ( mode == Mode::IoUring ) {
+    try {
+      setup_io_uring();
+    } catch ( const unix_error& ) {
+      uring_.reset(); // (io_uring is too old, or disabled)
+      rx_buffers_ = {};
+    }
+  }
+}
+
+void TapPort::setup_io_uring()
+{
+  uring_ = make_unique<IoUring>( 2 * BURST );
+
+  vector<int> fds;
+  for ( const auto& fd : queues_ ) {
+    fds.push_back( fd.fd_num() );
+  }
+  uring_->register_files( fds );
+
+  rx_buffers_.resize( queues_.size() * BURST * PacketPool::JUMBO_CAPACITY );
+  vector<iovec> buffers;
+  for ( size_t queue = 0; queue < queues_.size(); ++queue ) {
+    for ( size_t i = 0; i < BURST; ++i ) {
+      buffers.push_back( { rx_buffer( queue, i ), PacketPool::JUMBO_CAPACITY } );
+    }
+  }
+  uring_->register_buffers( buffers );
+}
+
+void TapPort::transmit( const NetworkInterface& sender, const EthernetFrame& frame )
+{
+  transmit_batch( sender, span { &frame, 1 } );
+}
+
+void TapPort::transmit_batch( const NetworkInterface& sender [[maybe_unused]], span<const EthernetFrame> frames )
+{
+  if ( uring_ ) {
+    write_io_uring( frames );
+    return;
+  }
+
+  for ( const auto& frame : frames ) {
+    // Like a NIC whose link is down, drop what the device won't take rather than stop the sender
+    try {
+      ++stats_.system_calls;
+      queues_[queue_for( frame )].write( serialize( frame ) );
+      ++stats_.frames_sent;
+    } catch ( const runtime_error& ) {
+      ++stats_.send_errors;
+    }
+  }
+}
+
+// Submit a writev per frame (as many at a time as the ring holds), and wait for them to finish
+void TapPort::write_io_uring( span<const EthernetFrame> frames )
+{
+  while ( not frames.empty() ) {
+    const auto chunk = frames.first( min( frames.size(), static_cast<size_t>( uring_->queue_size() ) ) );
+    frames = frames.subspan( chunk.size() );
+
+    tx_chains_.clear();
+    tx_iovecs_.clear();
+    size_t num_iovecs = 0;
+    for ( const auto& frame : chunk ) {
+      tx_chains_.push_back( serialize( frame ) );
+      num_iovecs += tx_chains_.back().size();
+    }
+    tx_iovecs_.reserve( num_iovecs ); // (so that the iovecs stay put once the kernel has their addresses)
+
+    for ( size_t i = 0; i < chunk.size(); ++i ) {
+      const size_t first_iovec = tx_iovecs_.size();
+      for ( const auto& buffer : tx_chains_[i] ) {
+        tx_iovecs_.push_back( { const_cast<char*>( buffer.data() ), buffer.size() } ); // NOLINT(*-const-cast)
+      }
+
+      io_uring_sqe* sqe = notnull( "IoUring::get_sqe", uring_->get_sqe() );
+      sqe->opcode = IORING_OP_WRITEV;
+      sqe->flags = IOSQE_FIXED_FILE;
+      sqe->fd = static_cast<int>( queue_for( chunk[i] ) );
+      sqe->addr = reinterpret_cast<uint64_t>( &tx_iovecs_[first_iovec] ); // NOLINT(*-reinterpret-cast)
+      sqe->len = static_cast<uint32_t>( tx_chains_[i].size() );
+      sqe->user_data = i;
+    }
+
+    ++stats_.system_calls;
+    uring_->submit( chunk.size() );
+    uring_->reap( [&]( const io_uring_cqe& cqe ) {
+      // as with write(), drop what the device won't take
+      if ( cqe.res < 0 ) {
+        ++stats_.send_errors;
+      } else {
+        queues_[queue_for( chunk[cqe.user_data] )].register_write();
+        ++stats_.frames_sent;
+      }
+    } );
+  }
+}
+
+size_t TapPort::receive( NetworkInterface& interface, const size_t queue )
+{
+  if ( queue >= queues_.size() ) {
+    throw out_of_range( "TapPort: no queue " + to_string( queue ) );
+  }
+
+  burst_.clear();
+  if ( uring_ ) {
+    read_burst_io_uring( queue );
+  } else {
+    read_burst( queue );
+  }
+
+  if ( burst_.empty() ) {
+    return 0;
+  }
+
+  stats_.frames_received += burst_.size();
+  ++stats_.receive_calls;
+  interface.recv_frames( burst_ );
+  return burst_.size();
+}
+
+void TapPort::read_burst( const size_t queue )
+{
+  TapFD& fd = queues_[queue];
+
+  while ( burst_.size() < BURST ) {
+    string buffer = PacketPool::take( PacketPool::JUMBO_CAPACITY );
+    buffer.resize_and_overwrite( PacketPool::JUMBO_CAPACITY, []( char*, const size_t n ) { return n; } );
+    ++stats_.system_calls;
+    fd.read( buffer );
+    if ( buffer.empty() ) { // nothing more to read for now
+      PacketPool::give( std::move( buffer ) );
+      break;
+    }
+
+    EthernetFrame frame;
+    if ( parse( frame, array { std::move( buffer ) } ) ) {
+      burst_.push_back( std::move( frame ) );
+    }
+  }
+}
+
+// Submit BURST reads of the queue at once, into its registered buffers. Each read finishes during the
+// submission: with a frame, or with EAGAIN once there are none left.
+void TapPort::read_burst_io_uring( const size_t queue )
+{
+  for ( size_t i = 0; i < BURST; ++i ) {
+    io_uring_sqe* sqe = notnull( "IoUring::get_sqe", uring_->get_sqe() );
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = static_cast<int>( queue );
+    sqe->addr = reinterpret_cast<uint64_t>( rx_buffer( queue, i ) ); // NOLINT(*-reinterpret-cast)
+    sqe->len = PacketPool::JUMBO_CAPACITY;
+    sqe->buf_index = static_cast<uint16_t>( queue * BURST + i );
+    sqe->rw_flags = RWF_NOWAIT; // (or the ring would wait for a frame, instead of finishing with EAGAIN)
+    sqe->user_data = i;
+  }
+
+  ++stats_.system_calls;
+  uring_->submit( BURST );
+  queues_[queue].register_read();
+
+  array<int, BURST> lengths {};
+  uring_->reap( [&]( const io_uring_cqe& cqe ) { lengths.at( cqe.user_data ) = cqe.res; } );
+
+  for ( size_t i = 0; i < BURST; ++i ) { // (in the order the reads were submitted, which is the frames' order)
+    if ( lengths[i] == -EAGAIN ) {
+      continue;
+    }
+    if ( lengths[i] < 0 ) {
+      throw unix_error( "read (io_uring)", -lengths[i] );
+    }
+
+    string buffer = PacketPool::take( PacketPool::JUMBO_CAPACITY );
+    buffer.assign( rx_buffer( queue, i ), static_cast<size_t>( lengths[i] ) );
+
+    EthernetFrame frame;
+    if ( parse( frame, array { std::move( buffer ) } ) ) {
+      burst_.push_back( std::move( frame ) );
+    }
+  }
+}
+
+char* TapPort::rx_buffer( const size_t queue, const size_t i )
+{
+  return &rx_buffers_[( queue * BURST + i ) * PacketPool::JUMBO_CAPACITY];
+}
+
+void TapPort::add_to( EventLoop& loop, NetworkInterface& interface )
+{
+  for ( size_t i = 0; i < queues_.size(); ++i ) {
+    loop.add_rule( interface.name() + " queue " + to_string( i ), queues_[i], Direction::In, [this, &interface, i] {
+      receive( interface, i );
+    } );
+  }
+}
+
+// Pick the queue for a frame: frames between the same two IPv4 addresses (in either direction) share a queue
+size_t TapPort::queue_for( const EthernetFrame& frame ) const
+{
+  if ( queues_.size() == 1 ) {
+    return 0;
+  }
+
+  uint32_t key = 0;
+  if ( frame.header.type == EthernetHeader::TYPE_IPv4 and not frame.payload.empty() ) {
+    const string_view header = frame.payload.front();
+    if ( header.size() >= IPv4Header::LENGTH ) {
+      for ( size_t i = 12; i < 16; ++i ) { // source and destination addresses
+        key = ( key << 8 ) | ( static_cast<uint8_t>( header[i] ) ^ static_cast<uint8_t>( header[i + 4] ) );
+      }
+    }
+  }
+  return ( static_cast<uint64_t>( key * 0x9E3779B1U ) * queues_.size() ) >> 32;
+}
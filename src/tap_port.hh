@@ -0,0 +1,90 @@
+#pragma once
+
+#include "eventloop.hh"
+#include "io_uring.hh"
+#include "network_interface.hh"
+#include "tun.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+// \brief An OutputPort that connects a NetworkInterface to a Linux TAP device.
+//
+// Frames the interface sends are written to the device, and frames the kernel sends to the device are read
+// (BURST at a time) and passed to the interface's recv_frames(), from an EventLoop rule or by calling
+// receive() directly. A TAP fd carries one frame per read or write, so with Mode::Syscalls what a burst
+// saves is the trip through the event loop and the interface for each frame, not system calls.
+//
+// With Mode::IoUring (the default, where the kernel supports it), each burst costs one system call: a
+// receive() submits BURST reads at once to an io_uring, into buffers and fds registered with the ring in
+// advance (so the kernel skips looking them up and pinning the pages on every read), and copies what
+// arrives into pooled strings; a transmit_batch() submits a write per frame, all at once.
+//
+// A device created with `multi_queue` can be opened with several queues. The kernel spreads the flows it
+// sends across the queues, and the port spreads the frames it writes across them the same way (by a hash
+// of the IPv4 addresses), so no flow is reordered. Every queue feeds the same NetworkInterface, so all of
+// a port's queues must be serviced by the thread that owns the interface.
+class TapPort : public NetworkInterface::OutputPort
+{
+public:
+  static constexpr size_t BURST = 32; // most frames read from a queue on each call to receive()
+
+  // How the port reads and writes frames
+  enum class Mode : uint8_t
+  {
+    Syscalls, // a read() or write() per frame (and a read() that finds no frame to end each burst)
+    IoUring   // one io_uring_enter() per burst
+  };
+
+  struct Stats
+  {
+    uint64_t frames_received {};
+    uint64_t frames_sent {};
+    uint64_t receive_calls {}; // calls to receive() that found at least one frame
+    uint64_t send_errors {};   // frames the device refused (e.g. because it is down)
+    uint64_t system_calls {};  // reads, writes and io_uring_enters
+  };
+
+  // Open a TAP device (with IFF_MULTI_QUEUE if num_queues > 1). The fds are non-blocking.
+  // Mode::IoUring falls back to Mode::Syscalls if io_uring is unavailable.
+  explicit TapPort( const std::string& devname, size_t num_queues = 1, Mode mode = Mode::IoUring );
+
+  void transmit( const NetworkInterface& sender, const EthernetFrame& frame ) override;
+  void transmit_batch( const NetworkInterface& sender, std::span<const EthernetFrame> frames ) override;
+
+  // Read up to BURST frames from one queue and pass them to the interface
+  // \returns the number of frames read
+  size_t receive( NetworkInterface& interface, size_t queue = 0 );
+
+  // Have an EventLoop call receive() whenever one of the queues is readable
+  void add_to( EventLoop& loop, NetworkInterface& interface );
+
+  size_t num_queues() const { return queues_.size(); }
+  TapFD& queue( const size_t N ) { return queues_.at( N ); }
+  const Stats& stats() const { return stats_; }
+  Mode mode() const { return uring_ ? Mode::IoUring : Mode::Syscalls; }
+
+private:
+  std::vector<TapFD> queues_ {};
+  std::vector<EthernetFrame> burst_ {};
+  Stats stats_ {};
+
+  // With Mode::IoUring: the ring (with the queues registered as its fixed files), the receive buffers
+  // registered with it (BURST frames per queue), and the frames being written
+  std::unique_ptr<IoUring> uring_ {};
+  std::vector<char> rx_buffers_ {};
+  std::vector<BufferChain> tx_chains_ {};
+  std::vector<iovec> tx_iovecs_ {};
+
+  void setup_io_uring();
+  void read_burst( size_t queue );
+  void read_burst_io_uring( size_t queue );
+  void write_io_uring( std::span<const EthernetFrame> frames );
+
+  size_t queue_for( const EthernetFrame& frame ) const;
+  char* rx_buffer( size_t queue, size_t i );
+};
@@ -1,5 +1,9 @@
 #include "tcp_minnow_socket_impl.hh"
 
-//! Specializations of TCPMinnowSocket for TCPOverIPv4OverTunFdAdapter and its lossy version
+//! Specializations of TCPMinnowSocket for TCPOverIPv4OverTunFdAdapter, TCPOverIPv4LoopbackAdapter and their
+//! lossy (and, for the loopback, emulated) versions
 template class TCPMinnowSocket<TCPOverIPv4OverTunFdAdapter>;
 template class TCPMinnowSocket<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>;
+template class TCPMinnowSocket<TCPOverIPv4LoopbackAdapter>;
+template class TCPMinnowSocket<LossyFdAdapter<TCPOverIPv4LoopbackAdapter>>;
+template class TCPMinnowSocket<NetworkEmulatorAdapter<TCPOverIPv4LoopbackAdapter>>;
@@ -1,5 +1,6 @@
 #include "tcp_receiver.hh"
 #include "debug.hh"
+#include "packet_pool.hh"
 
 using namespace std;
 
@@ -26,7 +27,8 @@ void TCPReceiver::receive( TCPSenderMessage message )
   // 1. 当前收到的包带SYN flag，此时abs seqno必定为0，则不减1
   // 2. 当前收到的包不带SYN flag，此时stream_idx = abs_seqno-1
   uint64_t stream_index = message.seqno.unwrap( *isn_, reassembler_.next_byte() ) - ( !message.SYN );
-  reassembler_.insert( stream_index, message.payload, message.FIN );
+  reassembler_.insert( stream_index, string_view { message.payload }, message.FIN );
+  PacketPool::give( move( message.payload ) );
 }
 
 TCPReceiverMessage TCPReceiver::send() const
@@ -1,5 +1,6 @@
 #include "tcp_sender.hh"
 #include "debug.hh"
+#include "packet_pool.hh"
 #include "tcp_config.hh"
 
 using namespace std;
@@ -16,6 +17,19 @@ uint64_t TCPSender::consecutive_retransmissions() const
   return consecutive_retransmissions_;
 }
 
+// How long until the retransmission timer expires? (empty if it isn't running)
+optional<uint64_t> TCPSender::ms_until_timeout() const
+{
+  if ( !RTO_timer_.has_value() ) {
+    return {};
+  }
+  const auto deadline = timers_.deadline( *RTO_timer_ );
+  if ( !deadline.has_value() ) {
+    return {};
+  }
+  return *deadline > timers_.now() ? *deadline - timers_.now() : 0;
+}
+
 void TCPSender::push( const TransmitFunction& transmit )
 {
   // Bug: 这里当FIN = true时就不要再继续循环了，否则会不停的发送FIN包！
@@ -32,7 +46,7 @@ void TCPSender::push( const TransmitFunction& transmit )
        * 理论上这俩不应该放到一起决定序列号空间长度上限，但是可以通过将MAX_PAYLOAD_SIZE+2来将它变为考虑了SYN+Payload+Fin
        * 但是这里还要考虑下面取stream的substr的时候不能取到MAX_PAYLOAD_SIZE+2这么长，因为payload最长只能是MAX_PAYLOAD_SIZE
        */
-        limit = min( max( rwnd_, (uint16_t)1 ) - sequence_number_in_flight_, TCPConfig::MAX_PAYLOAD_SIZE + 2 );
+        limit = min( max( rwnd_, (uint16_t)1 ) - sequence_number_in_flight_, max_payload_size_ + 2 );
     }
 
     if ( limit == 0 ) return;
@@ -51,7 +65,9 @@ void TCPSender::push( const TransmitFunction& transmit )
     }
     
     // 因为上面得到的limit是序列号空间的上限，可能会超过MAX_PAYLOAD_SIZE，所以当用limit决定payload长度时要和MAX_PAYLOAD_SIZE取最小值
-    string payload { stream.substr( 0, min( TCPConfig::MAX_PAYLOAD_SIZE, min( limit, stream.size() ) ) ) };
+    // payload strings come from the PacketPool and go back to it once acknowledged
+    string payload = PacketPool::take();
+    payload.assign( stream.substr( 0, min( max_payload_size_, min( limit, stream.size() ) ) ) );
     reader().pop( payload.size() );
     limit -= payload.size();
 
@@ -73,27 +89,35 @@ void TCPSender::push( const TransmitFunction& transmit )
      */
     auto seq_len = segment.sequence_length();
     
-    if ( seq_len == 0 ) return;
+    if ( seq_len == 0 ) {
+      PacketPool::give( move( segment.payload ) );
+      return;
+    }
 
     transmit( segment );
 
     // Bug: 这里Segment里面必须要记录SYN和FIN，相当于TCPSendMessage里有的字段都要记录
-    outstanding_.push_back({
+    Segment sent {
       abs_seqno_,
       segment.SYN,
       segment.FIN,
       move( segment.payload ),
-    });
+    };
+    if ( spare_.empty() ) {
+      outstanding_.push_back( move( sent ) );
+    } else {
+      spare_.front() = move( sent );
+      outstanding_.splice( outstanding_.end(), spare_, spare_.begin() );
+    }
 
     // Advance absolute seqno
     abs_seqno_ += seq_len;
     sequence_number_in_flight_ += seq_len;
 
-    // Restart timer everytime send a msg
-    if ( !RTO_timer_start_ ) {
-      RTO_timer_start_ = true;
-      RTO_timer_ = 0;
+    // Start the timer when sending a msg (if it is not already running)
+    if ( !RTO_timer_.has_value() ) {
       RTO_ms_ = initial_RTO_ms_;
+      start_RTO_timer();
     }
   }
 }
@@ -141,10 +165,11 @@ void TCPSender::receive( const TCPReceiverMessage& msg )
     auto seq_len = max( (uint64_t)1, it->sequence_length() );
     if ( abs_ackno_ >= it->first_index + seq_len ) {
       sequence_number_in_flight_ -= seq_len;
-      outstanding_.erase(it);
+      PacketPool::give( move( it->payload ) );
+      spare_.splice( spare_.end(), outstanding_, it );
 
       RTO_ms_ = initial_RTO_ms_;
-      RTO_timer_ = 0;
+      start_RTO_timer();
       consecutive_retransmissions_ = 0;
     } else {
       break;
@@ -152,34 +177,49 @@ void TCPSender::receive( const TCPReceiverMessage& msg )
   }
 
   if ( outstanding_.empty() ) {
-    RTO_timer_start_ = false;
-    RTO_timer_ = 0;
+    stop_RTO_timer();
     RTO_ms_ = initial_RTO_ms_;
   }
 }
 
 void TCPSender::tick( uint64_t ms_since_last_tick, const TransmitFunction& transmit )
 {
-  if ( RTO_timer_start_ ) {
-    RTO_timer_ += ms_since_last_tick;
-    if ( RTO_timer_ >= RTO_ms_ && !outstanding_.empty() ) {
-      RTO_timer_ = 0;
-
-      auto it = outstanding_.begin();
-      auto segment = make_empty_message();
-      segment.seqno = Wrap32::wrap( it->first_index , isn_ );
-      segment.SYN = it->SYN;
-      segment.FIN = it->FIN;
-      segment.payload = move( it->payload );
-      transmit( segment );
-
-      it->payload = move( segment.payload );
-      ++consecutive_retransmissions_;
-      
-      // Bug: 只有在rwnd nonzero的时候才能倍增RTO（看文档）
-      if ( rwnd_ > 0 ) {
-        RTO_ms_ <<= 1;
-      }
+  bool expired = false;
+  timers_.advance( ms_since_last_tick, [&]( RetransmissionTimeout ) {
+    expired = true;
+    RTO_timer_.reset();
+  } );
+
+  if ( expired && !outstanding_.empty() ) {
+    auto it = outstanding_.begin();
+    auto segment = make_empty_message();
+    segment.seqno = Wrap32::wrap( it->first_index , isn_ );
+    segment.SYN = it->SYN;
+    segment.FIN = it->FIN;
+    segment.payload = move( it->payload );
+    transmit( segment );
+
+    it->payload = move( segment.payload );
+    ++consecutive_retransmissions_;
+    
+    // Bug: 只有在rwnd nonzero的时候才能倍增RTO（看文档）
+    if ( rwnd_ > 0 ) {
+      RTO_ms_ <<= 1;
     }
+    start_RTO_timer();
+  }
+}
+
+void TCPSender::start_RTO_timer()
+{
+  stop_RTO_timer();
+  RTO_timer_ = timers_.schedule_after( RTO_ms_, {} );
+}
+
+void TCPSender::stop_RTO_timer()
+{
+  if ( RTO_timer_.has_value() ) {
+    timers_.cancel( *RTO_timer_ );
+    RTO_timer_.reset();
   }
 }
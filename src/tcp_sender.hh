@@ -2,18 +2,27 @@
 
 #include "segment.hh"
 #include "byte_stream.hh"
+#include "tcp_config.hh"
 #include "tcp_receiver_message.hh"
 #include "tcp_sender_message.hh"
+#include "timer_queue.hh"
 
 #include <functional>
 #include <list>
+#include <optional>
 
 class TCPSender
 {
 public:
-  /* Construct TCP sender with given default Retransmission Timeout and possible ISN */
-  TCPSender( ByteStream&& input, Wrap32 isn, uint64_t initial_RTO_ms )
-    : input_( std::move( input ) ), isn_( isn ), initial_RTO_ms_( initial_RTO_ms )
+  /* Construct TCP sender with given default Retransmission Timeout, possible ISN and maximum payload size */
+  TCPSender( ByteStream&& input,
+             Wrap32 isn,
+             uint64_t initial_RTO_ms,
+             uint64_t max_payload_size = TCPConfig::MAX_PAYLOAD_SIZE )
+    : input_( std::move( input ) )
+    , isn_( isn )
+    , initial_RTO_ms_( initial_RTO_ms )
+    , max_payload_size_( max_payload_size )
   {}
 
   /* Generate an empty TCPSenderMessage */
@@ -34,6 +43,7 @@ public:
   // Accessors
   uint64_t sequence_numbers_in_flight() const;  // How many sequence numbers are outstanding?
   uint64_t consecutive_retransmissions() const; // How many consecutive retransmissions have happened?
+  std::optional<uint64_t> ms_until_timeout() const; // When will tick() next have work? (empty: not until data)
   const Writer& writer() const { return input_.writer(); }
   const Reader& reader() const { return input_.reader(); }
   Writer& writer() { return input_.writer(); }
@@ -41,15 +51,22 @@ public:
 private:
   Reader& reader() { return input_.reader(); }
 
+  // (Re)start the retransmission timer, to expire RTO_ms_ from now
+  void start_RTO_timer();
+  void stop_RTO_timer();
+
   ByteStream input_;
   Wrap32 isn_;
   uint64_t initial_RTO_ms_;
+  uint64_t max_payload_size_;
   uint64_t RTO_ms_{0};
-  bool RTO_timer_start_{false};
-  uint64_t RTO_timer_{0};
+  struct RetransmissionTimeout {};
+  TimerQueue<RetransmissionTimeout> timers_{};
+  std::optional<TimerQueue<RetransmissionTimeout>::TimerId> RTO_timer_{};  // running if set
   uint64_t abs_seqno_{0};
   uint64_t abs_ackno_{0};
   list<Segment> outstanding_{};
+  list<Segment> spare_{};  // nodes of acknowledged segments, reused for the next ones (so sending doesn't allocate)
   uint16_t rwnd_{1};
   bool first_msg_{true};
   uint64_t sequence_number_in_flight_{0};
@@ -0,0 +1,900 @@
+#include "tcp_stack.hh"
+
+#include "exception.hh"
+#include "helpers.hh"
+#include "packet_pool.hh"
+#include "random.hh"
+#include "tcp_segment.hh"
+
+#include <array>
+#include <bit>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+// Add one to an eventfd from any thread (writing through its number, so as not to touch the
+// FileDescriptor's read and write counts, which belong to the thread that reads it)
+void signal_eventfd( const FileDescriptor& fd )
+{
+  const uint64_t one = 1;
+  CheckSystemCall( "write", static_cast<int>( ::write( fd.fd_num(), &one, sizeof( one ) ) ) );
+}
+
+void consume_eventfd( FileDescriptor& fd )
+{
+  string counter( sizeof( uint64_t ), 0 );
+  fd.read( counter );
+}
+
+// Add one to a counter that only the calling thread writes (a plain load and store, not a locked increment)
+void bump( atomic<uint64_t>& counter )
+{
+  counter.store( counter.load( memory_order_relaxed ) + 1, memory_order_relaxed );
+}
+
+Address make_address( const uint32_t ip, const uint16_t port )
+{
+  return Address { Address::from_ipv4_numeric( ip ).ip(), port };
+}
+
+// Read a datagram from `fd` (see read_datagram()), keeping it only if it carries TCP
+bool read_tcp_datagram( FileDescriptor& fd, optional<InternetDatagram>& dgram )
+{
+  if ( not read_datagram( fd, dgram ) ) {
+    return false;
+  }
+  if ( dgram.has_value() and dgram->header.proto != IPv4Header::PROTO_TCP ) {
+    dgram.reset();
+  }
+  return true;
+}
+
+// The source and destination ports at the start of a TCP segment (or empty, if they aren't in its first buffer)
+optional<pair<uint16_t, uint16_t>> tcp_ports( const BufferChain& segment )
+{
+  if ( segment.empty() or segment.front().size() < 2 * sizeof( uint16_t ) ) {
+    return {};
+  }
+  const auto* bytes = reinterpret_cast<const uint8_t*>( segment.front().data() ); // NOLINT(*-reinterpret-cast)
+  return pair { static_cast<uint16_t>( ( bytes[0] << 8U ) | bytes[1] ),
+               static_cast<uint16_t>( ( bytes[2] << 8U ) | bytes[3] ) };
+}
+
+// The Toeplitz hash of 12 bytes of input, as a table per input byte of what each of its values contributes
+using ToeplitzTables = array<array<uint32_t, 256>, 12>;
+
+constexpr ToeplitzTables make_toeplitz_tables()
+{
+  // the key in Microsoft's RSS specification, which most NIC drivers use by default
+  constexpr array<uint8_t, 40> key { 0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67,
+                                     0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb,
+                                     0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30,
+                                     0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa };
+
+  // each input bit that is set contributes the 32 bits of the key that start at that bit
+  const auto window = [&key]( const size_t bit ) {
+    uint64_t bits = 0;
+    for ( size_t i = 0; i < 5; ++i ) {
+      bits = ( bits << 8U ) | key.at( bit / 8 + i );
+    }
+    return static_cast<uint32_t>( ( bits << ( bit % 8 ) ) >> 8U );
+  };
+
+  ToeplitzTables tables {};
+  for ( size_t byte = 0; byte < tables.size(); ++byte ) {
+    for ( size_t value = 0; value < 256; ++value ) {
+      for ( size_t bit = 0; bit < 8; ++bit ) {
+        if ( value & ( 0x80U >> bit ) ) {
+          tables.at( byte ).at( value ) ^= window( byte * 8 + bit );
+        }
+      }
+    }
+  }
+  return tables;
+}
+
+constexpr ToeplitzTables TOEPLITZ_TABLES = make_toeplitz_tables();
+
+// how many ephemeral ports a connect() tries before giving up
+constexpr size_t MAX_PORT_ATTEMPTS = 64;
+
+// A SYN cookie's top bits hold the period it was made in (modulo 2^5), and the rest a keyed hash
+constexpr unsigned COOKIE_PERIOD_BITS = 5;
+constexpr uint32_t COOKIE_HASH_MASK = ( 1U << ( 32 - COOKIE_PERIOD_BITS ) ) - 1;
+
+// SipHash-2-4 (keyed with `key`) of three 64-bit words
+uint64_t siphash( const array<uint64_t, 2>& key, const array<uint64_t, 3>& words )
+{
+  uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+  uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+  uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+  uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+
+  const auto round = [&] {
+    v0 += v1;
+    v1 = rotl( v1, 13 ) ^ v0;
+    v0 = rotl( v0, 32 );
+    v2 += v3;
+    v3 = rotl( v3, 16 ) ^ v2;
+    v0 += v3;
+    v3 = rotl( v3, 21 ) ^ v0;
+    v2 += v1;
+    v1 = rotl( v1, 17 ) ^ v2;
+    v2 = rotl( v2, 32 );
+  };
+  const auto absorb = [&]( const uint64_t word ) {
+    v3 ^= word;
+    round();
+    round();
+    v0 ^= word;
+  };
+
+  for ( const auto word : words ) {
+    absorb( word );
+  }
+  absorb( uint64_t { sizeof( words ) } << 56U );
+  v2 ^= 0xFFU;
+  for ( size_t i = 0; i < 4; ++i ) {
+    round();
+  }
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// (to read the number in a Wrap32)
+class Wrap32Value : public Wrap32
+{
+public:
+  uint32_t raw_value() const { return raw_value_; }
+};
+} // namespace
+
+TCPStack::Listener::Listener( const Address& local_address, const size_t backlog, const size_t syn_backlog )
+  : local_address_( local_address )
+  , backlog_( backlog )
+  , syn_backlog_( syn_backlog )
+  , queue_( backlog )
+  , ready_( CheckSystemCall( "eventfd", eventfd( 0, EFD_SEMAPHORE | EFD_CLOEXEC ) ) )
+{}
+
+TCPStack::Accepted TCPStack::Listener::accept()
+{
+  string counter( sizeof( uint64_t ), 0 );
+  ready_.read( counter ); // (waits for a connection, unless the fd has been made non-blocking)
+  if ( counter.empty() ) {
+    throw runtime_error( "TCPStack::Listener: no connection to accept" );
+  }
+
+  // (the connection counted may sit behind one that another shard is still pushing: wait for that to finish)
+  auto accepted = queue_.pop();
+  while ( not accepted.has_value() ) {
+    this_thread::yield();
+    accepted = queue_.pop();
+  }
+  --queued_;
+  return std::move( *accepted );
+}
+
+TCPStack::Connection::Connection( const FourTuple& s_key, const TCPConfig& config ) : key( s_key ), peer( config )
+{
+  adapter.config_mut().source = make_address( key.local_ip, key.local_port );
+  adapter.config_mut().destination = make_address( key.remote_ip, key.remote_port );
+}
+
+size_t TCPStack::FourTupleHash::operator()( const FourTuple& t ) const
+{
+  uint64_t h = ( uint64_t { t.local_ip } << 32U ) | t.remote_ip;
+  h ^= ( ( uint64_t { t.local_port } << 16U ) | t.remote_port ) * 0x9E3779B97F4A7C15ULL;
+  h ^= h >> 33U;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33U;
+  return h;
+}
+
+uint32_t TCPStack::toeplitz_hash( const FourTuple& key )
+{
+  // the bytes a NIC hashes for a TCP segment: its source and destination addresses, then its ports
+  const uint64_t addresses = ( uint64_t { key.remote_ip } << 32U ) | key.local_ip;
+  const uint32_t ports = ( uint32_t { key.remote_port } << 16U ) | key.local_port;
+
+  uint32_t hash = 0;
+  for ( size_t i = 0; i < 8; ++i ) {
+    hash ^= TOEPLITZ_TABLES[i][( addresses >> ( 56 - 8 * i ) ) & 0xFFU];
+  }
+  for ( size_t i = 0; i < 4; ++i ) {
+    hash ^= TOEPLITZ_TABLES[8 + i][( ports >> ( 24 - 8 * i ) ) & 0xFFU];
+  }
+  return hash;
+}
+
+size_t TCPStack::steering_index( const FourTuple& key, const size_t num_shards )
+{
+  return num_shards == 1 ? 0 : ( uint64_t { toeplitz_hash( key ) } * num_shards ) >> 32U;
+}
+
+TCPStack::TCPStack( FileDescriptor&& datagrams, const TCPConfig& config, const size_t num_shards )
+  : config_( config )
+  , datagrams_( std::move( datagrams ) )
+  , next_ephemeral_port_( static_cast<uint16_t>( get_random_engine()() ) )
+  , dispatch_wakeup_( CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) )
+{
+  if ( num_shards == 0 ) {
+    throw runtime_error( "TCPStack: at least one shard is required" );
+  }
+
+  random_device rd;
+  for ( auto& word : cookie_key_ ) {
+    word = ( uint64_t { rd() } << 32U ) | rd();
+  }
+
+  datagrams_.set_blocking( false );
+
+  if ( num_shards == 1 ) { // (nothing to steer: the shard reads the datagrams itself)
+    shards_.push_back( make_unique<Shard>( *this, std::move( datagrams_ ), false ) );
+  } else {
+    for ( size_t i = 0; i < num_shards; ++i ) {
+      // (each shard writes through its own fd, so that the shards never share a FileDescriptor's counts)
+      FileDescriptor writer { CheckSystemCall( "dup", ::dup( datagrams_.fd_num() ) ) };
+      shards_.push_back( make_unique<Shard>( *this, std::move( writer ), true ) );
+    }
+
+    dispatch_loop_.add_rule( "steer datagrams to shards", datagrams_, Direction::In, [this] {
+      dispatch_datagrams();
+    } );
+    dispatch_loop_.add_rule(
+      "stop", dispatch_wakeup_, Direction::In, [this] { consume_eventfd( dispatch_wakeup_ ); } );
+  }
+
+  for ( auto& shard : shards_ ) {
+    shard->start();
+  }
+  if ( num_shards > 1 ) {
+    dispatcher_ = thread( [this] { dispatch_loop(); } );
+  }
+}
+
+TCPStack::~TCPStack()
+{
+  try {
+    stopping_.store( true );
+    if ( dispatcher_.joinable() ) {
+      signal_eventfd( dispatch_wakeup_ );
+      dispatcher_.join();
+    }
+    for ( auto& shard : shards_ ) {
+      shard->stop();
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception destructing TCPStack: " << e.what() << "\n";
+  }
+}
+
+LocalStreamSocket TCPStack::connect( const Address& local, const Address& remote )
+{
+  auto [app_end, stack_end] = socket_pair();
+  auto data = make_shared<LocalStreamSocket>( std::move( stack_end ) );
+
+  FourTuple key { .local_ip = local.ipv4_numeric(),
+                  .remote_ip = remote.ipv4_numeric(),
+                  .local_port = local.port(),
+                  .remote_port = remote.port() };
+  const bool pick_port = key.local_port == 0;
+  if ( pick_port ) {
+    key.local_port = ephemeral_port();
+  }
+
+  Shard& shard = shard_of( key );
+  shard.run_command( [&shard, key, data, pick_port] { shard.connect( key, data, pick_port, 1 ); } );
+
+  return std::move( app_end );
+}
+
+shared_ptr<TCPStack::Listener> TCPStack::listen( const Address& local_address,
+                                                 const size_t backlog,
+                                                 const size_t syn_backlog )
+{
+  auto listener = make_shared<Listener>( local_address, backlog, syn_backlog );
+  for ( auto& shard : shards_ ) { // (a connection to the listener may hash to any shard)
+    shard->run_command( [owner = shard.get(), listener] { owner->listen( listener ); } );
+  }
+  return listener;
+}
+
+size_t TCPStack::connection_count() const
+{
+  size_t count = 0;
+  for ( const auto& shard : shards_ ) {
+    count += shard->connection_count();
+  }
+  return count;
+}
+
+TCPStack::Stats TCPStack::stats() const
+{
+  Stats total { .ring_drops = ring_drops_.load( memory_order_relaxed ) };
+  for ( const auto& shard : shards_ ) {
+    shard->add_stats( total );
+  }
+  return total;
+}
+
+// The ephemeral ports (49152 to 65535) are handed out in turn, starting from a random one
+uint16_t TCPStack::ephemeral_port()
+{
+  static constexpr uint16_t FIRST = 49152;
+  return FIRST + next_ephemeral_port_.fetch_add( 1, memory_order_relaxed ) % ( 65536 - FIRST );
+}
+
+uint64_t TCPStack::syn_cookie_period()
+{
+  return duration_cast<seconds>( steady_clock::now().time_since_epoch() ) / SYN_COOKIE_PERIOD;
+}
+
+uint32_t TCPStack::syn_cookie( const FourTuple& key, const uint32_t client_isn, const uint64_t period ) const
+{
+  const uint64_t hash = siphash( cookie_key_,
+                                 { ( uint64_t { key.local_ip } << 32U ) | key.remote_ip,
+                                   ( uint64_t { key.local_port } << 48U ) | ( uint64_t { key.remote_port } << 32U )
+                                     | client_isn,
+                                   period } );
+  return static_cast<uint32_t>( period << ( 32 - COOKIE_PERIOD_BITS ) ) | ( hash & COOKIE_HASH_MASK );
+}
+
+bool TCPStack::check_syn_cookie( const FourTuple& key, const uint32_t client_isn, const uint32_t cookie ) const
+{
+  const uint64_t now = syn_cookie_period();
+  for ( const uint64_t period : { now, now - 1 } ) {
+    if ( syn_cookie( key, client_isn, period ) == cookie ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TCPStack::dispatch_loop()
+{
+  try {
+    while ( not stopping_ ) {
+      dispatch_loop_.wait_next_event( -1 );
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception in TCPStack dispatcher: " << e.what() << "\n";
+  }
+}
+
+// Read a burst of datagrams, steer each to its connection's shard, and wake the shards that got any
+void TCPStack::dispatch_datagrams()
+{
+  static constexpr size_t BURST = 32;
+
+  // (take back no more than the burst could use from each shard, leaving the rest in its ring: taking it all
+  // at once would overflow the PacketPool, which would then run dry again before the next lot came back)
+  for ( auto& shard : shards_ ) {
+    shard->reclaim_buffers( BURST * DATAGRAM_BUFFER_CAPACITIES.size() );
+  }
+
+  woken_.assign( shards_.size(), false );
+  for ( size_t i = 0; i < BURST; ++i ) {
+    optional<InternetDatagram> dgram;
+    if ( not read_tcp_datagram( datagrams_, dgram ) ) {
+      break;
+    }
+    if ( not dgram.has_value() ) {
+      continue;
+    }
+    const auto ports = tcp_ports( dgram->payload );
+    if ( not ports.has_value() ) {
+      continue;
+    }
+
+    const size_t index = steering_index( { .local_ip = dgram->header.dst,
+                                           .remote_ip = dgram->header.src,
+                                           .local_port = ports->second,
+                                           .remote_port = ports->first },
+                                         shards_.size() );
+    if ( shards_[index]->steer( std::move( *dgram ) ) ) {
+      woken_[index] = true;
+    } else {
+      bump( ring_drops_ );
+    }
+  }
+
+  for ( size_t index = 0; index < shards_.size(); ++index ) {
+    if ( woken_[index] ) {
+      shards_[index]->wake();
+    }
+  }
+}
+
+TCPStack::Shard::Shard( TCPStack& stack, FileDescriptor&& datagrams, const bool steered )
+  : stack_( stack )
+  , datagrams_( std::move( datagrams ) )
+  , push_category_( loop_.add_category( "push bytes to TCPPeer" ) )
+  , deliver_category_( loop_.add_category( "read bytes from inbound stream" ) )
+  , wakeup_( CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) )
+  , random_( get_random_engine() )
+{
+  if ( not steered ) {
+    loop_.add_rule( "receive TCP segments from the network", datagrams_, Direction::In, [this] {
+      receive_datagrams();
+    } );
+  }
+
+  loop_.add_rule( "run commands and receive steered segments", wakeup_, Direction::In, [this] {
+    consume_eventfd( wakeup_ );
+    while ( auto command = commands_.pop() ) {
+      ( *command )();
+    }
+
+    // (take no more than the ring holds, so the dispatcher can't keep the shard here; if that leaves any,
+    // come back for them after the next wait)
+    for ( size_t i = 0; i < steered_.capacity(); ++i ) {
+      auto dgram = steered_.pop();
+      if ( not dgram.has_value() ) {
+        return;
+      }
+      receive_datagram( std::move( *dgram ) );
+      return_buffers();
+    }
+    wake();
+  } );
+}
+
+// Hand the dispatcher back as much memory as it read a datagram into, from what the shard's PacketPool has cached
+// (mostly the datagram's own, just freed: taking it back one datagram at a time keeps a burst of them from
+// overflowing the pool). Otherwise the dispatcher's memory would all pile up here, and it would allocate afresh
+// for every datagram.
+void TCPStack::Shard::return_buffers()
+{
+  for ( const size_t capacity : DATAGRAM_BUFFER_CAPACITIES ) {
+    auto storage = PacketPool::take_cached( capacity );
+    if ( not storage ) {
+      continue; // (a datagram's payload, say, may still be waiting to be delivered)
+    }
+    if ( not returned_.push( std::move( storage ) ) ) {
+      return; // (what wasn't pushed goes back into the shard's pool)
+    }
+  }
+}
+
+void TCPStack::Shard::reclaim_buffers( const size_t count )
+{
+  for ( size_t i = 0; i < count and returned_.pop().has_value(); ++i ) {} // (released into this thread's pool)
+}
+
+void TCPStack::Shard::start()
+{
+  thread_ = thread( [this] { main_loop(); } );
+}
+
+void TCPStack::Shard::stop()
+{
+  wake();
+  thread_.join();
+}
+
+void TCPStack::Shard::run_command( function<void()>&& command )
+{
+  while ( not commands_.push( std::move( command ) ) ) {
+    this_thread::yield();
+  }
+  wake();
+}
+
+void TCPStack::Shard::wake()
+{
+  signal_eventfd( wakeup_ );
+}
+
+void TCPStack::Shard::add_stats( Stats& total ) const
+{
+  total.segments_received += counters_.segments_received.load( memory_order_relaxed );
+  total.segments_sent += counters_.segments_sent.load( memory_order_relaxed );
+  total.segments_unmatched += counters_.segments_unmatched.load( memory_order_relaxed );
+  total.send_errors += counters_.send_errors.load( memory_order_relaxed );
+  total.connections_opened += counters_.connections_opened.load( memory_order_relaxed );
+  total.connections_closed += counters_.connections_closed.load( memory_order_relaxed );
+  total.syn_cookies_sent += counters_.syn_cookies_sent.load( memory_order_relaxed );
+  total.syn_cookies_accepted += counters_.syn_cookies_accepted.load( memory_order_relaxed );
+}
+
+void TCPStack::Shard::main_loop()
+{
+  try {
+    while ( not stack_.stopping_ ) {
+      // drop the connections that finished (their rules, cancelled, are removed by the next wait)
+      for ( const auto& key : closing_ ) {
+        connections_.erase( key );
+      }
+      closing_.clear();
+
+      loop_.wait_next_event( -1 );
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception in TCPStack shard: " << e.what() << "\n";
+  }
+
+  connections_.clear();
+  listeners_.clear();
+}
+
+void TCPStack::Shard::connect( FourTuple key,
+                               shared_ptr<LocalStreamSocket> data,
+                               const bool pick_port,
+                               const size_t attempts )
+{
+  if ( connections_.contains( key ) ) {
+    if ( not pick_port or attempts >= MAX_PORT_ATTEMPTS ) {
+      return; // (no port free: dropping the socket makes it reach EOF)
+    }
+
+    // try the next ephemeral port, on whichever shard owns the connection with it
+    key.local_port = stack_.ephemeral_port();
+    Shard& owner = stack_.shard_of( key );
+    owner.run_command(
+      [&owner, key, data, attempts] { owner.connect( key, data, true, attempts + 1 ); } );
+    return;
+  }
+
+  Connection& conn = open( key );
+  attach( conn, std::move( *data ) );
+  conn.peer.push( [&]( const TCPMessage& x ) { transmit( conn, x ); } ); // send the SYN
+  update( conn );
+}
+
+void TCPStack::Shard::listen( const shared_ptr<Listener>& listener )
+{
+  listeners_[listener_key( listener->local_address().ipv4_numeric(), listener->local_address().port() )]
+    = listener;
+}
+
+// Read a burst of datagrams, and hand the TCP segments among them to their connections
+void TCPStack::Shard::receive_datagrams()
+{
+  static constexpr size_t BURST = 32;
+
+  for ( size_t i = 0; i < BURST; ++i ) {
+    optional<InternetDatagram> dgram;
+    if ( not read_tcp_datagram( datagrams_, dgram ) ) {
+      return;
+    }
+    if ( dgram.has_value() ) {
+      receive_datagram( std::move( *dgram ) );
+    }
+  }
+}
+
+void TCPStack::Shard::receive_datagram( InternetDatagram&& dgram )
+{
+  TCPSegment seg;
+  if ( not parse( seg, std::move( dgram.payload ), dgram.header.pseudo_checksum() ) ) {
+    return;
+  }
+
+  bump( counters_.segments_received );
+  receive( { .local_ip = dgram.header.dst,
+             .remote_ip = dgram.header.src,
+             .local_port = seg.udinfo.dst_port,
+             .remote_port = seg.udinfo.src_port },
+           std::move( seg.message ) );
+}
+
+void TCPStack::Shard::receive( const FourTuple& key, TCPMessage&& msg )
+{
+  const auto it = connections_.find( key );
+  if ( it == connections_.end() ) {
+    accept_syn( key, std::move( msg ) );
+    return;
+  }
+
+  Connection& conn = *it->second;
+  if ( conn.closing ) {
+    bump( counters_.segments_unmatched );
+    return;
+  }
+
+  tick( conn ); // (so that any timer the segment starts runs from now)
+  conn.peer.receive( std::move( msg ), [&]( const TCPMessage& x ) { transmit( conn, x ); } );
+  update( conn );
+}
+
+// A segment for no connection: if it is a SYN to a listener with room in its accept queue, start a handshake
+// (or, if its SYN queue is full, send a SYN cookie), and if it is an ACK that brings back a SYN cookie, open
+// the connection that the cookie stood for. (The shards check the queues' lengths without coordinating, so
+// together they may overshoot them by a few.)
+void TCPStack::Shard::accept_syn( const FourTuple& key, TCPMessage&& msg )
+{
+  auto it = listeners_.find( listener_key( key.local_ip, key.local_port ) );
+  if ( it == listeners_.end() ) {
+    it = listeners_.find( listener_key( 0, key.local_port ) );
+  }
+  if ( it != listeners_.end() and it->second->closed_ ) {
+    listeners_.erase( it );
+    it = listeners_.end();
+  }
+
+  if ( it == listeners_.end() or msg.sender->RST or it->second->queued_ >= it->second->backlog_ ) {
+    bump( counters_.segments_unmatched );
+    return;
+  }
+  const auto& listener = it->second;
+
+  if ( not msg.sender->SYN ) {
+    if ( not accept_syn_cookie( key, msg, listener ) ) {
+      bump( counters_.segments_unmatched );
+    }
+    return;
+  }
+
+  if ( listener->handshaking_ >= listener->syn_backlog_ ) {
+    send_syn_cookie( key, msg.sender.get() );
+    return;
+  }
+
+  Connection& conn = open( key );
+  conn.listener = listener;
+  ++conn.listener->handshaking_;
+  conn.peer.receive( std::move( msg ), [&]( const TCPMessage& x ) { transmit( conn, x ); } ); // SYN-ACK
+  update( conn );
+}
+
+// Answer a SYN with the SYN-ACK that a new connection's TCPPeer would send, but with a cookie for its ISN,
+// and keep nothing
+void TCPStack::Shard::send_syn_cookie( const FourTuple& key, const TCPSenderMessage& syn )
+{
+  const uint32_t client_isn = Wrap32Value { syn.seqno }.raw_value();
+  TCPSenderMessage syn_ack { .seqno = Wrap32 { stack_.syn_cookie( key, client_isn, syn_cookie_period() ) },
+                             .SYN = true };
+  TCPReceiverMessage ack { .ackno = syn.seqno + 1,
+                           .window_size = static_cast<uint16_t>( min<size_t>( stack_.config_.recv_capacity,
+                                                                              UINT16_MAX ) ) };
+
+  cookie_adapter_.config_mut().source = make_address( key.local_ip, key.local_port );
+  cookie_adapter_.config_mut().destination = make_address( key.remote_ip, key.remote_port );
+  transmit( cookie_adapter_, { .sender = std::move( syn_ack ), .receiver = std::move( ack ) } );
+  bump( counters_.syn_cookies_sent );
+}
+
+// If `msg` is the ACK of a SYN-ACK that carried a cookie, open the connection: give its TCPPeer (whose ISN is
+// the cookie) the client's SYN again, so that it is where it was when it sent that SYN-ACK, and then the ACK
+bool TCPStack::Shard::accept_syn_cookie( const FourTuple& key,
+                                         TCPMessage& msg,
+                                         const shared_ptr<Listener>& listener )
+{
+  if ( not msg.receiver->ackno.has_value() ) {
+    return false;
+  }
+  const Wrap32 client_isn = msg.sender->seqno + UINT32_MAX; // (one less)
+  const Wrap32 cookie = *msg.receiver->ackno + UINT32_MAX;
+  if ( not stack_.check_syn_cookie(
+         key, Wrap32Value { client_isn }.raw_value(), Wrap32Value { cookie }.raw_value() ) ) {
+    return false;
+  }
+
+  Connection& conn = open( key, cookie );
+  conn.listener = listener;
+  ++conn.listener->handshaking_;
+  conn.peer.receive( { .sender = TCPSenderMessage { .seqno = client_isn, .SYN = true },
+                       .receiver = TCPReceiverMessage { .window_size = msg.receiver->window_size } },
+                     []( const TCPMessage& ) {} ); // (the SYN-ACK was sent already)
+  conn.peer.receive( std::move( msg ), [&]( const TCPMessage& x ) { transmit( conn, x ); } );
+  bump( counters_.syn_cookies_accepted );
+  update( conn );
+  return true;
+}
+
+TCPStack::Connection& TCPStack::Shard::open( const FourTuple& key, const optional<Wrap32> isn )
+{
+  TCPConfig config = stack_.config_;
+  config.isn = isn.value_or( Wrap32 { uniform_int_distribution<uint32_t> {}( random_ ) } );
+
+  connection_count_.store( connection_count_.load( memory_order_relaxed ) + 1, memory_order_relaxed );
+  bump( counters_.connections_opened );
+  return *connections_.emplace( key, make_unique<Connection>( key, config ) ).first->second;
+}
+
+// Connect a connection to the stack's end of its socket pair, with the two rules that TCPMinnowSocket uses
+// to move bytes between the socket and the TCPPeer
+void TCPStack::Shard::attach( Connection& conn, LocalStreamSocket&& socket )
+{
+  conn.data.emplace( std::move( socket ) );
+  conn.data->set_blocking( false );
+
+  // read from the socket into the outbound stream
+  conn.rules.push_back( loop_.add_rule(
+    push_category_,
+    *conn.data,
+    Direction::In,
+    [this, &conn] {
+      tick( conn );
+      string data;
+      data.resize( conn.peer.outbound_writer().available_capacity() );
+      conn.data->read( data );
+      conn.peer.outbound_writer().push( std::move( data ) );
+      if ( conn.data->eof() ) {
+        conn.peer.outbound_writer().close();
+        conn.outbound_shutdown = true;
+      }
+      conn.peer.push( [&]( const TCPMessage& x ) { transmit( conn, x ); } );
+      update( conn );
+    },
+    [&conn] {
+      return conn.peer.active() and not conn.outbound_shutdown
+             and conn.peer.outbound_writer().available_capacity() > 0;
+    },
+    [this, &conn] {
+      conn.peer.outbound_writer().close();
+      conn.outbound_shutdown = true;
+      conn.peer.push( [&]( const TCPMessage& x ) { transmit( conn, x ); } );
+      update( conn );
+    },
+    [this, &conn] {
+      conn.peer.outbound_writer().set_error();
+      update( conn );
+    } ) );
+
+  // write from the inbound stream into the socket
+  conn.rules.push_back( loop_.add_rule(
+    deliver_category_,
+    *conn.data,
+    Direction::Out,
+    [this, &conn] {
+      Reader& inbound = conn.peer.inbound_reader();
+      if ( inbound.bytes_buffered() ) {
+        inbound.pop( conn.data->write( inbound.peek() ) );
+      }
+      if ( inbound.is_finished() or inbound.has_error() ) {
+        conn.data->shutdown( SHUT_WR );
+        conn.inbound_shutdown = true;
+      }
+      update( conn );
+    },
+    [&conn] { return delivering_inbound( conn ); },
+    [] {},
+    [this, &conn] {
+      conn.peer.inbound_reader().set_error();
+      update( conn );
+    } ) );
+}
+
+bool TCPStack::Shard::delivering_inbound( Connection& conn )
+{
+  const Reader& inbound = conn.peer.inbound_reader();
+  return conn.data.has_value()
+         and ( inbound.bytes_buffered()
+               or ( ( inbound.is_finished() or inbound.has_error() ) and not conn.inbound_shutdown ) );
+}
+
+void TCPStack::Shard::transmit( Connection& conn, const TCPMessage& msg )
+{
+  transmit( conn.adapter, msg );
+}
+
+void TCPStack::Shard::transmit( TCPOverIPv4Adapter& adapter, const TCPMessage& msg )
+{
+  // (as a NIC would, drop what the fd won't take: the TCPPeer will send it again)
+  try {
+    if ( datagrams_.write( serialize( adapter.wrap_tcp_in_ip( msg ) ) ) > 0 ) {
+      bump( counters_.segments_sent );
+      return;
+    }
+  } catch ( const runtime_error& ) {
+  }
+  bump( counters_.send_errors );
+}
+
+// Tell a connection's TCPPeer how much time has passed (in whole milliseconds: the rest carries over)
+void TCPStack::Shard::tick( Connection& conn )
+{
+  if ( conn.closing or not conn.peer.active() ) {
+    return;
+  }
+
+  const auto elapsed = duration_cast<milliseconds>( steady_clock::now() - conn.last_tick );
+  conn.last_tick += elapsed;
+  conn.peer.tick( elapsed.count(), [&]( const TCPMessage& x ) { transmit( conn, x ); } );
+}
+
+// After anything happens to a connection: give up on a peer that has stopped answering, queue a connection
+// that has finished its handshake for accept(), drop a connection that has finished, and otherwise set its
+// timer for whenever its TCPPeer next has something to do
+void TCPStack::Shard::update( Connection& conn )
+{
+  if ( conn.closing ) {
+    return;
+  }
+
+  // (whatever happened may have changed what the connection's rules are interested in)
+  for ( auto& rule : conn.rules ) {
+    rule.interest_changed();
+  }
+
+  if ( conn.peer.sender().consecutive_retransmissions() > TCPConfig::MAX_RETX_ATTEMPTS ) {
+    conn.peer.outbound_writer().set_error();
+    conn.peer.inbound_reader().set_error();
+  }
+
+  if ( conn.listener and conn.peer.active() and conn.peer.has_ackno()
+       and conn.peer.sender().sequence_numbers_in_flight() == 0 ) {
+    const auto listener = std::move( conn.listener );
+    --listener->handshaking_;
+
+    auto [app_end, stack_end] = socket_pair();
+    Accepted accepted { .socket = std::move( app_end ), .peer = conn.adapter.config().destination };
+    ++listener->queued_;
+    if ( listener->closed_ or not listener->queue_.push( std::move( accepted ) ) ) {
+      --listener->queued_;
+      conn.peer.outbound_writer().set_error();
+      conn.peer.inbound_reader().set_error();
+    } else {
+      signal_eventfd( listener->ready_ );
+      attach( conn, std::move( stack_end ) );
+    }
+  }
+
+  if ( not conn.peer.active() and not delivering_inbound( conn ) ) {
+    close( conn );
+    return;
+  }
+
+  schedule_tick( conn );
+}
+
+void TCPStack::Shard::schedule_tick( Connection& conn )
+{
+  optional<steady_clock::time_point> deadline;
+  if ( conn.peer.active() ) {
+    if ( const auto ms = conn.peer.ms_until_next_tick() ) {
+      deadline = conn.last_tick + milliseconds { *ms };
+    }
+  }
+
+  if ( deadline == conn.tick_deadline ) {
+    return;
+  }
+  if ( conn.tick_timer.has_value() ) {
+    loop_.cancel_timer( *conn.tick_timer );
+    conn.tick_timer.reset();
+  }
+  if ( deadline.has_value() ) {
+    conn.tick_timer = loop_.add_timer( *deadline, [this, &conn] {
+      conn.tick_timer.reset();
+      conn.tick_deadline.reset();
+      tick( conn );
+      update( conn );
+    } );
+  }
+  conn.tick_deadline = deadline;
+}
+
+void TCPStack::Shard::close( Connection& conn )
+{
+  conn.closing = true;
+  for ( auto& rule : conn.rules ) {
+    rule.cancel();
+  }
+  if ( conn.tick_timer.has_value() ) {
+    loop_.cancel_timer( *conn.tick_timer );
+  }
+  if ( conn.listener ) {
+    --conn.listener->handshaking_;
+  }
+
+  connection_count_.store( connection_count_.load( memory_order_relaxed ) - 1, memory_order_relaxed );
+  bump( counters_.connections_closed );
+  closing_.push_back( conn.key );
+}
+
+pair<LocalStreamSocket, LocalStreamSocket> TCPStack::socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds.data() ) );
+  return { LocalStreamSocket { FileDescriptor { fds[0] } }, LocalStreamSocket { FileDescriptor { fds[1] } } };
+}
@@ -0,0 +1,166 @@
+#include "buffer.hh"
+#include "test_should_be.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+// "0123456789abcdef", after `headroom` bytes of headroom
+Buffer make_buffer( const size_t headroom )
+{
+  return Buffer { string( headroom, '-' ) + "0123456789abcdef", headroom };
+}
+
+BufferChain make_chain()
+{
+  BufferChain chain;
+  chain.push_back( string { "abc" } );
+  chain.push_back( string { "defg" } );
+  chain.push_back( string { "hi" } );
+  return chain;
+}
+
+// Unlike test_should_be, shows the bytes that differ
+void expect_bytes( const string& actual, const string& expected )
+{
+  if ( actual != expected ) {
+    throw runtime_error( "expected \"" + expected + "\", but got \"" + actual + "\"" );
+  }
+}
+
+string fragments( const BufferChain& chain )
+{
+  string ret;
+  for ( const auto& buf : chain ) {
+    ret += "[" + string { buf } + "]";
+  }
+  return ret;
+}
+
+void test_shared_headroom()
+{
+  const Buffer payload = make_buffer( 8 );
+  const Buffer copy = payload;              // NOLINT(*-unnecessary-copy-initialization)
+  const Buffer slice = payload.substr( 0 ); // shares the storage, and starts where the headroom ends
+  test_should_be( payload.shared(), true );
+
+  // the first slice to prepend claims the headroom...
+  const auto with_header = copy.with_prefix( "HDR" );
+  test_should_be( with_header.has_value(), true );
+  expect_bytes( string { *with_header }, string { "HDR0123456789abcdef" } );
+  test_should_be( with_header->data() + 3 == payload.data(), true );
+
+  // ...so the others can't write there, and their bytes are still as they were
+  const auto second = slice.with_prefix( "XYZ" );
+  test_should_be( second.has_value(), false );
+  test_should_be( payload.with_prefix( "Z" ).has_value(), false );
+  expect_bytes( string { payload }, string { "0123456789abcdef" } );
+  expect_bytes( string { *with_header }, string { "HDR0123456789abcdef" } );
+
+  // the slice that claimed it can go on prepending, into what is left of the headroom
+  const auto lower = with_header->with_prefix( "ETHER" );
+  test_should_be( lower.has_value(), true );
+  expect_bytes( string { *lower }, string { "ETHERHDR0123456789abcdef" } );
+  test_should_be( lower->with_prefix( "!" ).has_value(), false ); // (the headroom is used up)
+
+  // a slice that doesn't start where the headroom ends can never prepend
+  test_should_be( make_buffer( 8 ).substr( 2 ).with_prefix( "A" ).has_value(), false );
+
+  // nor can a buffer without enough headroom, or without any
+  test_should_be( make_buffer( 2 ).with_prefix( "ABC" ).has_value(), false );
+  test_should_be( Buffer { string { "abc" } }.with_prefix( "A" ).has_value(), false );
+}
+
+void test_copy_on_write()
+{
+  Buffer original { string { "0123456789" } };
+  const char* const original_data = original.data();
+
+  // a buffer alone with its storage is written in place
+  original.mutable_data()[0] = 'A';
+  test_should_be( original.data() == original_data, true );
+  expect_bytes( string { original }, string { "A123456789" } );
+
+  // a write through a shared slice copies the slice first, and leaves the other buffer alone
+  Buffer slice = original.substr( 2, 4 );
+  test_should_be( slice.shared(), true );
+  slice.mutable_data()[0] = 'B';
+  expect_bytes( string { slice }, string { "B345" } );
+  expect_bytes( string { original }, string { "A123456789" } );
+  test_should_be( slice.shared(), false );
+  test_should_be( original.shared(), false );
+
+  // and the same the other way around
+  Buffer copy = original;
+  original.mutable_data()[9] = 'C';
+  expect_bytes( string { original }, string { "A12345678C" } );
+  expect_bytes( string { copy }, string { "A123456789" } );
+}
+
+void test_slicing()
+{
+  const Buffer buf { string { "0123456789" } };
+  expect_bytes( string { buf.substr( 3 ) }, string { "3456789" } );
+  expect_bytes( string { buf.substr( 3, 4 ) }, string { "3456" } );
+  expect_bytes( string { buf.substr( 8, 100 ) }, string { "89" } );
+  test_should_be( buf.substr( 10 ).empty(), true );
+  test_should_be( buf.substr( 3, 4 ).data() == buf.data() + 3, true );
+
+  // truncate within a fragment, at a boundary, and across several
+  for ( const auto& [len, expected] : { pair<uint64_t, string> { 100, "[abc][defg][hi]" },
+                                        { 9, "[abc][defg][hi]" },
+                                        { 8, "[abc][defg][h]" },
+                                        { 7, "[abc][defg]" },
+                                        { 5, "[abc][de]" },
+                                        { 3, "[abc]" },
+                                        { 1, "[a]" },
+                                        { 0, "" } } ) {
+    BufferChain chain = make_chain();
+    chain.truncate( len );
+    expect_bytes( fragments( chain ), expected );
+    test_should_be( chain.total_size(), min<uint64_t>( len, 9 ) );
+  }
+
+  // remove_prefix the same way
+  for ( const auto& [len, expected] : { pair<uint64_t, string> { 0, "[abc][defg][hi]" },
+                                        { 2, "[c][defg][hi]" },
+                                        { 3, "[defg][hi]" },
+                                        { 6, "[g][hi]" },
+                                        { 7, "[hi]" },
+                                        { 9, "" },
+                                        { 100, "" } } ) {
+    BufferChain chain = make_chain();
+    chain.remove_prefix( len );
+    expect_bytes( fragments( chain ), expected );
+    test_should_be( chain.total_size(), 9 - min<uint64_t>( len, 9 ) );
+  }
+
+  // a copy of a chain shares the fragments, and trimming one leaves the other whole
+  BufferChain chain = make_chain();
+  const BufferChain copy = chain; // NOLINT(*-unnecessary-copy-initialization)
+  chain.remove_prefix( 4 );
+  chain.truncate( 2 );
+  expect_bytes( chain.concatenate(), string { "ef" } );
+  expect_bytes( copy.concatenate(), string { "abcdefghi" } );
+  test_should_be( chain.front().data() == copy.begin()[1].data() + 1, true );
+}
+} // namespace
+
+int main()
+{
+  try {
+    test_shared_headroom();
+    test_copy_on_write();
+    test_slicing();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -112,6 +112,14 @@ int main()
       test.execute( HasError { false } );
       test.execute( IsClosed { true } );
     }
+
+    {
+      ByteStream bs { 15 };
+      bs.writer().push( "hello" ); // a string literal must not be ambiguous between push() overloads
+      if ( bs.reader().peek() != "hello" ) {
+        throw runtime_error( "push() of a string literal didn't write it" );
+      }
+    }
   } catch ( const exception& e ) {
     cerr << "Exception: " << e.what() << "\n";
     return EXIT_FAILURE;
@@ -0,0 +1,334 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <source_location>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+using Backend = EventLoop::Backend;
+using Dispatch = EventLoop::Dispatch;
+using InterestCheck = EventLoop::InterestCheck;
+using Result = EventLoop::Result;
+
+// A pipe's read end, then its write end (both non-blocking)
+pair<FileDescriptor, FileDescriptor> make_pipe()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "pipe2", ::pipe2( fds.data(), O_NONBLOCK | O_CLOEXEC ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+pair<FileDescriptor, FileDescriptor> make_socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds.data() ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+// Read one byte (so that a rule that calls it never reads everything at once)
+void read_byte( FileDescriptor& fd )
+{
+  string byte( 1, 0 );
+  fd.read( byte );
+}
+
+void expect_result( const Result actual,
+                    const Result expected,
+                    const source_location& where = source_location::current() )
+{
+  if ( actual != expected ) {
+    throw runtime_error( "wait_next_event() returned " + to_string( static_cast<int>( actual ) ) + ", not "
+                         + to_string( static_cast<int>( expected ) ) + " (at line " + to_string( where.line() )
+                         + ")" );
+  }
+}
+
+void test_interest( const Backend backend, const InterestCheck check )
+{
+  EventLoop loop { backend, Dispatch::OneRule, check };
+  auto [read_end, write_end] = make_pipe();
+  write_end.write( "abc" );
+
+  bool interested = false;
+  size_t callbacks = 0;
+  auto rule = loop.add_rule(
+    "read",
+    read_end,
+    Direction::In,
+    [&] {
+      read_byte( read_end );
+      if ( ++callbacks == 2 ) {
+        interested = false;
+      }
+    },
+    [&] { return interested; } );
+
+  // an uninterested rule is never served, however ready its fd
+  expect_result( loop.wait_next_event( 0 ), Result::Exit );
+  test_should_be( callbacks, size_t { 0 } );
+
+  // its interest is called again once it has been marked
+  interested = true;
+  rule.interest_changed();
+  expect_result( loop.wait_next_event( 0 ), Result::Success );
+  test_should_be( callbacks, size_t { 1 } );
+
+  // and after each of its callbacks (the second of which takes its interest away)
+  expect_result( loop.wait_next_event( 0 ), Result::Success );
+  test_should_be( callbacks, size_t { 2 } );
+  expect_result( loop.wait_next_event( 0 ), Result::Exit );
+
+  // a rule that waits for nothing to read times out
+  interested = true;
+  rule.interest_changed();
+  expect_result( loop.wait_next_event( 0 ), Result::Success );
+  expect_result( loop.wait_next_event( 0 ), Result::Timeout );
+  test_should_be( callbacks, size_t { 3 } );
+
+  // two rules on one fd, each served for its own direction
+  auto [left, right] = make_socket_pair();
+  size_t reads = 0;
+  size_t writes = 0;
+  bool want_write = true;
+  loop.add_rule( "left in", left, Direction::In, [&] {
+    read_byte( left );
+    ++reads;
+  } );
+  loop.add_rule(
+    "left out",
+    left,
+    Direction::Out,
+    [&] {
+      left.write( "x" );
+      ++writes;
+      want_write = false;
+    },
+    [&] { return want_write; } );
+  expect_result( loop.wait_next_event( 0 ), Result::Success );
+  test_should_be( writes, size_t { 1 } );
+  test_should_be( reads, size_t { 0 } );
+  right.write( "y" );
+  expect_result( loop.wait_next_event( 0 ), Result::Success );
+  test_should_be( reads, size_t { 1 } );
+  test_should_be( writes, size_t { 1 } );
+}
+
+void test_cancel( const Backend backend, const InterestCheck check )
+{
+  EventLoop loop { backend, Dispatch::OneRule, check };
+  auto [read_end, write_end] = make_pipe();
+  write_end.write( "abc" );
+
+  // a rule cancelled from outside is gone before the next wait, without its cancel callback
+  bool called = false;
+  bool cancelled = false;
+  auto rule = loop.add_rule(
+    "read", read_end, Direction::In, [&] { called = true; }, [] { return true; }, [&] { cancelled = true; } );
+  rule.cancel();
+  expect_result( loop.wait_next_event( 0 ), Result::Exit );
+  test_should_be( called, false );
+  test_should_be( cancelled, false );
+  rule.cancel(); // (again, for a rule that is gone)
+  rule.interest_changed();
+
+  // one that reaches EOF is cancelled by the loop, with its cancel callback
+  loop.add_rule(
+    "read to eof",
+    read_end,
+    Direction::In,
+    [&] {
+      string data;
+      while ( not read_end.eof() ) {
+        read_end.read( data );
+      }
+    },
+    [] { return true; },
+    [&] { cancelled = true; } );
+  write_end.close();
+  expect_result( loop.wait_next_event( 0 ), Result::Success );
+  test_should_be( read_end.eof(), true );
+  test_should_be( cancelled, false );
+  expect_result( loop.wait_next_event( 0 ), Result::Exit );
+  test_should_be( cancelled, true );
+
+  // as is one whose fd is closed, once it has been marked
+  auto [other_read_end, other_write_end] = make_pipe();
+  cancelled = false;
+  auto other_rule = loop.add_rule(
+    "closed", other_read_end, Direction::In, [] {}, [] { return true; }, [&] { cancelled = true; } );
+  expect_result( loop.wait_next_event( 0 ), Result::Timeout );
+  other_read_end.close();
+  other_rule.interest_changed();
+  expect_result( loop.wait_next_event( 0 ), Result::Exit );
+  test_should_be( cancelled, true );
+}
+
+void test_interest_check( const Backend backend )
+{
+  // a rule whose interest changes without a word to the loop, noticed on the next wait only if the loop asks
+  // every rule before each wait (as it does by default, and always with Backend::Poll)
+  const auto run = []( EventLoop& loop, const bool asks_every_wait ) {
+    auto [read_end, write_end] = make_pipe();
+    write_end.write( "abc" );
+    bool interested = false;
+    size_t callbacks = 0;
+    loop.add_rule(
+      "read",
+      read_end,
+      Direction::In,
+      [&] {
+        read_byte( read_end );
+        ++callbacks;
+      },
+      [&] { return interested; } );
+    expect_result( loop.wait_next_event( 0 ), Result::Exit );
+
+    interested = true;
+    expect_result( loop.wait_next_event( 0 ), asks_every_wait ? Result::Success : Result::Exit );
+    test_should_be( callbacks, size_t { asks_every_wait ? 1U : 0U } );
+
+    // and a closed fd is noticed too (its rule is cancelled)
+    if ( asks_every_wait ) {
+      read_end.close();
+      expect_result( loop.wait_next_event( 0 ), Result::Exit );
+    }
+  };
+
+  EventLoop default_loop { backend };
+  run( default_loop, true );
+  EventLoop tracking_loop { backend, Dispatch::OneRule, InterestCheck::WhenChanged };
+  run( tracking_loop, tracking_loop.backend() == Backend::Poll );
+}
+
+void test_hangup( const Backend backend )
+{
+  // a rule that writes is cancelled once the other end hangs up, even though the fd still polls writable
+  EventLoop loop { backend };
+  auto [left, right] = make_socket_pair();
+  bool called = false;
+  bool cancelled = false;
+  loop.add_rule(
+    "write", left, Direction::Out, [&] { called = true; }, [] { return true; }, [&] { cancelled = true; } );
+  right.close();
+
+  loop.wait_next_event( 0 );
+  test_should_be( cancelled, true );
+  test_should_be( called, false );
+  expect_result( loop.wait_next_event( 0 ), Result::Exit );
+}
+
+void test_busy_wait( const Backend backend )
+{
+  // a callback that neither reads its fd nor loses interest would be called forever
+  EventLoop loop { backend };
+  auto [read_end, write_end] = make_pipe();
+  write_end.write( "abc" );
+  loop.add_rule( "lazy reader", read_end, Direction::In, [] {} );
+
+  bool threw = false;
+  try {
+    loop.wait_next_event( 0 );
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  test_should_be( threw, true );
+}
+
+void test_dispatch( const Backend backend )
+{
+  // three rules, each with five bytes to read, one at a time
+  const auto run = [backend]( const Dispatch dispatch, const size_t budget ) {
+    EventLoop loop { backend, dispatch };
+    loop.set_rule_budget( budget );
+    vector<pair<FileDescriptor, FileDescriptor>> pipes;
+    vector<size_t> unread( 3, 5 );
+    pipes.reserve( 3 );
+    for ( size_t i = 0; i < 3; ++i ) {
+      pipes.push_back( make_pipe() );
+      FileDescriptor& read_end = pipes.back().first;
+      pipes.back().second.write( "abcde" );
+      loop.add_rule(
+        "read",
+        read_end,
+        Direction::In,
+        [&read_end, &unread, i] {
+          read_byte( read_end );
+          --unread[i];
+        },
+        [&unread, i] { return unread[i] > 0; } );
+    }
+    expect_result( loop.wait_next_event( 0 ), Result::Success );
+    return loop.stats().callbacks;
+  };
+
+  test_should_be( run( Dispatch::OneRule, 1 ), uint64_t { 1 } );
+  test_should_be( run( Dispatch::OneRule, 4 ), uint64_t { 1 } );
+  test_should_be( run( Dispatch::AllReady, 1 ), uint64_t { 3 } );
+  test_should_be( run( Dispatch::AllReady, 2 ), uint64_t { 6 } );
+  test_should_be( run( Dispatch::AllReady, 100 ), uint64_t { 15 } ); // (a rule stops once it loses interest)
+}
+
+void test_timers( const Backend backend )
+{
+  EventLoop loop { backend };
+  const auto now = steady_clock::now();
+  vector<int> fired;
+  loop.add_timer( now + milliseconds { 3 }, [&] { fired.push_back( 3 ); } );
+  loop.add_timer( now + milliseconds { 1 }, [&] { fired.push_back( 1 ); } );
+  const auto cancelled = loop.add_timer( now + milliseconds { 2 }, [&] { fired.push_back( 2 ); } );
+  loop.add_timer( now, [&] { fired.push_back( 0 ); } );
+  test_should_be( loop.cancel_timer( cancelled ), true );
+  test_should_be( loop.cancel_timer( cancelled ), false );
+
+  // the timers fire earliest first, and the loop exits once none are left
+  while ( loop.wait_next_event( 1000 ) != Result::Exit ) {}
+  const vector<int> expected { 0, 1, 3 };
+  test_should_be( fired == expected, true );
+  test_should_be( steady_clock::now() >= now + milliseconds { 3 }, true );
+
+  // cancelling the only timer left leaves nothing to wait for
+  const auto lone = loop.add_timer( now + seconds { 100 }, [&] { fired.push_back( 100 ); } );
+  expect_result( loop.wait_next_event( 0 ), Result::Timeout );
+  test_should_be( loop.cancel_timer( lone ), true );
+  expect_result( loop.wait_next_event( 0 ), Result::Exit );
+  test_should_be( fired.size(), size_t { 3 } );
+}
+} // namespace
+
+int main()
+{
+  try {
+    for ( const auto backend : { Backend::Poll, Backend::Epoll, Backend::IoUring } ) {
+      for ( const auto check : { InterestCheck::EveryWait, InterestCheck::WhenChanged } ) {
+        test_interest( backend, check );
+        test_cancel( backend, check );
+      }
+      test_interest_check( backend );
+      test_hangup( backend );
+      test_busy_wait( backend );
+      test_dispatch( backend );
+      test_timers( backend );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
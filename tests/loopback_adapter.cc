@@ -0,0 +1,172 @@
+#include "loopback_adapter.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+namespace {
+using Mode = TCPOverIPv4LoopbackAdapter::Mode;
+
+// Two adapters, addressed to each other
+pair<TCPOverIPv4LoopbackAdapter, TCPOverIPv4LoopbackAdapter> make_connected_pair(
+  const Mode mode,
+  const size_t capacity = TCPOverIPv4LoopbackAdapter::DEFAULT_CAPACITY )
+{
+  auto ret = TCPOverIPv4LoopbackAdapter::make_pair( mode, capacity );
+  ret.first.config_mut().source = Address { "10.0.0.1", 40000 };
+  ret.first.config_mut().destination = Address { "10.0.0.2", 5000 };
+  ret.second.config_mut().source = ret.first.config().destination;
+  ret.second.config_mut().destination = ret.first.config().source;
+  return ret;
+}
+
+TCPMessage make_message( const uint32_t seqno, const string& payload, const uint32_t ackno = 0 )
+{
+  return { TCPSenderMessage { .seqno = Wrap32 { seqno }, .payload = payload },
+           TCPReceiverMessage { .ackno = Wrap32 { ackno }, .window_size = 1000 } };
+}
+
+void expect_message( const optional<TCPMessage>& msg, const uint32_t seqno, const string& payload )
+{
+  if ( not msg.has_value() ) {
+    throw runtime_error( "expected a segment carrying \"" + payload + "\", but read() returned none" );
+  }
+  test_should_be( msg->sender.get().seqno, Wrap32 { seqno } );
+  test_should_be( msg->sender.get().payload == payload, true );
+  test_should_be( msg->receiver.get().window_size, uint16_t { 1000 } );
+}
+
+bool readable( FileDescriptor& fd )
+{
+  pollfd pfd { .fd = fd.fd_num(), .events = POLLIN, .revents = 0 };
+  return ::poll( &pfd, 1, 0 ) == 1 and ( pfd.revents & POLLIN );
+}
+
+void test_round_trip( const Mode mode )
+{
+  auto [client, server] = make_connected_pair( mode );
+  test_should_be( client.mode() == mode, true );
+  test_should_be( server.read().has_value(), false );
+
+  client.write( make_message( 1000, "hello" ) );
+  client.write( make_message( 1005, "again" ) );
+  expect_message( server.read(), 1000, "hello" );
+  expect_message( server.read(), 1005, "again" );
+  test_should_be( server.read().has_value(), false );
+
+  server.write( make_message( 7, "and back", 1010 ) );
+  const auto reply = client.read();
+  expect_message( reply, 7, "and back" );
+  test_should_be( reply->receiver.get().ackno.value_or( Wrap32 { 0 } ), Wrap32 { 1010 } );
+  test_should_be( client.read().has_value(), false );
+
+  test_should_be( client.stats().datagrams_written, uint64_t { 2 } );
+  test_should_be( client.stats().datagrams_read, uint64_t { 1 } );
+  test_should_be( server.stats().datagrams_written, uint64_t { 1 } );
+  test_should_be( server.stats().datagrams_read, uint64_t { 2 } );
+  test_should_be( client.stats().datagrams_dropped + server.stats().datagrams_dropped, uint64_t { 0 } );
+
+  // a datagram for another connection is read and dropped
+  server.config_mut().source = Address { "10.0.0.3", 5000 };
+  client.write( make_message( 1010, "elsewhere" ) );
+  test_should_be( server.read().has_value(), false );
+}
+
+void test_full( const Mode mode )
+{
+  // a full ring drops what is written to it, and takes datagrams again once the reader has made room
+  auto [client, server] = make_connected_pair( mode, 4 );
+  for ( uint32_t i = 0; i < 6; ++i ) {
+    client.write( make_message( i, "x" ) );
+  }
+  test_should_be( client.stats().datagrams_written, uint64_t { 6 } );
+  test_should_be( client.stats().datagrams_dropped, uint64_t { 2 } );
+
+  expect_message( server.read(), 0, "x" );
+  client.write( make_message( 6, "x" ) );
+  test_should_be( client.stats().datagrams_dropped, uint64_t { 2 } );
+  for ( const uint32_t i : { 1, 2, 3, 6 } ) {
+    expect_message( server.read(), i, "x" );
+  }
+  test_should_be( server.read().has_value(), false );
+}
+
+void test_full_socket()
+{
+  // likewise a socket whose buffer has filled up
+  auto [client, server] = make_connected_pair( Mode::SocketPair );
+  const string payload( 1000, 'x' );
+  for ( uint32_t i = 0; i < 10000 and client.stats().datagrams_dropped == 0; ++i ) {
+    client.write( make_message( i * 1000, payload ) );
+  }
+  test_should_be( client.stats().datagrams_dropped, uint64_t { 1 } );
+
+  uint64_t received = 0;
+  while ( server.read().has_value() ) {
+    ++received;
+  }
+  test_should_be( received, client.stats().datagrams_written - 1 );
+}
+
+void test_notified()
+{
+  // the fd is readable exactly while a datagram is waiting to be read
+  auto [client, server] = make_connected_pair( Mode::Notified );
+  test_should_be( readable( server.fd() ), false );
+  client.write( make_message( 0, "one" ) );
+  client.write( make_message( 3, "two" ) );
+  test_should_be( readable( server.fd() ), true );
+  test_should_be( readable( client.fd() ), false );
+  expect_message( server.read(), 0, "one" );
+  test_should_be( readable( server.fd() ), true );
+  expect_message( server.read(), 3, "two" );
+  test_should_be( readable( server.fd() ), false );
+  test_should_be( server.read().has_value(), false );
+
+  // (and a datagram dropped because the ring was full is never counted)
+  auto [small_client, small_server] = make_connected_pair( Mode::Notified, 2 );
+  for ( uint32_t i = 0; i < 3; ++i ) {
+    small_client.write( make_message( i, "x" ) );
+  }
+  expect_message( small_server.read(), 0, "x" );
+  expect_message( small_server.read(), 1, "x" );
+  test_should_be( readable( small_server.fd() ), false );
+
+  // in Mode::Memory, there is no fd to wait on
+  auto [memory_client, memory_server] = make_connected_pair( Mode::Memory );
+  bool threw = false;
+  try {
+    memory_server.fd();
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  test_should_be( threw, true );
+}
+} // namespace
+
+int main()
+{
+  try {
+    test_round_trip( Mode::Memory );
+    test_round_trip( Mode::Notified );
+    test_round_trip( Mode::SocketPair );
+    test_full( Mode::Memory );
+    test_full( Mode::Notified );
+    test_full_socket();
+    test_notified();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -51,7 +51,7 @@ ARPMessage make_arp( const uint16_t opcode,
 EthernetFrame make_frame( const EthernetAddress& src,
                           const EthernetAddress& dst,
                           const uint16_t type,
-                          vector<Ref<string>> payload )
+                          BufferChain payload )
 {
   EthernetFrame frame;
   frame.header.src = src;
@@ -932,6 +932,246 @@ int main()
       test.execute( ExpectFrame { make_frame( eth_a, eth_b, EthernetHeader::TYPE_IPv4, serialize( datagram ) ) } );
       test.execute( ExpectNoFrame {} );
     }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test { "receive queue is bounded (tail drop)", local_eth, Address( "5.5.5.5", 0 ) };
+
+      auto events = make_shared<vector<size_t>>();
+      NetworkInterface::QueueConfig config;
+      config.receive_limit = 4;
+      config.high_watermark = 3;
+      test.execute( SetQueueConfig { config } );
+      test.execute( SetHighWatermarkCallback { events } );
+
+      const auto frame
+        = make_frame( remote_eth, local_eth, EthernetHeader::TYPE_IPv4, serialize( make_datagram( "5.6.7.8", "5.5.5.5" ) ) );
+      test.execute( ReceiveFrames { frame, 6 } );
+      test.execute( ExpectReceiveQueueLength { 4 } );
+      test.execute( ExpectTailDrops { 2 } );
+      test.execute( ExpectRedDrops { 0 } );
+
+      if ( *events != vector<size_t> { 3 } ) {
+        throw runtime_error( "high-watermark callback should have been called once, when the queue reached 3" );
+      }
+
+      // ARP frames are not datagrams, and are never dropped
+      test.execute( ReceiveFrame {
+        make_frame( remote_eth,
+                    ETHERNET_BROADCAST,
+                    EthernetHeader::TYPE_ARP,
+                    // NOLINTNEXTLINE(*-suspicious-*)
+                    serialize( make_arp( ARPMessage::OPCODE_REQUEST, remote_eth, "5.6.7.8", {}, "5.5.5.5" ) ) ),
+        make_datagram( "5.6.7.8", "5.5.5.5" ) } );
+      test.execute( ExpectFrame { make_frame(
+        local_eth,
+        remote_eth,
+        EthernetHeader::TYPE_ARP,
+        // NOLINTNEXTLINE(*-suspicious-*)
+        serialize( make_arp( ARPMessage::OPCODE_REPLY, local_eth, "5.5.5.5", remote_eth, "5.6.7.8" ) ) ) } );
+
+      // (ReceiveFrame took one datagram off the queue) once there is room again, datagrams are admitted
+      test.execute( ExpectReceiveQueueLength { 3 } );
+      test.execute( ReceiveFrames { frame, 2 } );
+      test.execute( ExpectReceiveQueueLength { 4 } );
+      test.execute( ExpectTailDrops { 3 } );
+
+      if ( *events != vector<size_t> { 3 } ) {
+        throw runtime_error( "high-watermark callback should only be called when the queue grows to the watermark" );
+      }
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test { "receive queue with RED", local_eth, Address( "5.5.5.5", 0 ) };
+
+      // with the average tracking the queue exactly and no early drops, RED drops everything from 4 on
+      NetworkInterface::QueueConfig config;
+      config.receive_policy = NetworkInterface::DropPolicy::RED;
+      config.red_min = 2;
+      config.red_max = 4;
+      config.red_max_probability = 0;
+      config.red_weight = 1;
+      test.execute( SetQueueConfig { config } );
+
+      const auto frame
+        = make_frame( remote_eth, local_eth, EthernetHeader::TYPE_IPv4, serialize( make_datagram( "5.6.7.8", "5.5.5.5" ) ) );
+      test.execute( ReceiveFrames { frame, 10 } );
+      test.execute( ExpectReceiveQueueLength { 4 } );
+      test.execute( ExpectRedDrops { 6 } );
+      test.execute( ExpectTailDrops { 0 } );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test { "pending datagrams are bounded", local_eth, Address( "5.5.5.5", 0 ) };
+
+      NetworkInterface::QueueConfig config;
+      config.pending_limit_per_hop = 2;
+      config.pending_limit = 3;
+      test.execute( SetQueueConfig { config } );
+
+      // three datagrams for one next hop: the third is dropped
+      const auto datagram = make_datagram( "5.5.5.5", "13.12.11.10" );
+      for ( int i = 0; i < 3; ++i ) {
+        test.execute( SendDatagram { datagram, Address( "192.168.0.1", 0 ) } );
+      }
+      test.execute( ExpectFrame { make_frame(
+        local_eth,
+        ETHERNET_BROADCAST,
+        EthernetHeader::TYPE_ARP,
+        // NOLINTNEXTLINE(*-suspicious-*)
+        serialize( make_arp( ARPMessage::OPCODE_REQUEST, local_eth, "5.5.5.5", {}, "192.168.0.1" ) ) ) } );
+      test.execute( ExpectNoFrame {} );
+      test.execute( ExpectPendingDrops { 1 } );
+
+      // two datagrams for another next hop: the total limit drops the second
+      test.execute( SendDatagram { datagram, Address( "192.168.0.2", 0 ) } );
+      test.execute( SendDatagram { datagram, Address( "192.168.0.2", 0 ) } );
+      test.execute( ExpectFrame { make_frame(
+        local_eth,
+        ETHERNET_BROADCAST,
+        EthernetHeader::TYPE_ARP,
+        // NOLINTNEXTLINE(*-suspicious-*)
+        serialize( make_arp( ARPMessage::OPCODE_REQUEST, local_eth, "5.5.5.5", {}, "192.168.0.2" ) ) ) } );
+      test.execute( ExpectPendingDrops { 2 } );
+
+      // the reply sends the two datagrams that were kept, which makes room for more
+      test.execute( ReceiveFrame { make_frame(
+        remote_eth,
+        local_eth,
+        EthernetHeader::TYPE_ARP,
+        // NOLINTNEXTLINE(*-suspicious-*)
+        serialize( make_arp( ARPMessage::OPCODE_REPLY, remote_eth, "192.168.0.1", local_eth, "5.5.5.5" ) ) ) } );
+      test.execute( ExpectFrame { make_frame( local_eth, remote_eth, EthernetHeader::TYPE_IPv4, serialize( datagram ) ) } );
+      test.execute( ExpectFrame { make_frame( local_eth, remote_eth, EthernetHeader::TYPE_IPv4, serialize( datagram ) ) } );
+      test.execute( ExpectNoFrame {} );
+
+      test.execute( SendDatagram { datagram, Address( "192.168.0.2", 0 ) } );
+      test.execute( ExpectNoFrame {} );
+      test.execute( ExpectPendingDrops { 2 } );
+
+      // expired datagrams make room too
+      test.execute( Tick { 5000 } );
+      test.execute( SendDatagram { datagram, Address( "192.168.0.2", 0 ) } );
+      test.execute( SendDatagram { datagram, Address( "192.168.0.2", 0 ) } );
+      test.execute( ExpectPendingDrops { 2 } );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test { "each pending datagram expires 5 seconds after it was sent",
+                                         local_eth,
+                                         Address( "5.5.5.5", 0 ) };
+
+      const auto arp_request = make_frame(
+        local_eth,
+        ETHERNET_BROADCAST,
+        EthernetHeader::TYPE_ARP,
+        // NOLINTNEXTLINE(*-suspicious-*)
+        serialize( make_arp( ARPMessage::OPCODE_REQUEST, local_eth, "5.5.5.5", {}, "192.168.0.1" ) ) );
+
+      const auto first = make_datagram( "5.5.5.5", "13.12.11.10" );
+      const auto second = make_datagram( "5.5.5.5", "13.12.11.11" );
+      test.execute( SendDatagram { first, Address( "192.168.0.1", 0 ) } );
+      test.execute( ExpectFrame { arp_request } );
+      test.execute( Tick { 3000 } );
+      test.execute( SendDatagram { second, Address( "192.168.0.1", 0 ) } );
+      test.execute( ExpectNoFrame {} );
+
+      // the first datagram expires, but the second is still waiting (and the ARP request may be re-sent)
+      test.execute( Tick { 3000 } );
+      test.execute( SendDatagram { second, Address( "192.168.0.1", 0 ) } );
+      test.execute( ExpectFrame { arp_request } );
+      test.execute( ExpectNoFrame {} );
+
+      test.execute( ReceiveFrame { make_frame(
+        remote_eth,
+        local_eth,
+        EthernetHeader::TYPE_ARP,
+        // NOLINTNEXTLINE(*-suspicious-*)
+        serialize( make_arp( ARPMessage::OPCODE_REPLY, remote_eth, "192.168.0.1", local_eth, "5.5.5.5" ) ) ) } );
+      test.execute( ExpectFrame { make_frame( local_eth, remote_eth, EthernetHeader::TYPE_IPv4, serialize( second ) ) } );
+      test.execute( ExpectFrame { make_frame( local_eth, remote_eth, EthernetHeader::TYPE_IPv4, serialize( second ) ) } );
+      test.execute( ExpectNoFrame {} );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test { "send a burst of datagrams at once", local_eth, Address( "5.5.5.5", 0 ) };
+
+      test.execute( ReceiveFrame { make_frame(
+        remote_eth,
+        ETHERNET_BROADCAST,
+        EthernetHeader::TYPE_ARP,
+        // NOLINTNEXTLINE(*-suspicious-*)
+        serialize( make_arp( ARPMessage::OPCODE_REQUEST, remote_eth, "192.168.0.1", {}, "192.168.0.9" ) ) ) } );
+      test.execute( ExpectNoFrame {} );
+
+      // two datagrams to a known next hop, and one to an unknown next hop
+      const auto first = make_datagram( "5.5.5.5", "13.12.11.10" );
+      const auto second = make_datagram( "5.5.5.5", "13.12.11.11" );
+      const auto third = make_datagram( "5.5.5.5", "13.12.11.12" );
+      test.execute( SendDatagrams { { { first, Address( "192.168.0.1", 0 ) },
+                                      { second, Address( "192.168.0.2", 0 ) },
+                                      { third, Address( "192.168.0.1", 0 ) } } } );
+      test.execute( ExpectFrame { make_frame( local_eth, remote_eth, EthernetHeader::TYPE_IPv4, serialize( first ) ) } );
+      test.execute( ExpectFrame { make_frame(
+        local_eth,
+        ETHERNET_BROADCAST,
+        EthernetHeader::TYPE_ARP,
+        // NOLINTNEXTLINE(*-suspicious-*)
+        serialize( make_arp( ARPMessage::OPCODE_REQUEST, local_eth, "5.5.5.5", {}, "192.168.0.2" ) ) ) } );
+      test.execute( ExpectFrame { make_frame( local_eth, remote_eth, EthernetHeader::TYPE_IPv4, serialize( third ) ) } );
+      test.execute( ExpectNoFrame {} );
+
+      // the mapping expires after 30 seconds
+      test.execute( Tick { 30000 } );
+      test.execute( SendDatagrams { { { first, Address( "192.168.0.1", 0 ) } } } );
+      test.execute( ExpectFrame { make_frame(
+        local_eth,
+        ETHERNET_BROADCAST,
+        EthernetHeader::TYPE_ARP,
+        // NOLINTNEXTLINE(*-suspicious-*)
+        serialize( make_arp( ARPMessage::OPCODE_REQUEST, local_eth, "5.5.5.5", {}, "192.168.0.1" ) ) ) } );
+      test.execute( ExpectNoFrame {} );
+    }
+
+    {
+      // the Ethernet header is written into the headroom in front of the IPv4 header, so a frame's
+      // headers end up in one buffer in front of the (shared) payload
+      auto dgram = make_datagram( "5.5.5.5", "13.12.11.10" );
+      const EthernetFrame frame { { ETHERNET_BROADCAST, random_private_ethernet_address(), EthernetHeader::TYPE_IPv4 },
+                                  serialize( dgram ) };
+      const auto wire = serialize( frame );
+      if ( wire.size() != 2 or wire.front().size() != EthernetHeader::LENGTH + IPv4Header::LENGTH ) {
+        throw runtime_error( "Ethernet and IPv4 headers were not serialized into one buffer" );
+      }
+
+      // the headroom can only be claimed once
+      if ( serialize( frame ).front().size() != EthernetHeader::LENGTH or concat( serialize( frame ) ) != concat( wire ) ) {
+        throw runtime_error( "second serialization of a frame did not fall back to a separate header" );
+      }
+
+      // a parsed header is reused as long as it is unchanged
+      InternetDatagram parsed;
+      if ( not parse( parsed, frame.payload ) or concat( serialize( parsed ) ) != concat( frame.payload ) ) {
+        throw runtime_error( "parsed datagram did not serialize back to the same bytes" );
+      }
+
+      // decrementing the TTL keeps the checksum correct
+      parsed.header.decrement_ttl();
+      auto expected = parsed.header;
+      expected.compute_checksum();
+      if ( parsed.header.cksum != expected.cksum or not parse( dgram, serialize( parsed ) ) ) {
+        throw runtime_error( "decrement_ttl() did not update the checksum" );
+      }
+    }
   } catch ( const exception& e ) {
     cerr << e.what() << "\n";
     return EXIT_FAILURE;
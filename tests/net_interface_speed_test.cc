@@ -0,0 +1,130 @@
+#include "arp_message.hh"
+#include "helpers.hh"
+#include "network_interface.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+// An output port that just counts the frames sent through it
+class FrameCounter : public NetworkInterface::OutputPort
+{
+public:
+  size_t frames {};
+  void transmit( const NetworkInterface& n [[maybe_unused]], const EthernetFrame& x [[maybe_unused]] ) override
+  {
+    ++frames;
+  }
+};
+
+// How fast does send_datagram() go when every next hop's Ethernet address is known? With few neighbours
+// the neighbour table stays in cache ("warm"); with many, visited in random order, most lookups miss ("cold").
+void speed_test( const size_t num_neighbors, // NOLINT(bugprone-easily-swappable-parameters)
+                 const size_t num_dgrams,    // NOLINT(bugprone-easily-swappable-parameters)
+                 const bool batched,
+                 const size_t random_seed )
+{
+  default_random_engine rd { random_seed };
+
+  auto port = make_shared<FrameCounter>();
+  NetworkInterface iface { "eth0", port, { 2, 0, 0, 0, 0, 1 }, Address( "10.0.0.1" ) };
+
+  // Teach the interface every neighbour's Ethernet address (from ARP requests for someone else)
+  const uint32_t base = Address( "10.128.0.0" ).ipv4_numeric();
+  for ( uint32_t i = 0; i < num_neighbors; ++i ) {
+    ARPMessage arp;
+    arp.opcode = ARPMessage::OPCODE_REQUEST;
+    arp.sender_ethernet_address = { 2, 0, 0, static_cast<uint8_t>( i >> 16 ), static_cast<uint8_t>( i >> 8 ),
+                                    static_cast<uint8_t>( i ) };
+    arp.sender_ip_address = base + i;
+    arp.target_ip_address = base - 1;
+    iface.recv_frame( { { ETHERNET_BROADCAST, arp.sender_ethernet_address, EthernetHeader::TYPE_ARP }, serialize( arp ) } );
+  }
+  port->frames = 0;
+
+  uniform_int_distribution<uint32_t> random_neighbor { 0, static_cast<uint32_t>( num_neighbors - 1 ) };
+  vector<Address> next_hops;
+  next_hops.reserve( num_dgrams );
+  for ( size_t i = 0; i < num_dgrams; ++i ) {
+    next_hops.push_back( Address::from_ipv4_numeric( base + random_neighbor( rd ) ) );
+  }
+
+  InternetDatagram dgram;
+  dgram.header.src = Address( "10.0.0.1" ).ipv4_numeric();
+  dgram.header.dst = Address( "1.2.3.4" ).ipv4_numeric();
+  dgram.payload.emplace_back( string( 64, 'x' ) );
+  dgram.header.len = dgram.header.hlen * 4 + 64;
+  dgram.header.compute_checksum();
+
+  static constexpr size_t BURST = 32;
+  vector<InternetDatagram> burst( BURST, dgram );
+
+  const auto start_time = steady_clock::now();
+  if ( batched ) {
+    for ( size_t i = 0; i < num_dgrams; i += BURST ) {
+      const size_t n = min( BURST, num_dgrams - i );
+      // send_datagrams() moves from the datagrams, so refill the burst each time (as send_datagram() below
+      // gets a copy of each datagram)
+      fill_n( burst.begin(), n, dgram );
+      iface.send_datagrams( span { burst.data(), n }, span { next_hops.data() + i, n } );
+    }
+  } else {
+    for ( const auto& next_hop : next_hops ) {
+      iface.send_datagram( dgram, next_hop );
+    }
+  }
+  const auto stop_time = steady_clock::now();
+
+  if ( port->frames != num_dgrams ) {
+    throw runtime_error( "NetworkInterface sent " + to_string( port->frames ) + " frames, expected "
+                         + to_string( num_dgrams ) );
+  }
+
+  auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  auto dgrams_per_second = static_cast<double>( num_dgrams ) / test_duration.count();
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  const string mode = batched ? "in bursts of " + to_string( BURST ) : "one at a time";
+  cout << "NetworkInterface with " << num_neighbors << " neighbours sent " << fixed << setprecision( 2 )
+       << dgrams_per_second / 1e6 << " M datagrams/s " << mode << ".\n";
+
+  debug_output << "        NetworkInterface send (" << setw( 6 ) << num_neighbors << " neighbours, " << setw( 13 )
+               << mode << "): " << fixed << setprecision( 2 ) << setw( 6 ) << dgrams_per_second / 1e6
+               << " M datagrams/s\n";
+
+  if ( dgrams_per_second < 1e5 ) {
+    throw runtime_error( "NetworkInterface did not meet minimum speed of 0.1 M datagrams/s." );
+  }
+}
+
+void program_body()
+{
+  speed_test( 16, 1'000'000, false, 2604 );
+  speed_test( 16, 1'000'000, true, 2604 );
+  speed_test( 262'144, 1'000'000, false, 8133 );
+  speed_test( 262'144, 1'000'000, true, 8133 );
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
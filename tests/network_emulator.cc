@@ -0,0 +1,315 @@
+#include "network_emulator.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+// What reached the far end of the path: each datagram's number, and when it arrived
+struct Delivery
+{
+  uint64_t ms;
+  uint64_t num;
+  bool operator==( const Delivery& other ) const = default;
+};
+
+struct Log
+{
+  uint64_t now_ms {};
+  vector<Delivery> deliveries {};
+};
+
+// Stands in for an FD adapter, noting down the datagrams the emulator delivers to it
+class RecordingAdapter
+{
+  shared_ptr<Log> log_;
+
+public:
+  explicit RecordingAdapter( shared_ptr<Log> log ) : log_( std::move( log ) ) {}
+
+  void write( const TCPMessage& msg )
+  {
+    log_->deliveries.push_back( { log_->now_ms, msg.sender.get().seqno.unwrap( Wrap32 { 0 }, 0 ) } );
+  }
+
+  void tick( size_t /* ms_since_last_tick */ ) {}
+};
+
+class Path
+{
+  shared_ptr<Log> log_ = make_shared<Log>();
+  NetworkEmulatorAdapter<RecordingAdapter> emulator_;
+  uint64_t next_num_ {};
+
+public:
+  explicit Path( const NetworkEmulatorConfig& config ) : emulator_( RecordingAdapter { log_ }, config ) {}
+
+  // Write a datagram (numbered in the order written) whose IPv4 datagram is `bytes` long
+  void write( const size_t bytes = 1000 )
+  {
+    const size_t payload = bytes - IPv4Header::LENGTH - TCPSegment::HEADER_LENGTH;
+    emulator_.write( { TCPSenderMessage { .seqno = Wrap32 { static_cast<uint32_t>( next_num_++ ) },
+                                          .payload = string( payload, 'x' ) },
+                       TCPReceiverMessage {} } );
+  }
+
+  void tick( const uint64_t ms )
+  {
+    for ( uint64_t i = 0; i < ms; ++i ) {
+      ++log_->now_ms;
+      emulator_.tick( 1 );
+    }
+  }
+
+  const vector<Delivery>& deliveries() const { return log_->deliveries; }
+  const NetworkEmulatorAdapter<RecordingAdapter>::Stats& stats() const { return emulator_.stats(); }
+  optional<uint64_t> ms_until_next_tick() const { return emulator_.ms_until_next_tick(); }
+};
+
+string to_string( const vector<Delivery>& deliveries )
+{
+  string ret;
+  for ( const auto& [ms, num] : deliveries ) {
+    ret += " #" + std::to_string( num ) + " at " + std::to_string( ms ) + " ms";
+  }
+  return ret.empty() ? " nothing" : ret;
+}
+
+void expect_deliveries( const Path& path, const vector<Delivery>& expected )
+{
+  if ( path.deliveries() != expected ) {
+    throw runtime_error( "expected" + to_string( expected ) + ", but delivered" + to_string( path.deliveries() ) );
+  }
+}
+
+// A path with some of everything
+NetworkEmulatorConfig messy_path( const uint64_t seed )
+{
+  return { .delay_ms = 5,
+           .jitter_ms = 3,
+           .rate_bps = 10'000'000,
+           .queue_bytes = 8000,
+           .reorder = 0.05,
+           .duplicate = 0.05,
+           .good_to_bad = 0.02,
+           .bad_to_good = 0.3,
+           .loss_good = 0.01,
+           .loss_bad = 0.8,
+           .seed = seed };
+}
+
+// Write datagrams of varying sizes, a few per millisecond, then wait for the path to empty
+Path run( const NetworkEmulatorConfig& config )
+{
+  Path path { config };
+  for ( size_t i = 0; i < 5000; ++i ) {
+    path.write( 100 + ( i * 37 ) % 1400 );
+    if ( i % 3 == 0 ) {
+      path.tick( 1 );
+    }
+  }
+  path.tick( 1000 );
+  return path;
+}
+
+void test_determinism()
+{
+  const Path first = run( messy_path( 42 ) );
+  const Path second = run( messy_path( 42 ) );
+
+  test_should_be( first.deliveries() == second.deliveries(), true );
+  test_should_be( first.stats().datagrams_written, second.stats().datagrams_written );
+  test_should_be( first.stats().datagrams_lost, second.stats().datagrams_lost );
+  test_should_be( first.stats().datagrams_dropped, second.stats().datagrams_dropped );
+  test_should_be( first.stats().datagrams_duplicated, second.stats().datagrams_duplicated );
+  test_should_be( first.stats().datagrams_reordered, second.stats().datagrams_reordered );
+  test_should_be( first.stats().datagrams_delivered, second.stats().datagrams_delivered );
+
+  // (and the path really did all of it)
+  test_should_be( first.stats().datagrams_written, uint64_t { 5000 } );
+  test_should_be( first.stats().datagrams_lost > 0, true );
+  test_should_be( first.stats().datagrams_dropped > 0, true );
+  test_should_be( first.stats().datagrams_duplicated > 0, true );
+  test_should_be( first.stats().datagrams_reordered > 0, true );
+  test_should_be( static_cast<uint64_t>( first.deliveries().size() ), first.stats().datagrams_delivered );
+  test_should_be( first.stats().datagrams_delivered,
+                  first.stats().datagrams_written - first.stats().datagrams_lost
+                    + first.stats().datagrams_duplicated - first.stats().datagrams_dropped );
+
+  // another seed takes another course
+  test_should_be( first.deliveries() == run( messy_path( 43 ) ).deliveries(), false );
+}
+
+void test_delay_and_rate()
+{
+  // with no delay and no bottleneck, write() delivers at once
+  {
+    Path path { NetworkEmulatorConfig {} };
+    path.write();
+    expect_deliveries( path, { { 0, 0 } } );
+    test_should_be( path.ms_until_next_tick().has_value(), false );
+  }
+
+  // 1000-byte datagrams over 8 Mbit/s (one byte per microsecond) take 1 ms each to send, then 10 ms to arrive
+  {
+    Path path { { .delay_ms = 10, .rate_bps = 8'000'000 } };
+    path.write();
+    path.write();
+    path.write();
+    test_should_be( path.ms_until_next_tick().value_or( 0 ), uint64_t { 11 } );
+    path.tick( 10 );
+    test_should_be( path.deliveries().empty(), true );
+    path.tick( 5 );
+    expect_deliveries( path, { { 11, 0 }, { 12, 1 }, { 13, 2 } } );
+  }
+
+  // a 2500-byte queue holds the datagram being sent and one more; the rest are dropped until it drains
+  {
+    Path path { { .rate_bps = 8'000'000, .queue_bytes = 2500 } };
+    for ( size_t i = 0; i < 4; ++i ) {
+      path.write();
+    }
+    test_should_be( path.stats().datagrams_dropped, uint64_t { 2 } );
+    path.tick( 1 );
+    path.write(); // (now one datagram is in the queue, and there is room for another)
+    path.write();
+    test_should_be( path.stats().datagrams_dropped, uint64_t { 3 } );
+    path.tick( 10 );
+    expect_deliveries( path, { { 1, 0 }, { 2, 1 }, { 3, 4 } } );
+
+    // a smaller datagram still fits where a larger one wouldn't
+    path.write();
+    path.write();
+    path.write( 500 );
+    test_should_be( path.stats().datagrams_dropped, uint64_t { 3 } );
+    path.write( 501 );
+    test_should_be( path.stats().datagrams_dropped, uint64_t { 4 } );
+  }
+
+  // jitter without reordering keeps the datagrams in order
+  {
+    Path path { { .delay_ms = 2, .jitter_ms = 20, .seed = 7 } };
+    for ( size_t i = 0; i < 1000; ++i ) {
+      path.write();
+      path.tick( 1 );
+    }
+    path.tick( 100 );
+    test_should_be( path.deliveries().size(), size_t { 1000 } );
+    for ( size_t i = 0; i < 1000; ++i ) {
+      test_should_be( path.deliveries()[i].num, uint64_t { i } );
+    }
+    test_should_be( path.stats().datagrams_reordered, uint64_t { 0 } );
+  }
+}
+
+void test_reordering()
+{
+  // with nothing in flight to overtake, skipping the delay reorders nothing
+  {
+    Path path { { .reorder = 1 } };
+    for ( size_t i = 0; i < 100; ++i ) {
+      path.write();
+    }
+    test_should_be( path.stats().datagrams_reordered, uint64_t { 0 } );
+  }
+
+  // otherwise, each datagram counted as reordered arrives before one written earlier (and no other does)
+  Path path { { .delay_ms = 10, .reorder = 0.2, .seed = 3 } };
+  for ( size_t i = 0; i < 1000; ++i ) {
+    path.write();
+    path.tick( 1 );
+  }
+  path.tick( 100 );
+  test_should_be( path.deliveries().size(), size_t { 1000 } );
+
+  uint64_t overtakes = 0;
+  uint64_t earliest_later = UINT64_MAX; // the lowest number among the datagrams delivered after this one
+  for ( auto it = path.deliveries().rbegin(); it != path.deliveries().rend(); ++it ) {
+    overtakes += earliest_later < it->num;
+    earliest_later = min( earliest_later, it->num );
+  }
+  test_should_be( overtakes > 100, true );
+  test_should_be( path.stats().datagrams_reordered, overtakes );
+}
+
+void test_duplication()
+{
+  {
+    Path path { { .duplicate = 1 } };
+    for ( size_t i = 0; i < 10; ++i ) {
+      path.write();
+    }
+    test_should_be( path.stats().datagrams_duplicated, uint64_t { 10 } );
+    test_should_be( path.deliveries().size(), size_t { 20 } );
+    for ( size_t i = 0; i < 20; ++i ) {
+      test_should_be( path.deliveries()[i].num, uint64_t { i / 2 } );
+    }
+  }
+
+  Path path { { .duplicate = 0.25, .seed = 11 } };
+  for ( size_t i = 0; i < 10000; ++i ) {
+    path.write();
+  }
+  const uint64_t duplicated = path.stats().datagrams_duplicated;
+  test_should_be( duplicated > 2300 and duplicated < 2700, true );
+  test_should_be( static_cast<uint64_t>( path.deliveries().size() ), 10000 + duplicated );
+}
+
+void test_burst_loss()
+{
+  // The chain goes bad with probability 1/100 and recovers with probability 1/10, losing everything while bad:
+  // about 1/11 of the datagrams are lost, in bursts of 10 on average
+  Path path { { .good_to_bad = 0.01, .bad_to_good = 0.1, .loss_bad = 1, .seed = 5 } };
+  constexpr uint64_t count = 200'000;
+  vector<bool> lost( count, true );
+  for ( uint64_t i = 0; i < count; ++i ) {
+    path.write();
+  }
+  for ( const auto& delivery : path.deliveries() ) {
+    lost[delivery.num] = false;
+  }
+
+  uint64_t losses = 0;
+  uint64_t bursts = 0;
+  for ( uint64_t i = 0; i < count; ++i ) {
+    losses += lost[i];
+    bursts += lost[i] and ( i == 0 or not lost[i - 1] );
+  }
+  test_should_be( path.stats().datagrams_lost, losses );
+  test_should_be( losses > count * 8 / 100 and losses < count * 10 / 100, true );
+  test_should_be( losses > bursts * 9 and losses < bursts * 11, true );
+
+  // with the same rate of loss in the good state alone, the losses are independent: bursts of about 1.1
+  Path independent { { .loss_good = 1.0 / 11, .seed = 5 } };
+  for ( uint64_t i = 0; i < count; ++i ) {
+    independent.write();
+  }
+  const uint64_t independent_losses = independent.stats().datagrams_lost;
+  test_should_be( independent_losses > count * 8 / 100 and independent_losses < count * 10 / 100, true );
+  test_should_be( static_cast<uint64_t>( independent.deliveries().size() ), count - independent_losses );
+}
+} // namespace
+
+int main()
+{
+  try {
+    test_determinism();
+    test_delay_and_rate();
+    test_reordering();
+    test_duplication();
+    test_burst_loss();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <memory>
 #include <optional>
 #include <utility>
+#include <vector>
 
 #include "common.hh"
 #include "helpers.hh"
@@ -64,6 +66,38 @@ struct SendDatagram : public Action<InterfaceAndOutput>
   SendDatagram( const InternetDatagram& d, Address n ) : dgram( clone( d ) ), next_hop( n ) {}
 };
 
+struct SendDatagrams : public Action<InterfaceAndOutput>
+{
+  std::vector<InternetDatagram> dgrams {};
+  std::vector<Address> next_hops {};
+
+  std::string description() const override
+  {
+    std::string ret = "request to send " + to_string( dgrams.size() ) + " datagrams at once (to next hops";
+    for ( const auto& next_hop : next_hops ) {
+      ret += " " + next_hop.ip();
+    }
+    return ret + ")";
+  }
+
+  void execute( InterfaceAndOutput& interface ) const override
+  {
+    std::vector<InternetDatagram> burst;
+    for ( const auto& dgram : dgrams ) {
+      burst.push_back( clone( dgram ) );
+    }
+    interface.first.send_datagrams( burst, next_hops );
+  }
+
+  SendDatagrams( const std::vector<std::pair<InternetDatagram, Address>>& burst )
+  {
+    for ( const auto& [dgram, next_hop] : burst ) {
+      dgrams.push_back( clone( dgram ) );
+      next_hops.push_back( next_hop );
+    }
+  }
+};
+
 template<class T>
 bool equal( const T& t1, const T& t2 )
 {
@@ -151,3 +185,91 @@ struct Tick : public Action<InterfaceAndOutput>
 
   explicit Tick( const size_t ms ) : _ms( ms ) {}
 };
+
+struct SetQueueConfig : public Action<InterfaceAndOutput>
+{
+  NetworkInterface::QueueConfig config;
+
+  std::string description() const override
+  {
+    return "set queue limits (receive=" + to_string( config.receive_limit ) + ", pending per hop="
+           + to_string( config.pending_limit_per_hop ) + ", pending=" + to_string( config.pending_limit ) + ")";
+  }
+  void execute( InterfaceAndOutput& interface ) const override { interface.first.set_queue_config( config ); }
+
+  explicit SetQueueConfig( const NetworkInterface::QueueConfig& c ) : config( c ) {}
+};
+
+struct SetHighWatermarkCallback : public Action<InterfaceAndOutput>
+{
+  std::shared_ptr<std::vector<size_t>> events;
+
+  std::string description() const override { return "record high-watermark callbacks"; }
+  void execute( InterfaceAndOutput& interface ) const override
+  {
+    interface.first.set_high_watermark_callback(
+      [events = events]( NetworkInterface&, const size_t queued ) { events->push_back( queued ); } );
+  }
+
+  explicit SetHighWatermarkCallback( std::shared_ptr<std::vector<size_t>> e ) : events( std::move( e ) ) {}
+};
+
+// Receive frames without taking the datagrams out of the receive queue
+struct ReceiveFrames : public Action<InterfaceAndOutput>
+{
+  EthernetFrame frame;
+  size_t count;
+
+  std::string description() const override
+  {
+    return "receive " + to_string( count ) + " frames (" + summary( frame ) + ")";
+  }
+  void execute( InterfaceAndOutput& interface ) const override
+  {
+    for ( size_t i = 0; i < count; ++i ) {
+      interface.first.recv_frame( clone( frame ) );
+    }
+  }
+
+  ReceiveFrames( const EthernetFrame& f, const size_t c ) : frame( clone( f ) ), count( c ) {}
+};
+
+struct ExpectReceiveQueueLength : public ExpectNumber<InterfaceAndOutput, size_t>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "datagrams_received().size()"; }
+  size_t value( const InterfaceAndOutput& interface ) const override
+  {
+    return const_cast<NetworkInterface&>( interface.first ).datagrams_received().size(); // NOLINT(*-const-cast)
+  }
+};
+
+struct ExpectTailDrops : public ExpectNumber<InterfaceAndOutput, uint64_t>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "drop_stats().tail_drops"; }
+  uint64_t value( const InterfaceAndOutput& interface ) const override
+  {
+    return interface.first.drop_stats().tail_drops;
+  }
+};
+
+struct ExpectPendingDrops : public ExpectNumber<InterfaceAndOutput, uint64_t>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "drop_stats().pending_drops"; }
+  uint64_t value( const InterfaceAndOutput& interface ) const override
+  {
+    return interface.first.drop_stats().pending_drops;
+  }
+};
+
+struct ExpectRedDrops : public ExpectNumber<InterfaceAndOutput, uint64_t>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "drop_stats().red_drops"; }
+  uint64_t value( const InterfaceAndOutput& interface ) const override
+  {
+    return interface.first.drop_stats().red_drops;
+  }
+};
@@ -107,6 +107,14 @@ int main()
       test.execute( ReadAll( "abc" ) );
       test.execute( IsFinished( true ) );
     }
+
+    {
+      Reassembler r { ByteStream { 15 } };
+      r.insert( 0, "abc", true ); // a string literal must not be ambiguous between insert() overloads
+      if ( r.reader().peek() != "abc" or not r.writer().is_closed() ) {
+        throw runtime_error( "insert() of a string literal didn't write it" );
+      }
+    }
   } catch ( const exception& e ) {
     cerr << "Exception: " << e.what() << "\n";
     return EXIT_FAILURE;
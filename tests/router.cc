@@ -1,10 +1,14 @@
 #include "router.hh"
+#include "icmp_message.hh"
 #include "network_interface_test_harness.hh"
 
 #include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <list>
 #include <memory>
+#include <numeric>
 #include <random>
 #include <unordered_map>
 #include <utility>
@@ -42,6 +46,30 @@ uint32_t ip( const string& str )
   return Address { str }.ipv4_numeric();
 }
 
+// The ICMP error message a router interface should send about a datagram it could not forward
+InternetDatagram icmp_error( uint8_t type, const Address& router, const InternetDatagram& offending )
+{
+  ICMPMessage icmp;
+  icmp.type = type;
+  Serializer quote;
+  offending.header.serialize( quote );
+  BufferChain payload = offending.payload;
+  payload.truncate( ICMPMessage::QUOTED_PAYLOAD_LENGTH );
+  quote.buffer( payload );
+  icmp.data = quote.finish();
+  icmp.compute_checksum();
+
+  InternetDatagram ret;
+  ret.header.ttl = IPv4Header::DEFAULT_TTL;
+  ret.header.proto = IPv4Header::PROTO_ICMP;
+  ret.header.src = router.ipv4_numeric();
+  ret.header.dst = offending.header.src;
+  ret.payload = serialize( icmp );
+  ret.header.len = ret.header.hlen * 4 + ret.payload.total_size();
+  ret.header.compute_checksum();
+  return ret;
+}
+
 class NetworkSegment : public NetworkInterface::OutputPort
 {
   vector<weak_ptr<NetworkInterface>> connections_ {};
@@ -236,6 +264,9 @@ public:
     router_.add_route( ip( "128.30.76.255" ), 16, Address { "128.30.0.1" }, mit5_id );
   }
 
+  void set_forwarding_threads( size_t num_threads ) { router_.set_forwarding_threads( num_threads ); }
+  void set_burst_size( size_t datagrams ) { router_.set_burst_size( datagrams ); }
+
   void simulate()
   {
     for ( unsigned int i = 0; i < 256; i++ ) {
@@ -340,9 +371,13 @@ void network_simulator()
   cout << green << "\n\nTesting TTL expiration..." << normal << "\n\n";
   {
     auto dgram_sent = network.host( "applesauce" ).send_to( Address { "1.2.3.4" }, 1 );
+    network.host( "applesauce" )
+      .expect( icmp_error( ICMPMessage::TYPE_TIME_EXCEEDED, Address { "10.0.0.1" }, dgram_sent ) );
     network.simulate();
 
     dgram_sent = network.host( "applesauce" ).send_to( Address { "1.2.3.4" }, 0 );
+    network.host( "applesauce" )
+      .expect( icmp_error( ICMPMessage::TYPE_TIME_EXCEEDED, Address { "10.0.0.1" }, dgram_sent ) );
     network.simulate();
   }
 
@@ -401,6 +436,385 @@ void network_simulator()
       throw runtime_error(
         "router sent an unexpected frame (datagram should have been dropped because there is no matching route)" );
     }
+
+    // adding a route must invalidate the router's cached "no route" result for this destination
+    router.add_route( ip( "18.0.0.0" ), 8, {}, 0 );
+
+    for ( int i = 0; i < 2; i++ ) {
+      router.interface( eth2_id )->recv_frame(
+        { .header = { .dst = addr2, .src = random_host_ethernet_address(), .type = EthernetHeader::TYPE_IPv4 },
+          .payload = serialize( dg2 ) } );
+    }
+
+    router.route();
+
+    frames0->expect_frame();
+    if ( ( !frames0->frames.empty() ) or ( !frames1->frames.empty() ) or ( !frames2->frames.empty() ) ) {
+      throw runtime_error( "router sent an unexpected frame (after the expected ARP request on the new route)" );
+    }
+
+    // (one of the misses is the router looking for a route back to 192.168.0.2, to send an ICMP error)
+    if ( router.route_cache_stats().hits != 1 or router.route_cache_stats().misses != 4 ) {
+      throw runtime_error( "router's route cache should have missed four times and hit once" );
+    }
+  }
+
+  cout << green << "\n\nTesting route removal, replacement, and loading from a file..." << normal << "\n\n";
+  {
+    Router router {};
+    auto addr1 = random_router_ethernet_address();
+    auto addr2 = random_router_ethernet_address();
+
+    auto frames1 = make_shared<FramesOut>();
+    auto frames2 = make_shared<FramesOut>();
+
+    auto eth1_id
+      = router.add_interface( make_shared<NetworkInterface>( "eth1", frames1, addr1, Address { "10.0.0.1" } ) );
+    auto eth2_id
+      = router.add_interface( make_shared<NetworkInterface>( "eth2", frames2, addr2, Address { "192.168.0.1" } ) );
+
+    auto send_to = [&]( const string& dst ) {
+      InternetDatagram dgram { { .len = 20,
+                                 .ttl = 64,
+                                 .src = Address { "192.168.0.2" }.ipv4_numeric(),
+                                 .dst = Address { dst }.ipv4_numeric() } };
+      dgram.header.compute_checksum();
+      router.interface( eth2_id )->recv_frame(
+        { .header = { .dst = addr2, .src = random_host_ethernet_address(), .type = EthernetHeader::TYPE_IPv4 },
+          .payload = serialize( dgram ) } );
+      router.route();
+    };
+
+    auto expect_arp_request = []( FramesOut& frames, const string& target ) {
+      ARPMessage arp;
+      if ( !parse( arp, frames.expect_frame().payload ) or arp.opcode != ARPMessage::OPCODE_REQUEST
+           or arp.target_ip_address != Address { target }.ipv4_numeric() ) {
+        throw runtime_error( "router should have sent an ARP request for " + target );
+      }
+    };
+
+    auto expect_nothing = [&] {
+      if ( ( !frames1->frames.empty() ) or ( !frames2->frames.empty() ) ) {
+        throw runtime_error( "router sent an unexpected frame" );
+      }
+    };
+
+    router.add_route( ip( "10.0.0.0" ), 8, {}, eth1_id );
+    router.add_route( ip( "10.1.0.0" ), 16, Address { "10.0.0.9" }, eth1_id );
+    send_to( "10.1.2.3" );
+    expect_arp_request( *frames1, "10.0.0.9" );
+    expect_nothing();
+
+    if ( !router.remove_route( ip( "10.1.0.0" ), 16 ) or router.remove_route( ip( "10.1.0.0" ), 16 ) ) {
+      throw runtime_error( "remove_route should succeed exactly once" );
+    }
+    send_to( "10.1.2.3" );
+    expect_arp_request( *frames1, "10.1.2.3" );
+    expect_nothing();
+
+    router.replace_route( ip( "10.0.0.0" ), 8, {}, eth2_id );
+    send_to( "10.1.2.3" );
+    expect_arp_request( *frames2, "10.1.2.3" );
+    expect_nothing();
+
+    // a batch with an invalid change in it is refused whole
+    const vector<Router::RouteChange> batch {
+      { .type = Router::RouteChange::Type::Add,
+        .route_prefix = ip( "10.1.0.0" ),
+        .prefix_length = 16,
+        .paths = { { Address { "10.0.0.9" }, eth1_id } } },
+      { .type = Router::RouteChange::Type::Remove, .route_prefix = ip( "10.0.0.0" ), .prefix_length = 33 } };
+    bool refused = false;
+    try {
+      router.update_routes( batch );
+    } catch ( const runtime_error& ) {
+      refused = true;
+    }
+    if ( !refused or router.num_routes() != 1 ) {
+      throw runtime_error( "update_routes should have refused the whole batch" );
+    }
+    send_to( "10.1.2.3" );
+    expect_nothing();
+
+    const string filename = "router_test_routes.txt";
+    {
+      ofstream file { filename };
+      file << "# prefix/length next-hop interface\n"
+           << "0.0.0.0/0 192.168.0.7 " << eth2_id << "\n"
+           << "\n"
+           << "10.0.0.0/8 direct " << eth1_id << "\n";
+    }
+    router.load_routes( filename );
+    remove( filename.c_str() );
+
+    if ( router.num_routes() != 2 ) {
+      throw runtime_error( "load_routes should have replaced the table with two routes" );
+    }
+    send_to( "10.9.9.9" );
+    expect_arp_request( *frames1, "10.9.9.9" );
+    send_to( "172.16.0.1" );
+    expect_arp_request( *frames2, "192.168.0.7" );
+    expect_nothing();
+
+    // removing a /28 under a /20 (both below the trie's first level) gives its addresses back to the /20, and
+    // removing that gives them back to the /8
+    router.add_route( ip( "10.2.0.0" ), 20, Address { "10.0.0.20" }, eth1_id );
+    router.add_route( ip( "10.2.0.16" ), 28, Address { "10.0.0.28" }, eth1_id );
+    send_to( "10.2.0.17" );
+    expect_arp_request( *frames1, "10.0.0.28" );
+    router.remove_route( ip( "10.2.0.16" ), 28 );
+    send_to( "10.2.0.18" );
+    expect_arp_request( *frames1, "10.0.0.20" );
+    router.remove_route( ip( "10.2.0.0" ), 20 );
+    send_to( "10.2.0.19" );
+    expect_arp_request( *frames1, "10.2.0.19" );
+    expect_nothing();
+
+    // replacing a /24 changes where its addresses go, but not those of a longer prefix inside it
+    router.add_route( ip( "10.3.4.0" ), 24, Address { "10.0.0.24" }, eth1_id );
+    router.add_route( ip( "10.3.4.32" ), 28, Address { "10.0.0.29" }, eth1_id );
+    send_to( "10.3.4.5" );
+    expect_arp_request( *frames1, "10.0.0.24" );
+    router.replace_route( ip( "10.3.4.0" ), 24, Address { "192.168.0.24" }, eth2_id );
+    send_to( "10.3.4.6" );
+    expect_arp_request( *frames2, "192.168.0.24" );
+    send_to( "10.3.4.33" );
+    expect_arp_request( *frames1, "10.0.0.29" );
+    expect_nothing();
+  }
+
+  cout << green << "\n\nTesting ICMP errors and their rate limit..." << normal << "\n\n";
+  {
+    Router router {};
+    const auto eth0_addr = random_router_ethernet_address();
+    const auto host_addr = random_host_ethernet_address();
+    auto frames = make_shared<FramesOut>();
+    auto eth0 = make_shared<NetworkInterface>( "eth0", frames, eth0_addr, Address { "10.0.0.1" } );
+    router.add_interface( eth0 );
+    router.add_route( ip( "10.0.0.0" ), 8, {}, 0 );
+
+    // let the router learn the host's Ethernet address
+    ARPMessage arp;
+    arp.opcode = ARPMessage::OPCODE_REPLY;
+    arp.sender_ethernet_address = host_addr;
+    arp.sender_ip_address = ip( "10.0.0.2" );
+    arp.target_ethernet_address = eth0_addr;
+    arp.target_ip_address = ip( "10.0.0.1" );
+    eth0->recv_frame( { .header = { .dst = eth0_addr, .src = host_addr, .type = EthernetHeader::TYPE_ARP },
+                        .payload = serialize( arp ) } );
+
+    InternetDatagram dgram;
+    dgram.header.src = ip( "10.0.0.2" );
+    dgram.header.dst = ip( "8.8.8.8" );
+    dgram.header.ttl = 64;
+    dgram.payload.emplace_back( string { "0123456789abcdef" } );
+    dgram.header.len = dgram.header.hlen * 4 + 16;
+    dgram.header.compute_checksum();
+
+    auto send = [&]( const InternetDatagram& d, int count ) {
+      for ( int i = 0; i < count; i++ ) {
+        eth0->recv_frame( { .header = { .dst = eth0_addr, .src = host_addr, .type = EthernetHeader::TYPE_IPv4 },
+                            .payload = serialize( d ) } );
+      }
+      router.route();
+    };
+
+    // no route to 8.8.8.8: the host should hear about it
+    send( dgram, 1 );
+    InternetDatagram reply;
+    if ( !parse( reply, frames->expect_frame().payload )
+         or !equal( reply, icmp_error( ICMPMessage::TYPE_DESTINATION_UNREACHABLE, Address { "10.0.0.1" }, dgram ) ) ) {
+      throw runtime_error( "router should have sent an ICMP Destination Unreachable message" );
+    }
+
+    // but never about an ICMP error message
+    reply.header.src = ip( "10.0.0.2" );
+    reply.header.dst = ip( "8.8.8.8" );
+    reply.header.compute_checksum();
+    send( reply, 1 );
+    if ( !frames->frames.empty() ) {
+      throw runtime_error( "router should not send an ICMP error about an ICMP error" );
+    }
+
+    // only two errors allowed at once, then one more a millisecond later (at 1000 per second)
+    router.set_icmp_rate_limit( 1000, 2 );
+    send( dgram, 5 );
+    router.tick( 1 );
+    send( dgram, 5 );
+    if ( frames->frames.size() != 3 or router.icmp_stats().sent != 4 or router.icmp_stats().rate_limited != 7 ) {
+      throw runtime_error( "router should have rate-limited its ICMP error messages" );
+    }
+  }
+
+  cout << green << "\n\nTesting multipath routes..." << normal << "\n\n";
+  {
+    Router router {};
+    vector<shared_ptr<FramesOut>> frames;
+    const auto eth3_addr = random_router_ethernet_address();
+    for ( int i = 0; i < 4; i++ ) {
+      frames.push_back( make_shared<FramesOut>() );
+      router.add_interface( make_shared<NetworkInterface>( "eth" + to_string( i ),
+                                                           frames.back(),
+                                                           i == 3 ? eth3_addr : random_router_ethernet_address(),
+                                                           Address { "192.168." + to_string( i ) + ".1" } ) );
+    }
+    router.add_route( ip( "10.0.0.0" ),
+                      8,
+                      { { Address { "192.168.0.2" }, 0 }, { Address { "192.168.1.2" }, 1 }, { {}, 2 } } );
+
+    const auto eth3 = router.interface( 3 );
+    auto send_flow = [&]( uint16_t src_port, int count ) {
+      InternetDatagram dgram;
+      dgram.header.src = ip( "192.168.3.2" );
+      dgram.header.dst = ip( "10.1.2.3" );
+      dgram.header.ttl = 64;
+      dgram.payload.emplace_back( string { static_cast<char>( src_port >> 8 ),
+                                           static_cast<char>( src_port & 0xff ),
+                                           0,
+                                           80,
+                                           'h',
+                                           'i' } );
+      dgram.header.len = dgram.header.hlen * 4 + 6;
+      dgram.header.compute_checksum();
+      for ( int i = 0; i < count; i++ ) {
+        eth3->recv_frame(
+          { .header = { .dst = eth3_addr, .src = random_host_ethernet_address(), .type = EthernetHeader::TYPE_IPv4 },
+            .payload = serialize( dgram ) } );
+      }
+      router.route();
+    };
+
+    auto total = []( const vector<uint64_t>& counts ) { return accumulate( counts.begin(), counts.end(), 0UL ); };
+
+    // many flows should be spread over all the paths
+    for ( uint16_t port = 1000; port < 1600; port++ ) {
+      send_flow( port, 1 );
+    }
+    const auto counts = router.path_counts( ip( "10.0.0.0" ), 8 );
+    if ( counts.size() != 3 or total( counts ) != 600 or ranges::any_of( counts, []( auto c ) { return c < 100; } ) ) {
+      throw runtime_error( "multipath route should spread 600 flows over its three paths" );
+    }
+    const auto histogram = router.flow_hash_histogram();
+    if ( accumulate( histogram.begin(), histogram.end(), 0UL ) != 600 ) {
+      throw runtime_error( "flow hash histogram should count every multipath datagram" );
+    }
+
+    // all the datagrams of one flow should take the same path
+    send_flow( 4242, 20 );
+    const auto after = router.path_counts( ip( "10.0.0.0" ), 8 );
+    size_t paths_used = 0;
+    for ( size_t i = 0; i < 3; i++ ) {
+      paths_used += ( after.at( i ) != counts.at( i ) );
+    }
+    if ( total( after ) != 620 or paths_used != 1 ) {
+      throw runtime_error( "all the datagrams of a flow should take the same path" );
+    }
+
+    // all the fragments of a datagram should take the same path (only the first one carries the ports)
+    auto send_fragment = [&]( uint16_t src_port, bool more_fragments, uint16_t offset ) {
+      InternetDatagram dgram;
+      dgram.header.src = ip( "192.168.3.2" );
+      dgram.header.dst = ip( "10.1.2.3" );
+      dgram.header.ttl = 64;
+      dgram.header.id = src_port;
+      dgram.header.df = false;
+      dgram.header.mf = more_fragments;
+      dgram.header.offset = offset;
+      if ( offset == 0 ) {
+        dgram.payload.emplace_back( string { static_cast<char>( src_port >> 8 ),
+                                             static_cast<char>( src_port & 0xff ),
+                                             0,
+                                             80,
+                                             'h',
+                                             'i',
+                                             '!',
+                                             '!' } );
+      } else {
+        dgram.payload.emplace_back( "rest" );
+      }
+      dgram.header.len = dgram.header.hlen * 4 + ( offset == 0 ? 8 : 4 );
+      dgram.header.compute_checksum();
+      const auto before = router.path_counts( ip( "10.0.0.0" ), 8 );
+      eth3->recv_frame(
+        { .header = { .dst = eth3_addr, .src = random_host_ethernet_address(), .type = EthernetHeader::TYPE_IPv4 },
+          .payload = serialize( dgram ) } );
+      router.route();
+      const auto now = router.path_counts( ip( "10.0.0.0" ), 8 );
+      for ( size_t i = 0; i < 3; i++ ) {
+        if ( now.at( i ) != before.at( i ) ) {
+          return i;
+        }
+      }
+      throw runtime_error( "fragment was not forwarded on any path" );
+    };
+    for ( uint16_t port = 2000; port < 2030; port++ ) {
+      if ( send_fragment( port, true, 0 ) != send_fragment( port, false, 1 ) ) {
+        throw runtime_error( "all the fragments of a datagram should take the same path" );
+      }
+    }
+
+    // every path should have asked for its next hop's Ethernet address
+    auto expect_arp_request = [&]( size_t interface, const string& target ) {
+      ARPMessage arp;
+      if ( !parse( arp, frames.at( interface )->expect_frame().payload )
+           or arp.target_ip_address != ip( target ) ) {
+        throw runtime_error( "router should have sent an ARP request for " + target );
+      }
+    };
+    expect_arp_request( 0, "192.168.0.2" );
+    expect_arp_request( 1, "192.168.1.2" );
+    expect_arp_request( 2, "10.1.2.3" );
+  }
+
+  cout << green << "\n\nTesting traffic through a router with three forwarding threads..." << normal << "\n\n";
+  {
+    Network threaded_network;
+    threaded_network.set_forwarding_threads( 3 );
+
+    // many datagrams at once, so that the threads hand datagrams to each other while they forward
+    for ( const auto& [from, to] : { pair { "applesauce", "cherrypie" },
+                                     pair { "cherrypie", "applesauce" },
+                                     pair { "dm42", "dm43" },
+                                     pair { "applesauce", "dm42" },
+                                     pair { "dm43", "cherrypie" } } ) {
+      for ( int i = 0; i < 10; i++ ) {
+        auto dgram_sent = threaded_network.host( from ).send_to( threaded_network.host( to ).address() );
+        dgram_sent.header.ttl--;
+        dgram_sent.header.compute_checksum();
+        threaded_network.host( to ).expect( dgram_sent );
+      }
+    }
+
+    auto dgram_sent = threaded_network.host( "dm42" ).send_to( Address { "143.195.131.17" } );
+    dgram_sent.header.ttl--;
+    dgram_sent.header.compute_checksum();
+    threaded_network.host( "hs_router" ).expect( dgram_sent );
+
+    threaded_network.simulate();
+  }
+
+  for ( const size_t burst_size : { 1, 4 } ) {
+    cout << green << "\n\nTesting traffic through a router forwarding in bursts of " << burst_size << "..." << normal
+         << "\n\n";
+    Network burst_network;
+    burst_network.set_burst_size( burst_size );
+
+    // a mix of datagrams to forward and datagrams to answer with ICMP errors, arriving together
+    for ( int i = 0; i < 10; i++ ) {
+      for ( const auto& [from, to] : { pair { "applesauce", "cherrypie" }, pair { "applesauce", "dm42" } } ) {
+        auto dgram_sent = burst_network.host( from ).send_to( burst_network.host( to ).address() );
+        dgram_sent.header.ttl--;
+        dgram_sent.header.compute_checksum();
+        burst_network.host( to ).expect( dgram_sent );
+      }
+      if ( i % 3 == 0 ) {
+        auto dgram_sent = burst_network.host( "applesauce" ).send_to( Address { "1.2.3.4" }, 1 );
+        burst_network.host( "applesauce" )
+          .expect( icmp_error( ICMPMessage::TYPE_TIME_EXCEEDED, Address { "10.0.0.1" }, dgram_sent ) );
+      }
+    }
+
+    burst_network.simulate();
   }
 
   cout << "\n\n\033[32;1mCongratulations! All datagrams were routed successfully.\033[m\n";
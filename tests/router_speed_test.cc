@@ -0,0 +1,698 @@
+#include "arp_message.hh"
+#include "forwarding_table.hh"
+#include "helpers.hh"
+#include "router.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+struct Prefix
+{
+  uint32_t prefix;
+  uint8_t length;
+};
+
+// The reference longest-prefix match: compare the address against every prefix in turn
+optional<uint32_t> linear_lookup( const vector<Prefix>& prefixes, const uint32_t address )
+{
+  optional<uint32_t> best;
+  uint8_t best_length = 0;
+  for ( uint32_t i = 0; i < prefixes.size(); ++i ) {
+    const auto& [prefix, length] = prefixes[i];
+    const bool matches = length == 0 or ( prefix >> ( 32 - length ) ) == ( address >> ( 32 - length ) );
+    if ( matches and ( not best.has_value() or length > best_length ) ) {
+      best = i;
+      best_length = length;
+    }
+  }
+  return best;
+}
+
+void speed_test( const size_t num_prefixes, // NOLINT(bugprone-easily-swappable-parameters)
+                 const size_t num_lookups,  // NOLINT(bugprone-easily-swappable-parameters)
+                 const size_t random_seed )
+{
+  default_random_engine rd { random_seed };
+  uniform_int_distribution<uint32_t> random_address;
+  uniform_int_distribution<int> random_length { 8, 32 };
+  bernoulli_distribution is_slash_24 { 0.6 };
+
+  // Generate a table shaped roughly like a real one (mostly /24s), with a default route
+  vector<Prefix> prefixes { { 0, 0 } };
+  while ( prefixes.size() < num_prefixes ) {
+    const uint8_t length = is_slash_24( rd ) ? 24 : random_length( rd );
+    prefixes.push_back( { random_address( rd ), length } );
+  }
+
+  ForwardingTable table;
+  for ( uint32_t i = 0; i < prefixes.size(); ++i ) {
+    table.insert( prefixes[i].prefix, prefixes[i].length, i );
+  }
+
+  // Half the addresses fall inside a random prefix of the table; the rest are random
+  vector<uint32_t> addresses;
+  addresses.reserve( num_lookups );
+  uniform_int_distribution<size_t> random_prefix { 0, prefixes.size() - 1 };
+  for ( size_t i = 0; i < num_lookups; ++i ) {
+    const auto& p = prefixes[random_prefix( rd )];
+    const uint32_t host_mask = p.length ? ( 1ULL << ( 32 - p.length ) ) - 1 : UINT32_MAX;
+    addresses.push_back( i % 2 ? random_address( rd ) : ( p.prefix & ~host_mask ) | ( random_address( rd ) & host_mask ) );
+  }
+
+  // Check a sample of the lookups against the reference
+  for ( size_t i = 0; i < min<size_t>( addresses.size(), 200 ); ++i ) {
+    const auto expected = linear_lookup( prefixes, addresses[i] );
+    const auto actual = table.lookup( addresses[i] );
+    if ( expected.has_value() != actual.has_value()
+         or ( expected.has_value() and prefixes[*expected].length != prefixes[*actual].length ) ) {
+      throw runtime_error( "ForwardingTable did not find the longest matching prefix" );
+    }
+  }
+
+  uint64_t checksum = 0;
+  const auto start_time = steady_clock::now();
+  for ( const uint32_t address : addresses ) {
+    checksum += table.lookup( address ).value_or( 0 );
+  }
+  const auto stop_time = steady_clock::now();
+
+  auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  auto lookups_per_second = static_cast<double>( num_lookups ) / test_duration.count();
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Router lookups with " << num_prefixes << " routes reached " << fixed << setprecision( 2 )
+       << lookups_per_second / 1e6 << " M lookups/s (checksum " << checksum << ").\n";
+
+  debug_output << "        Router lookups (" << setw( 6 ) << num_prefixes << " routes): " << fixed
+               << setprecision( 2 ) << setw( 7 ) << lookups_per_second / 1e6 << " M lookups/s\n";
+
+  if ( lookups_per_second < 1e6 ) {
+    throw runtime_error( "Router did not meet minimum speed of 1 M lookups/s." );
+  }
+}
+
+// How long does a batch of route changes take to reach the forwarding path?
+void convergence_test( const size_t num_routes, const size_t random_seed )
+{
+  default_random_engine rd { random_seed };
+  uniform_int_distribution<uint32_t> random_address;
+  uniform_int_distribution<int> random_length { 8, 32 };
+  uniform_int_distribution<size_t> random_interface { 0, 7 };
+
+  vector<Router::RouteChange> adds;
+  for ( size_t i = 0; i < num_routes; ++i ) {
+    adds.push_back( { Router::RouteChange::Type::Add,
+                      random_address( rd ),
+                      static_cast<uint8_t>( random_length( rd ) ),
+                      { { Address::from_ipv4_numeric( random_address( rd ) ), random_interface( rd ) } } } );
+  }
+
+  // then replace half of the routes and remove the other half
+  vector<Router::RouteChange> changes = adds;
+  for ( size_t i = 0; i < changes.size(); ++i ) {
+    changes[i].type = i % 2 ? Router::RouteChange::Type::Replace : Router::RouteChange::Type::Remove;
+    changes[i].paths.front().interface_num = random_interface( rd );
+  }
+
+  Router router;
+
+  const auto start_time = steady_clock::now();
+  router.update_routes( adds );
+  const auto load_time = steady_clock::now();
+  router.update_routes( changes );
+  const auto stop_time = steady_clock::now();
+
+  if ( router.num_routes() > num_routes / 2 ) {
+    throw runtime_error( "Router did not apply the route removals" );
+  }
+
+  // The routes that should be left (the first add of a prefix wins, and the last change to it decides its fate),
+  // and a sample of lookups checked against the reference: half inside a remaining prefix, half random
+  map<pair<uint32_t, uint8_t>, size_t> expected_routes; // (prefix with its host bits clear, length) -> interface
+  const auto key = []( const Router::RouteChange& change ) {
+    const uint8_t length = change.prefix_length;
+    const uint32_t mask = length ? ~static_cast<uint32_t>( ( 1ULL << ( 32 - length ) ) - 1 ) : 0;
+    return pair { change.route_prefix & mask, length };
+  };
+  for ( const auto& add : adds ) {
+    expected_routes.try_emplace( key( add ), add.paths.front().interface_num );
+  }
+  for ( const auto& change : changes ) {
+    if ( change.type == Router::RouteChange::Type::Remove ) {
+      expected_routes.erase( key( change ) );
+    } else {
+      expected_routes.insert_or_assign( key( change ), change.paths.front().interface_num );
+    }
+  }
+  vector<Prefix> prefixes;
+  vector<size_t> interfaces;
+  for ( const auto& [prefix, interface_num] : expected_routes ) {
+    prefixes.push_back( { prefix.first, prefix.second } );
+    interfaces.push_back( interface_num );
+  }
+  uniform_int_distribution<size_t> random_prefix { 0, prefixes.size() - 1 };
+  for ( size_t i = 0; i < 400; ++i ) {
+    const auto& p = prefixes[random_prefix( rd )];
+    const uint32_t host_mask = p.length ? ( 1ULL << ( 32 - p.length ) ) - 1 : UINT32_MAX;
+    const uint32_t address = i % 2 ? random_address( rd ) : p.prefix | ( random_address( rd ) & host_mask );
+    const auto expected = linear_lookup( prefixes, address );
+    const auto actual = router.route_for( address );
+    const bool same_route
+      = expected.has_value()
+          ? actual.has_value()
+              and key( { {}, actual->route_prefix, actual->prefix_length } )
+                    == pair { prefixes[*expected].prefix, prefixes[*expected].length }
+              and interfaces[*expected] == actual->paths.front().interface_num
+          : not actual.has_value();
+    if ( not same_route ) {
+      throw runtime_error( "Router did not find the longest matching prefix after the route changes" );
+    }
+  }
+
+  const auto load_ms = duration_cast<duration<double, milli>>( load_time - start_time ).count();
+  const auto update_ms = duration_cast<duration<double, milli>>( stop_time - load_time ).count();
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Router converged after " << num_routes << " route adds in " << fixed << setprecision( 2 ) << load_ms
+       << " ms, and after " << num_routes << " replacements/removals in " << update_ms << " ms.\n";
+
+  debug_output << "        Router convergence (" << num_routes << " changes):   " << fixed << setprecision( 2 )
+               << setw( 7 ) << max( load_ms, update_ms ) << " ms\n";
+
+  if ( max( load_ms, update_ms ) > 5000 ) {
+    throw runtime_error( "Router did not converge within 5 s." );
+  }
+}
+
+// An output port that just counts the frames sent through it
+class FrameCounter : public NetworkInterface::OutputPort
+{
+public:
+  size_t frames {};
+  size_t calls {}; // calls to transmit() or transmit_batch() (what an fd-backed port pays a system call for)
+  void transmit( const NetworkInterface& n [[maybe_unused]], const EthernetFrame& x [[maybe_unused]] ) override
+  {
+    ++frames;
+    ++calls;
+  }
+  void transmit_batch( const NetworkInterface& n [[maybe_unused]], std::span<const EthernetFrame> x ) override
+  {
+    frames += x.size();
+    calls += !x.empty();
+  }
+};
+
+// How fast does a router with many busy interfaces forward datagrams, with a given number of threads?
+void forwarding_test( const size_t num_interfaces, // NOLINT(bugprone-easily-swappable-parameters)
+                      const size_t num_threads,    // NOLINT(bugprone-easily-swappable-parameters)
+                      const size_t dgrams_per_interface,
+                      const size_t random_seed )
+{
+  default_random_engine rd { random_seed };
+  uniform_int_distribution<uint32_t> random_host { 0, 0xffff };
+  uniform_int_distribution<size_t> random_offset { 1, num_interfaces - 1 };
+
+  Router router;
+  router.set_forwarding_threads( num_threads );
+
+  // Interface k serves 10.k.0.0/16 through a neighbouring router at 10.k.0.2 (whose Ethernet address it knows)
+  vector<shared_ptr<FrameCounter>> ports;
+  vector<EthernetAddress> router_addresses;
+  for ( size_t k = 0; k < num_interfaces; ++k ) {
+    const uint32_t subnet = ( 10U << 24 ) | ( static_cast<uint32_t>( k ) << 16 );
+    const EthernetAddress router_address { 2, 0, 0, 0, 0, static_cast<uint8_t>( k ) };
+    const EthernetAddress neighbour_address { 2, 0, 0, 0, 1, static_cast<uint8_t>( k ) };
+
+    ports.push_back( make_shared<FrameCounter>() );
+    router_addresses.push_back( router_address );
+    router.add_interface( make_shared<NetworkInterface>(
+      "eth" + to_string( k ), ports.back(), router_address, Address::from_ipv4_numeric( subnet | 1 ) ) );
+
+    // hold the whole burst of arriving datagrams
+    NetworkInterface::QueueConfig config;
+    config.receive_limit = dgrams_per_interface;
+    router.interface( k )->set_queue_config( config );
+    router.update_routes(
+      { { Router::RouteChange::Type::Add, subnet, 16, { { Address::from_ipv4_numeric( subnet | 2 ), k } } } } );
+
+    ARPMessage arp;
+    arp.opcode = ARPMessage::OPCODE_REQUEST;
+    arp.sender_ethernet_address = neighbour_address;
+    arp.sender_ip_address = subnet | 2;
+    arp.target_ip_address = subnet | 1;
+    router.interface( k )->recv_frame(
+      { { ETHERNET_BROADCAST, neighbour_address, EthernetHeader::TYPE_ARP }, serialize( arp ) } );
+    ports.back()->frames = 0;
+  }
+
+  // Fill every interface's receive queue with datagrams for the other interfaces' subnets
+  const string payload( 64, 'x' );
+  for ( size_t k = 0; k < num_interfaces; ++k ) {
+    for ( size_t i = 0; i < dgrams_per_interface; ++i ) {
+      const size_t egress = ( k + random_offset( rd ) ) % num_interfaces;
+      InternetDatagram dgram;
+      dgram.header.len = dgram.header.hlen * 4 + payload.size();
+      dgram.header.ttl = 64;
+      dgram.header.src = ( 10U << 24 ) | ( static_cast<uint32_t>( k ) << 16 ) | random_host( rd );
+      dgram.header.dst = ( 10U << 24 ) | ( static_cast<uint32_t>( egress ) << 16 ) | random_host( rd );
+      dgram.header.compute_checksum();
+      dgram.payload.emplace_back( string { payload } );
+
+      router.interface( k )->recv_frame(
+        { { router_addresses[k], { 2, 0, 0, 0, 1, static_cast<uint8_t>( k ) }, EthernetHeader::TYPE_IPv4 },
+          serialize( dgram ) } );
+    }
+  }
+
+  const auto start_time = steady_clock::now();
+  router.route();
+  const auto stop_time = steady_clock::now();
+
+  size_t frames_sent = 0;
+  for ( const auto& port : ports ) {
+    frames_sent += port->frames;
+  }
+  if ( frames_sent != num_interfaces * dgrams_per_interface ) {
+    throw runtime_error( "Router forwarded " + to_string( frames_sent ) + " datagrams, expected "
+                         + to_string( num_interfaces * dgrams_per_interface ) );
+  }
+
+  auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  auto packets_per_second = static_cast<double>( frames_sent ) / test_duration.count();
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Router with " << num_interfaces << " interfaces and " << num_threads << " forwarding thread"
+       << ( num_threads == 1 ? "" : "s" ) << " forwarded " << fixed << setprecision( 2 ) << packets_per_second / 1e6
+       << " M datagrams/s.\n";
+
+  debug_output << "        Router forwarding (" << num_interfaces << " interfaces, " << num_threads
+               << " threads): " << fixed << setprecision( 2 ) << setw( 6 ) << packets_per_second / 1e6
+               << " M datagrams/s\n";
+
+  if ( packets_per_second < 1e5 ) {
+    throw runtime_error( "Router did not meet minimum forwarding speed of 0.1 M datagrams/s." );
+  }
+}
+
+// How fast does a router with the topology of the router test forward mixed traffic, processing each
+// interface's datagrams in bursts of a given size (1 = one at a time)?
+void topology_test( const size_t burst_size, const size_t dgrams_per_interface, const size_t random_seed )
+{
+  default_random_engine rd { random_seed };
+
+  struct Interface
+  {
+    string name;
+    string address;
+    string neighbour; // the host or router on the other side (empty if none)
+  };
+  const vector<Interface> interfaces { { "default", "171.67.76.46", "171.67.76.1" },
+                                       { "eth0", "10.0.0.1", "10.0.0.2" },
+                                       { "eth1", "172.16.0.1", "" },
+                                       { "eth2", "192.168.0.1", "192.168.0.2" },
+                                       { "uun3", "198.178.229.1", "198.178.229.42" },
+                                       { "hs4", "143.195.0.2", "143.195.0.1" },
+                                       { "mit5", "128.30.76.255", "128.30.0.1" } };
+
+  Router router;
+  router.set_burst_size( burst_size );
+
+  vector<shared_ptr<FrameCounter>> ports;
+  vector<EthernetAddress> router_addresses;
+  vector<EthernetAddress> neighbour_addresses;
+  for ( size_t k = 0; k < interfaces.size(); ++k ) {
+    ports.push_back( make_shared<FrameCounter>() );
+    router_addresses.push_back( { 2, 0, 0, 0, 0, static_cast<uint8_t>( k ) } );
+    neighbour_addresses.push_back( { 2, 0, 0, 0, 1, static_cast<uint8_t>( k ) } );
+    router.add_interface( make_shared<NetworkInterface>(
+      interfaces[k].name, ports.back(), router_addresses.back(), Address { interfaces[k].address } ) );
+
+    NetworkInterface::QueueConfig config;
+    config.receive_limit = dgrams_per_interface;
+    router.interface( k )->set_queue_config( config );
+
+    // the neighbour introduces itself
+    if ( not interfaces[k].neighbour.empty() ) {
+      ARPMessage arp;
+      arp.opcode = ARPMessage::OPCODE_REQUEST;
+      arp.sender_ethernet_address = neighbour_addresses.back();
+      arp.sender_ip_address = Address { interfaces[k].neighbour }.ipv4_numeric();
+      arp.target_ip_address = Address { interfaces[k].address }.ipv4_numeric();
+      router.interface( k )->recv_frame(
+        { { ETHERNET_BROADCAST, neighbour_addresses.back(), EthernetHeader::TYPE_ARP }, serialize( arp ) } );
+    }
+  }
+
+  const auto ip = []( const string& str ) { return Address { str }.ipv4_numeric(); };
+  router.add_route( ip( "10.0.0.0" ), 8, {}, 1 );
+  router.add_route( ip( "172.16.0.0" ), 16, {}, 2 );
+  router.add_route( ip( "192.168.0.0" ), 24, {}, 3 );
+  router.add_route( ip( "0.0.0.0" ), 0, Address { "171.67.76.1" }, 0 );
+  router.add_route( ip( "198.178.229.0" ), 24, {}, 4 );
+  router.add_route( ip( "143.195.0.0" ), 17, Address { "143.195.0.1" }, 5 );
+  router.add_route( ip( "143.195.128.0" ), 18, Address { "143.195.0.1" }, 5 );
+  router.add_route( ip( "143.195.192.0" ), 19, Address { "143.195.0.1" }, 5 );
+  router.add_route( ip( "128.30.76.255" ), 16, Address { "128.30.0.1" }, 6 );
+
+  // Every neighbour sends to the other hosts, to hs's networks, to MIT and to random places on the internet
+  // (1.0.0.0/8, which only the default route covers)
+  uniform_int_distribution<uint32_t> random_address;
+  uniform_int_distribution<uint32_t> random_low_bits { 0, 0x7fff };
+  uniform_int_distribution<int> random_kind { 0, 5 };
+  const string payload( 64, 'x' );
+  size_t expected = 0;
+  for ( size_t k = 0; k < interfaces.size(); ++k ) {
+    if ( interfaces[k].neighbour.empty() ) {
+      continue;
+    }
+
+    vector<EthernetFrame> frames;
+    for ( size_t i = 0; i < dgrams_per_interface; ++i ) {
+      InternetDatagram dgram;
+      dgram.header.len = dgram.header.hlen * 4 + payload.size();
+      dgram.header.ttl = 64;
+      dgram.header.src = ip( interfaces[k].neighbour );
+      switch ( random_kind( rd ) ) {
+        case 0: dgram.header.dst = ip( "10.0.0.2" ); break;
+        case 1: dgram.header.dst = ip( "192.168.0.2" ); break;
+        case 2: dgram.header.dst = ip( "198.178.229.42" ); break;
+        case 3: dgram.header.dst = ip( "143.195.0.0" ) | random_low_bits( rd ) << 1; break;
+        case 4: dgram.header.dst = ip( "128.30.0.0" ) | random_low_bits( rd ); break;
+        default: dgram.header.dst = ip( "1.0.0.0" ) | random_address( rd ) >> 8; break;
+      }
+      dgram.header.compute_checksum();
+      dgram.payload.emplace_back( string { payload } );
+
+      // (a datagram for the network it came from goes back out the same interface)
+      ++expected;
+      frames.push_back( { { router_addresses[k], neighbour_addresses[k], EthernetHeader::TYPE_IPv4 },
+                          serialize( dgram ) } );
+    }
+
+    for ( size_t i = 0; i < frames.size(); i += 32 ) {
+      router.interface( k )->recv_frames( span { frames }.subspan( i, min<size_t>( 32, frames.size() - i ) ) );
+    }
+  }
+  for ( auto& port : ports ) {
+    port->frames = 0;
+    port->calls = 0;
+  }
+
+  const auto start_time = steady_clock::now();
+  router.route();
+  const auto stop_time = steady_clock::now();
+
+  size_t frames_sent = 0;
+  size_t transmit_calls = 0;
+  for ( const auto& port : ports ) {
+    frames_sent += port->frames;
+    transmit_calls += port->calls;
+  }
+  if ( frames_sent != expected ) {
+    throw runtime_error( "Router forwarded " + to_string( frames_sent ) + " datagrams, expected "
+                         + to_string( expected ) );
+  }
+
+  auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  auto packets_per_second = static_cast<double>( frames_sent ) / test_duration.count();
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Router with the router test's topology forwarded " << fixed << setprecision( 2 )
+       << packets_per_second / 1e6 << " M datagrams/s in bursts of " << burst_size << " ("
+       << static_cast<double>( frames_sent ) / static_cast<double>( transmit_calls )
+       << " frames per transmit call).\n";
+
+  debug_output << "        Router forwarding (test topology, bursts of " << setw( 2 ) << burst_size
+               << "): " << fixed << setprecision( 2 ) << setw( 6 ) << packets_per_second / 1e6
+               << " M datagrams/s, " << setw( 5 )
+               << static_cast<double>( frames_sent ) / static_cast<double>( transmit_calls )
+               << " frames per transmit call\n";
+
+  if ( packets_per_second < 1e5 ) {
+    throw runtime_error( "Router did not meet minimum forwarding speed of 0.1 M datagrams/s." );
+  }
+}
+
+// An output port that times each datagram it sends (the test numbers the datagrams, modulo 2^16, in their IPv4
+// identification field, and notes when each number arrived), and notes which neighbours the interface asks
+// about with ARP
+class TimingPort : public NetworkInterface::OutputPort
+{
+public:
+  TimingPort( const vector<steady_clock::time_point>& arrivals, vector<uint64_t>& latencies )
+    : arrivals_( arrivals ), latencies_( latencies )
+  {}
+
+  vector<uint32_t> arp_requests {}; // the IP addresses asked about
+
+  void transmit( const NetworkInterface& n [[maybe_unused]], const EthernetFrame& x ) override
+  {
+    if ( x.header.type == EthernetHeader::TYPE_IPv4 ) {
+      const string_view header = x.payload.front();
+      if ( header.size() < IPv4Header::LENGTH ) {
+        throw runtime_error( "Router sent a datagram without its header in one piece" );
+      }
+      const uint16_t id = static_cast<uint8_t>( header[4] ) << 8 | static_cast<uint8_t>( header[5] );
+      latencies_.push_back( duration_cast<nanoseconds>( steady_clock::now() - arrivals_[id] ).count() );
+      return;
+    }
+
+    ARPMessage arp;
+    if ( parse( arp, x.payload ) and arp.opcode == ARPMessage::OPCODE_REQUEST ) {
+      arp_requests.push_back( arp.target_ip_address );
+    }
+  }
+
+private:
+  const vector<steady_clock::time_point>& arrivals_;
+  vector<uint64_t>& latencies_;
+};
+
+struct LatencyScenario
+{
+  size_t num_interfaces;     // (at most 256)
+  size_t num_routes;         // random /16 to /24 prefixes outside 10.0.0.0/8
+  size_t hops_per_interface; // the neighbours on each interface that the routes lead to
+  size_t burst_size;         // frames received before each call to route()
+  bool cold_arp;             // are the neighbours' Ethernet addresses forgotten every COLD_INTERVAL datagrams?
+};
+
+// How fast, and with what latency for each datagram, does a router forward frames given to recv_frame() in
+// bursts? With cold ARP, datagrams wait in the interfaces' pending queues until the neighbours, which answer
+// every ARP request after each burst, have replied.
+void latency_test( const LatencyScenario& scenario, const size_t num_dgrams, const size_t random_seed )
+{
+  static constexpr size_t COLD_INTERVAL = 16384;
+  static constexpr size_t FORGET_MS = 30'001; // (longer than an interface keeps an ARP mapping)
+
+  default_random_engine rd { random_seed };
+  uniform_int_distribution<uint32_t> random_address;
+  uniform_int_distribution<int> random_length { 16, 24 };
+  uniform_int_distribution<size_t> random_interface { 0, scenario.num_interfaces - 1 };
+  uniform_int_distribution<size_t> random_hop { 0, scenario.hops_per_interface - 1 };
+
+  // Interface k is 10.k.0.1, with neighbours 10.k.0.2, 10.k.0.3, ...
+  const auto interface_ip = []( size_t k ) { return ( 10U << 24 ) | static_cast<uint32_t>( k ) << 16 | 1; };
+  const auto router_ethernet = []( size_t k ) {
+    return EthernetAddress { 2, 0, 0, 0, 0, static_cast<uint8_t>( k ) };
+  };
+  const auto hop_ethernet = []( uint32_t ip ) {
+    return EthernetAddress { 2, 0, 1, static_cast<uint8_t>( ip >> 16 ), static_cast<uint8_t>( ip >> 8 ),
+                             static_cast<uint8_t>( ip ) };
+  };
+
+  Router router;
+  vector<steady_clock::time_point> arrivals( 65536 );
+  vector<uint64_t> latencies;
+  latencies.reserve( num_dgrams );
+  vector<shared_ptr<TimingPort>> ports;
+  for ( size_t k = 0; k < scenario.num_interfaces; ++k ) {
+    ports.push_back( make_shared<TimingPort>( arrivals, latencies ) );
+    router.add_interface( make_shared<NetworkInterface>( "eth" + to_string( k ),
+                                                         ports.back(),
+                                                         router_ethernet( k ),
+                                                         Address::from_ipv4_numeric( interface_ip( k ) ) ) );
+  }
+
+  // Each route leads to a random neighbour
+  vector<Router::RouteChange> routes;
+  for ( size_t i = 0; i < scenario.num_routes; ++i ) {
+    const auto length = static_cast<uint8_t>( random_length( rd ) );
+    const uint32_t address = random_address( rd );
+    const uint32_t prefix = ( ( 11 + ( address >> 24 ) % 200 ) << 24 | ( address & 0xffffff ) )
+                            & ~( UINT32_MAX >> length );
+    const size_t k = random_interface( rd );
+    const uint32_t hop = interface_ip( k ) + 1 + static_cast<uint32_t>( random_hop( rd ) );
+    routes.push_back(
+      { Router::RouteChange::Type::Add, prefix, length, { { Address::from_ipv4_numeric( hop ), k } } } );
+  }
+  router.update_routes( routes );
+
+  // With warm ARP, every neighbour introduces itself first
+  if ( not scenario.cold_arp ) {
+    for ( size_t k = 0; k < scenario.num_interfaces; ++k ) {
+      for ( uint32_t h = 0; h < scenario.hops_per_interface; ++h ) {
+        ARPMessage arp;
+        arp.opcode = ARPMessage::OPCODE_REQUEST;
+        arp.sender_ip_address = interface_ip( k ) + 1 + h;
+        arp.sender_ethernet_address = hop_ethernet( arp.sender_ip_address );
+        arp.target_ip_address = interface_ip( k );
+        router.interface( k )->recv_frame(
+          { { ETHERNET_BROADCAST, arp.sender_ethernet_address, EthernetHeader::TYPE_ARP }, serialize( arp ) } );
+      }
+    }
+  }
+
+  // The frames to send, numbered (in the IPv4 identification field) in the order they will be sent, and
+  // each for a random host in a random route's prefix
+  struct Arrival
+  {
+    size_t ingress;
+    EthernetFrame frame;
+  };
+  vector<Arrival> frames;
+  const string payload( 64, 'x' );
+  for ( size_t i = 0; i < min<size_t>( num_dgrams, arrivals.size() ); ++i ) {
+    const auto& route = routes[uniform_int_distribution<size_t> { 0, routes.size() - 1 }( rd )];
+    const size_t k = random_interface( rd );
+
+    InternetDatagram dgram;
+    dgram.header.len = dgram.header.hlen * 4 + payload.size();
+    dgram.header.id = static_cast<uint16_t>( i );
+    dgram.header.ttl = 64;
+    dgram.header.src = interface_ip( k ) + 1;
+    dgram.header.dst = route.route_prefix | ( random_address( rd ) & ( UINT32_MAX >> route.prefix_length ) );
+    dgram.header.compute_checksum();
+    dgram.payload.emplace_back( string { payload } );
+
+    frames.push_back( { k,
+                        { { router_ethernet( k ), hop_ethernet( dgram.header.src ), EthernetHeader::TYPE_IPv4 },
+                          serialize( dgram ) } } );
+  }
+  for ( auto& port : ports ) {
+    port->arp_requests.clear();
+  }
+
+  size_t arp_requests = 0;
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < num_dgrams; i += scenario.burst_size ) {
+    if ( scenario.cold_arp and i % COLD_INTERVAL < scenario.burst_size ) {
+      for ( size_t k = 0; k < scenario.num_interfaces; ++k ) {
+        router.interface( k )->tick( FORGET_MS );
+      }
+    }
+
+    for ( size_t n = i; n < min( num_dgrams, i + scenario.burst_size ); ++n ) {
+      const auto& arrival = frames[n % frames.size()];
+      arrivals[n % arrivals.size()] = steady_clock::now();
+      router.interface( arrival.ingress )->recv_frame( clone( arrival.frame ) );
+    }
+    router.route();
+
+    // the neighbours answer
+    for ( size_t k = 0; k < scenario.num_interfaces; ++k ) {
+      for ( const uint32_t ip : exchange( ports[k]->arp_requests, {} ) ) {
+        ARPMessage arp;
+        arp.opcode = ARPMessage::OPCODE_REPLY;
+        arp.sender_ethernet_address = hop_ethernet( ip );
+        arp.sender_ip_address = ip;
+        arp.target_ethernet_address = router_ethernet( k );
+        arp.target_ip_address = interface_ip( k );
+        router.interface( k )->recv_frame(
+          { { router_ethernet( k ), arp.sender_ethernet_address, EthernetHeader::TYPE_ARP }, serialize( arp ) } );
+        ++arp_requests;
+      }
+    }
+  }
+  const auto stop_time = steady_clock::now();
+
+  if ( latencies.size() != num_dgrams ) {
+    throw runtime_error( "Router forwarded " + to_string( latencies.size() ) + " datagrams, expected "
+                         + to_string( num_dgrams ) );
+  }
+
+  ranges::sort( latencies );
+  const auto percentile = [&latencies]( const double p ) {
+    const auto rank = static_cast<size_t>( p * static_cast<double>( latencies.size() ) );
+    return latencies[min( latencies.size() - 1, rank )];
+  };
+
+  auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  auto packets_per_second = static_cast<double>( num_dgrams ) / test_duration.count();
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  const string arp = scenario.cold_arp ? "cold ARP" : "warm ARP";
+  cout << "Router with " << scenario.num_interfaces << " interfaces and " << scenario.num_routes << " routes ("
+       << arp << ") forwarded " << fixed << setprecision( 2 ) << packets_per_second / 1e6
+       << " M datagrams/s in bursts of " << scenario.burst_size << ", with latencies of p50 " << percentile( 0.5 )
+       << " ns, p90 " << percentile( 0.9 ) << " ns, p99 " << percentile( 0.99 ) << " ns, p99.9 "
+       << percentile( 0.999 ) << " ns and max " << latencies.back() << " ns (" << arp_requests
+       << " ARP requests).\n";
+
+  debug_output << "        Router latency (" << setw( 2 ) << scenario.num_interfaces << " interfaces, " << setw( 6 )
+               << scenario.num_routes << " routes, " << arp << ", bursts of " << setw( 2 ) << scenario.burst_size
+               << "): " << fixed << setprecision( 2 ) << setw( 5 ) << packets_per_second / 1e6
+               << " M datagrams/s, p50 " << setw( 6 ) << percentile( 0.5 ) << " ns, p99 " << setw( 6 )
+               << percentile( 0.99 ) << " ns\n";
+
+  if ( packets_per_second < 1e5 ) {
+    throw runtime_error( "Router did not meet minimum forwarding speed of 0.1 M datagrams/s." );
+  }
+}
+
+void program_body( const size_t num_latency_dgrams )
+{
+  speed_test( 16, 4'000'000, 9801 );
+  speed_test( 1024, 4'000'000, 3417 );
+  speed_test( 16384, 4'000'000, 1150 );
+  speed_test( 131072, 4'000'000, 5722 );
+  convergence_test( 100'000, 4410 );
+  forwarding_test( 8, 1, 20'000, 6620 );
+  forwarding_test( 8, 2, 20'000, 6620 );
+  forwarding_test( 8, 4, 20'000, 6620 );
+  topology_test( 1, 20'000, 3021 );
+  topology_test( 32, 20'000, 3021 );
+  latency_test( { 8, 1024, 16, 1, false }, num_latency_dgrams, 7731 );
+  latency_test( { 8, 1024, 16, 32, false }, num_latency_dgrams, 7731 );
+  latency_test( { 64, 131'072, 16, 32, false }, num_latency_dgrams, 2468 );
+  latency_test( { 8, 1024, 512, 32, true }, num_latency_dgrams, 9054 );
+}
+} // namespace
+
+int main( int argc, char** argv )
+{
+  try {
+    // (the number of datagrams for each latency scenario may be given, e.g. millions for a longer run)
+    program_body( argc > 1 ? strtoull( argv[1], nullptr, 0 ) : 100'000 );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
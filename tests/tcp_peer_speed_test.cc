@@ -0,0 +1,259 @@
+#include "loopback_adapter.hh"
+#include "network_emulator.hh"
+#include "tcp_config.hh"
+#include "tcp_peer.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+uint64_t allocations = 0; // calls to operator new, in the whole program
+
+// The CPU's timestamp counter (elsewhere, nanoseconds stand in for cycles)
+uint64_t cycles()
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+  return __rdtsc();
+#else
+  return duration_cast<nanoseconds>( steady_clock::now().time_since_epoch() ).count();
+#endif
+}
+} // namespace
+
+// Count allocations (the array and aligned forms of operator new are left alone; nothing here uses them)
+void* operator new( size_t size )
+{
+  ++allocations;
+  if ( void* ptr = malloc( size == 0 ? 1 : size ) ) {
+    return ptr;
+  }
+  throw bad_alloc();
+}
+
+void operator delete( void* ptr ) noexcept
+{
+  free( ptr );
+}
+
+void operator delete( void* ptr, size_t size [[maybe_unused]] ) noexcept
+{
+  free( ptr );
+}
+
+namespace {
+using Adapter = NetworkEmulatorAdapter<TCPOverIPv4LoopbackAdapter>;
+
+// Send `num_bytes` from one TCPPeer to another, each wrapping its segments in IPv4 datagrams that are serialized,
+// carried in memory (over a path losing each with probability `loss`), parsed and unwrapped again. Time is
+// simulated: when nothing can happen until a timer runs out, the clock jumps straight to it.
+void speed_test( const size_t num_bytes, // NOLINT(bugprone-easily-swappable-parameters)
+                 const size_t window,    // NOLINT(bugprone-easily-swappable-parameters)
+                 const size_t mss,       // NOLINT(bugprone-easily-swappable-parameters)
+                 const double loss,
+                 const size_t random_seed )
+{
+  // Generate the data to be sent (repeated as often as needed)
+  const string data = [&] {
+    default_random_engine rd { random_seed };
+    uniform_int_distribution<char> ud;
+    string ret;
+    for ( size_t i = 0; i < 65536; ++i ) {
+      ret += ud( rd );
+    }
+    return ret;
+  }();
+
+  TCPConfig config;
+  config.rt_timeout = 10;
+  config.recv_capacity = window;
+  config.send_capacity = window;
+  config.max_payload_size = mss;
+  TCPPeer client_peer { config };
+  config.isn = Wrap32 { static_cast<uint32_t>( random_seed ) };
+  TCPPeer server_peer { config };
+
+  auto [client_loopback, server_loopback] = TCPOverIPv4LoopbackAdapter::make_pair(
+    TCPOverIPv4LoopbackAdapter::Mode::Memory );
+  NetworkEmulatorConfig path;
+  path.loss_good = loss;
+  path.seed = random_seed;
+  Adapter client { std::move( client_loopback ), path };
+  ++path.seed;
+  Adapter server { std::move( server_loopback ), path };
+
+  client.config_mut().source = Address { "10.0.0.1", 40000 };
+  client.config_mut().destination = Address { "10.0.0.2", 5000 };
+  server.config_mut().source = client.config().destination;
+  server.config_mut().destination = client.config().source;
+
+  const TCPPeer::TransmitFunction client_send = [&client]( const TCPMessage& msg ) { client.write( msg ); };
+  const TCPPeer::TransmitFunction server_send = [&server]( const TCPMessage& msg ) { server.write( msg ); };
+
+  size_t sent = 0;
+  size_t received = 0;
+  uint64_t simulated_ms = 0;
+
+  const uint64_t start_allocations = allocations;
+  const uint64_t start_cycles = cycles();
+  const auto start_time = steady_clock::now();
+
+  client_peer.push( client_send );
+  while ( client_peer.active() or server_peer.active() ) {
+    bool progress = false;
+
+    // the client writes as much as its outbound stream takes
+    Writer& writer = client_peer.outbound_writer();
+    while ( sent < num_bytes and writer.available_capacity() > 0 ) {
+      const size_t offset = sent % data.size();
+      const size_t len = min( { writer.available_capacity(), num_bytes - sent, data.size() - offset } );
+      writer.push( string_view { data }.substr( offset, len ) );
+      sent += len;
+      if ( sent == num_bytes ) {
+        writer.close();
+      }
+      progress = true;
+    }
+    if ( progress ) {
+      client_peer.push( client_send );
+    }
+
+    while ( auto msg = server.read() ) {
+      server_peer.receive( std::move( *msg ), server_send );
+      progress = true;
+    }
+    while ( auto msg = client.read() ) {
+      client_peer.receive( std::move( *msg ), client_send );
+      progress = true;
+    }
+
+    // the server reads (and checks) what arrived, and closes its own stream once the client's has finished
+    Reader& reader = server_peer.inbound_reader();
+    while ( reader.bytes_buffered() > 0 ) {
+      string_view bytes = reader.peek();
+      for ( size_t i = 0; i < bytes.size(); ) {
+        const size_t offset = ( received + i ) % data.size();
+        const size_t len = min( bytes.size() - i, data.size() - offset );
+        if ( bytes.substr( i, len ) != string_view { data }.substr( offset, len ) ) {
+          throw runtime_error( "Mismatch between data written and read" );
+        }
+        i += len;
+      }
+      received += bytes.size();
+      reader.pop( bytes.size() );
+      progress = true;
+    }
+    if ( reader.is_finished() and not server_peer.outbound_writer().is_closed() ) {
+      server_peer.outbound_writer().close();
+      server_peer.push( server_send );
+      progress = true;
+    }
+
+    if ( progress ) {
+      continue;
+    }
+
+    // nothing can happen until a timer runs out: make it now
+    optional<uint64_t> next;
+    for ( const auto ms : { client_peer.ms_until_next_tick(),
+                            server_peer.ms_until_next_tick(),
+                            client.ms_until_next_tick(),
+                            server.ms_until_next_tick() } ) {
+      if ( ms.has_value() ) {
+        next = min( next.value_or( UINT64_MAX ), *ms );
+      }
+    }
+    if ( not next.has_value() ) {
+      throw runtime_error( "TCPPeers stalled after " + to_string( received ) + " bytes" );
+    }
+    const uint64_t ms = max<uint64_t>( *next, 1 );
+    client_peer.tick( ms, client_send );
+    server_peer.tick( ms, server_send );
+    client.tick( ms );
+    server.tick( ms );
+    simulated_ms += ms;
+  }
+
+  const auto stop_time = steady_clock::now();
+  const uint64_t total_cycles = cycles() - start_cycles;
+  const uint64_t total_allocations = allocations - start_allocations;
+
+  if ( received != num_bytes ) {
+    throw runtime_error( "Server received " + to_string( received ) + " bytes, expected "
+                         + to_string( num_bytes ) );
+  }
+
+  const uint64_t segments = client.stats().datagrams_written + server.stats().datagrams_written;
+  auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  auto gigabits_per_second = static_cast<double>( num_bytes ) * 8 / test_duration.count() / 1e9;
+  auto segments_per_second = static_cast<double>( segments ) / test_duration.count();
+  auto cycles_per_byte = static_cast<double>( total_cycles ) / static_cast<double>( num_bytes );
+  auto allocations_per_segment = static_cast<double>( total_allocations ) / static_cast<double>( segments );
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  // one line per setting, of key=value pairs
+  cout << "tcp_peer window=" << window << " mss=" << mss << fixed << setprecision( 3 ) << " loss=" << loss
+       << " bytes=" << num_bytes << " gbit_per_s=" << gigabits_per_second << " segments_per_s=" << setprecision( 0 )
+       << segments_per_second << " cycles_per_byte=" << setprecision( 3 ) << cycles_per_byte
+       << " allocations_per_segment=" << allocations_per_segment << " segments=" << segments
+       << " lost=" << client.stats().datagrams_lost + server.stats().datagrams_lost
+       << " simulated_ms=" << simulated_ms << "\n";
+
+  debug_output << "        TCPPeer to TCPPeer (window " << setw( 5 ) << window << ", MSS " << setw( 4 ) << mss
+               << ", loss " << fixed << setprecision( 3 ) << loss << "): " << setprecision( 2 ) << setw( 5 )
+               << gigabits_per_second << " Gbit/s, " << setw( 6 ) << cycles_per_byte << " cycles/byte, "
+               << setw( 4 ) << allocations_per_segment << " allocations/segment\n";
+
+  if ( loss == 0 and gigabits_per_second < 0.1 ) {
+    throw runtime_error( "TCPPeer did not meet minimum speed of 0.1 Gbit/s." );
+  }
+
+  // Once the PacketPool (and the sender's list of segments in flight) has warmed up, sending and receiving a
+  // segment should not allocate: what is left is the warm-up, spread over all the segments. (Lost segments make
+  // the receiver store the ones that arrive out of order, which does allocate.)
+  if ( loss == 0 and allocations_per_segment > 0.1 ) {
+    throw runtime_error( "TCPPeer allocated memory for most segments (" + to_string( allocations_per_segment )
+                         + " allocations per segment)." );
+  }
+}
+
+void program_body( const size_t num_bytes )
+{
+  speed_test( num_bytes, 64000, 1000, 0, 2217 );
+  speed_test( num_bytes, 64000, 536, 0, 4406 );
+  speed_test( num_bytes, 64000, 1460, 0, 9137 );
+  speed_test( num_bytes, 16000, 1000, 0, 3551 );
+  speed_test( num_bytes, 4000, 1000, 0, 7102 );
+  speed_test( num_bytes / 4, 64000, 1000, 0.001, 5830 );
+  speed_test( num_bytes / 4, 64000, 1000, 0.01, 1288 );
+}
+} // namespace
+
+int main( int argc, char** argv )
+{
+  try {
+    // (the number of bytes to send for each setting may be given, e.g. for longer runs than the default)
+    program_body( argc > 1 ? strtoull( argv[1], nullptr, 0 ) : 50'000'000 );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,398 @@
+#include "exception.hh"
+#include "helpers.hh"
+#include "ipv4_datagram.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_stack.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+const Address CLIENT { "10.0.0.1" };
+const Address SERVER { "10.0.0.2", 5000 };
+
+// How long a test waits for anything before it gives up
+constexpr milliseconds TIMEOUT { 10000 };
+
+// Two TCPStacks, each of which reads the datagrams the other writes (through a socket pair)
+struct Network
+{
+  Network( const TCPConfig& config, const size_t shards ) : Network( make_datagram_pair(), config, shards ) {}
+
+  TCPStack client;
+  TCPStack server;
+
+  static pair<FileDescriptor, FileDescriptor> make_datagram_pair()
+  {
+    array<int, 2> fds {};
+    CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds.data() ) );
+
+    // (room for every connection's window at once, so that the stacks drop nothing)
+    for ( const int fd : fds ) {
+      const int bytes = 16 << 20;
+      CheckSystemCall( "setsockopt", ::setsockopt( fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof( bytes ) ) ); // NOLINT
+    }
+    return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+  }
+
+private:
+  Network( pair<FileDescriptor, FileDescriptor>&& fds, const TCPConfig& config, const size_t shards )
+    : client( std::move( fds.first ), config, shards ), server( std::move( fds.second ), config, shards )
+  {}
+};
+
+bool wait_readable( FileDescriptor& fd, const milliseconds timeout = TIMEOUT )
+{
+  pollfd pfd { .fd = fd.fd_num(), .events = POLLIN, .revents = 0 };
+  return ::poll( &pfd, 1, static_cast<int>( timeout.count() ) ) == 1;
+}
+
+void wait_until( const function<bool()>& done, const string& what )
+{
+  const auto deadline = steady_clock::now() + TIMEOUT;
+  while ( not done() ) {
+    if ( steady_clock::now() > deadline ) {
+      throw runtime_error( "timed out waiting for " + what );
+    }
+    this_thread::sleep_for( milliseconds { 1 } );
+  }
+}
+
+TCPStack::Accepted accept( TCPStack::Listener& listener )
+{
+  if ( not wait_readable( listener.fd() ) ) {
+    throw runtime_error( "timed out waiting for a connection to accept" );
+  }
+  return listener.accept();
+}
+
+string read_to_eof( LocalStreamSocket& socket )
+{
+  string ret;
+  string buffer;
+  while ( not socket.eof() ) {
+    if ( not wait_readable( socket ) ) {
+      throw runtime_error( "timed out waiting to read (after " + to_string( ret.size() ) + " bytes)" );
+    }
+    buffer.clear();
+    socket.read( buffer );
+    ret += buffer;
+  }
+  return ret;
+}
+
+// Write all of `data` and then end the stream, from another thread (so that nothing waits for the reader)
+jthread write_and_close( LocalStreamSocket& socket, const string& data )
+{
+  return jthread { [&socket, &data] {
+    socket.write_all( data );
+    socket.shutdown( SHUT_WR );
+  } };
+}
+
+// Bytes that show it if any are lost, repeated or reordered
+string make_data( const size_t size, const size_t seed )
+{
+  string ret( size, 0 );
+  for ( size_t i = 0; i < size; ++i ) {
+    ret[i] = static_cast<char>( ( i * 7 + seed ) % 251 );
+  }
+  return ret;
+}
+
+// Run `task` on another thread, keeping the exception (if any) that it throws
+jthread run( const function<void()>& task, exception_ptr& error )
+{
+  return jthread { [task, &error] {
+    try {
+      task();
+    } catch ( ... ) {
+      error = current_exception();
+    }
+  } };
+}
+
+void test_echo( const size_t shards,
+                const size_t connections,
+                const size_t syn_backlog = TCPStack::DEFAULT_SYN_BACKLOG )
+{
+  // each client sends more than a window's worth and ends its stream; the server sends it back, then ends its
+  // own. Every stream is read as it is written, and has room for all of it, so no window stays closed for
+  // long (a TCPSender gives up on a peer that ignores its zero-window probes).
+  Network net { { .rt_timeout = 20, .recv_capacity = 256'000 }, shards };
+  const auto listener = net.server.listen( SERVER, TCPStack::DEFAULT_BACKLOG, syn_backlog );
+
+  vector<LocalStreamSocket> clients;
+  vector<string> requests;
+  clients.reserve( connections );
+  for ( size_t i = 0; i < connections; ++i ) {
+    requests.push_back( make_data( 200'000, i ) );
+    clients.push_back( net.client.connect( CLIENT, SERVER ) );
+  }
+
+  vector<TCPStack::Accepted> accepted;
+  accepted.reserve( connections );
+  for ( size_t i = 0; i < connections; ++i ) {
+    accepted.push_back( accept( *listener ) );
+    test_should_be( accepted.back().peer.ipv4_numeric(), CLIENT.ipv4_numeric() );
+  }
+
+  vector<string> echoes( connections );
+  vector<exception_ptr> errors( 3 * connections );
+  {
+    vector<jthread> threads;
+    for ( size_t i = 0; i < connections; ++i ) {
+      auto& client = clients[i];
+      auto& server = accepted[i].socket;
+      threads.push_back( run(
+        [&client, &request = requests[i]] {
+          client.write_all( request );
+          client.shutdown( SHUT_WR );
+        },
+        errors[3 * i] ) );
+      threads.push_back( run(
+        [&server] {
+          const string received = read_to_eof( server );
+          server.write_all( received );
+          server.shutdown( SHUT_WR );
+        },
+        errors[3 * i + 1] ) );
+      threads.push_back( run( [&client, &echo = echoes[i]] { echo = read_to_eof( client ); }, errors[3 * i + 2] ) );
+    }
+  }
+  for ( const auto& error : errors ) {
+    if ( error ) {
+      rethrow_exception( error );
+    }
+  }
+  for ( size_t i = 0; i < connections; ++i ) {
+    test_should_be( echoes[i] == requests[i], true );
+  }
+
+  // once both streams have ended, each stack drops the connection
+  wait_until( [&] { return net.client.connection_count() == 0 and net.server.connection_count() == 0; },
+              "the connections to close" );
+  for ( const auto& stats : { net.client.stats(), net.server.stats() } ) {
+    test_should_be( stats.connections_opened, uint64_t { connections } );
+    test_should_be( stats.connections_closed, uint64_t { connections } );
+  }
+  if ( syn_backlog == 0 ) {
+    test_should_be( net.server.stats().syn_cookies_accepted, uint64_t { connections } );
+  }
+}
+
+void test_backlog()
+{
+  // with one connection waiting to be accepted, the next one's SYNs are ignored
+  Network net { { .rt_timeout = 20 }, 1 };
+  const auto listener = net.server.listen( SERVER, 1 );
+  auto first = net.client.connect( CLIENT, SERVER );
+  if ( not wait_readable( listener->fd() ) ) {
+    throw runtime_error( "timed out waiting for the first connection" );
+  }
+
+  auto second = net.client.connect( CLIENT, SERVER );
+  wait_until( [&] { return net.server.stats().segments_unmatched >= 2; }, "the second connection's SYNs" );
+  test_should_be( net.server.connection_count(), size_t { 1 } );
+
+  // until the first has been accepted, when a SYN sent again gets in
+  auto first_accepted = listener->accept();
+  auto second_accepted = accept( *listener );
+  const string one = "one";
+  const string two = "two";
+  const jthread first_writer = write_and_close( first, one );
+  const jthread second_writer = write_and_close( second, two );
+  test_should_be( read_to_eof( first_accepted.socket ) == one, true );
+  test_should_be( read_to_eof( second_accepted.socket ) == two, true );
+}
+
+void test_give_up()
+{
+  // a connection whose SYNs go unanswered (as there is no listener) is dropped after the last retransmission
+  Network net { { .rt_timeout = 1 }, 1 };
+  auto client = net.client.connect( CLIENT, SERVER );
+  test_should_be( read_to_eof( client ).empty(), true );
+  wait_until( [&] { return net.client.connection_count() == 0; }, "the connection to be dropped" );
+  test_should_be( net.server.stats().segments_unmatched >= TCPConfig::MAX_RETX_ATTEMPTS + 1, true );
+  test_should_be( net.server.connection_count(), size_t { 0 } );
+}
+
+// The client's end of a connection to a TCPStack, through which a test sends and receives its segments itself
+class RawClient
+{
+public:
+  RawClient( FileDescriptor&& datagrams, const uint16_t port ) : datagrams_( std::move( datagrams ) )
+  {
+    adapter_.config_mut().source = Address { CLIENT.ip(), port };
+    adapter_.config_mut().destination = SERVER;
+  }
+
+  void send( const uint32_t seqno, const bool syn, const optional<Wrap32> ackno = {}, const string& payload = {} )
+  {
+    datagrams_.write( serialize( adapter_.wrap_tcp_in_ip(
+      { .sender = TCPSenderMessage { .seqno = Wrap32 { seqno }, .SYN = syn, .payload = payload },
+        .receiver = TCPReceiverMessage { .ackno = ackno, .window_size = 1000 } } ) ) );
+  }
+
+  // The next segment for this connection (skipping any for another), if one comes within `timeout`
+  optional<TCPMessage> receive( const milliseconds timeout )
+  {
+    while ( wait_readable( datagrams_, timeout ) ) {
+      string buffer;
+      datagrams_.read( buffer );
+      InternetDatagram dgram;
+      if ( parse( dgram, vector<string> { std::move( buffer ) } ) ) {
+        if ( auto msg = adapter_.unwrap_tcp_in_ip( std::move( dgram ) ) ) {
+          return msg;
+        }
+      }
+    }
+    return {};
+  }
+
+  // Send a SYN with sequence number `isn` (again, until it is answered: a listener is in effect only once
+  // every shard has it), and return the SYN-ACK's sequence number
+  Wrap32 handshake( const uint32_t isn )
+  {
+    const auto deadline = steady_clock::now() + TIMEOUT;
+    optional<TCPMessage> syn_ack;
+    while ( not syn_ack.has_value() ) {
+      if ( steady_clock::now() > deadline ) {
+        throw runtime_error( "timed out waiting for a SYN-ACK" );
+      }
+      send( isn, true );
+      syn_ack = receive( milliseconds { 100 } );
+    }
+    test_should_be( syn_ack->sender->SYN, true );
+    test_should_be( syn_ack->receiver->ackno.value_or( Wrap32 { 0 } ), Wrap32 { isn + 1 } );
+    return syn_ack->sender->seqno;
+  }
+
+  // Another client, on another port, that shares this one's end of the socket pair
+  RawClient another( const uint16_t port ) const { return { datagrams_.duplicate(), port }; }
+
+private:
+  FileDescriptor datagrams_;
+  TCPOverIPv4Adapter adapter_ {};
+};
+
+void test_syn_cookies()
+{
+  // with no room for handshakes, a SYN is answered with a cookie, and the stack keeps nothing
+  auto [datagrams, stack_end] = Network::make_datagram_pair();
+  TCPStack server { std::move( stack_end ), {}, 1 };
+  const auto listener = server.listen( SERVER, TCPStack::DEFAULT_BACKLOG, 0 );
+  RawClient client { std::move( datagrams ), 40000 };
+  const Wrap32 cookie = client.handshake( 1000 );
+  wait_until( [&] { return server.stats().syn_cookies_sent >= 1; }, "the cookie to be counted" );
+  test_should_be( server.connection_count(), size_t { 0 } );
+  const uint64_t unmatched = server.stats().segments_unmatched;
+
+  // an ACK that doesn't bring back the cookie, or brings it back for another ISN or port, opens nothing
+  client.send( 1001, false, cookie + 2 );
+  wait_until( [&] { return server.stats().segments_unmatched == unmatched + 1; }, "a forged cookie to be refused" );
+  client.send( 2001, false, cookie + 1 );
+  wait_until( [&] { return server.stats().segments_unmatched == unmatched + 2; },
+              "a cookie for another ISN to be refused" );
+  RawClient other = client.another( 40001 );
+  other.send( 1001, false, cookie + 1 );
+  wait_until( [&] { return server.stats().segments_unmatched == unmatched + 3; },
+              "a cookie for another port to be refused" );
+
+  // nor does a cookie made by another stack (as it would be after a restart: stale cookies from earlier periods
+  // can't be made here without waiting two periods)
+  auto [old_datagrams, old_stack_end] = Network::make_datagram_pair();
+  const Wrap32 stale_cookie = [&] {
+    TCPStack old_server { std::move( old_stack_end ), {}, 1 };
+    const auto old_listener = old_server.listen( SERVER, TCPStack::DEFAULT_BACKLOG, 0 );
+    RawClient old_client { std::move( old_datagrams ), 40002 };
+    return old_client.handshake( 3000 );
+  }();
+  RawClient restarted = client.another( 40002 );
+  restarted.send( 3001, false, stale_cookie + 1 );
+  wait_until( [&] { return server.stats().segments_unmatched == unmatched + 4; }, "a stale cookie to be refused" );
+  test_should_be( server.connection_count(), size_t { 0 } );
+  test_should_be( server.stats().syn_cookies_accepted, uint64_t { 0 } );
+
+  // the ACK that brings back the cookie opens the connection
+  client.send( 1001, false, cookie + 1 );
+  auto accepted = accept( *listener );
+  test_should_be( accepted.peer.port(), uint16_t { 40000 } );
+  test_should_be( server.stats().syn_cookies_accepted, uint64_t { 1 } );
+  test_should_be( server.connection_count(), size_t { 1 } );
+
+  client.send( 1001, false, cookie + 1, "hello" );
+  if ( not wait_readable( accepted.socket ) ) {
+    throw runtime_error( "timed out waiting to read" );
+  }
+  string received;
+  accepted.socket.read( received );
+  test_should_be( received == "hello", true );
+}
+
+void test_listener_close()
+{
+  // closing a listener refuses the connection in its handshake, and the SYNs and cookies that come after
+  auto [datagrams, stack_end] = Network::make_datagram_pair();
+  TCPStack server { std::move( stack_end ), {}, 1 };
+  const auto listener = server.listen( SERVER, TCPStack::DEFAULT_BACKLOG, 1 );
+  RawClient client { std::move( datagrams ), 40000 };
+  const Wrap32 server_isn = client.handshake( 1000 );
+  test_should_be( server.connection_count(), size_t { 1 } );
+
+  RawClient cookie_client = client.another( 40001 );
+  const Wrap32 cookie = cookie_client.handshake( 2000 );
+  wait_until( [&] { return server.stats().syn_cookies_sent >= 1; }, "the cookie to be counted" );
+  const uint64_t unmatched = server.stats().segments_unmatched;
+
+  listener->close();
+  client.send( 1001, false, server_isn + 1 );
+  wait_until( [&] { return server.connection_count() == 0; }, "the connection in its handshake to be refused" );
+  test_should_be( server.stats().connections_closed, uint64_t { 1 } );
+
+  cookie_client.send( 2001, false, cookie + 1 );
+  wait_until( [&] { return server.stats().segments_unmatched == unmatched + 1; }, "the cookie to be refused" );
+  RawClient late = client.another( 40002 );
+  late.send( 3000, true );
+  wait_until( [&] { return server.stats().segments_unmatched == unmatched + 2; }, "the SYN to be refused" );
+
+  test_should_be( server.stats().syn_cookies_accepted, uint64_t { 0 } );
+  test_should_be( server.connection_count(), size_t { 0 } );
+}
+} // namespace
+
+int main()
+{
+  try {
+    test_echo( 1, 1 );
+    test_echo( 1, 8 );
+    test_echo( 2, 8 );
+    test_echo( 2, 8, 0 );
+    test_backlog();
+    test_give_up();
+    test_syn_cookies();
+    test_listener_close();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,289 @@
+#include "buffer.hh"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+// Emptied lists of fragments, kept for reuse by this thread's BufferChains
+struct ListCache
+{
+  static constexpr size_t INITIAL_CAPACITY = 8; // fragments (a packet seldom has more than a few)
+
+  vector<vector<Buffer>> lists {};
+
+  ListCache() = default;
+  ListCache( const ListCache& other ) = delete;
+  ListCache( ListCache&& other ) = delete;
+  ListCache& operator=( const ListCache& other ) = delete;
+  ListCache& operator=( ListCache&& other ) = delete;
+  ~ListCache();
+};
+
+// Set once this thread's cache has been destroyed (chains that outlive it free their lists directly)
+thread_local bool list_cache_destroyed = false;
+
+ListCache::~ListCache()
+{
+  list_cache_destroyed = true;
+}
+
+ListCache* list_cache()
+{
+  static thread_local ListCache cache;
+  return list_cache_destroyed ? nullptr : &cache;
+}
+} // namespace
+
+Buffer::Buffer( string str )
+{
+  if ( str.empty() ) {
+    PacketPool::give( move( str ) );
+    return;
+  }
+  storage_ = PacketPool::make_storage( move( str ) );
+  view_ = storage_->bytes;
+}
+
+Buffer::Buffer( string str, const size_t headroom )
+{
+  if ( str.size() <= headroom ) {
+    PacketPool::give( move( str ) );
+    return;
+  }
+  storage_ = PacketPool::make_storage( move( str ), headroom );
+  view_ = string_view { storage_->bytes }.substr( headroom );
+}
+
+Buffer::Buffer( const Buffer& other ) : storage_( other.storage_ ), view_( other.view_ )
+{
+  if ( storage_ ) {
+    storage_->refs.fetch_add( 1, memory_order_relaxed );
+  }
+}
+
+Buffer::Buffer( Buffer&& other ) noexcept : storage_( other.storage_ ), view_( other.view_ )
+{
+  other.storage_ = nullptr;
+  other.view_ = {};
+}
+
+Buffer& Buffer::operator=( const Buffer& other )
+{
+  if ( this != &other ) {
+    Buffer copy { other };
+    *this = move( copy );
+  }
+  return *this;
+}
+
+Buffer& Buffer::operator=( Buffer&& other ) noexcept
+{
+  if ( this != &other ) {
+    release();
+    storage_ = other.storage_;
+    view_ = other.view_;
+    other.storage_ = nullptr;
+    other.view_ = {};
+  }
+  return *this;
+}
+
+Buffer::~Buffer()
+{
+  release();
+}
+
+void Buffer::release()
+{
+  if ( storage_ and storage_->refs.fetch_sub( 1, memory_order_acq_rel ) == 1 ) {
+    PacketPool::release_storage( storage_ );
+  }
+  storage_ = nullptr;
+  view_ = {};
+}
+
+Buffer Buffer::substr( size_t pos, size_t len ) const
+{
+  Buffer ret { *this };
+  ret.view_ = view_.substr( pos, len );
+  return ret;
+}
+
+char* Buffer::mutable_data()
+{
+  if ( not storage_ ) {
+    return nullptr;
+  }
+  if ( shared() ) {
+    string copy = PacketPool::take( view_.size() );
+    copy.assign( view_ );
+    *this = Buffer { move( copy ) };
+  }
+  return storage_->bytes.data() + ( view_.data() - storage_->bytes.data() );
+}
+
+optional<Buffer> Buffer::with_prefix( const string_view bytes ) const
+{
+  if ( not storage_ or bytes.empty() ) {
+    return {};
+  }
+
+  const auto offset = static_cast<uint32_t>( view_.data() - storage_->bytes.data() );
+  uint32_t expected = offset;
+  if ( offset < bytes.size()
+       or not storage_->front.compare_exchange_strong( expected, offset - bytes.size(), memory_order_acq_rel ) ) {
+    return {};
+  }
+
+  char* start = storage_->bytes.data() + offset - bytes.size();
+  ranges::copy( bytes, start );
+
+  Buffer ret { *this };
+  ret.view_ = { start, bytes.size() + view_.size() };
+  return ret;
+}
+
+BufferChain::BufferChain( const BufferChain& other )
+{
+  append( other );
+}
+
+BufferChain::BufferChain( BufferChain&& other ) noexcept
+  : buffers_( move( other.buffers_ ) ), total_size_( other.total_size_ )
+{
+  other.total_size_ = 0;
+}
+
+BufferChain& BufferChain::operator=( const BufferChain& other )
+{
+  if ( this != &other ) {
+    BufferChain copy { other };
+    *this = move( copy );
+  }
+  return *this;
+}
+
+BufferChain& BufferChain::operator=( BufferChain&& other ) noexcept
+{
+  if ( this != &other ) {
+    release();
+    buffers_ = move( other.buffers_ );
+    total_size_ = other.total_size_;
+    other.total_size_ = 0;
+  }
+  return *this;
+}
+
+BufferChain::~BufferChain()
+{
+  release();
+}
+
+void BufferChain::reserve()
+{
+  if ( buffers_.capacity() > 0 ) {
+    return;
+  }
+  ListCache* cache = list_cache();
+  if ( cache and not cache->lists.empty() ) {
+    buffers_ = move( cache->lists.back() );
+    cache->lists.pop_back();
+  } else {
+    buffers_.reserve( ListCache::INITIAL_CAPACITY );
+  }
+}
+
+// Give the list of fragments (emptied) back to the cache
+void BufferChain::release()
+{
+  buffers_.clear();
+  total_size_ = 0;
+  ListCache* cache = list_cache();
+  if ( cache and buffers_.capacity() > 0 and cache->lists.size() < PacketPool::MAX_CACHED ) {
+    cache->lists.push_back( move( buffers_ ) );
+  }
+  buffers_ = {};
+}
+
+void BufferChain::push_back( Buffer buf )
+{
+  if ( not buf.empty() ) {
+    reserve();
+    total_size_ += buf.size();
+    buffers_.push_back( move( buf ) );
+  }
+}
+
+void BufferChain::prepend( Buffer buf )
+{
+  if ( not buf.empty() ) {
+    reserve();
+    total_size_ += buf.size();
+    buffers_.insert( buffers_.begin(), move( buf ) );
+  }
+}
+
+void BufferChain::append( const BufferChain& other )
+{
+  if ( other.empty() ) {
+    return;
+  }
+  reserve();
+  buffers_.insert( buffers_.end(), other.buffers_.begin(), other.buffers_.end() );
+  total_size_ += other.total_size_;
+}
+
+void BufferChain::remove_prefix( uint64_t len )
+{
+  len = min( len, total_size_ );
+  total_size_ -= len;
+
+  auto it = buffers_.begin();
+  while ( len ) {
+    if ( len < it->size() ) {
+      it->remove_prefix( len );
+      break;
+    }
+    len -= it->size();
+    ++it;
+  }
+  buffers_.erase( buffers_.begin(), it );
+}
+
+void BufferChain::truncate( uint64_t len )
+{
+  if ( len >= total_size_ ) {
+    return;
+  }
+
+  uint64_t size_so_far = 0;
+  auto it = buffers_.begin();
+  while ( size_so_far + it->size() < len ) {
+    size_so_far += it->size();
+    ++it;
+  }
+
+  if ( size_so_far < len ) {
+    it->remove_suffix( size_so_far + it->size() - len );
+    ++it;
+  }
+  buffers_.erase( it, buffers_.end() );
+  total_size_ = len;
+}
+
+void BufferChain::clear()
+{
+  buffers_.clear();
+  total_size_ = 0;
+}
+
+string BufferChain::concatenate() const
+{
+  string ret;
+  ret.reserve( total_size_ );
+  for ( const auto& x : buffers_ ) {
+    ret.append( x );
+  }
+  return ret;
+}
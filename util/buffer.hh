@@ -0,0 +1,153 @@
+#pragma once
+
+#include "packet_pool.hh"
+
+#include <concepts>
+#include <cstdint>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+/*
+ * A Buffer is a reference-counted, immutable slice of a string (in the spirit of a BSD mbuf or a Linux skb
+ * fragment). Copying a Buffer, or slicing it with substr/remove_prefix/remove_suffix, shares the underlying
+ * storage instead of copying the bytes. The only way to modify the bytes is mutable_data(), which first
+ * copies the slice if its storage is shared with another Buffer (copy-on-write).
+ *
+ * The storage (and the string inside it) is drawn from, and returned to, the thread's PacketPool.
+ */
+class Buffer
+{
+public:
+  Buffer() = default;
+
+  // construct from a string -> takes ownership of the string's storage
+  Buffer( std::string str ); // NOLINT(*-explicit-*)
+
+  // construct from the bytes of a string after its first `headroom` bytes, which a lower layer
+  // can later fill in with its header (see with_prefix)
+  Buffer( std::string str, size_t headroom );
+
+  // copies share the storage; the last Buffer to go away returns it to the PacketPool
+  Buffer( const Buffer& other );
+  Buffer( Buffer&& other ) noexcept;
+  Buffer& operator=( const Buffer& other );
+  Buffer& operator=( Buffer&& other ) noexcept;
+  ~Buffer();
+
+  // accessors
+  size_t size() const { return view_.size(); }
+  bool empty() const { return view_.empty(); }
+  const char* data() const { return view_.data(); }
+
+  operator std::string_view() const { return view_; } // NOLINT(*-explicit-*)
+  const std::string_view* operator->() const { return &view_; }
+
+  // cheap slicing (the storage is shared, not copied)
+  Buffer substr( size_t pos, size_t len = std::string_view::npos ) const;
+  void remove_prefix( size_t n ) { view_.remove_prefix( n ); }
+  void remove_suffix( size_t n ) { view_.remove_suffix( n ); }
+
+  // Is the storage shared with another Buffer?
+  bool shared() const { return storage_ and storage_->refs.load( std::memory_order_acquire ) > 1; }
+
+  // mutable access to the bytes (copies them first if the storage is shared)
+  char* mutable_data();
+
+  // A Buffer holding `bytes` followed by this Buffer's bytes, written into the headroom in front of
+  // them (without copying this Buffer's bytes). Returns empty unless this Buffer starts where the
+  // storage's headroom ends and the headroom is big enough; claiming the headroom means no other
+  // Buffer (sharing the storage or not) can ever see those bytes change.
+  std::optional<Buffer> with_prefix( std::string_view bytes ) const;
+
+private:
+  PacketPool::Storage* storage_ {};
+  std::string_view view_ {};
+
+  void release();
+};
+
+/*
+ * A BufferChain is a sequence of Buffers that together make up a packet (or part of one, e.g. a datagram's
+ * payload). Each layer adds its header with prepend() and strips it with remove_prefix(), so passing a
+ * packet between layers never copies the payload bytes, and copying a BufferChain only copies the list of
+ * fragments. Empty Buffers are never stored.
+ *
+ * The list of fragments is drawn from, and returned to, a per-thread cache (as the PacketPool does for
+ * strings), so that building, copying and dropping a chain for each packet doesn't call malloc and free.
+ *
+ * Like a std::vector, size() and empty() refer to the number of fragments; total_size() is the number of bytes.
+ */
+class BufferChain
+{
+public:
+  BufferChain() = default;
+
+  BufferChain( const BufferChain& other );
+  BufferChain( BufferChain&& other ) noexcept;
+  BufferChain& operator=( const BufferChain& other );
+  BufferChain& operator=( BufferChain&& other ) noexcept;
+  ~BufferChain();
+
+  // construct from a range of strings (or anything else a Buffer can be constructed from)
+  template<std::ranges::input_range R>
+    requires( std::constructible_from<Buffer, std::ranges::range_reference_t<R>>
+              and not std::same_as<std::remove_cvref_t<R>, BufferChain> )
+  explicit BufferChain( R&& buffers )
+  {
+    for ( auto&& x : buffers ) {
+      if constexpr ( std::is_rvalue_reference_v<R&&> ) {
+        emplace_back( std::move( x ) );
+      } else {
+        emplace_back( x );
+      }
+    }
+  }
+
+  // container interface
+  auto begin() const { return buffers_.begin(); }
+  auto end() const { return buffers_.end(); }
+  size_t size() const { return buffers_.size(); }
+  bool empty() const { return buffers_.empty(); }
+  const Buffer& front() const { return buffers_.front(); }
+  const Buffer& back() const { return buffers_.back(); }
+
+  // total number of bytes in the chain
+  uint64_t total_size() const { return total_size_; }
+
+  // add a fragment at the end of the chain
+  void push_back( Buffer buf );
+
+  template<typename... Targs>
+  void emplace_back( Targs&&... Fargs )
+  {
+    push_back( Buffer { std::forward<Targs>( Fargs )... } );
+  }
+
+  // add a fragment (e.g. a header) at the start of the chain
+  void prepend( Buffer buf );
+
+  // add all of another chain's fragments at the end of this one (sharing their storage)
+  void append( const BufferChain& other );
+
+  // trim `len` bytes from the start of the chain
+  void remove_prefix( uint64_t len );
+
+  // trim the chain to its first `len` bytes
+  void truncate( uint64_t len );
+
+  void clear();
+
+  // Copy the bytes of the whole chain into one string
+  std::string concatenate() const;
+
+private:
+  std::vector<Buffer> buffers_ {};
+  uint64_t total_size_ {};
+
+  void reserve(); // (takes a cached list of fragments, if the chain has none yet)
+  void release();
+};
@@ -3,12 +3,10 @@
 #include "ethernet_header.hh"
 #include "parser.hh"
 
-#include <vector>
-
 struct EthernetFrame
 {
   EthernetHeader header {};
-  std::vector<Ref<std::string>> payload {};
+  BufferChain payload {};
 
   void parse( Parser& parser )
   {
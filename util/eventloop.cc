@@ -1,17 +1,63 @@
 #include "eventloop.hh"
 #include "exception.hh"
 
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
+#include <fcntl.h>
 #include <iostream>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 
 using namespace std;
+using namespace std::chrono;
+
+EventLoop::EventLoop( const Backend backend, const Dispatch dispatch, const InterestCheck interest_check )
+  : _backend( backend ), _dispatch( dispatch ), _interest_check( interest_check )
+{
+  _rule_categories.reserve( 64 );
+  if ( _backend == Backend::Epoll ) {
+    _epoll.emplace( CheckSystemCall( "epoll_create1", epoll_create1( EPOLL_CLOEXEC ) ) );
+    _epoll_events.resize( 64 );
+  }
+  if ( _backend == Backend::IoUring ) {
+    try {
+      _uring = make_unique<IoUring>( 256 );
+    } catch ( const unix_error& ) {
+      _backend = Backend::Poll; // (io_uring is too old, or disabled)
+    }
+  }
+}
+
+void EventLoop::set_rule_budget( const size_t callbacks )
+{
+  if ( callbacks == 0 ) {
+    throw runtime_error( "EventLoop rule budget must be at least 1" );
+  }
+  _rule_budget = callbacks;
+}
 
 unsigned int EventLoop::FDRule::service_count() const
 {
   return direction == Direction::In ? fd.read_count() : fd.write_count();
 }
 
+// (the epoll events share their values with poll's, so that one function can act on what either reports)
+static_assert( EPOLLIN == POLLIN and EPOLLOUT == POLLOUT and EPOLLERR == POLLERR and EPOLLHUP == POLLHUP );
+
+uint32_t EventLoop::FDRule::events() const
+{
+  if ( not interested ) {
+    return 0;
+  }
+  return direction == Direction::In ? POLLIN : POLLOUT;
+}
+
+bool EventLoop::FDRule::finished() const
+{
+  return ( direction == Direction::In and fd.eof() ) or fd.closed();
+}
+
 size_t EventLoop::add_category( const string& name )
 {
   if ( _rule_categories.size() >= _rule_categories.capacity() ) {
@@ -50,10 +96,12 @@ EventLoop::RuleHandle EventLoop::add_rule( size_t category_id,
     throw out_of_range( "bad category_id" );
   }
 
-  _fd_rules.emplace_back( make_shared<FDRule>(
+  auto& rule = _fd_rules.emplace_back( make_shared<FDRule>(
     BasicRule { category_id, interest, callback }, fd.duplicate(), direction, cancel, error ) );
+  rule->position = prev( _fd_rules.end() );
+  mark_dirty( *rule ); // (its interest is looked at, and it is registered with the backend, before the next wait)
 
-  return RuleHandle { _fd_rules.back() };
+  return RuleHandle { rule, this };
 }
 
 EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
@@ -69,18 +117,166 @@ EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
   return RuleHandle { _non_fd_rules.back() };
 }
 
+EventLoop::TimerId EventLoop::add_timer( const steady_clock::time_point deadline, const CallbackT& callback )
+{
+  if ( not _timerfd.has_value() ) {
+    _timerfd.emplace(
+      CheckSystemCall( "timerfd_create", timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC ) ) );
+    add_rule(
+      "timers", *_timerfd, Direction::In, [this] { fire_timers(); }, [this] { return not _timers.empty(); } );
+    _timer_rule = _fd_rules.back();
+  }
+
+  const auto ns = duration_cast<nanoseconds>( deadline - _timer_epoch ).count();
+  mark_dirty( *_timer_rule );
+  return _timers.schedule_at( ns > 0 ? static_cast<uint64_t>( ns ) : 0, callback );
+}
+
+bool EventLoop::cancel_timer( const TimerId id )
+{
+  if ( _timer_rule ) {
+    mark_dirty( *_timer_rule );
+  }
+  return _timers.cancel( id );
+}
+
+// Set the timerfd for the earliest timer (if that has changed). An absolute deadline that has already passed
+// makes the timerfd readable right away.
+void EventLoop::arm_timerfd()
+{
+  const auto next = _timers.next_deadline();
+  if ( next == _timerfd_deadline ) {
+    return;
+  }
+
+  itimerspec spec {}; // (all zero disarms it)
+  if ( next.has_value() ) {
+    const auto ns = duration_cast<nanoseconds>( ( _timer_epoch + nanoseconds { *next } ).time_since_epoch() );
+    spec.it_value.tv_sec = ns.count() / 1'000'000'000;
+    spec.it_value.tv_nsec = ns.count() % 1'000'000'000;
+  }
+  CheckSystemCall( "timerfd_settime",
+                   timerfd_settime( _timerfd->fd_num(), TFD_TIMER_ABSTIME, &spec, nullptr ) );
+  _timerfd_deadline = next;
+}
+
+// The timerfd is readable: call the callbacks of the timers that are due, earliest first
+void EventLoop::fire_timers()
+{
+  string expirations( sizeof( uint64_t ), 0 );
+  _timerfd->read( expirations ); // (nothing, if the timerfd was set again since it became readable)
+  _timerfd_deadline.reset();     // (it needs setting again, for the next deadline)
+
+  const auto now = duration_cast<nanoseconds>( steady_clock::now() - _timer_epoch ).count();
+  const auto elapsed = static_cast<uint64_t>( now ) - min( _timers.now(), static_cast<uint64_t>( now ) );
+  _timers.advance( elapsed, []( CallbackT&& callback ) { callback(); } );
+}
+
 void EventLoop::RuleHandle::cancel()
 {
   const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
-  if ( rule_shared_ptr ) {
+  if ( rule_shared_ptr and loop_ ) {
+    loop_->mark_cancelled( static_cast<FDRule&>( *rule_shared_ptr ) );
+  } else if ( rule_shared_ptr ) {
     rule_shared_ptr->cancel_requested = true;
   }
 }
 
+void EventLoop::RuleHandle::interest_changed()
+{
+  const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
+  if ( rule_shared_ptr and loop_ ) {
+    loop_->mark_dirty( static_cast<FDRule&>( *rule_shared_ptr ) );
+  }
+}
+
+void EventLoop::mark_dirty( FDRule& rule )
+{
+  if ( not rule.dirty and not rule.removed ) {
+    rule.dirty = true;
+    _dirty_rules.push_back( *rule.position );
+  }
+}
+
+void EventLoop::mark_cancelled( FDRule& rule )
+{
+  if ( not rule.cancel_requested and not rule.removed ) {
+    rule.cancel_requested = true;
+    _cancelled_rules.push_back( *rule.position );
+  }
+}
+
+// Before a wait, bring the backend up to date with the fd rules that have changed since the last one: remove
+// the cancelled rules, and call interest() again for the dirty ones (cancelling those whose fds have finished).
+// A cancel callback may cancel or mark other rules in turn, so go on until there are none left.
+void EventLoop::update_rules()
+{
+  while ( not _cancelled_rules.empty() or not _dirty_rules.empty() ) {
+    _updating_rules.swap( _cancelled_rules );
+    for ( const auto& rule : _updating_rules ) {
+      // if rule is cancelled externally, no need to call the cancellation callback
+      // this makes it easier to cancel rules and delete captured objects right away
+      remove_rule( *rule );
+    }
+    _updating_rules.clear();
+
+    _updating_rules.swap( _dirty_rules );
+    for ( const auto& rule_ptr : _updating_rules ) {
+      auto& rule = *rule_ptr;
+      rule.dirty = false;
+      if ( rule.removed or rule.cancel_requested ) {
+        continue;
+      }
+
+      if ( rule.finished() ) {
+        // no more reading on this rule (it's reached eof), or no more anything (its fd is closed)
+        rule.cancel();
+        remove_rule( rule );
+        continue;
+      }
+
+      const bool interested = rule.interest();
+      if ( interested != rule.interested ) {
+        rule.interested = interested;
+        _interested_rules = interested ? _interested_rules + 1 : _interested_rules - 1;
+      }
+
+      if ( _backend == Backend::Epoll ) {
+        update_epoll( rule );
+      } else if ( _backend == Backend::IoUring ) {
+        update_uring( rule );
+      }
+    }
+    _updating_rules.clear();
+  }
+}
+
+// Take a rule out of the backend and out of _fd_rules (which may destroy it: so only between waits)
+void EventLoop::remove_rule( FDRule& rule )
+{
+  if ( rule.removed ) {
+    return;
+  }
+
+  if ( _backend == Backend::Epoll ) {
+    remove_from_epoll( rule );
+  } else if ( _backend == Backend::IoUring ) {
+    remove_from_uring( rule );
+  }
+  if ( rule.interested ) {
+    rule.interested = false;
+    --_interested_rules;
+  }
+  rule.removed = true;
+  _fd_rules.erase( rule.position );
+}
+
 // NOLINTBEGIN(*-cognitive-complexity)
 // NOLINTBEGIN(*-signed-bitwise)
 EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
 {
+  bool any_rule_fired = false;
+
   // first, handle the non-file-descriptor-related rules
   {
     for ( auto it = _non_fd_rules.begin(); it != _non_fd_rules.end(); ) {
@@ -104,124 +300,400 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
         this_rule.callback();
       }
 
-      if ( rule_fired ) {
+      if ( rule_fired and _dispatch == Dispatch::OneRule ) {
         return Result::Success; /* only serve one rule on each iteration */
       }
+      any_rule_fired |= rule_fired;
 
       ++it;
     }
   }
 
-  // now the file-descriptor-related rules. poll any "interested" file descriptors
-  vector<pollfd> pollfds {};
-  pollfds.reserve( _fd_rules.size() );
-  bool something_to_poll = false;
+  // now the file-descriptor-related rules (without waiting, if a rule has already fired)
+  const int fd_timeout_ms = any_rule_fired ? 0 : timeout_ms;
+  if ( _timerfd.has_value() ) {
+    arm_timerfd();
+  }
+  if ( _backend == Backend::Poll or _interest_check == InterestCheck::EveryWait ) {
+    // (this also finds the fds that have been closed or reached EOF without a word to the loop: with poll, their
+    // numbers may belong to other files by now)
+    for ( const auto& rule : _fd_rules ) {
+      mark_dirty( *rule );
+    }
+  }
+  Result fd_result {};
+  switch ( _backend ) {
+    case Backend::Poll:
+      fd_result = wait_poll( fd_timeout_ms );
+      break;
+    case Backend::Epoll:
+      fd_result = wait_epoll( fd_timeout_ms );
+      break;
+    case Backend::IoUring:
+      fd_result = wait_uring( fd_timeout_ms );
+      break;
+  }
+  return any_rule_fired ? Result::Success : fd_result;
+}
 
-  // set up the pollfd for each rule
-  for ( auto it = _fd_rules.begin(); it != _fd_rules.end(); ) { // NOTE: it gets erased or incremented in loop body
-    auto& this_rule = **it;
+EventLoop::Result EventLoop::wait_poll( const int timeout_ms )
+{
+  update_rules();
 
-    if ( this_rule.cancel_requested ) {
-      //      this_rule.cancel();
-      //      if rule is cancelled externally, no need to call the cancellation callback
-      //      this makes it easier to cancel rules and delete captured objects right away
-      it = _fd_rules.erase( it );
-      continue;
-    }
+  // quit if there is nothing left to poll
+  if ( _interested_rules == 0 ) {
+    return Result::Exit;
+  }
 
-    if ( this_rule.direction == Direction::In && this_rule.fd.eof() ) {
-      // no more reading on this rule, it's reached eof
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
+  // set up the pollfd for each rule (an uninterested rule polls for no events: we still want errors)
+  _pollfds.clear();
+  _polled_rules.clear();
+  for ( const auto& rule : _fd_rules ) {
+    _pollfds.push_back( { rule->fd.fd_num(), static_cast<int16_t>( rule->events() ), 0 } );
+    _polled_rules.push_back( rule.get() );
+  }
+
+  // call poll -- wait until one of the fds satisfies one of the rules (writeable/readable)
+  // (an interrupted wait -- by a signal, or by io_uring's work after a ring is closed -- counts as a timeout)
+  ++_stats.waits;
+  const int num_ready = ::poll( _pollfds.data(), _pollfds.size(), timeout_ms );
+  if ( num_ready == 0 or ( num_ready == -1 and errno == EINTR ) ) {
+    return Result::Timeout;
+  }
+  CheckSystemCall( "poll", num_ready );
+
+  // go through the poll results (for the rules that were polled: with Dispatch::AllReady, a callback may add more)
+  for ( size_t i = 0; i < _pollfds.size(); ++i ) {
+    const auto revents = static_cast<uint16_t>( _pollfds[i].revents );
+    if ( revents != 0 and handle_events( *_polled_rules[i], revents ) and _dispatch == Dispatch::OneRule ) {
+      return Result::Success; /* only serve one rule on each iteration */
     }
+  }
 
-    if ( this_rule.fd.closed() ) {
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
+  return Result::Success;
+}
+
+EventLoop::Result EventLoop::wait_epoll( const int timeout_ms )
+{
+  update_rules();
+
+  // quit if there is nothing left to poll
+  if ( _interested_rules == 0 ) {
+    return Result::Exit;
+  }
+
+  // wait until one of the fds satisfies one of the rules (unless a regular file is ready already)
+  const bool always_ready
+    = ranges::any_of( _always_ready_rules, []( const FDRule* rule ) { return rule->interested; } );
+  ++_stats.waits;
+  int num_events = ::epoll_wait( _epoll->fd_num(),
+                                 _epoll_events.data(),
+                                 static_cast<int>( _epoll_events.size() ),
+                                 always_ready ? 0 : timeout_ms );
+  if ( num_events == -1 and errno == EINTR ) {
+    num_events = 0; // (as with poll, an interrupted wait counts as a timeout)
+  }
+  CheckSystemCall( "epoll_wait", num_events );
+
+  // go through the ready fds only, and the rules on each
+  for ( int i = 0; i < num_events; ++i ) {
+    const uint64_t data = _epoll_events.at( i ).data.u64;
+    const auto registration = _epoll_registrations.find( static_cast<int>( data & UINT32_MAX ) );
+    if ( registration == _epoll_registrations.end() or registration->second.id != data >> 32 ) {
+      continue; // (for an earlier registration of the fd number)
     }
+    for ( FDRule* rule : registration->second.rules ) {
+      if ( handle_events( *rule, _epoll_events.at( i ).events ) and _dispatch == Dispatch::OneRule ) {
+        return Result::Success; /* only serve one rule on each iteration */
+      }
+    }
+  }
 
-    if ( this_rule.interest() ) {
-      pollfds.push_back( { this_rule.fd.fd_num(),
-                           static_cast<int16_t>( this_rule.direction == Direction::In ? POLLIN : POLLOUT ),
-                           0 } );
-      something_to_poll = true;
-    } else {
-      pollfds.push_back( { this_rule.fd.fd_num(), 0, 0 } ); // placeholder --- we still want errors
+  if ( always_ready ) {
+    for ( FDRule* rule : _always_ready_rules ) {
+      if ( _dispatch == Dispatch::OneRule and rule->interested ) {
+        serve( *rule );
+        return Result::Success;
+      }
+      if ( _dispatch == Dispatch::AllReady ) {
+        serve_ready( *rule );
+      }
     }
-    ++it;
+    return Result::Success;
   }
 
+  return num_events == 0 ? Result::Timeout : Result::Success;
+}
+
+EventLoop::Result EventLoop::wait_uring( const int timeout_ms )
+{
+  update_rules(); // (queuing a poll request for each rule that changed, or whose last request completed)
+
   // quit if there is nothing left to poll
-  if ( not something_to_poll ) {
+  if ( _interested_rules == 0 ) {
     return Result::Exit;
   }
 
-  // call poll -- wait until one of the fds satisfies one of the rules (writeable/readable)
-  if ( 0 == CheckSystemCall( "poll", ::poll( pollfds.data(), pollfds.size(), timeout_ms ) ) ) {
-    return Result::Timeout;
+  // submit the queued changes, and wait for a poll request to complete -- all in one system call
+  ++_stats.waits;
+  _uring->submit( 1, timeout_ms );
+
+  // Collect the completed requests (each for a rule that is still in _fd_rules: rules are only erased in
+  // update_rules, after their requests are removed). A completed request is no longer armed, so its rule is
+  // marked to have it armed again before the next wait.
+  _uring_ready.clear();
+  _uring->reap( [&]( const io_uring_cqe& cqe ) {
+    const auto poll = _uring_polls.find( cqe.user_data );
+    if ( poll == _uring_polls.end() ) {
+      return; // a removal, or a request that was replaced
+    }
+    FDRule* rule = poll->second;
+    _uring_polls.erase( poll );
+    rule->uring_poll = 0;
+    mark_dirty( *rule );
+    if ( cqe.res >= 0 ) {
+      _uring_ready.emplace_back( rule, static_cast<uint32_t>( cqe.res ) );
+    }
+  } );
+
+  for ( const auto& [rule, revents] : _uring_ready ) {
+    if ( handle_events( *rule, revents ) and _dispatch == Dispatch::OneRule ) {
+      return Result::Success; /* only serve one rule on each iteration */
+    }
+  }
+
+  return _uring_ready.empty() ? Result::Timeout : Result::Success;
+}
+
+// Act on the events a wait reported for a rule's fd (with the values poll gives them). Returns true if the
+// rule's callback was called.
+bool EventLoop::handle_events( FDRule& rule, const uint32_t revents )
+{
+  if ( rule.removed or rule.cancel_requested ) {
+    return false; // (cancelled by a callback earlier in this wait)
   }
 
-  // go through the poll results
-  for ( auto [it, idx] = make_pair( _fd_rules.begin(), static_cast<size_t>( 0 ) ); it != _fd_rules.end(); ++idx ) {
-    const auto& this_pollfd = pollfds.at( idx );
-    auto& this_rule = **it;
-
-    const auto poll_error = static_cast<bool>( this_pollfd.revents & ( POLLERR | POLLNVAL ) );
-    if ( poll_error ) {
-      /* see if fd is a socket */
-      int socket_error = 0;
-      socklen_t optlen = sizeof( socket_error );
-      const int ret = getsockopt( this_rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
-      if ( ret == -1 and errno == ENOTSOCK ) {
-        cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\"\n";
-      } else if ( ret == -1 ) {
-        throw unix_error( "getsockopt" );
-      } else if ( optlen != sizeof( socket_error ) ) {
-        throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
-      } else if ( socket_error ) {
-        cerr << "error on polled socket for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\": " << strerror( socket_error ) << "\n";
+  if ( revents & ( POLLERR | POLLNVAL ) ) {
+    report_error( rule );
+    rule.error();
+    rule.cancel();
+    mark_cancelled( rule );
+    return false;
+  }
+
+  const uint32_t asked = rule.events();
+  const auto ready = static_cast<bool>( revents & asked );
+  const auto hup = static_cast<bool>( revents & POLLHUP );
+  if ( hup && ( ( asked && !ready ) or ( rule.direction == Direction::Out ) ) ) {
+    // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
+    //   - if it was POLLIN and nothing is readable, no more will ever be readable
+    //   - if it was POLLOUT, it will not be writable again
+    // additionally, consider FD defunct if rule will only query for Direction::Out
+    rule.cancel();
+    mark_cancelled( rule );
+    return false;
+  }
+
+  if ( not ready ) {
+    return false;
+  }
+
+  // we only want to call callback if revents includes the event we asked for
+  if ( _dispatch == Dispatch::OneRule ) {
+    serve( rule );
+  } else {
+    serve_ready( rule );
+  }
+  return true;
+}
+
+void EventLoop::report_error( const FDRule& rule ) const
+{
+  /* see if fd is a socket */
+  int socket_error = 0;
+  socklen_t optlen = sizeof( socket_error );
+  const int ret = getsockopt( rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
+  if ( ret == -1 and errno == ENOTSOCK ) {
+    cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( rule.category_id ).name << "\"\n";
+  } else if ( ret == -1 ) {
+    throw unix_error( "getsockopt" );
+  } else if ( optlen != sizeof( socket_error ) ) {
+    throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
+  } else if ( socket_error ) {
+    cerr << "error on polled socket for rule \"" << _rule_categories.at( rule.category_id ).name
+         << "\": " << strerror( socket_error ) << "\n";
+  }
+}
+
+// Execute a ready rule's callback (which must read or write its fd, unless it has lost interest)
+void EventLoop::serve( FDRule& rule )
+{
+  const auto count_before = rule.service_count();
+  ++_stats.callbacks;
+  rule.callback();
+  mark_dirty( rule ); // (its interest may have changed)
+
+  if ( count_before == rule.service_count() and ( not rule.fd.closed() ) and rule.interest() ) {
+    throw runtime_error( "EventLoop: busy wait detected: rule \"" + _rule_categories.at( rule.category_id ).name
+                         + "\" did not read/write fd and is still interested" );
+  }
+}
+
+// With Dispatch::AllReady: serve a rule whose fd was ready when polled, unless a callback served earlier in
+// this iteration has cancelled or finished the rule or taken away its interest. A rule on a non-blocking fd
+// is served again (up to its budget) while it stays interested; a blocking fd can't be tried again without
+// knowing that it won't block.
+void EventLoop::serve_ready( FDRule& rule )
+{
+  for ( size_t i = 0; i < _rule_budget; ++i ) {
+    if ( rule.cancel_requested or rule.finished() or not rule.interest() ) {
+      return;
+    }
+    if ( i > 0 and rule.fd.blocking() ) {
+      return;
+    }
+    serve( rule );
+  }
+}
+
+namespace {
+// What epoll reports with each event for a registration: the fd number, and the registration's id
+uint64_t epoll_tag( const uint32_t registration_id, const int fd_num )
+{
+  return ( uint64_t { registration_id } << 32 ) | static_cast<uint32_t>( fd_num );
+}
+} // namespace
+
+// Bring the epoll registration of a rule's fd up to date with the rule's interest, registering the fd if it
+// isn't yet. The rules on one fd share its registration (epoll takes each fd only once), for the union of the
+// events they wait for; one for no events still reports errors and hangups.
+void EventLoop::update_epoll( FDRule& rule )
+{
+  if ( rule.always_ready ) {
+    return;
+  }
+
+  const int fd_num = rule.fd.fd_num();
+  auto [it, inserted] = _epoll_registrations.try_emplace( fd_num );
+  EpollRegistration& registration = it->second;
+  if ( rule.epoll_registration == 0 ) {
+    if ( not inserted and ranges::any_of( registration.rules, []( const FDRule* r ) { return r->fd.closed(); } ) ) {
+      // the fd number was closed (taking it out of epoll) and now belongs to another file: the rules left from
+      // before are finished, and are cancelled when they are looked at again
+      for ( FDRule* old_rule : registration.rules ) {
+        old_rule->epoll_registration = 0;
+        mark_dirty( *old_rule );
       }
+      registration = {};
+      inserted = true;
+    }
 
-      this_rule.error();
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
-    }
-
-    const auto poll_ready = static_cast<bool>( this_pollfd.revents & this_pollfd.events );
-    const auto poll_hup = static_cast<bool>( this_pollfd.revents & POLLHUP );
-    if ( poll_hup && ( ( this_pollfd.events && !poll_ready ) or ( this_rule.direction == Direction::Out ) ) ) {
-      // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
-      //   - if it was POLLIN and nothing is readable, no more will ever be readable
-      //   - if it was POLLOUT, it will not be writable again
-      // additionally, consider FD defunct if rule will only query for Direction::Out
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
-    }
-
-    if ( poll_ready ) {
-      // we only want to call callback if revents includes the event we asked for
-      const auto count_before = this_rule.service_count();
-      this_rule.callback();
-
-      if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.interest() ) {
-        throw runtime_error( "EventLoop: busy wait detected: rule \""
-                             + _rule_categories.at( this_rule.category_id ).name
-                             + "\" did not read/write fd and is still interested" );
+    if ( inserted ) {
+      registration.id = _next_epoll_registration++;
+      epoll_event event { 0, { .u64 = epoll_tag( registration.id, fd_num ) } };
+      if ( ::epoll_ctl( _epoll->fd_num(), EPOLL_CTL_ADD, fd_num, &event ) == -1 ) {
+        if ( errno != EPERM ) {
+          throw unix_error( "epoll_ctl" );
+        }
+        _epoll_registrations.erase( it ); // a regular file (which poll would always report ready)
+        rule.always_ready = true;
+        _always_ready_rules.push_back( &rule );
+        return;
       }
+    }
+    registration.rules.push_back( &rule );
+    rule.epoll_registration = registration.id;
+  }
 
-      return Result::Success; /* only serve one rule on each iteration */
+  uint32_t events = 0;
+  for ( const FDRule* r : registration.rules ) {
+    events |= r->events();
+  }
+  if ( events != registration.events ) {
+    epoll_event event { events, { .u64 = epoll_tag( registration.id, fd_num ) } };
+    CheckSystemCall( "epoll_ctl", ::epoll_ctl( _epoll->fd_num(), EPOLL_CTL_MOD, fd_num, &event ) );
+    registration.events = events;
+  }
+}
+
+void EventLoop::remove_from_epoll( FDRule& rule )
+{
+  if ( rule.always_ready ) {
+    erase( _always_ready_rules, &rule );
+    return;
+  }
+  if ( rule.epoll_registration == 0 ) {
+    return;
+  }
+
+  const auto it = _epoll_registrations.find( rule.fd.fd_num() );
+  EpollRegistration& registration = it->second;
+  erase( registration.rules, &rule );
+  rule.epoll_registration = 0;
+
+  if ( rule.fd.closed() ) {
+    // closing the fd took it out of epoll, and finished the other rules on it too
+    for ( FDRule* other_rule : registration.rules ) {
+      other_rule->epoll_registration = 0;
+      mark_dirty( *other_rule );
+    }
+    _epoll_registrations.erase( it );
+  } else if ( registration.rules.empty() ) {
+    CheckSystemCall( "epoll_ctl", ::epoll_ctl( _epoll->fd_num(), EPOLL_CTL_DEL, rule.fd.fd_num(), nullptr ) );
+    _epoll_registrations.erase( it );
+  } else {
+    update_epoll( *registration.rules.front() ); // (for the events the others wait for)
+  }
+}
+
+// Queue a one-shot poll request for a rule, unless one is already armed for the same events (replacing it if
+// not). As with epoll, an uninterested rule still asks for no events, so that errors and hangups are reported.
+void EventLoop::update_uring( FDRule& rule )
+{
+  const uint32_t events = rule.events();
+
+  if ( rule.uring_poll != 0 ) {
+    if ( events == rule.uring_events ) {
+      return;
     }
+    remove_from_uring( rule );
+  }
+
+  const uint64_t id = _next_uring_poll++;
+  io_uring_sqe& sqe = next_uring_sqe();
+  sqe.opcode = IORING_OP_POLL_ADD;
+  sqe.fd = rule.fd.fd_num();
+  sqe.poll32_events = events;
+  sqe.user_data = id;
 
-    ++it; // if we got here, it means we didn't call _fd_rules.erase()
+  _uring_polls.emplace( id, &rule );
+  rule.uring_poll = id;
+  rule.uring_events = events;
+}
+
+void EventLoop::remove_from_uring( FDRule& rule )
+{
+  if ( rule.uring_poll != 0 ) {
+    io_uring_sqe& sqe = next_uring_sqe();
+    sqe.opcode = IORING_OP_POLL_REMOVE;
+    sqe.addr = rule.uring_poll;
+    sqe.user_data = 0; // (its completion, and the removed request's, are ignored)
+
+    _uring_polls.erase( rule.uring_poll );
+    rule.uring_poll = 0;
   }
+  rule.uring_events = 0;
+}
 
-  return Result::Success;
+io_uring_sqe& EventLoop::next_uring_sqe()
+{
+  io_uring_sqe* sqe = _uring->get_sqe();
+  if ( sqe == nullptr ) { // the submission queue is full: hand it to the kernel now
+    _uring->submit();
+    sqe = notnull( "IoUring::get_sqe", _uring->get_sqe() );
+  }
+  return *sqe;
 }
+
 // NOLINTEND(*-signed-bitwise)
 // NOLINTEND(*-cognitive-complexity)
@@ -1,11 +1,19 @@
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <list>
 #include <memory>
+#include <optional>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "file_descriptor.hh"
+#include "io_uring.hh"
+#include "timer_queue.hh"
 
 //! Waits for events on file descriptors and executes corresponding callbacks.
 class EventLoop
@@ -18,6 +26,47 @@ public:
     Out // Callback will be triggered when Rule::fd is writable.
   };
 
+  //! How the EventLoop waits for file descriptors.
+  enum class Backend : uint8_t
+  {
+    Poll, //!< [poll(2)](\ref man2::poll) every interested fd on each call (O(rules) per wakeup)
+    Epoll, //!< keep the fds registered with [epoll(7)](\ref man7::epoll) (O(ready) per wakeup)
+    IoUring //!< keep a poll request armed in an [io_uring(7)](\ref man7::io_uring) for each fd, changed in
+            //!< a batch with the same system call that waits (falls back to Poll if io_uring is unavailable)
+  };
+
+  //! How many ready rules EventLoop::wait_next_event serves.
+  enum class Dispatch : uint8_t
+  {
+    OneRule, //!< the first ready rule (so N ready fds take N calls, and N waits)
+    AllReady //!< every ready rule, each up to the rule budget (see set_rule_budget)
+  };
+
+  //! Which fd rules' interest() EventLoop::wait_next_event calls before it waits.
+  enum class InterestCheck : uint8_t
+  {
+    EveryWait,  //!< every rule's (so an interest may depend on anything)
+    WhenChanged //!< only those of rules that may have changed (see add_rule), so that a wait looks only at the
+                //!< rules that are ready or have changed (Backend::Poll, which hands the kernel every fd on each
+                //!< call anyway, checks every rule regardless)
+  };
+
+  //! Counters of the work done by an EventLoop.
+  struct Stats
+  {
+    uint64_t waits {};     //!< calls to poll(), epoll_wait() or io_uring_enter()
+    uint64_t callbacks {}; //!< callbacks of fd rules
+  };
+
+  //! Returned by each call to EventLoop::wait_next_event.
+  enum class Result : uint8_t
+  {
+    Success, //!< At least one Rule was triggered.
+    Timeout, //!< No rules were triggered before timeout.
+    Exit     //!< All rules have been canceled or were uninterested; make no further calls to
+             //!< EventLoop::wait_next_event.
+  };
+
 private:
   using CallbackT = std::function<void( void )>;
   using InterestT = std::function<bool( void )>;
@@ -44,43 +93,150 @@ private:
     CallbackT cancel;    //!< A callback that is called when the rule is cancelled (e.g. on EOF or hangup)
     CallbackT error;     //!< A callback that is called when the fd has an error before cancellation
 
+    //! The rule's place in _fd_rules, and what its interest() returned when last called (see update_rules)
+    std::list<std::shared_ptr<FDRule>>::iterator position {};
+    bool interested {};
+    bool dirty {};   //!< waiting in _dirty_rules for its interest() to be called again
+    bool removed {}; //!< taken out of _fd_rules (and out of the backend)
+
+    //! With Backend::Epoll: the id of the registration of fd that the rule is part of (0 if none), and whether
+    //! epoll refused the fd (a regular file, which is always ready)
+    uint32_t epoll_registration {};
+    bool always_ready {};
+
+    //! With Backend::IoUring: the id of the rule's armed poll request (0 if none), and the events it asked for
+    uint64_t uring_poll {};
+    uint32_t uring_events {};
+
     FDRule( BasicRule&& base, FileDescriptor&& s_fd, Direction s_direction, CallbackT s_cancel, CallbackT s_error );
 
     //! Returns the number of times fd has been read or written, depending on the value of Rule::direction.
     //! \details This function is used internally by EventLoop; you will not need to call it
     unsigned int service_count() const;
+
+    //! The poll events the rule waits for: its direction's, if it is interested, or none
+    uint32_t events() const;
+
+    //! Has fd reached EOF (for a rule that reads) or been closed?
+    bool finished() const;
+  };
+
+  //! With Backend::Epoll: the rules on one fd (such as one that reads and one that writes), registered with epoll
+  //! once, for the union of the events they wait for. The id tells it apart from an earlier registration of the
+  //! same fd number, in case an event for that one is still on its way.
+  struct EpollRegistration
+  {
+    uint32_t id {};
+    uint32_t events {};
+    std::vector<FDRule*> rules {};
   };
 
+  Backend _backend;
+  Dispatch _dispatch;
+  InterestCheck _interest_check;
+  size_t _rule_budget = 1;
+  Stats _stats {};
+  std::optional<FileDescriptor> _epoll {};
+  std::vector<epoll_event> _epoll_events {};
+  std::unordered_map<int, EpollRegistration> _epoll_registrations {}; //!< by fd number
+  uint32_t _next_epoll_registration = 1;
+  std::vector<FDRule*> _always_ready_rules {};
+  std::unique_ptr<IoUring> _uring {};
+  std::unordered_map<uint64_t, FDRule*> _uring_polls {}; //!< armed poll requests, by id
+  uint64_t _next_uring_poll = 1;
+
+  //! Timers (see add_timer), with deadlines in nanoseconds since _timer_epoch, and the timerfd that wakes
+  //! the loop for the earliest one (created with the first timer), with the deadline it is set for
+  TimerQueue<CallbackT> _timers {};
+  std::chrono::steady_clock::time_point _timer_epoch { std::chrono::steady_clock::now() };
+  std::optional<FileDescriptor> _timerfd {};
+  std::optional<uint64_t> _timerfd_deadline {};
+  std::shared_ptr<FDRule> _timer_rule {};
+
   std::vector<RuleCategory> _rule_categories {};
   std::list<std::shared_ptr<FDRule>> _fd_rules {};
   std::list<std::shared_ptr<BasicRule>> _non_fd_rules {};
 
+  //! The fd rules that have changed since the last wait: those cancelled (by RuleHandle::cancel, or by the
+  //! loop after an error or hangup), and those whose interest() is to be called again (new rules, rules just
+  //! served, and rules marked by RuleHandle::interest_changed). With InterestCheck::WhenChanged, no other rule
+  //! is looked at before a wait.
+  std::vector<std::shared_ptr<FDRule>> _cancelled_rules {};
+  std::vector<std::shared_ptr<FDRule>> _dirty_rules {};
+  std::vector<std::shared_ptr<FDRule>> _updating_rules {}; //!< (the batch update_rules is working through)
+  size_t _interested_rules {};                              //!< fd rules whose interest() last returned true
+
+  //! Scratch space for each wait
+  std::vector<pollfd> _pollfds {};
+  std::vector<FDRule*> _polled_rules {};
+  std::vector<std::pair<FDRule*, uint32_t>> _uring_ready {};
+
+  Result wait_poll( int timeout_ms );
+  Result wait_epoll( int timeout_ms );
+  Result wait_uring( int timeout_ms );
+
+  void mark_dirty( FDRule& rule );
+  void mark_cancelled( FDRule& rule );
+  void update_rules();
+  void remove_rule( FDRule& rule );
+  bool handle_events( FDRule& rule, uint32_t revents );
+  void report_error( const FDRule& rule ) const;
+  void serve( FDRule& rule );
+  void serve_ready( FDRule& rule );
+  void update_epoll( FDRule& rule );
+  void remove_from_epoll( FDRule& rule );
+  void update_uring( FDRule& rule );
+  void remove_from_uring( FDRule& rule );
+  io_uring_sqe& next_uring_sqe();
+  void arm_timerfd();
+  void fire_timers();
+
 public:
-  EventLoop() { _rule_categories.reserve( 64 ); }
+  explicit EventLoop( Backend backend = Backend::Epoll,
+                      Dispatch dispatch = Dispatch::OneRule,
+                      InterestCheck interest_check = InterestCheck::EveryWait );
 
-  //! Returned by each call to EventLoop::wait_next_event.
-  enum class Result : uint8_t
-  {
-    Success, //!< At least one Rule was triggered.
-    Timeout, //!< No rules were triggered before timeout.
-    Exit     //!< All rules have been canceled or were uninterested; make no further calls to
-             //!< EventLoop::wait_next_event.
-  };
+  //! With Dispatch::AllReady, the most callbacks a rule on a non-blocking fd gets per call to wait_next_event
+  //! (while it stays interested), so that one busy fd can't starve the others. Rules on blocking fds get one.
+  void set_rule_budget( size_t callbacks );
+
+  const Stats& stats() const { return _stats; }
+
+  //! The backend in use (Backend::Poll if Backend::IoUring was asked for but io_uring is unavailable)
+  Backend backend() const { return _backend; }
 
   size_t add_category( const std::string& name );
 
   class RuleHandle
   {
     std::weak_ptr<BasicRule> rule_weak_ptr_;
+    EventLoop* loop_; //!< (for an fd rule: a non-fd rule's interest is checked on every call anyway)
 
   public:
     template<class RuleType>
-    explicit RuleHandle( const std::shared_ptr<RuleType>& x ) : rule_weak_ptr_( x )
+    explicit RuleHandle( const std::shared_ptr<RuleType>& x, EventLoop* loop = nullptr )
+      : rule_weak_ptr_( x ), loop_( loop )
     {}
 
+    ~RuleHandle() = default;
+    RuleHandle( const RuleHandle& other ) = default;
+    RuleHandle& operator=( const RuleHandle& other ) = default;
+    RuleHandle( RuleHandle&& other ) noexcept = default;
+    RuleHandle& operator=( RuleHandle&& other ) noexcept = default;
+
     void cancel();
+
+    //! The rule's interest function may now return something else: call it again before the next wait
+    //! (needed only with InterestCheck::WhenChanged)
+    void interest_changed();
   };
 
+  //! Call `callback` whenever `fd` is ready for `direction` while `interest` returns true. The rule is cancelled
+  //! (calling `cancel`) once fd reaches EOF (Direction::In), is closed or hangs up, and after `error` if fd has
+  //! an error. With InterestCheck::WhenChanged (and Backend::Epoll or Backend::IoUring), the EventLoop calls
+  //! `interest` only when the rule is added, after each of the rule's callbacks, and after
+  //! RuleHandle::interest_changed(): whenever anything else may change what `interest` returns (another
+  //! rule's callback, say), or closes fd, call RuleHandle::interest_changed().
   RuleHandle add_rule(
     size_t category_id,
     FileDescriptor& fd,
@@ -93,7 +249,20 @@ public:
   RuleHandle
   add_rule( size_t category_id, const CallbackT& callback, const InterestT& interest = [] { return true; } );
 
-  //! Calls [poll(2)](\ref man2::poll) and then executes callback for each ready fd.
+  using TimerId = TimerQueue<CallbackT>::TimerId;
+
+  //! Call `callback` once, as soon as `deadline` has passed (from the call to wait_next_event that is waiting
+  //! then). A pending timer keeps wait_next_event from returning Result::Exit. The timers share one
+  //! [timerfd](\ref man2::timerfd_create), set for the earliest deadline, so they work with every backend
+  //! and fire to within the kernel's timer slack (well under a millisecond).
+  TimerId add_timer( std::chrono::steady_clock::time_point deadline, const CallbackT& callback );
+
+  //! Stop a timer. Returns false if it has already fired, or been cancelled.
+  bool cancel_timer( TimerId id );
+
+  //! Waits (with [epoll_wait(2)](\ref man2::epoll_wait), [poll(2)](\ref man2::poll) or
+  //! [io_uring_enter(2)](\ref man2::io_uring_enter)) for a rule's fd to be ready and then executes its
+  //! callback (or, with Dispatch::AllReady, the callbacks of every ready rule).
   Result wait_next_event( int timeout_ms );
 
   // convenience function to add category and rule at the same time
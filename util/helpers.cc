@@ -1,11 +1,38 @@
 #include "helpers.hh"
 #include "arp_message.hh"
+#include "file_descriptor.hh"
 #include "ipv4_datagram.hh"
+#include "tcp_segment.hh"
 
 #include <iomanip>
 
 using namespace std;
 
+bool read_datagram( FileDescriptor& fd, optional<InternetDatagram>& dgram )
+{
+  static thread_local vector<string> strs( DATAGRAM_BUFFER_CAPACITIES.size() );
+  for ( size_t i = 0; i < strs.size(); ++i ) {
+    strs[i] = PacketPool::take( DATAGRAM_BUFFER_CAPACITIES[i] );
+  }
+  strs[0].resize( IPv4Header::LENGTH );
+  strs[1].resize( TCPSegment::HEADER_LENGTH );
+  strs[2].resize( DATAGRAM_BUFFER_CAPACITIES[2] );
+  fd.read( strs );
+
+  if ( strs[0].empty() ) { // nothing to read
+    for ( auto& str : strs ) {
+      PacketPool::give( std::move( str ) );
+    }
+    return false;
+  }
+
+  dgram.emplace();
+  if ( not parse( *dgram, std::move( strs ) ) ) {
+    dgram.reset();
+  }
+  return true;
+}
+
 string pretty_print( string_view str, size_t max_length )
 {
   ostringstream ss;
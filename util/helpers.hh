@@ -2,10 +2,12 @@
 
 #include "ethernet_frame.hh"
 #include "ipv4_datagram.hh"
+#include "packet_pool.hh"
 #include "parser.hh"
-#include "ref.hh"
 
+#include <array>
 #include <numeric>
+#include <optional>
 #include <ranges>
 #include <string>
 #include <vector>
@@ -13,7 +15,7 @@
 // Helper to serialize any object (without constructing a Serializer of the caller's own)
 // example: ```ethernet_frame.payload = serialize( internet_datagram );```
 template<class T>
-std::vector<Ref<std::string>> serialize( const T& obj )
+BufferChain serialize( const T& obj )
 {
   Serializer s;
   obj.serialize( s );
@@ -36,6 +38,16 @@ template<class T, typename... Targs>
   return not p.has_error();
 }
 
+class FileDescriptor;
+
+// The buffers read_datagram() reads a datagram into: its IPv4 header, its TCP header and the rest
+inline constexpr std::array<size_t, 3> DATAGRAM_BUFFER_CAPACITIES
+  = { PacketPool::HEADER_CAPACITY, PacketPool::HEADER_CAPACITY, PacketPool::JUMBO_CAPACITY };
+
+// Read an IPv4 datagram from `fd` into buffers from the PacketPool (they go back to it once the datagram is
+// released). Returns false if there was nothing to read; otherwise `dgram` holds the datagram, if it parsed.
+bool read_datagram( FileDescriptor& fd, std::optional<InternetDatagram>& dgram );
+
 // Concatenate a sequence of buffers into one string
 std::string concat( std::ranges::range auto&& r )
 {
@@ -52,15 +64,13 @@ std::string pretty_print( std::string_view str, size_t max_length = 32 );
 // Summarize an Ethernet frame into a string
 std::string summary( const EthernetFrame& frame );
 
-// Explicitly copy ("clone") a frame or datagram
+// Explicitly copy ("clone") a frame or datagram (the payload's storage is shared, not copied)
 inline EthernetFrame clone( const EthernetFrame& x )
 {
-  auto duplicate_payload = x.payload | std::views::transform( []( auto& i ) { return i.get(); } );
-  return { .header = x.header, .payload = { duplicate_payload.begin(), duplicate_payload.end() } };
+  return { .header = x.header, .payload = x.payload };
 }
 
 inline InternetDatagram clone( const InternetDatagram& x )
 {
-  auto duplicate_payload = x.payload | std::views::transform( []( auto& i ) { return i.get(); } );
-  return { x.header, { duplicate_payload.begin(), duplicate_payload.end() } };
+  return { x.header, x.payload, x.parsed_header };
 }
@@ -0,0 +1,67 @@
+#include "icmp_message.hh"
+#include "checksum.hh"
+
+#include <sstream>
+
+using namespace std;
+
+bool ICMPMessage::is_error( const uint8_t type )
+{
+  return type == TYPE_DESTINATION_UNREACHABLE or type == TYPE_SOURCE_QUENCH or type == TYPE_REDIRECT
+         or type == TYPE_TIME_EXCEEDED or type == TYPE_PARAMETER_PROBLEM;
+}
+
+string ICMPMessage::to_string() const
+{
+  stringstream ss {};
+  string type_str = "(type " + ::to_string( type ) + ")";
+  if ( type == TYPE_DESTINATION_UNREACHABLE ) {
+    type_str = "DESTINATION UNREACHABLE";
+  }
+  if ( type == TYPE_TIME_EXCEEDED ) {
+    type_str = "TIME EXCEEDED";
+  }
+  ss << "ICMP " << type_str << " code=" << static_cast<int>( code ) << " data=" << data.total_size() << " bytes";
+  return ss.str();
+}
+
+void ICMPMessage::compute_checksum()
+{
+  cksum = 0;
+  Serializer s;
+  serialize( s );
+
+  InternetChecksum check;
+  check.add( s.finish() );
+  cksum = check.value();
+}
+
+void ICMPMessage::parse( Parser& parser )
+{
+  parser.integer( type );
+  parser.integer( code );
+  parser.integer( cksum );
+  parser.integer( rest );
+  parser.all_remaining( data );
+
+  if ( parser.has_error() ) {
+    return;
+  }
+
+  // Verify checksum
+  const uint16_t given_cksum = cksum;
+  compute_checksum();
+  if ( cksum != given_cksum ) {
+    parser.set_error();
+  }
+}
+
+// Serialize the ICMPMessage (does not recompute the checksum)
+void ICMPMessage::serialize( Serializer& serializer ) const
+{
+  serializer.integer( type );
+  serializer.integer( code );
+  serializer.integer( cksum );
+  serializer.integer( rest );
+  serializer.buffer( data );
+}
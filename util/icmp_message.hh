@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ipv4_datagram.hh"
+#include "parser.hh"
+
+#include <string>
+
+// [ICMP](\ref rfc::rfc792) error message (e.g. Destination Unreachable or Time Exceeded)
+struct ICMPMessage
+{
+  static constexpr size_t HEADER_LENGTH = 8;         // ICMP header length in bytes
+  static constexpr size_t QUOTED_PAYLOAD_LENGTH = 8; // bytes of the offending datagram's payload to quote
+
+  static constexpr uint8_t TYPE_DESTINATION_UNREACHABLE = 3;
+  static constexpr uint8_t TYPE_SOURCE_QUENCH = 4;
+  static constexpr uint8_t TYPE_REDIRECT = 5;
+  static constexpr uint8_t TYPE_TIME_EXCEEDED = 11;
+  static constexpr uint8_t TYPE_PARAMETER_PROBLEM = 12;
+
+  static constexpr uint8_t CODE_NETWORK_UNREACHABLE = 0; // (Destination Unreachable)
+  static constexpr uint8_t CODE_TTL_EXCEEDED = 0;        // (Time Exceeded)
+
+  uint8_t type {};
+  uint8_t code {};
+  uint16_t cksum {};
+  uint32_t rest {};    // rest of the header (unused by Destination Unreachable and Time Exceeded)
+  BufferChain data {}; // the offending datagram's header and the first bytes of its payload
+
+  // Is this type of message an error (which must never provoke another error message)?
+  static bool is_error( uint8_t type );
+
+  // Return a string containing the ICMP message in human-readable format
+  std::string to_string() const;
+
+  void compute_checksum();
+
+  void parse( Parser& parser );
+  void serialize( Serializer& serializer ) const;
+};
@@ -0,0 +1,204 @@
+#include "io_uring.hh"
+
+#include "exception.hh"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+int io_uring_setup( const unsigned entries, io_uring_params* params )
+{
+  return static_cast<int>( syscall( __NR_io_uring_setup, entries, params ) );
+}
+
+int io_uring_enter( const int fd,
+                    const unsigned to_submit,
+                    const unsigned min_complete,
+                    const unsigned flags,
+                    const void* arg,
+                    const size_t arg_size )
+{
+  return static_cast<int>( syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size ) );
+}
+
+int io_uring_register( const int fd, const unsigned opcode, const void* arg, const unsigned nr_args )
+{
+  return static_cast<int>( syscall( __NR_io_uring_register, fd, opcode, arg, nr_args ) );
+}
+
+template<typename T>
+T* at_offset( void* base, const uint32_t offset )
+{
+  return reinterpret_cast<T*>( static_cast<char*>( base ) + offset ); // NOLINT(*-reinterpret-cast)
+}
+} // namespace
+
+unsigned IoUring::load_acquire( const unsigned* p )
+{
+  return atomic_ref<const unsigned> { *p }.load( memory_order_acquire );
+}
+
+void IoUring::store_release( unsigned* p, const unsigned value )
+{
+  atomic_ref<unsigned> { *p }.store( value, memory_order_release );
+}
+
+IoUring::IoUring( const unsigned entries )
+{
+  // Ask the kernel not to interrupt the thread to run io_uring's work (which would otherwise make a later
+  // poll() or epoll_wait() fail with EINTR -- e.g., after a ring with armed requests is closed). Older kernels
+  // (before Linux 5.19) don't know the flag.
+  io_uring_params params {};
+  params.flags = IORING_SETUP_COOP_TASKRUN;
+  fd_ = io_uring_setup( entries, &params );
+  if ( fd_ < 0 and errno == EINVAL ) {
+    params = {};
+    fd_ = io_uring_setup( entries, &params );
+  }
+  CheckSystemCall( "io_uring_setup", fd_ );
+  sq_entries_ = params.sq_entries;
+  features_ = params.features;
+
+  if ( not( features_ & IORING_FEAT_EXT_ARG ) ) { // (needed for timed waits; Linux 5.11)
+    ::close( fd_ );
+    throw unix_error( "io_uring_setup (no IORING_FEAT_EXT_ARG)", ENOSYS );
+  }
+
+  // Map the two rings (in one mapping, on kernels that allow it) and the submission queue entries
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+  const bool single_mmap = features_ & IORING_FEAT_SINGLE_MMAP;
+  if ( single_mmap ) {
+    sq_ring_size_ = cq_ring_size_ = max( sq_ring_size_, cq_ring_size_ );
+  }
+
+  sq_ring_
+    = mmap( nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING );
+  cq_ring_ = single_mmap ? sq_ring_
+                         : mmap( nullptr,
+                                 cq_ring_size_,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE,
+                                 fd_,
+                                 IORING_OFF_CQ_RING );
+  sqes_size_ = params.sq_entries * sizeof( io_uring_sqe );
+  void* sqes = mmap( nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES );
+  sqes_ = static_cast<io_uring_sqe*>( sqes );
+  if ( sq_ring_ == MAP_FAILED or cq_ring_ == MAP_FAILED or sqes == MAP_FAILED ) {
+    const int error = errno;
+    release();
+    throw unix_error( "mmap (io_uring)", error );
+  }
+
+  sq_.head = at_offset<unsigned>( sq_ring_, params.sq_off.head );
+  sq_.tail = at_offset<unsigned>( sq_ring_, params.sq_off.tail );
+  sq_.ring_mask = at_offset<unsigned>( sq_ring_, params.sq_off.ring_mask );
+  sq_.array = at_offset<unsigned>( sq_ring_, params.sq_off.array );
+  cq_.head = at_offset<unsigned>( cq_ring_, params.cq_off.head );
+  cq_.tail = at_offset<unsigned>( cq_ring_, params.cq_off.tail );
+  cq_.ring_mask = at_offset<unsigned>( cq_ring_, params.cq_off.ring_mask );
+  cq_.cqes = at_offset<io_uring_cqe>( cq_ring_, params.cq_off.cqes );
+
+  sqe_tail_ = submitted_tail_ = *sq_.tail;
+}
+
+IoUring::~IoUring()
+{
+  release();
+}
+
+void IoUring::release()
+{
+  if ( sqes_ != nullptr and static_cast<void*>( sqes_ ) != MAP_FAILED ) {
+    munmap( sqes_, sqes_size_ );
+  }
+  if ( cq_ring_ != nullptr and cq_ring_ != MAP_FAILED and cq_ring_ != sq_ring_ ) {
+    munmap( cq_ring_, cq_ring_size_ );
+  }
+  if ( sq_ring_ != nullptr and sq_ring_ != MAP_FAILED ) {
+    munmap( sq_ring_, sq_ring_size_ );
+  }
+  sqes_ = nullptr;
+  cq_ring_ = sq_ring_ = nullptr;
+  if ( fd_ >= 0 and files_registered_ ) {
+    // Let go of the files now: closing the ring only releases them later, in the background, so a
+    // device (e.g. a TAP device) could otherwise still be busy when this returns
+    io_uring_register( fd_, IORING_UNREGISTER_FILES, nullptr, 0 );
+    files_registered_ = false;
+  }
+  if ( fd_ >= 0 ) {
+    ::close( fd_ );
+    fd_ = -1;
+  }
+}
+
+io_uring_sqe* IoUring::get_sqe()
+{
+  if ( sqe_tail_ - load_acquire( sq_.head ) >= sq_entries_ ) {
+    return nullptr;
+  }
+
+  const unsigned index = sqe_tail_ & *sq_.ring_mask;
+  io_uring_sqe* sqe = &sqes_[index];
+  memset( sqe, 0, sizeof( *sqe ) );
+  sq_.array[index] = index;
+  ++sqe_tail_;
+  return sqe;
+}
+
+unsigned IoUring::submit( const unsigned wait_for, const optional<int> timeout_ms )
+{
+  const unsigned to_submit = sqe_tail_ - submitted_tail_;
+  store_release( sq_.tail, sqe_tail_ );
+
+  unsigned flags = IORING_ENTER_EXT_ARG;
+  if ( wait_for > 0 ) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+
+  __kernel_timespec timeout {};
+  io_uring_getevents_arg arg {};
+  if ( timeout_ms.has_value() and *timeout_ms >= 0 ) {
+    timeout.tv_sec = *timeout_ms / 1000;
+    timeout.tv_nsec = static_cast<long long>( *timeout_ms % 1000 ) * 1'000'000;
+    arg.ts = reinterpret_cast<uint64_t>( &timeout ); // NOLINT(*-reinterpret-cast)
+  }
+
+  while ( true ) {
+    const int ret = io_uring_enter( fd_, to_submit, wait_for, flags, &arg, sizeof( arg ) );
+    if ( ret >= 0 ) {
+      submitted_tail_ += static_cast<unsigned>( ret );
+      return static_cast<unsigned>( ret );
+    }
+    if ( errno == ETIME ) { // the wait timed out (with nothing to submit)
+      return 0;
+    }
+    if ( errno == EBUSY ) { // the completion queue has overflowed: the caller must reap() first
+      return 0;
+    }
+    if ( errno != EINTR ) {
+      throw unix_error( "io_uring_enter" );
+    }
+  }
+}
+
+void IoUring::register_files( const span<const int> fds )
+{
+  CheckSystemCall(
+    "io_uring_register",
+    io_uring_register( fd_, IORING_REGISTER_FILES, fds.data(), static_cast<unsigned>( fds.size() ) ) );
+  files_registered_ = true;
+}
+
+void IoUring::register_buffers( const span<const iovec> buffers )
+{
+  CheckSystemCall(
+    "io_uring_register",
+    io_uring_register( fd_, IORING_REGISTER_BUFFERS, buffers.data(), static_cast<unsigned>( buffers.size() ) ) );
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <optional>
+#include <span>
+#include <sys/uio.h>
+
+/*
+ * A minimal [io_uring](https://man7.org/linux/man-pages/man7/io_uring.7.html), used through the raw system
+ * calls (so there is no dependency on liburing).
+ *
+ * Operations are queued with get_sqe(), which returns a zeroed submission queue entry to fill in, and many
+ * of them go to the kernel with a single submit() -- which can also wait for completions. Completions are
+ * then consumed with reap(). Files and buffers can be registered with the kernel once, so that operations
+ * on them skip the per-operation lookups ("fixed" files and buffers).
+ *
+ * The constructor throws a unix_error if io_uring is unavailable (an old kernel, or disabled by
+ * the administrator or a seccomp policy); callers fall back to ordinary system calls.
+ */
+class IoUring
+{
+public:
+  explicit IoUring( unsigned entries );
+  ~IoUring();
+
+  IoUring( const IoUring& other ) = delete;
+  IoUring& operator=( const IoUring& other ) = delete;
+  IoUring( IoUring&& other ) = delete;
+  IoUring& operator=( IoUring&& other ) = delete;
+
+  // A zeroed submission queue entry to fill in, or nullptr if the queue is full (submit() first)
+  io_uring_sqe* get_sqe();
+
+  // Hand every queued entry to the kernel, and wait until at least `wait_for` completions are ready (or
+  // `timeout_ms` passes, if given). Returns the number of entries submitted (none, without waiting, if the
+  // completion queue is too full to take more: reap() and try again).
+  unsigned submit( unsigned wait_for = 0, std::optional<int> timeout_ms = {} );
+
+  // Entries queued but not yet submitted
+  unsigned pending() const { return sqe_tail_ - submitted_tail_; }
+
+  // Consume every available completion, calling on_completion( const io_uring_cqe& ) for each
+  template<typename F>
+  unsigned reap( F&& on_completion )
+  {
+    unsigned head = *cq_.head;
+    const unsigned tail = load_acquire( cq_.tail );
+    const unsigned count = tail - head;
+    for ( ; head != tail; ++head ) {
+      on_completion( cq_.cqes[head & *cq_.ring_mask] );
+    }
+    store_release( cq_.head, head );
+    return count;
+  }
+
+  // Register files (used with IOSQE_FIXED_FILE, by index) and buffers (used by READ_FIXED and WRITE_FIXED)
+  void register_files( std::span<const int> fds );
+  void register_buffers( std::span<const iovec> buffers );
+
+  unsigned queue_size() const { return sq_entries_; }
+
+private:
+  int fd_ {};
+  unsigned sq_entries_ {};
+  uint32_t features_ {};
+  bool files_registered_ {};
+
+  struct SubmissionRing
+  {
+    unsigned* head {};
+    unsigned* tail {};
+    unsigned* ring_mask {};
+    unsigned* array {};
+  } sq_ {};
+
+  struct CompletionRing
+  {
+    unsigned* head {};
+    unsigned* tail {};
+    unsigned* ring_mask {};
+    io_uring_cqe* cqes {};
+  } cq_ {};
+
+  io_uring_sqe* sqes_ {};
+  void* sq_ring_ {};
+  size_t sq_ring_size_ {};
+  void* cq_ring_ {};
+  size_t cq_ring_size_ {};
+  size_t sqes_size_ {};
+
+  unsigned sqe_tail_ {};       // entries handed out by get_sqe()
+  unsigned submitted_tail_ {}; // entries the kernel has taken
+
+  void release(); // unmap the rings and close the io_uring
+
+  static unsigned load_acquire( const unsigned* p );
+  static void store_release( unsigned* p, unsigned value );
+};
@@ -2,29 +2,68 @@
 
 #include "ipv4_header.hh"
 #include "parser.hh"
-#include "ref.hh"
 
-#include <string>
-#include <vector>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <utility>
 
 //! \brief [IPv4](\ref rfc::rfc791) Internet datagram
 struct IPv4Datagram
 {
   IPv4Header header {};
-  std::vector<Ref<std::string>> payload {};
+  BufferChain payload {};
+
+  // The header as parsed, and its bytes (sharing the storage they arrived in). While the header is unchanged,
+  // serialize() reuses the bytes instead of writing the header out again; once a router has decremented the TTL
+  // (and so adjusted the checksum), it copies them, patching just those two fields.
+  std::optional<std::pair<IPv4Header, Buffer>> parsed_header {};
 
   void parse( Parser& parser )
   {
+    const Buffer first = parser.buffer().empty() ? Buffer {} : parser.buffer().front();
     header.parse( parser );
+    if ( not parser.has_error() and first.size() >= header.hlen * 4UL ) {
+      parsed_header.emplace( header, first.substr( 0, header.hlen * 4UL ) );
+    } else {
+      parsed_header.reset();
+    }
     parser.truncate( header.payload_length() );
     parser.all_remaining( payload );
   }
 
   void serialize( Serializer& serializer ) const
   {
-    header.serialize( serializer );
+    if ( not parsed_header.has_value() ) {
+      header.serialize( serializer );
+    } else if ( parsed_header->first == header ) {
+      serializer.buffer( parsed_header->second );
+    } else if ( only_ttl_changed() ) {
+      // (copy-on-write: other Buffers sharing the storage, such as a clone of the frame, still see the original)
+      const std::string_view bytes = parsed_header->second;
+      serializer.bytes( bytes.substr( 0, TTL_OFFSET ) );
+      serializer.integer( header.ttl );
+      serializer.integer( header.proto );
+      serializer.integer( header.cksum );
+      serializer.bytes( bytes.substr( CKSUM_OFFSET + sizeof( header.cksum ) ) );
+    } else {
+      header.serialize( serializer );
+    }
     serializer.buffer( payload );
   }
+
+private:
+  static constexpr size_t TTL_OFFSET = 8;
+  static constexpr size_t CKSUM_OFFSET = 10;
+
+  // Does the header differ from the one parsed only in its TTL and checksum?
+  bool only_ttl_changed() const
+  {
+    IPv4Header patched = parsed_header->first;
+    patched.ttl = header.ttl;
+    patched.cksum = header.cksum;
+    return patched == header;
+  }
 };
 
 using InternetDatagram = IPv4Datagram;
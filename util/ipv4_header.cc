@@ -114,6 +114,20 @@ void IPv4Header::compute_checksum()
   cksum = check.value();
 }
 
+void IPv4Header::decrement_ttl()
+{
+  // HC' = ~(~HC + ~m + m'), where m is the 16-bit word holding the TTL and protocol
+  const uint16_t old_word = ( static_cast<uint16_t>( ttl ) << 8 ) | proto;
+  --ttl;
+  const uint16_t new_word = ( static_cast<uint16_t>( ttl ) << 8 ) | proto;
+
+  uint32_t sum = static_cast<uint16_t>( ~cksum ) + static_cast<uint16_t>( ~old_word ) + new_word;
+  while ( sum > 0xffff ) {
+    sum = ( sum >> 16 ) + static_cast<uint16_t>( sum );
+  }
+  cksum = ~static_cast<uint16_t>( sum );
+}
+
 string IPv4Header::to_string() const
 {
   stringstream ss {};
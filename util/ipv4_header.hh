@@ -11,7 +11,9 @@ struct IPv4Header
 {
   static constexpr uint8_t LENGTH = 20;       // IPv4 header length, not including options
   static constexpr uint8_t DEFAULT_TTL = 128; // A reasonable default TTL value
+  static constexpr uint8_t PROTO_ICMP = 1;    // Protocol number for ICMP
   static constexpr uint8_t PROTO_TCP = 6;     // Protocol number for TCP
+  static constexpr uint8_t PROTO_UDP = 17;    // Protocol number for UDP
 
   static constexpr uint64_t serialized_length() { return LENGTH; }
 
@@ -57,9 +59,14 @@ struct IPv4Header
   // Set checksum to correct value
   void compute_checksum();
 
+  // Decrement the TTL, adjusting the checksum to match (incrementally, per RFC 1624)
+  void decrement_ttl();
+
   // Return a string containing a header in human-readable format
   std::string to_string() const;
 
   void parse( Parser& parser );
   void serialize( Serializer& serializer ) const;
+
+  bool operator==( const IPv4Header& other ) const = default;
 };
@@ -0,0 +1,120 @@
+#include "loopback_adapter.hh"
+
+#include "exception.hh"
+#include "helpers.hh"
+
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+TCPOverIPv4LoopbackAdapter::Queue::Queue( const size_t capacity, const bool notified ) : datagrams( capacity )
+{
+  if ( notified ) {
+    ready.emplace( CheckSystemCall( "eventfd", eventfd( 0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC ) ) );
+  }
+}
+
+TCPOverIPv4LoopbackAdapter::TCPOverIPv4LoopbackAdapter( const Mode mode,
+                                                        shared_ptr<Queue> inbound,
+                                                        shared_ptr<Queue> outbound )
+  : mode_( mode ), inbound_( std::move( inbound ) ), outbound_( std::move( outbound ) )
+{}
+
+TCPOverIPv4LoopbackAdapter::TCPOverIPv4LoopbackAdapter( FileDescriptor&& socket )
+  : mode_( Mode::SocketPair ), socket_( std::move( socket ) )
+{}
+
+pair<TCPOverIPv4LoopbackAdapter, TCPOverIPv4LoopbackAdapter> TCPOverIPv4LoopbackAdapter::make_pair(
+  const Mode mode,
+  const size_t capacity )
+{
+  if ( mode == Mode::SocketPair ) {
+    // (a SOCK_SEQPACKET pair keeps the datagrams' boundaries, and holds as many as fit in its buffers)
+    array<int, 2> fds {};
+    CheckSystemCall( "socketpair",
+                     ::socketpair( AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds.data() ) );
+    return { TCPOverIPv4LoopbackAdapter { FileDescriptor { fds[0] } },
+             TCPOverIPv4LoopbackAdapter { FileDescriptor { fds[1] } } };
+  }
+
+  auto a_to_b = make_shared<Queue>( capacity, mode == Mode::Notified );
+  auto b_to_a = make_shared<Queue>( capacity, mode == Mode::Notified );
+  return { TCPOverIPv4LoopbackAdapter { mode, b_to_a, a_to_b },
+           TCPOverIPv4LoopbackAdapter { mode, a_to_b, b_to_a } };
+}
+
+FileDescriptor& TCPOverIPv4LoopbackAdapter::fd()
+{
+  if ( socket_.has_value() ) {
+    return *socket_;
+  }
+  if ( not inbound_->ready.has_value() ) {
+    throw runtime_error( "TCPOverIPv4LoopbackAdapter: no fd to wait on in Mode::Memory" );
+  }
+  return *inbound_->ready;
+}
+
+optional<TCPMessage> TCPOverIPv4LoopbackAdapter::read()
+{
+  InternetDatagram ip_dgram;
+
+  if ( socket_.has_value() ) {
+    optional<InternetDatagram> dgram;
+    if ( not read_datagram( *socket_, dgram ) or not dgram.has_value() ) {
+      return {};
+    }
+    ip_dgram = std::move( *dgram );
+  } else {
+    if ( inbound_->ready.has_value() ) {
+      string counter( sizeof( uint64_t ), 0 );
+      inbound_->ready->read( counter ); // (one datagram's worth, as the eventfd is a semaphore)
+      if ( counter.empty() ) {
+        return {};
+      }
+    }
+
+    auto datagram = inbound_->datagrams.pop();
+    if ( not datagram.has_value() or not parse( ip_dgram, std::move( *datagram ) ) ) {
+      return {};
+    }
+  }
+
+  ++stats_.datagrams_read;
+  return unwrap_tcp_in_ip( std::move( ip_dgram ) );
+}
+
+void TCPOverIPv4LoopbackAdapter::write( const TCPMessage& seg )
+{
+  ++stats_.datagrams_written;
+
+  if ( socket_.has_value() ) {
+    try {
+      socket_->write( serialize( wrap_tcp_in_ip( seg ) ) );
+    } catch ( const runtime_error& ) { // (the socket's buffer is full)
+      ++stats_.datagrams_dropped;
+    }
+    return;
+  }
+
+  if ( not outbound_->datagrams.push( serialize( wrap_tcp_in_ip( seg ) ) ) ) {
+    ++stats_.datagrams_dropped;
+    return;
+  }
+  if ( outbound_->ready.has_value() ) {
+    // (written through its number: the other adapter's thread owns the FileDescriptor's counts)
+    const uint64_t one = 1;
+    CheckSystemCall( "write", static_cast<int>( ::write( outbound_->ready->fd_num(), &one, sizeof( one ) ) ) );
+  }
+}
+
+//! Specialize LossyFdAdapter to TCPOverIPv4LoopbackAdapter
+template class LossyFdAdapter<TCPOverIPv4LoopbackAdapter>;
+
+//! Specialize NetworkEmulatorAdapter to TCPOverIPv4LoopbackAdapter
+template class NetworkEmulatorAdapter<TCPOverIPv4LoopbackAdapter>;
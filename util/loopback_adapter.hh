@@ -0,0 +1,80 @@
+#pragma once
+
+#include "file_descriptor.hh"
+#include "lossy_fd_adapter.hh"
+#include "network_emulator.hh"
+#include "spsc_queue.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_segment.hh"
+#include "tuntap_adapter.hh"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+
+//! \brief A FD adapter for IPv4 datagrams carried to another adapter in the same process, without a TUN
+//! device (see make_pair()). Each TCP segment is still wrapped in an IPv4 datagram and serialized by write(),
+//! and parsed and filtered again by read(), by the same code as for TCPOverIPv4OverTunFdAdapter.
+class TCPOverIPv4LoopbackAdapter : public TCPOverIPv4Adapter
+{
+public:
+  //! How the datagrams travel between the two adapters
+  enum class Mode : uint8_t
+  {
+    Memory,     //!< through an in-memory queue each way, with no system calls (read() must be polled)
+    Notified,   //!< the same, and fd() is readable while a datagram is waiting (e.g. for a TCPMinnowSocket)
+    SocketPair, //!< through a connected pair of AF_UNIX sockets (so through the kernel)
+  };
+
+  //! Two adapters, each of which reads what the other writes. Each way holds at most `capacity` datagrams
+  //! (in Mode::SocketPair, what the socket's buffer holds); as a NIC would, write() drops any more.
+  static std::pair<TCPOverIPv4LoopbackAdapter, TCPOverIPv4LoopbackAdapter> make_pair(
+    Mode mode = Mode::Notified,
+    size_t capacity = DEFAULT_CAPACITY );
+
+  //! Attempts to read and parse an IPv4 datagram containing a TCP segment related to the current connection
+  std::optional<TCPMessage> read();
+
+  //! Creates an IPv4 datagram from a TCP segment and sends it to the other adapter
+  void write( const TCPMessage& seg );
+
+  //! Readable while a datagram is waiting (there is none in Mode::Memory)
+  FileDescriptor& fd();
+
+  struct Stats
+  {
+    uint64_t datagrams_written {};
+    uint64_t datagrams_dropped {}; //!< written while the way to the other adapter was full
+    uint64_t datagrams_read {};
+  };
+
+  const Stats& stats() const { return stats_; }
+  Mode mode() const { return mode_; }
+
+  static constexpr size_t DEFAULT_CAPACITY = 4096;
+
+private:
+  //! One way between the adapters: its datagrams, and (in Mode::Notified) an eventfd, in semaphore mode,
+  //! that counts them
+  struct Queue
+  {
+    Queue( size_t capacity, bool notified );
+
+    SPSCQueue<BufferChain> datagrams;
+    std::optional<FileDescriptor> ready {};
+  };
+
+  TCPOverIPv4LoopbackAdapter( Mode mode, std::shared_ptr<Queue> inbound, std::shared_ptr<Queue> outbound );
+  explicit TCPOverIPv4LoopbackAdapter( FileDescriptor&& socket );
+
+  Mode mode_;
+  std::shared_ptr<Queue> inbound_ {};  //!< read by this adapter (and written by the other)
+  std::shared_ptr<Queue> outbound_ {}; //!< written by this adapter (and read by the other)
+  std::optional<FileDescriptor> socket_ {};
+  Stats stats_ {};
+};
+
+static_assert( TCPDatagramAdapter<TCPOverIPv4LoopbackAdapter> );
+static_assert( TCPDatagramAdapter<LossyFdAdapter<TCPOverIPv4LoopbackAdapter>> );
+static_assert( TCPDatagramAdapter<NetworkEmulatorAdapter<TCPOverIPv4LoopbackAdapter>> );
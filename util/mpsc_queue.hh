@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+/*
+ * A bounded, lock-free queue with any number of producer threads and a single consumer thread
+ * (after Dmitry Vyukov's bounded MPMC queue). Each cell carries a sequence number that tells a
+ * producer whether the cell is free and tells the consumer whether it has been filled, so push()
+ * costs one compare-and-swap and pop() none.
+ */
+template<typename T>
+class MPSCQueue
+{
+public:
+  // capacity is rounded up to a power of two
+  explicit MPSCQueue( size_t capacity )
+    : mask_( std::bit_ceil( std::max<size_t>( capacity, 2 ) ) - 1 ), cells_( new Cell[mask_ + 1] )
+  {
+    for ( size_t i = 0; i <= mask_; ++i ) {
+      cells_[i].sequence.store( i, std::memory_order_relaxed );
+    }
+  }
+
+  // Add to the queue (from any thread). Returns false, leaving `value` untouched, if the queue is full.
+  bool push( T&& value )
+  {
+    Cell* cell {};
+    size_t pos = enqueue_pos_.load( std::memory_order_relaxed );
+    while ( true ) {
+      cell = &cells_[pos & mask_];
+      const size_t sequence = cell->sequence.load( std::memory_order_acquire );
+      const auto diff = static_cast<intptr_t>( sequence ) - static_cast<intptr_t>( pos );
+      if ( diff == 0 ) {
+        if ( enqueue_pos_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+          break;
+        }
+      } else if ( diff < 0 ) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load( std::memory_order_relaxed );
+      }
+    }
+
+    cell->value.emplace( std::move( value ) );
+    cell->sequence.store( pos + 1, std::memory_order_release );
+    return true;
+  }
+
+  // Remove from the queue (only from the consumer thread). Returns empty if the queue is empty.
+  std::optional<T> pop()
+  {
+    Cell& cell = cells_[dequeue_pos_ & mask_];
+    const size_t sequence = cell.sequence.load( std::memory_order_acquire );
+    if ( static_cast<intptr_t>( sequence ) - static_cast<intptr_t>( dequeue_pos_ + 1 ) < 0 ) {
+      return {};
+    }
+
+    std::optional<T> ret { std::move( cell.value ) };
+    cell.value.reset();
+    cell.sequence.store( dequeue_pos_ + mask_ + 1, std::memory_order_release );
+    ++dequeue_pos_;
+    return ret;
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+private:
+  struct Cell
+  {
+    std::atomic<size_t> sequence {};
+    std::optional<T> value {};
+  };
+
+  size_t mask_;
+  std::unique_ptr<Cell[]> cells_; // NOLINT(*-avoid-c-arrays)
+
+  // keep the producers' and the consumer's positions on separate cache lines
+  alignas( 64 ) std::atomic<size_t> enqueue_pos_ {};
+  alignas( 64 ) size_t dequeue_pos_ {};
+};
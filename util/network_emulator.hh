@@ -0,0 +1,211 @@
+#pragma once
+
+#include "file_descriptor.hh"
+#include "ipv4_header.hh"
+#include "tcp_config.hh"
+#include "tcp_segment.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <utility>
+#include <vector>
+
+//! The path that a NetworkEmulatorAdapter sends its datagrams over (the defaults are a perfect path)
+struct NetworkEmulatorConfig
+{
+  uint64_t delay_ms = 0;        //!< One-way propagation delay
+  uint64_t jitter_ms = 0;       //!< Each datagram is delayed by up to this much more (without reordering them)
+  uint64_t rate_bps = 0;        //!< Bottleneck bandwidth, in bits per second (0 for no bottleneck)
+  uint64_t queue_bytes = 65536; //!< The bottleneck's queue; a datagram that would overflow it is dropped
+  double reorder = 0;           //!< Probability that a datagram skips the delay, overtaking those before it
+  double duplicate = 0;         //!< Probability that a datagram is sent twice
+
+  //! \name
+  //! Gilbert-Elliott loss: a two-state Markov chain, stepped once per datagram, with a loss rate in each state.
+  //! (With the defaults, loss_good alone gives independent losses.)
+
+  //!@{
+  double good_to_bad = 0; //!< Probability of moving from the good state to the bad state
+  double bad_to_good = 1; //!< Probability of moving from the bad state back to the good state
+  double loss_good = 0;   //!< Loss probability in the good state
+  double loss_bad = 1;    //!< Loss probability in the bad state
+  //!@}
+
+  //! Seeds the emulator's own generator (std::mt19937_64, whose output the standard fixes), so the same seed,
+  //! config, writes and ticks give the same losses, delays and order on any platform
+  uint64_t seed = 0;
+};
+
+//! \brief An adapter class that sends the datagrams written to it over an emulated path, then on to an FD adapter
+//! \details The path has a propagation delay with jitter, a bottleneck link with a tail-drop queue, reordering,
+//! duplication, and Gilbert-Elliott (bursty) loss. Like the rest of minnow, it learns that time has passed
+//! from tick(), which releases the datagrams that have arrived; ms_until_next_tick() says when that will next
+//! be. Only the written direction is emulated: to emulate both, wrap the adapter at each end.
+template<typename AdapterT>
+class NetworkEmulatorAdapter
+{
+public:
+  //! Datagrams written, and what became of them
+  struct Stats
+  {
+    uint64_t datagrams_written {};
+    uint64_t datagrams_lost {};       //!< by the Gilbert-Elliott model
+    uint64_t datagrams_dropped {};    //!< because the bottleneck's queue was full
+    uint64_t datagrams_duplicated {}; //!< (each copy is then queued, delayed and delivered on its own)
+    uint64_t datagrams_reordered {};
+    uint64_t datagrams_delivered {}; //!< to the underlying adapter
+  };
+
+  NetworkEmulatorAdapter( AdapterT&& adapter, const NetworkEmulatorConfig& config )
+    : _adapter( std::move( adapter ) ), _config( config ), _rand( config.seed )
+  {}
+
+  //! Conversion to a FileDescriptor by returning the underlying AdapterT
+  FileDescriptor& fd() { return _adapter.fd(); }
+
+  //! Read from the underlying AdapterT instance (the emulated path is the one that this adapter writes to)
+  std::optional<TCPMessage> read() { return _adapter.read(); }
+
+  //! \brief Send a datagram over the emulated path
+  //! \details It reaches the underlying AdapterT now if it arrives with no delay, else at a later tick()
+  void write( const TCPMessage& seg )
+  {
+    ++_stats.datagrams_written;
+    if ( _lose() ) {
+      ++_stats.datagrams_lost;
+      return;
+    }
+
+    const bool twice = _chance( _config.duplicate );
+    _send( seg );
+    if ( twice ) {
+      ++_stats.datagrams_duplicated;
+      _send( seg );
+    }
+  }
+
+  //! Let time pass, delivering the datagrams that have arrived by now
+  void tick( const size_t ms_since_last_tick )
+  {
+    _now_us += ms_since_last_tick * 1000;
+    while ( not _in_flight.empty() and _in_flight.front().arrival_us <= _now_us ) {
+      std::ranges::pop_heap( _in_flight, Later {} );
+      _deliver( _in_flight.back().seg );
+      _in_flight.pop_back();
+    }
+    _adapter.tick( ms_since_last_tick );
+  }
+
+  //! Milliseconds until tick() next has a datagram to deliver, if any is in flight
+  std::optional<uint64_t> ms_until_next_tick() const
+  {
+    if ( _in_flight.empty() ) {
+      return {};
+    }
+    const uint64_t arrival_us = _in_flight.front().arrival_us;
+    return arrival_us <= _now_us ? 0 : ( arrival_us - _now_us + 999 ) / 1000;
+  }
+
+  const Stats& stats() const { return _stats; }
+  const NetworkEmulatorConfig& emulator_config() const { return _config; }
+
+  //! \name
+  //! Passthrough functions to the underlying AdapterT instance
+
+  void set_listening( const bool l ) { _adapter.set_listening( l ); } //!< FdAdapterBase::set_listening passthrough
+  const FdAdapterConfig& config() const { return _adapter.config(); } //!< FdAdapterBase::config passthrough
+  FdAdapterConfig& config_mut() { return _adapter.config_mut(); }     //!< FdAdapterBase::config_mut passthrough
+
+private:
+  //! A datagram on the path, with the time it arrives and the order it was sent in (to break ties)
+  struct InFlight
+  {
+    uint64_t arrival_us;
+    uint64_t order;
+    TCPMessage seg;
+  };
+
+  //! Orders the heap of InFlight datagrams so that the front is the first to arrive
+  struct Later
+  {
+    bool operator()( const InFlight& a, const InFlight& b ) const
+    {
+      return std::pair { a.arrival_us, a.order } > std::pair { b.arrival_us, b.order };
+    }
+  };
+
+  //! The underlying FD adapter
+  AdapterT _adapter;
+
+  NetworkEmulatorConfig _config;
+  std::mt19937_64 _rand;
+  Stats _stats {};
+
+  uint64_t _now_us {};          //!< The emulator's clock, as told by tick()
+  uint64_t _link_free_us {};    //!< When the bottleneck link will have sent everything queued for it
+  uint64_t _last_arrival_us {}; //!< When the last datagram that wasn't reordered arrives
+  uint64_t _next_order {};
+  bool _bad_state {};                  //!< Is the Gilbert-Elliott chain in its bad state?
+  std::vector<InFlight> _in_flight {}; //!< (a heap, by Later)
+
+  //! \returns `true` with probability `p`
+  bool _chance( const double p ) { return p > 0 and static_cast<double>( _rand() >> 11 ) * 0x1.0p-53 < p; }
+
+  //! Step the Gilbert-Elliott chain, then \returns `true` if the datagram is lost in its new state
+  bool _lose()
+  {
+    if ( _chance( _bad_state ? _config.bad_to_good : _config.good_to_bad ) ) {
+      _bad_state = not _bad_state;
+    }
+    return _chance( _bad_state ? _config.loss_bad : _config.loss_good );
+  }
+
+  //! Queue a datagram for the bottleneck, then delay it, and deliver it (now, or from a later tick)
+  void _send( const TCPMessage& seg )
+  {
+    uint64_t arrival_us = _now_us;
+
+    if ( _config.rate_bps != 0 ) {
+      const uint64_t bytes = IPv4Header::LENGTH + TCPSegment::HEADER_LENGTH + seg.sender.get().payload.size();
+      const uint64_t start_us = std::max( _now_us, _link_free_us );
+      const uint64_t queued_bytes = ( start_us - _now_us ) * _config.rate_bps / 8'000'000;
+      if ( queued_bytes + bytes > _config.queue_bytes ) {
+        ++_stats.datagrams_dropped;
+        return;
+      }
+      _link_free_us = start_us + ( bytes * 8'000'000 + _config.rate_bps - 1 ) / _config.rate_bps;
+      arrival_us = _link_free_us;
+    }
+
+    if ( _chance( _config.reorder ) ) {
+      // (it has only been reordered if it overtakes a datagram sent before it)
+      if ( arrival_us < _last_arrival_us ) {
+        ++_stats.datagrams_reordered;
+      }
+    } else {
+      arrival_us += _config.delay_ms * 1000;
+      if ( _config.jitter_ms != 0 ) {
+        arrival_us += _rand() % ( _config.jitter_ms * 1000 + 1 );
+      }
+      arrival_us = std::max( arrival_us, _last_arrival_us );
+      _last_arrival_us = arrival_us;
+    }
+
+    if ( arrival_us <= _now_us ) {
+      _deliver( seg );
+      return;
+    }
+    // (an owned copy: `seg` may borrow from a TCPSender that will have moved on)
+    TCPMessage copy { TCPSenderMessage { seg.sender.get() }, TCPReceiverMessage { seg.receiver.get() } };
+    _in_flight.push_back( { arrival_us, _next_order++, std::move( copy ) } );
+    std::ranges::push_heap( _in_flight, Later {} );
+  }
+
+  void _deliver( const TCPMessage& seg )
+  {
+    ++_stats.datagrams_delivered;
+    _adapter.write( seg );
+  }
+};
@@ -0,0 +1,164 @@
+#include "packet_pool.hh"
+
+#include <array>
+#include <vector>
+
+using namespace std;
+
+namespace {
+constexpr array<size_t, 3> size_classes
+  = { PacketPool::HEADER_CAPACITY, PacketPool::MTU_CAPACITY, PacketPool::JUMBO_CAPACITY };
+
+struct LocalPool
+{
+  array<vector<string>, size_classes.size()> strings {};
+  vector<PacketPool::Storage*> storage {};
+  PacketPool::Stats stats {};
+
+  LocalPool() = default;
+  LocalPool( const LocalPool& other ) = delete;
+  LocalPool( LocalPool&& other ) = delete;
+  LocalPool& operator=( const LocalPool& other ) = delete;
+  LocalPool& operator=( LocalPool&& other ) = delete;
+  ~LocalPool();
+};
+
+// Set once this thread's pool has been destroyed (Buffers that outlive it are freed directly)
+thread_local bool pool_destroyed = false;
+
+LocalPool::~LocalPool()
+{
+  for ( auto* s : storage ) {
+    delete s; // NOLINT(*-owning-memory)
+  }
+  pool_destroyed = true;
+}
+
+LocalPool* local_pool()
+{
+  static thread_local LocalPool pool;
+  return pool_destroyed ? nullptr : &pool;
+}
+
+// The smallest size class that can hold `capacity` bytes (or size_classes.size() if none can)
+size_t class_for_request( size_t capacity )
+{
+  size_t i = 0;
+  while ( i < size_classes.size() and size_classes.at( i ) < capacity ) {
+    ++i;
+  }
+  return i;
+}
+
+// The largest size class that a string of this capacity can serve (or size_classes.size() if none)
+size_t class_for_capacity( size_t capacity )
+{
+  if ( capacity > 2 * size_classes.back() ) {
+    return size_classes.size(); // don't let a huge string sit in the pool
+  }
+  for ( size_t i = size_classes.size(); i > 0; --i ) {
+    if ( capacity >= size_classes.at( i - 1 ) ) {
+      return i - 1;
+    }
+  }
+  return size_classes.size();
+}
+} // namespace
+
+string PacketPool::take( size_t capacity )
+{
+  LocalPool* pool = local_pool();
+  const size_t cls = class_for_request( capacity );
+
+  if ( pool and cls < size_classes.size() and not pool->strings.at( cls ).empty() ) {
+    string ret = move( pool->strings.at( cls ).back() );
+    pool->strings.at( cls ).pop_back();
+    ++pool->stats.reuses;
+    return ret;
+  }
+
+  if ( pool ) {
+    ++pool->stats.allocations;
+  }
+  string ret;
+  ret.reserve( cls < size_classes.size() ? size_classes.at( cls ) : capacity );
+  return ret;
+}
+
+void PacketPool::give( string&& str )
+{
+  LocalPool* pool = local_pool();
+  const size_t cls = class_for_capacity( str.capacity() );
+
+  if ( pool and cls < size_classes.size() and pool->strings.at( cls ).size() < MAX_CACHED ) {
+    str.clear();
+    pool->strings.at( cls ).push_back( move( str ) );
+    ++pool->stats.returns;
+  } else if ( pool ) {
+    ++pool->stats.discards;
+  }
+
+  str = string {};
+}
+
+PacketPool::Storage* PacketPool::make_storage( string&& bytes, const size_t headroom )
+{
+  LocalPool* pool = local_pool();
+  Storage* ret {};
+
+  if ( pool and not pool->storage.empty() ) {
+    ret = pool->storage.back();
+    pool->storage.pop_back();
+    ret->refs.store( 1, memory_order_relaxed );
+    ++pool->stats.reuses;
+  } else {
+    ret = new Storage; // NOLINT(*-owning-memory)
+    if ( pool ) {
+      ++pool->stats.allocations;
+    }
+  }
+
+  ret->bytes = move( bytes );
+  ret->front.store( headroom, memory_order_relaxed );
+  return ret;
+}
+
+void PacketPool::release_storage( Storage* storage )
+{
+  give( move( storage->bytes ) );
+
+  LocalPool* pool = local_pool();
+  if ( pool and pool->storage.size() < MAX_CACHED ) {
+    pool->storage.push_back( storage );
+    ++pool->stats.returns;
+    return;
+  }
+
+  if ( pool ) {
+    ++pool->stats.discards;
+  }
+  delete storage; // NOLINT(*-owning-memory)
+}
+
+PacketPool::CachedStorage PacketPool::take_cached( const size_t capacity )
+{
+  LocalPool* pool = local_pool();
+  const size_t cls = class_for_request( capacity );
+  if ( not pool or cls == size_classes.size() or pool->strings.at( cls ).empty() or pool->storage.empty() ) {
+    return {};
+  }
+
+  CachedStorage ret { pool->storage.back() };
+  pool->storage.pop_back();
+  ret->refs.store( 1, memory_order_relaxed );
+  ret->bytes = move( pool->strings.at( cls ).back() );
+  pool->strings.at( cls ).pop_back();
+  return ret;
+}
+
+const PacketPool::Stats& PacketPool::stats()
+{
+  static thread_local const Stats empty {};
+  const LocalPool* pool = local_pool();
+  return pool ? pool->stats : empty;
+}
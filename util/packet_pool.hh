@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/*
+ * A per-thread pool of packet-sized strings (and of the reference-counted storage that Buffers are built on).
+ *
+ * Strings are cached in three size classes: headers, MTU-sized packets and jumbo packets. A string returned
+ * with give() keeps its capacity, and the next take() of the same size class hands it out again, so that
+ * steady-state packet processing reuses memory instead of calling malloc and free for every packet.
+ *
+ * Each thread has its own pool, so no locking is needed. Memory freed on a different thread from the one
+ * that allocated it simply migrates to the freeing thread's pool.
+ */
+class PacketPool
+{
+public:
+  static constexpr size_t HEADER_CAPACITY = 128;  // Ethernet, IPv4 and TCP headers (and headroom)
+  static constexpr size_t HEADROOM = 64;          // room left in front of a serialized header for lower layers'
+  static constexpr size_t MTU_CAPACITY = 2048;    // a full Ethernet-sized packet
+  static constexpr size_t JUMBO_CAPACITY = 9216;  // a jumbo frame
+  static constexpr size_t MAX_CACHED = 1024;      // maximum number of cached strings per size class
+
+  struct Stats
+  {
+    uint64_t allocations {}; // requests that had to allocate new memory
+    uint64_t reuses {};      // requests served from the pool
+    uint64_t returns {};     // strings or storage returned to the pool
+    uint64_t discards {};    // strings or storage freed because they fit no size class or the pool was full
+  };
+
+  // Reference-counted storage shared by Buffers (see buffer.hh)
+  struct Storage
+  {
+    std::atomic<uint32_t> refs { 1 };
+    std::string bytes {};
+    std::atomic<uint32_t> front {}; // bytes before this offset are headroom that no Buffer has claimed
+  };
+
+  // Take an empty string with at least `capacity` bytes reserved
+  static std::string take( size_t capacity = MTU_CAPACITY );
+
+  // Give a string's memory back to the pool (leaves `str` empty)
+  static void give( std::string&& str );
+
+  // Wrap a string in new Storage (with a reference count of one), keeping its first `headroom` bytes free
+  static Storage* make_storage( std::string&& bytes, size_t headroom = 0 );
+
+  // Return Storage whose reference count has dropped to zero (and its string) to the pool
+  static void release_storage( Storage* storage );
+
+  // Storage, with an empty string of a size class in it, that has been taken out of one thread's pool to hand
+  // back to another (such as the thread that reads the packets, which otherwise never sees its memory again):
+  // when it is dropped, it goes into the pool of the thread that drops it
+  struct StorageReleaser
+  {
+    void operator()( Storage* storage ) const { release_storage( storage ); }
+  };
+  using CachedStorage = std::unique_ptr<Storage, StorageReleaser>;
+
+  // Take Storage holding an empty string with at least `capacity` bytes reserved from this thread's pool alone
+  // (empty if the pool has none cached, so it never allocates)
+  static CachedStorage take_cached( size_t capacity );
+
+  // This thread's counters
+  static const Stats& stats();
+};
@@ -1,10 +1,9 @@
 #pragma once
 
-#include "ref.hh"
+#include "buffer.hh"
 
 #include <concepts>
 #include <cstdint>
-#include <deque>
 #include <ranges>
 #include <span>
 #include <stdexcept>
@@ -14,47 +13,18 @@
 
 class Parser
 {
-  class BufferList
-  {
-    uint64_t size_ {};
-    std::deque<Ref<std::string>> buffer_ {};
-    uint64_t skip_ {};
-
-  public:
-    explicit BufferList( std::ranges::range auto&& buffers )
-      requires std::is_convertible_v<decltype( std::move( *buffers.begin() ) ), Ref<std::string>>
-    {
-      for ( auto&& x : buffers ) {
-        buffer_.emplace_back( std::move( x ) );
-        if ( buffer_.back().is_borrowed() ) {
-          throw std::runtime_error( "cannot parse borrowed string" );
-        }
-        size_ += buffer_.back()->size();
-      }
-    }
-
-    uint64_t size() const { return size_; }
-    uint64_t serialized_length() const { return size(); }
-    bool empty() const { return size_ == 0; }
-    size_t buffer_segment_count() const { return buffer_.size(); }
-
-    std::string_view peek() const;
-    void remove_prefix( uint64_t len );
-    void truncate( size_t len );
-    void dump_all( std::vector<Ref<std::string>>& out );
-    std::vector<std::string_view> buffer() const;
-  };
-
-  BufferList input_;
+  BufferChain input_;
   bool error_ {};
 
   void check_size( const size_t size )
   {
-    if ( size > input_.size() ) {
+    if ( size > input_.total_size() ) {
       error_ = true;
     }
   }
 
+  std::string_view peek() const;
+
 public:
   explicit Parser( std::ranges::range auto&& input ) : input_( std::forward<decltype( input )>( input ) ) {}
 
@@ -63,8 +33,8 @@ public:
   void remove_prefix( size_t n ) { input_.remove_prefix( n ); }
   void truncate( size_t len ) { input_.truncate( len ); }
 
-  void all_remaining( std::vector<Ref<std::string>>& out ) { input_.dump_all( out ); }
-  std::vector<std::string_view> buffer() const { return input_.buffer(); }
+  void all_remaining( BufferChain& out );
+  const BufferChain& buffer() const { return input_; }
 
   void string( std::span<char> out );
   void concatenate_all_remaining( std::string& out );
@@ -78,41 +48,75 @@ public:
     }
 
     if constexpr ( sizeof( T ) == 1 ) {
-      out = static_cast<uint8_t>( input_.peek().front() );
+      out = static_cast<uint8_t>( peek().front() );
       input_.remove_prefix( 1 );
       return;
     } else {
       out = static_cast<T>( 0 );
       for ( size_t i = 0; i < sizeof( T ); i++ ) {
         out <<= 8;
-        out |= static_cast<uint8_t>( input_.peek().front() );
+        out |= static_cast<uint8_t>( peek().front() );
         input_.remove_prefix( 1 );
       }
     }
   }
 };
 
+/*
+ * Serializes headers (with integer()) and payloads (with buffer()) into a BufferChain. The bytes of
+ * each header go into a pooled string after PacketPool::HEADROOM bytes of headroom, so that when the
+ * result becomes the payload of a lower layer, that layer's header can be written into the headroom
+ * instead of into a buffer of its own (see Buffer::with_prefix): the headers of a whole frame end up
+ * in one buffer, in front of the shared payload.
+ */
 class Serializer
 {
-  std::vector<Ref<std::string>> output_ {};
-  std::string buffer_ {};
+  BufferChain output_ {};
+  std::string buffer_ {}; // headroom, then the header bytes written so far (or empty)
 
   void flush();
+  bool join( const Buffer& buf );
+
+  void start_header()
+  {
+    if ( buffer_.empty() ) {
+      if ( buffer_.capacity() < PacketPool::HEADER_CAPACITY ) {
+        buffer_ = PacketPool::take( PacketPool::HEADER_CAPACITY );
+      }
+      // (the headroom's bytes are left as they are: only a lower layer's header will ever be seen there)
+      buffer_.resize_and_overwrite( PacketPool::HEADROOM, []( char*, size_t n ) { return n; } );
+    }
+  }
 
 public:
+  Serializer() = default;
+  Serializer( const Serializer& other ) = delete;
+  Serializer( Serializer&& other ) = delete;
+  Serializer& operator=( const Serializer& other ) = delete;
+  Serializer& operator=( Serializer&& other ) = delete;
+  ~Serializer() { PacketPool::give( std::move( buffer_ ) ); } // (kept after a header joined its payload)
+
   template<std::unsigned_integral T>
   void integer( const T val )
   {
     constexpr uint64_t len = sizeof( T );
 
+    start_header();
     for ( uint64_t i = 0; i < len; ++i ) {
       const uint8_t byte_val = val >> ( ( len - i - 1 ) * 8 );
       buffer_.push_back( byte_val );
     }
   }
 
+  // header bytes written out as they are (copied, like integer(), into the header's buffer)
+  void bytes( std::string_view str )
+  {
+    start_header();
+    buffer_.append( str );
+  }
+
   void buffer( std::string buf );
-  void buffer( Ref<std::string> buf );
-  void buffer( const std::vector<Ref<std::string>>& bufs );
-  std::vector<Ref<std::string>> finish();
+  void buffer( Buffer buf );
+  void buffer( const BufferChain& bufs );
+  BufferChain finish();
 };
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+/*
+ * A bounded, lock-free ring with one producer thread and one consumer thread. Each side owns its own
+ * position and reads the other's only when its cached copy says the ring looks full (or empty), so in
+ * the common case push() and pop() touch no cache line that the other thread is writing.
+ */
+template<typename T>
+class SPSCQueue
+{
+public:
+  // capacity is rounded up to a power of two
+  explicit SPSCQueue( size_t capacity )
+    : mask_( std::bit_ceil( std::max<size_t>( capacity, 2 ) ) - 1 ), slots_( new std::optional<T>[mask_ + 1] )
+  {}
+
+  // Add to the ring (only from the producer thread). Returns false, leaving `value` untouched, if it is full.
+  bool push( T&& value )
+  {
+    const size_t tail = tail_.load( std::memory_order_relaxed );
+    if ( tail - cached_head_ > mask_ ) {
+      cached_head_ = head_.load( std::memory_order_acquire );
+      if ( tail - cached_head_ > mask_ ) {
+        return false;
+      }
+    }
+
+    slots_[tail & mask_].emplace( std::move( value ) );
+    tail_.store( tail + 1, std::memory_order_release );
+    return true;
+  }
+
+  // Remove from the ring (only from the consumer thread). Returns empty if it is empty.
+  std::optional<T> pop()
+  {
+    const size_t head = head_.load( std::memory_order_relaxed );
+    if ( head == cached_tail_ ) {
+      cached_tail_ = tail_.load( std::memory_order_acquire );
+      if ( head == cached_tail_ ) {
+        return {};
+      }
+    }
+
+    std::optional<T>& slot = slots_[head & mask_];
+    std::optional<T> ret { std::move( slot ) };
+    slot.reset();
+    head_.store( head + 1, std::memory_order_release );
+    return ret;
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+private:
+  size_t mask_;
+  std::unique_ptr<std::optional<T>[]> slots_; // NOLINT(*-avoid-c-arrays)
+
+  // the producer's position (and its copy of the consumer's), then the consumer's, on separate cache lines
+  alignas( 64 ) std::atomic<size_t> tail_ {};
+  size_t cached_head_ {};
+  alignas( 64 ) std::atomic<size_t> head_ {};
+  size_t cached_tail_ {};
+};
@@ -2,12 +2,14 @@
 
 #include "eventloop.hh"
 #include "file_descriptor.hh"
+#include "loopback_adapter.hh"
 #include "socket.hh"
 #include "tcp_config.hh"
 #include "tcp_peer.hh"
 #include "tuntap_adapter.hh"
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <optional>
 #include <thread>
@@ -70,12 +72,28 @@ private:
   //! TCP state machine
   std::optional<TCPPeer> _tcp {};
 
-  //! eventloop that handles all the events (new inbound datagram, new outbound bytes, new inbound bytes)
-  EventLoop _eventloop {};
+  //! eventloop that handles all the events (new inbound datagram, new outbound bytes, new inbound bytes),
+  //! all of those that are ready on each wakeup
+  EventLoop _eventloop { EventLoop::Backend::Epoll, EventLoop::Dispatch::AllReady };
 
   //! Process events while specified condition is true
   void _tcp_loop( const std::function<bool()>& condition );
 
+  //! When TCPPeer was last told the time, and the timer (with its deadline) that will next tell it, as soon
+  //! as its retransmission timer or its lingering runs out -- rather than on a fixed tick
+  std::chrono::steady_clock::time_point _last_tick {};
+  std::optional<EventLoop::TimerId> _tick_timer {};
+  std::optional<std::chrono::steady_clock::time_point> _tick_deadline {};
+
+  //! Tell TCPPeer (and the adapter) how much time has passed since the last tick
+  void _tick();
+
+  //! Set the timer for the next time TCPPeer has work to do in tick()
+  void _schedule_tick();
+
+  //! An eventfd that the owner writes to wake the TCPPeer thread (which may be waiting with nothing to do)
+  FileDescriptor _wakeup;
+
   //! Main loop of TCPPeer thread
   void _tcp_main();
 
@@ -96,6 +114,9 @@ private:
 
 using TCPOverIPv4MinnowSocket = TCPMinnowSocket<TCPOverIPv4OverTunFdAdapter>;
 using LossyTCPOverIPv4MinnowSocket = TCPMinnowSocket<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>;
+using LoopbackTCPMinnowSocket = TCPMinnowSocket<TCPOverIPv4LoopbackAdapter>;
+using LossyLoopbackTCPMinnowSocket = TCPMinnowSocket<LossyFdAdapter<TCPOverIPv4LoopbackAdapter>>;
+using EmulatedLoopbackTCPMinnowSocket = TCPMinnowSocket<NetworkEmulatorAdapter<TCPOverIPv4LoopbackAdapter>>;
 
 //! \class TCPMinnowSocket
 //! This class involves the simultaneous operation of two threads.
@@ -111,7 +132,8 @@ using LossyTCPOverIPv4MinnowSocket = TCPMinnowSocket<LossyFdAdapter<TCPOverIPv4O
 //!
 //! There are a few notable differences between the TCPMinnowSocket and TCPSocket interfaces:
 //!
-//! - a TCPMinnowSocket can only accept a single connection
+//! - a TCPMinnowSocket can only accept a single connection (TCPStack::listen() accepts any number, with
+//!   a bounded SYN queue and accept queue, and SYN cookies once the SYN queue is full)
 //! - listen_and_accept() is a blocking function call that acts as both [listen(2)](\ref man2::listen)
 //!   and [accept(2)](\ref man2::accept)
 //! - if TCPMinnowSocket is destructed while a TCP connection is open, the connection is
@@ -2,45 +2,83 @@
 
 #include "exception.hh"
 
+#include <algorithm>
 #include <cstddef>
 #include <exception>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <utility>
 
-static constexpr size_t TCP_TICK_MS = 10;
-
-inline uint64_t timestamp_ms()
-{
-  static_assert( std::is_same_v<std::chrono::steady_clock::duration, std::chrono::nanoseconds> );
-
-  return std::chrono::steady_clock::now().time_since_epoch().count() / 1000000;
-}
-
 //! \param[in] condition is a function returning true if loop should continue
 template<TCPDatagramAdapter AdaptT>
 void TCPMinnowSocket<AdaptT>::_tcp_loop( const std::function<bool()>& condition )
 {
-  auto base_time = timestamp_ms();
   while ( condition() ) {
-    auto ret = _eventloop.wait_next_event( TCP_TICK_MS );
+    if ( not _tcp.has_value() ) {
+      throw std::runtime_error( "_tcp_loop entered before TCPPeer initialized" );
+    }
+
+    // sleep until there is a segment, data, or a timeout to handle (no timeout while idle)
+    _schedule_tick();
+    auto ret = _eventloop.wait_next_event( -1 );
     if ( ret == EventLoop::Result::Exit or _abort ) {
       break;
     }
 
-    if ( not _tcp.has_value() ) {
-      throw std::runtime_error( "_tcp_loop entered before TCPPeer initialized" );
-    }
+    _tick();
+  }
+}
 
-    if ( _tcp.value().active() ) {
-      const auto next_time = timestamp_ms();
-      _tcp.value().tick( next_time - base_time, [&]( const auto& x ) { _datagram_adapter.write( x ); } );
-      _datagram_adapter.tick( next_time - base_time );
-      base_time = next_time;
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_tick()
+{
+  if ( not _tcp.value().active() ) {
+    return;
+  }
+
+  // (whole milliseconds only: the rest carries over to the next tick)
+  const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now()
+                                                                              - _last_tick );
+  _last_tick += elapsed;
+  _tcp.value().tick( elapsed.count(), [&]( const auto& x ) { _datagram_adapter.write( x ); } );
+  _datagram_adapter.tick( elapsed.count() );
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_schedule_tick()
+{
+  std::optional<std::chrono::steady_clock::time_point> deadline;
+  if ( _tcp.value().active() ) {
+    if ( const auto ms = _tcp.value().ms_until_next_tick() ) {
+      deadline = _last_tick + std::chrono::milliseconds { *ms };
+    }
+  }
+  // (an adapter that holds datagrams back, such as NetworkEmulatorAdapter, needs ticks of its own)
+  if constexpr ( requires( const AdaptT& adapter ) { adapter.ms_until_next_tick(); } ) {
+    if ( const auto ms = _datagram_adapter.ms_until_next_tick() ) {
+      const auto adapter_deadline = _last_tick + std::chrono::milliseconds { *ms };
+      deadline = deadline.has_value() ? std::min( *deadline, adapter_deadline ) : adapter_deadline;
     }
   }
+
+  if ( deadline == _tick_deadline ) {
+    return;
+  }
+  if ( _tick_timer.has_value() ) {
+    _eventloop.cancel_timer( *_tick_timer );
+    _tick_timer.reset();
+  }
+  if ( deadline.has_value() ) {
+    _tick_timer = _eventloop.add_timer( *deadline, [&] {
+      _tick_timer.reset();
+      _tick_deadline.reset();
+      _tick();
+    } );
+  }
+  _tick_deadline = deadline;
 }
 
 //! \param[in] data_socket_pair is a pair of connected AF_UNIX SOCK_STREAM sockets
@@ -51,6 +89,7 @@ TCPMinnowSocket<AdaptT>::TCPMinnowSocket( std::pair<FileDescriptor, FileDescript
   : LocalStreamSocket( std::move( data_socket_pair.first ) )
   , _datagram_adapter( std::move( datagram_interface ) )
   , _thread_data( std::move( data_socket_pair.second ) )
+  , _wakeup( CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) )
 {
   _thread_data.set_blocking( false );
 }
@@ -59,6 +98,7 @@ template<TCPDatagramAdapter AdaptT>
 void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
 {
   _tcp.emplace( config );
+  _last_tick = std::chrono::steady_clock::now();
 
   // Set up the event loop
 
@@ -80,6 +120,7 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
     _datagram_adapter.fd(),
     Direction::In,
     [&] {
+      _tick(); // (so that any timer the segment starts runs from now)
       if ( auto seg = _datagram_adapter.read() ) {
         _tcp->receive( std::move( seg.value() ), [&]( const auto& x ) { _datagram_adapter.write( x ); } );
       }
@@ -99,6 +140,7 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
     _thread_data,
     Direction::In,
     [&] {
+      _tick(); // (as above)
       std::string data;
       data.resize( _tcp->outbound_writer().available_capacity() );
       _thread_data.read( data );
@@ -130,6 +172,12 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
       _tcp->outbound_writer().set_error();
     } );
 
+  const auto delivering_inbound = [this] {
+    return _tcp->inbound_reader().bytes_buffered()
+           or ( ( _tcp->inbound_reader().is_finished() or _tcp->inbound_reader().has_error() )
+                and not _inbound_shutdown );
+  };
+
   // rule 3: read from inbound buffer into pipe
   _eventloop.add_rule(
     "read bytes from inbound stream",
@@ -155,16 +203,23 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
                   << " finished " << ( inbound.has_error() ? "uncleanly.\n" : "cleanly.\n" );
       }
     },
-    [&] {
-      return _tcp->inbound_reader().bytes_buffered()
-             or ( ( _tcp->inbound_reader().is_finished() or _tcp->inbound_reader().has_error() )
-                  and not _inbound_shutdown );
-    },
+    delivering_inbound,
     [&] {},
     [&] {
       std::cerr << "DEBUG: minnow inbound stream had error.\n";
       _tcp->inbound_reader().set_error();
     } );
+
+  // rule 4: wake up (for the owner to abort the connection), while any of the other rules may still fire
+  _eventloop.add_rule(
+    "wake up",
+    _wakeup,
+    Direction::In,
+    [&] {
+      std::string counter( sizeof( uint64_t ), 0 );
+      _wakeup.read( counter );
+    },
+    [this, delivering_inbound] { return _tcp->active() or delivering_inbound(); } );
 }
 
 //! \brief Call [socketpair](\ref man2::socketpair) and return connected Unix-domain sockets of specified type
@@ -193,6 +248,8 @@ TCPMinnowSocket<AdaptT>::~TCPMinnowSocket()
       std::cerr << "Warning: unclean shutdown of TCPMinnowSocket\n";
       // force the other side to exit
       _abort.store( true );
+      const uint64_t one = 1;
+      CheckSystemCall( "write", static_cast<int>( ::write( _wakeup.fd_num(), &one, sizeof( one ) ) ) );
       _tcp_thread.join();
     }
   } catch ( const std::exception& e ) {
@@ -7,6 +7,8 @@
 #include "tcp_sender.hh"
 #include "tcp_sender_message.hh"
 
+#include <algorithm>
+#include <cstdint>
 #include <functional>
 #include <optional>
 
@@ -35,6 +37,18 @@ public:
   }
   bool has_ackno() const { return receiver_.send().ackno.has_value(); }
 
+  /* How long until tick() next has work to do: the sender's retransmission timer, or the end of lingering
+     (empty if only new data, or a new segment, can make a difference) */
+  std::optional<uint64_t> ms_until_next_tick() const
+  {
+    std::optional<uint64_t> next = sender_.ms_until_timeout();
+    const uint64_t linger_end = time_of_last_receipt_ + 10UL * cfg_.rt_timeout;
+    if ( linger_after_streams_finish_ and linger_end > cumulative_time_ ) {
+      next = std::min( next.value_or( UINT64_MAX ), linger_end - cumulative_time_ );
+    }
+    return next;
+  }
+
   /* Is the peer still active? */
   bool active() const
   {
@@ -65,7 +79,8 @@ public:
     need_send_ |= ( our_ackno.has_value() and msg.sender->seqno + 1 == our_ackno.value() );
 
     // Give incoming TCPSenderMessage to receiver.
-    receiver_.receive( std::move( msg.sender ) );
+    // (an owned message is moved, so its payload goes back to the PacketPool; a borrowed one is copied)
+    receiver_.receive( msg.sender.release() );
 
     // Give incoming TCPReceiverMessage to sender.
     sender_.receive( msg.receiver );
@@ -88,7 +103,7 @@ public:
 
 private:
   TCPConfig cfg_;
-  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.rt_timeout };
+  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.rt_timeout, cfg_.max_payload_size };
   TCPReceiver receiver_ { Reassembler { ByteStream { cfg_.recv_capacity } } };
 
   bool need_send_ {};
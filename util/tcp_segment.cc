@@ -1,6 +1,7 @@
 #include "tcp_segment.hh"
 #include "checksum.hh"
 #include "helpers.hh"
+#include "packet_pool.hh"
 #include "wrapping_integers.hh"
 
 #include <sstream>
@@ -64,13 +65,17 @@ public:
   uint32_t raw_value() const { return raw_value_; }
 };
 
-void TCPSegment::serialize( Serializer& serializer ) const
+namespace {
+void serialize_header( const TCPSegment& seg, Serializer& serializer )
 {
+  const auto& message = seg.message;
+  const auto& udinfo = seg.udinfo;
+
   serializer.integer( udinfo.src_port );
   serializer.integer( udinfo.dst_port );
   serializer.integer( Wrap32Serializable { message.sender->seqno }.raw_value() );
   serializer.integer( Wrap32Serializable { message.receiver->ackno.value_or( Wrap32 { 0 } ) }.raw_value() );
-  serializer.integer( uint8_t { ( HEADER_LENGTH >> 2 ) << 4 } ); // data offset
+  serializer.integer( uint8_t { ( TCPSegment::HEADER_LENGTH >> 2 ) << 4 } ); // data offset
   const bool reset = message.sender->RST or message.receiver->RST;
   const uint8_t flags = ( message.receiver->ackno.has_value() ? 0b0001'0000U : 0 ) | ( reset ? 0b0000'0100U : 0 )
                         | ( message.sender->SYN ? 0b0000'0010U : 0 ) | ( message.sender->FIN ? 0b0000'0001U : 0 );
@@ -78,17 +83,31 @@ void TCPSegment::serialize( Serializer& serializer ) const
   serializer.integer( message.receiver->window_size );
   serializer.integer( udinfo.cksum );
   serializer.integer( uint16_t { 0 } ); // urgent pointer
-  serializer.buffer( message.sender->payload );
+}
+} // namespace
+
+void TCPSegment::serialize( Serializer& serializer ) const
+{
+  serialize_header( *this, serializer );
+
+  // copy the payload into a pooled string (the TCPSenderMessage may not outlive the serialized segment)
+  if ( not message.sender->payload.empty() ) {
+    string payload = PacketPool::take( message.sender->payload.size() );
+    payload.assign( message.sender->payload );
+    serializer.buffer( move( payload ) );
+  }
 }
 
 void TCPSegment::compute_checksum( uint32_t datagram_layer_pseudo_checksum )
 {
   udinfo.cksum = 0;
   Serializer s;
-  serialize( s );
+  serialize_header( *this, s );
 
+  // the header has an even length, so the payload can be added separately without copying it
   InternetChecksum check { datagram_layer_pseudo_checksum };
   check.add( s.finish() );
+  check.add( message.sender.get().payload ); // (read-only: the message is usually borrowed)
   udinfo.cksum = check.value();
 }
 
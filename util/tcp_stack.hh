@@ -0,0 +1,306 @@
+#pragma once
+
+#include "address.hh"
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+#include "ipv4_datagram.hh"
+#include "mpsc_queue.hh"
+#include "packet_pool.hh"
+#include "socket.hh"
+#include "spsc_queue.hh"
+#include "tcp_config.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_peer.hh"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//! A TCP stack that serves many connections: it reads IPv4 datagrams from a single fd (e.g. a TunFD), hands
+//! each TCP segment to the TCPPeer of its connection, found by 4-tuple in a hash table, and connects each
+//! TCPPeer to the application through a socket pair, as TCPMinnowSocket does.
+//!
+//! The connections are split among one or more shards, each a thread with its own EventLoop (and timers),
+//! PacketPool and connection table, that owns every connection whose 4-tuple hashes to it. With more than
+//! one shard, a dispatcher thread reads the datagrams and steers each to its connection's shard, through a
+//! ring that only the two of them touch, as a NIC steers packets to receive queues with RSS; the shards
+//! write their segments to the fd themselves. Nothing on the path of a segment takes a lock.
+//!
+//! Any thread may connect(), listen() and accept() (see TCPStack::Listener).
+class TCPStack
+{
+public:
+  //! A connection that has been accepted: the application's end of its socket pair, and the remote peer
+  struct Accepted
+  {
+    LocalStreamSocket socket;
+    Address peer;
+  };
+
+  //! Connections to a local address: those in their handshakes (the SYN queue), and those that have finished
+  //! them, waiting to be accepted (the accept queue)
+  class Listener
+  {
+  public:
+    Listener( const Address& local_address, size_t backlog, size_t syn_backlog );
+
+    //! Wait for the next connection (one thread at a time may accept)
+    Accepted accept();
+
+    //! Readable while connections are waiting to be accepted (e.g. for an EventLoop rule that accepts)
+    FileDescriptor& fd() { return ready_; }
+
+    const Address& local_address() const { return local_address_; }
+
+    //! Stop listening: connections still completing their handshakes, and new ones, are refused
+    void close() { closed_.store( true ); }
+
+  private:
+    friend class TCPStack;
+
+    Address local_address_;
+    size_t backlog_;
+    size_t syn_backlog_;
+    MPSCQueue<Accepted> queue_;
+    FileDescriptor ready_;          // an eventfd (in semaphore mode) counting the connections in queue_
+    std::atomic<size_t> queued_ {}; // connections in queue_
+    std::atomic<bool> closed_ {};   // set by close()
+    std::atomic<size_t> handshaking_ {}; // connections in their handshakes (on any shard)
+  };
+
+  struct Stats
+  {
+    uint64_t segments_received {};
+    uint64_t segments_sent {};
+    uint64_t segments_unmatched {};   //!< received for no connection or listener (or refused)
+    uint64_t send_errors {};          //!< segments the datagram fd didn't take
+    uint64_t ring_drops {};           //!< datagrams the dispatcher dropped because their shard's ring was full
+    uint64_t syn_cookies_sent {};     //!< SYN-ACKs sent, keeping no state, because a SYN queue was full
+    uint64_t syn_cookies_accepted {}; //!< connections opened by an ACK that brought back a valid cookie
+    uint64_t connections_opened {};
+    uint64_t connections_closed {};
+  };
+
+  //! Serve the connections whose IPv4 datagrams are read from and written to `datagrams` (a TunFD, or any
+  //! fd that carries one datagram per read and write), with `num_shards` shards (e.g. one per core). Each
+  //! connection's TCPPeer uses `config`, with its own random initial sequence number.
+  explicit TCPStack( FileDescriptor&& datagrams, const TCPConfig& config = {}, size_t num_shards = 1 );
+
+  //! Stop the stack: all connections are dropped, and their sockets reach EOF
+  ~TCPStack();
+
+  //! Open a connection from `local` (with an ephemeral port, if its port is 0) to `remote`. Returns at once,
+  //! with the application's end of the connection: what is written to it is sent once the connection is
+  //! established, and it reaches EOF when the connection finishes (or fails).
+  LocalStreamSocket connect( const Address& local, const Address& remote );
+
+  //! Accept connections to `local_address` (whose IP address may be 0, for any), with at most `backlog` of
+  //! them waiting to be accepted (SYNs that arrive while that many are waiting are ignored) and at most
+  //! `syn_backlog` in their handshakes. Once that many are, the stack answers further SYNs with SYN cookies:
+  //! it keeps nothing for the connection until the client's ACK shows it received the SYN-ACK.
+  std::shared_ptr<Listener> listen( const Address& local_address,
+                                    size_t backlog = DEFAULT_BACKLOG,
+                                    size_t syn_backlog = DEFAULT_SYN_BACKLOG );
+
+  //! Number of open connections (including those in their handshakes)
+  size_t connection_count() const;
+
+  //! The shards' counters, added up
+  Stats stats() const;
+
+  size_t shard_count() const { return shards_.size(); }
+
+  static constexpr size_t DEFAULT_BACKLOG = 128;
+  static constexpr size_t DEFAULT_SYN_BACKLOG = 256;
+
+  TCPStack( const TCPStack& ) = delete;
+  TCPStack( TCPStack&& ) = delete;
+  TCPStack& operator=( const TCPStack& ) = delete;
+  TCPStack& operator=( TCPStack&& ) = delete;
+
+private:
+  //! Identifies a connection: its local and remote addresses and ports
+  struct FourTuple
+  {
+    uint32_t local_ip {};
+    uint32_t remote_ip {};
+    uint16_t local_port {};
+    uint16_t remote_port {};
+
+    bool operator==( const FourTuple& other ) const = default;
+  };
+
+  struct FourTupleHash
+  {
+    size_t operator()( const FourTuple& t ) const;
+  };
+
+  //! The stack's side of a connection
+  struct Connection
+  {
+    Connection( const FourTuple& s_key, const TCPConfig& config );
+
+    FourTuple key;
+    TCPOverIPv4Adapter adapter {}; //!< configured with the connection's addresses, to wrap its segments
+    TCPPeer peer;
+
+    //! The stack's end of the socket pair (once the connection is established, if it was accepted)
+    std::optional<LocalStreamSocket> data {};
+    std::vector<EventLoop::RuleHandle> rules {};
+    bool inbound_shutdown {};
+    bool outbound_shutdown {};
+
+    //! The Listener whose backlog the connection counts against, until it has been queued for accept()
+    std::shared_ptr<Listener> listener {};
+
+    //! As in TCPMinnowSocket: when the peer was last told the time, and the timer that will next tell it
+    std::chrono::steady_clock::time_point last_tick { std::chrono::steady_clock::now() };
+    std::optional<EventLoop::TimerId> tick_timer {};
+    std::optional<std::chrono::steady_clock::time_point> tick_deadline {};
+
+    bool closing {}; //!< finished, and waiting to be dropped
+  };
+
+  //! A thread serving the connections whose 4-tuples hash to it
+  class Shard
+  {
+  public:
+    //! Serve connections for `stack`, writing to `datagrams` (and reading from it, unless `steered`, in
+    //! which case the datagrams come from the dispatcher through steer())
+    Shard( TCPStack& stack, FileDescriptor&& datagrams, bool steered );
+
+    void start();
+    void stop();
+
+    //! From any thread: run `command` on the shard's thread
+    void run_command( std::function<void()>&& command );
+
+    //! From the dispatcher: queue a datagram for the shard (returns false if its ring is full). The shard
+    //! doesn't look at its ring until wake() is called.
+    bool steer( InternetDatagram&& dgram ) { return steered_.push( std::move( dgram ) ); }
+    void wake();
+
+    //! From the dispatcher: take back (into the dispatcher's PacketPool) up to `count` of the buffers it read
+    //! the datagrams it steered to the shard into, which the shard hands back once it has received them
+    void reclaim_buffers( size_t count );
+
+    size_t connection_count() const { return connection_count_.load( std::memory_order_relaxed ); }
+    void add_stats( Stats& total ) const;
+
+    //! Open a connection from `key` (picking another ephemeral port, and handing the connection to
+    //! that port's shard, if `pick_port` and the port is taken)
+    void connect( FourTuple key, std::shared_ptr<LocalStreamSocket> data, bool pick_port, size_t attempts );
+
+    void listen( const std::shared_ptr<Listener>& listener );
+
+  private:
+    //! Counters written only by the shard's thread (so it bumps them without atomic read-modify-writes),
+    //! and read by stats()
+    struct Counters
+    {
+      std::atomic<uint64_t> segments_received {};
+      std::atomic<uint64_t> segments_sent {};
+      std::atomic<uint64_t> segments_unmatched {};
+      std::atomic<uint64_t> send_errors {};
+      std::atomic<uint64_t> connections_opened {};
+      std::atomic<uint64_t> connections_closed {};
+      std::atomic<uint64_t> syn_cookies_sent {};
+      std::atomic<uint64_t> syn_cookies_accepted {};
+    };
+
+    TCPStack& stack_;
+    FileDescriptor datagrams_;
+    EventLoop loop_ { // (update() marks a connection's rules whenever anything happens to it)
+      EventLoop::Backend::Epoll, EventLoop::Dispatch::AllReady, EventLoop::InterestCheck::WhenChanged };
+    size_t push_category_;
+    size_t deliver_category_;
+
+    std::unordered_map<FourTuple, std::unique_ptr<Connection>, FourTupleHash> connections_ {};
+    std::vector<FourTuple> closing_ {}; //!< finished connections, dropped before the next wait
+    std::unordered_map<uint64_t, std::shared_ptr<Listener>> listeners_ {}; //!< by IP address and port
+
+    //! Work handed to the shard by other threads, datagrams steered to it by the dispatcher (and the packet
+    //! memory handed back to it in return), and an eventfd to wake it for either
+    static constexpr size_t COMMAND_QUEUE_CAPACITY = 1024;
+    static constexpr size_t STEERED_QUEUE_CAPACITY = 4096;
+    MPSCQueue<std::function<void()>> commands_ { COMMAND_QUEUE_CAPACITY };
+    SPSCQueue<InternetDatagram> steered_ { STEERED_QUEUE_CAPACITY };
+    SPSCQueue<PacketPool::CachedStorage> returned_ { 3 * STEERED_QUEUE_CAPACITY };
+    FileDescriptor wakeup_;
+
+    std::atomic<size_t> connection_count_ {};
+    Counters counters_ {};
+    std::default_random_engine random_;
+    TCPOverIPv4Adapter cookie_adapter_ {}; //!< wraps the SYN-ACKs that carry cookies, for connections not kept
+
+    void main_loop();
+
+    void receive_datagrams();
+    void receive_datagram( InternetDatagram&& dgram );
+    void return_buffers();
+    void receive( const FourTuple& key, TCPMessage&& msg );
+    void accept_syn( const FourTuple& key, TCPMessage&& msg );
+    void send_syn_cookie( const FourTuple& key, const TCPSenderMessage& syn );
+    bool accept_syn_cookie( const FourTuple& key, TCPMessage& msg, const std::shared_ptr<Listener>& listener );
+    Connection& open( const FourTuple& key, std::optional<Wrap32> isn = {} );
+    void attach( Connection& conn, LocalStreamSocket&& socket );
+    void transmit( Connection& conn, const TCPMessage& msg );
+    void transmit( TCPOverIPv4Adapter& adapter, const TCPMessage& msg );
+    void tick( Connection& conn );
+    void update( Connection& conn );
+    void schedule_tick( Connection& conn );
+    void close( Connection& conn );
+
+    static bool delivering_inbound( Connection& conn );
+    static uint64_t listener_key( uint32_t ip, uint16_t port ) { return ( uint64_t { ip } << 16U ) | port; }
+
+    std::thread thread_ {};
+  };
+
+  TCPConfig config_;
+  FileDescriptor datagrams_; //!< read by the dispatcher (with one shard, the shard has it instead)
+  std::vector<std::unique_ptr<Shard>> shards_ {};
+  std::atomic<bool> stopping_ {};
+
+  //! The next ephemeral port to try (shared by all threads that connect)
+  std::atomic<uint16_t> next_ephemeral_port_;
+
+  //! The secret that SYN cookies are made with
+  std::array<uint64_t, 2> cookie_key_ {};
+
+  //! The dispatcher: its EventLoop, an eventfd to wake it to stop, and the datagrams it dropped
+  EventLoop dispatch_loop_ {
+    EventLoop::Backend::Epoll, EventLoop::Dispatch::AllReady, EventLoop::InterestCheck::WhenChanged };
+  FileDescriptor dispatch_wakeup_;
+  std::atomic<uint64_t> ring_drops_ {};
+  std::vector<bool> woken_ {}; //!< the shards that the current burst steered datagrams to
+  std::thread dispatcher_ {};
+
+  Shard& shard_of( const FourTuple& key ) { return *shards_[steering_index( key, shards_.size() )]; }
+  uint16_t ephemeral_port();
+
+  //! The SYN cookie (the ISN of a SYN-ACK) for a connection whose client chose `client_isn`, made in the
+  //! `period`th period of SYN_COOKIE_PERIOD; cookies are good in the period they were made in and the next
+  uint32_t syn_cookie( const FourTuple& key, uint32_t client_isn, uint64_t period ) const;
+  bool check_syn_cookie( const FourTuple& key, uint32_t client_isn, uint32_t cookie ) const;
+  static uint64_t syn_cookie_period();
+  static constexpr std::chrono::seconds SYN_COOKIE_PERIOD { 64 };
+  void dispatch_datagrams();
+  void dispatch_loop();
+
+  //! The shard (of `num_shards`) that serves a connection: the top bits of the Toeplitz hash (as computed by
+  //! NICs for RSS, with the usual key) of its remote address, local address, remote port and local port --
+  //! the source and destination of the segments it receives
+  static size_t steering_index( const FourTuple& key, size_t num_shards );
+  static uint32_t toeplitz_hash( const FourTuple& key );
+
+  static std::pair<LocalStreamSocket, LocalStreamSocket> socket_pair();
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+/*
+ * A set of timers with absolute deadlines (in ms, or in whatever unit the owner's clock counts), each
+ * carrying a value of type T. Like the rest of minnow, it learns that time has passed from advance(). The
+ * timers are kept in a binary min-heap that knows where each timer sits, so scheduling and cancelling cost
+ * O(log n) and advancing the clock costs O(log n) per timer that expires -- timers that are not yet due are
+ * never touched.
+ */
+template<typename T>
+class TimerQueue
+{
+public:
+  // Identifies a scheduled timer. An id stays invalid after its timer expires or is cancelled.
+  using TimerId = uint64_t;
+
+  // The current time
+  uint64_t now() const { return now_; }
+
+  // Start a timer that expires at `deadline` (or on the next advance(), if the deadline has passed)
+  TimerId schedule_at( const uint64_t deadline, T value )
+  {
+    uint32_t slot {};
+    if ( free_slots_.empty() ) {
+      slot = slots_.size();
+      slots_.emplace_back();
+    } else {
+      slot = free_slots_.back();
+      free_slots_.pop_back();
+    }
+
+    heap_.push_back( { deadline, slot, std::move( value ) } );
+    slots_[slot].position = heap_.size() - 1;
+    sift_up( heap_.size() - 1 );
+    return id_of( slot );
+  }
+
+  // Start a timer that expires `delay` ms from now
+  TimerId schedule_after( const uint64_t delay, T value ) { return schedule_at( now_ + delay, std::move( value ) ); }
+
+  // Stop a timer. Returns false if it had already expired or been cancelled.
+  bool cancel( const TimerId id )
+  {
+    const auto slot = live_slot( id );
+    if ( not slot.has_value() ) {
+      return false;
+    }
+    remove_at( slots_[*slot].position );
+    return true;
+  }
+
+  // The deadline of a timer that has not yet expired (or empty if it has, or was cancelled)
+  std::optional<uint64_t> deadline( const TimerId id ) const
+  {
+    const auto slot = live_slot( id );
+    if ( not slot.has_value() ) {
+      return {};
+    }
+    return heap_[slots_[*slot].position].deadline;
+  }
+
+  // The earliest deadline of any timer (or empty if there are none)
+  std::optional<uint64_t> next_deadline() const
+  {
+    if ( heap_.empty() ) {
+      return {};
+    }
+    return heap_.front().deadline;
+  }
+
+  // Move the clock forward by `ms`, and call on_expire( T&& ) for each timer that is now due, earliest
+  // first. on_expire may schedule and cancel timers (a timer it schedules for no later than the new time
+  // will also expire during this call).
+  template<typename F>
+  void advance( const uint64_t ms, F&& on_expire )
+  {
+    now_ += ms;
+    while ( not heap_.empty() and heap_.front().deadline <= now_ ) {
+      T value { std::move( heap_.front().value ) };
+      remove_at( 0 );
+      on_expire( std::move( value ) );
+    }
+  }
+
+  size_t size() const { return heap_.size(); }
+  bool empty() const { return heap_.empty(); }
+
+private:
+  struct Timer
+  {
+    uint64_t deadline;
+    uint32_t slot;
+    T value;
+  };
+
+  // Where each timer is in the heap; slots are reused, and the generation tells the timers that
+  // have used a slot apart
+  struct Slot
+  {
+    size_t position {};
+    uint32_t generation {};
+    bool live {};
+  };
+
+  uint64_t now_ {};
+  std::vector<Timer> heap_ {};
+  std::vector<Slot> slots_ {};
+  std::vector<uint32_t> free_slots_ {};
+
+  TimerId id_of( const uint32_t slot )
+  {
+    slots_[slot].live = true;
+    return ( static_cast<uint64_t>( slots_[slot].generation ) << 32 ) | slot;
+  }
+
+  std::optional<uint32_t> live_slot( const TimerId id ) const
+  {
+    const auto slot = static_cast<uint32_t>( id );
+    if ( slot >= slots_.size() or not slots_[slot].live or slots_[slot].generation != ( id >> 32 ) ) {
+      return {};
+    }
+    return slot;
+  }
+
+  void remove_at( const size_t position )
+  {
+    const uint32_t slot = heap_[position].slot;
+    slots_[slot].live = false;
+    ++slots_[slot].generation;
+    free_slots_.push_back( slot );
+
+    if ( position != heap_.size() - 1 ) {
+      move_to( std::move( heap_.back() ), position );
+      heap_.pop_back();
+      sift_down( sift_up( position ) );
+    } else {
+      heap_.pop_back();
+    }
+  }
+
+  void move_to( Timer&& timer, const size_t position )
+  {
+    slots_[timer.slot].position = position;
+    heap_[position] = std::move( timer );
+  }
+
+  size_t sift_up( size_t position )
+  {
+    Timer timer { std::move( heap_[position] ) };
+    while ( position > 0 ) {
+      const size_t parent = ( position - 1 ) / 2;
+      if ( heap_[parent].deadline <= timer.deadline ) {
+        break;
+      }
+      move_to( std::move( heap_[parent] ), position );
+      position = parent;
+    }
+    move_to( std::move( timer ), position );
+    return position;
+  }
+
+  void sift_down( size_t position )
+  {
+    Timer timer { std::move( heap_[position] ) };
+    while ( true ) {
+      size_t child = 2 * position + 1;
+      if ( child >= heap_.size() ) {
+        break;
+      }
+      if ( child + 1 < heap_.size() and heap_[child + 1].deadline < heap_[child].deadline ) {
+        ++child;
+      }
+      if ( timer.deadline <= heap_[child].deadline ) {
+        break;
+      }
+      move_to( std::move( heap_[child] ), position );
+      position = child;
+    }
+    move_to( std::move( timer ), position );
+  }
+};
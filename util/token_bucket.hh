@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// A token bucket rate limiter: on average, take() succeeds at most `rate` times per second, with bursts
+// of up to `burst` at once. Like the rest of minnow, it learns that time has passed from tick().
+// take() may be called from any thread; tick() and set_rate() from one thread at a time.
+class TokenBucket
+{
+public:
+  TokenBucket( uint64_t rate, uint64_t burst ) { set_rate( rate, burst ); }
+
+  // Change the rate (and refill the bucket)
+  void set_rate( uint64_t rate, uint64_t burst )
+  {
+    rate_ = rate;
+    capacity_ = burst * TOKEN;
+    millitokens_.store( capacity_, std::memory_order_relaxed );
+  }
+
+  // Take one token, if there is one
+  bool take()
+  {
+    uint64_t current = millitokens_.load( std::memory_order_relaxed );
+    while ( current >= TOKEN ) {
+      if ( millitokens_.compare_exchange_weak( current, current - TOKEN, std::memory_order_relaxed ) ) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Add the tokens earned since the last tick
+  void tick( size_t ms_since_last_tick )
+  {
+    uint64_t current = millitokens_.load( std::memory_order_relaxed );
+    while ( not millitokens_.compare_exchange_weak(
+      current, std::min( capacity_, current + rate_ * ms_since_last_tick ), std::memory_order_relaxed ) ) {}
+  }
+
+private:
+  static constexpr uint64_t TOKEN = 1000; // the bucket counts thousandths of a token, earned per millisecond
+
+  uint64_t rate_ {};
+  uint64_t capacity_ {};
+  std::atomic<uint64_t> millitokens_ {};
+};
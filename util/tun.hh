@@ -10,7 +10,13 @@ class TunTapFD : public FileDescriptor
 public:
   //! Open an existing persistent [TUN or TAP
   //! device](https://www.kernel.org/doc/Documentation/networking/tuntap.txt).
-  explicit TunTapFD( const std::string& devname, bool is_tun );
+  //! With `multi_queue`, each TunTapFD opened on the device is a separate queue (IFF_MULTI_QUEUE).
+  explicit TunTapFD( const std::string& devname, bool is_tun, bool multi_queue = false );
+
+  //! Count a read or write done on the fd by other means (e.g. through an io_uring), as an EventLoop
+  //! checks these counts to tell that a rule's callback used its fd.
+  using FileDescriptor::register_read;
+  using FileDescriptor::register_write;
 };
 
 //! A FileDescriptor to a [Linux TUN](https://www.kernel.org/doc/Documentation/networking/tuntap.txt) device
@@ -26,5 +32,8 @@ class TapFD : public TunTapFD
 {
 public:
   //! Open an existing persistent [TAP device](https://www.kernel.org/doc/Documentation/networking/tuntap.txt).
-  explicit TapFD( const std::string& devname ) : TunTapFD( devname, false ) {}
+  //! With `multi_queue`, open one queue of a device created with `multi_queue`.
+  explicit TapFD( const std::string& devname, const bool multi_queue = false )
+    : TunTapFD( devname, false, multi_queue )
+  {}
 };
@@ -5,14 +5,9 @@ using namespace std;
 
 optional<TCPMessage> TCPOverIPv4OverTunFdAdapter::read()
 {
-  vector<string> strs( 3 );
-  strs[0].resize( IPv4Header::LENGTH );
-  strs[1].resize( TCPSegment::HEADER_LENGTH );
-  _tun.read( strs );
-
-  InternetDatagram ip_dgram;
-  if ( parse( ip_dgram, move( strs ) ) ) {
-    return unwrap_tcp_in_ip( move( ip_dgram ) );
+  optional<InternetDatagram> ip_dgram;
+  if ( read_datagram( _tun, ip_dgram ) and ip_dgram.has_value() ) {
+    return unwrap_tcp_in_ip( move( *ip_dgram ) );
   }
   return {};
 }